@@ -0,0 +1,124 @@
+#ifndef AGGREGATE_H
+#define AGGREGATE_H
+
+#include "arena.h"
+#include "schema.h"
+#include "sort.h"
+#include "sql_parser.h"
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Groups that do not fit the memory budget are spilled, by hash, to this
+// many partition files and aggregated one partition at a time afterwards
+#define AGGREGATE_SPILL_PARTITIONS 8
+// Each level partitions on the next hash bits; past the last one the
+// table is allowed to outgrow the budget
+#define AGGREGATE_MAX_SPILL_LEVELS 4
+
+typedef struct
+{
+  SqlAggregateFunc function; // SQL_AGG_NONE for a GROUP BY column
+  int column;                // -1 for COUNT(*)
+  SortKey value;             // Where the column sits in a row
+  // A GROUP BY column's offset in the group key, or an aggregate's offset
+  // in the group state
+  uint32_t offset;
+  char name[MAX_COLUMN_NAME + 8]; // Output header, e.g. "sum(age)"
+} AggregateOutput;
+
+typedef struct
+{
+  AggregateOutput outputs[MAX_COLUMNS];
+  uint32_t num_outputs;
+  SortKey group_keys[MAX_COLUMNS];
+  uint32_t num_group_keys;
+  uint32_t key_size;   // Bytes of a group key: the GROUP BY columns
+  uint32_t group_size; // Key plus every aggregate's state
+  uint32_t row_size;
+  bool count_only;     // Nothing but COUNT(*) and no GROUP BY
+} AggregateSpec;
+
+typedef enum
+{
+  AGGREGATE_VALUE_NULL, // SUM, AVG, MIN or MAX over no rows
+  AGGREGATE_VALUE_INT,
+  AGGREGATE_VALUE_FLOAT,
+  AGGREGATE_VALUE_COLUMN // Raw column bytes, formatted like the column
+} AggregateValueKind;
+
+typedef struct
+{
+  AggregateValueKind kind;
+  int64_t int_value;
+  double float_value;
+  const uint8_t *bytes;
+} AggregateValue;
+
+// Open-addressing hash table slot. The group lives in the arena.
+typedef struct
+{
+  uint64_t hash;
+  uint8_t *group; // NULL for an empty slot
+} AggregateSlot;
+
+// Rows waiting to be aggregated after the current table is output
+typedef struct
+{
+  FILE *file;
+  uint32_t level;
+} AggregatePartition;
+
+typedef struct
+{
+  AggregateSpec spec;
+  size_t memory_budget;
+  pthread_mutex_t lock; // Parallel scan workers add rows concurrently
+
+  Arena arena;
+  AggregateSlot *slots;
+  uint32_t capacity; // Power of two
+  uint32_t num_groups;
+  uint8_t *key;      // Scratch key being looked up
+
+  // Spilling: rows of groups that are not in the table while it is full
+  uint32_t level;
+  FILE *spill[AGGREGATE_SPILL_PARTITIONS];
+  AggregatePartition *pending;
+  uint32_t num_pending;
+
+  uint32_t next_slot; // Output position in the table
+
+  // For EXPLAIN ANALYZE
+  uint64_t rows_in;
+  uint64_t rows_spilled;
+  uint32_t partitions_spilled;
+} Aggregator;
+
+// Resolve the select list and GROUP BY. Returns false and fills error if a
+// column does not exist, a plain column is not grouped on, or an aggregate
+// does not apply to its column's type.
+bool aggregate_spec_build(TableDef *table_def, char **columns,
+                          const SqlAggregateFunc *functions,
+                          uint32_t num_columns,
+                          char (*group_by)[MAX_COLUMN_NAME],
+                          uint32_t num_group_by, AggregateSpec *spec,
+                          char *error, size_t error_size);
+
+void aggregator_init(Aggregator *aggregator, const AggregateSpec *spec,
+                     size_t memory_budget);
+// Fold a deserialized row into its group; safe to call from several threads
+void aggregator_add(Aggregator *aggregator, const uint8_t *row);
+// COUNT(*) fast path: the single group counts rows it was never shown
+void aggregator_add_count(Aggregator *aggregator, uint64_t rows);
+// No more rows
+void aggregator_finish(Aggregator *aggregator);
+// Next finished group, or NULL. Spilled partitions are aggregated as the
+// output reaches them, so the group stays valid until the next call.
+const uint8_t *aggregator_next(Aggregator *aggregator);
+void aggregator_value(const AggregateSpec *spec, const uint8_t *group,
+                      uint32_t output, AggregateValue *value);
+void aggregator_free(Aggregator *aggregator);
+
+#endif
@@ -0,0 +1,30 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Bump allocator for many small objects that are all freed together
+#define ARENA_BLOCK_SIZE (64 * 1024)
+
+typedef struct ArenaBlock
+{
+  struct ArenaBlock *next;
+  size_t used;
+  size_t size;
+  uint8_t data[];
+} ArenaBlock;
+
+typedef struct
+{
+  ArenaBlock *blocks; // Newest first
+  size_t allocated;   // Bytes held in blocks, for memory budgets
+} Arena;
+
+void arena_init(Arena *arena);
+// Zeroed memory aligned for any scalar type
+void *arena_alloc(Arena *arena, size_t size);
+// Release every allocation at once
+void arena_free(Arena *arena);
+
+#endif
@@ -0,0 +1,104 @@
+#ifndef BITMAP_INDEX_H
+#define BITMAP_INDEX_H
+
+#include "roaring.h"
+#include "schema.h"
+#include "sql_parser.h"
+#include "table.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+// A secondary index for columns with few distinct values, for CREATE
+// INDEX ... USING BITMAP: one compressed bitmap of row ids per value.
+// Conditions on several bitmap-indexed columns combine with AND, OR and
+// != into one bitmap before any row is read, and COUNT(*) of such a WHERE
+// clause is the bitmap's cardinality.
+//
+// Values are stored as the WHERE clause compares them (strings lowered),
+// and INSERT, UPDATE and DELETE keep the bitmaps current, so a bitmap
+// answers its conditions exactly. The file holds the values and their
+// serialized bitmaps; the table cache handle keeps them decoded while it
+// is open, and writes change only the decoded bitmaps. They are written
+// back to the pages once, when the handle closes.
+
+// Widest value, a lowered STRING(255) with its terminator
+#define BITMAP_INDEX_MAX_KEY 256
+
+typedef struct
+{
+  uint32_t key_size;
+  uint8_t key[BITMAP_INDEX_MAX_KEY];
+  RoaringBitmap rows;
+} BitmapIndexValue;
+
+struct BitmapIndex
+{
+  BitmapIndexValue *values;
+  uint32_t num_values;
+  uint32_t capacity;
+  bool dirty; // Changed since it was loaded or saved
+};
+
+// Column types a bitmap index can be built on: the ones whose equality is
+// exact (not FLOAT or BLOB)
+bool bitmap_index_supports(ColumnType type);
+
+// Scan the table into a fresh bitmap index file
+bool bitmap_index_build(Table *table, TableDef *table_def, IndexDef *index_def,
+                        Table *index_table);
+
+// The decoded index of an open index file, or NULL if the file does not
+// hold a valid bitmap index
+BitmapIndex *bitmap_index_get(Table *index_table);
+// Save the decoded index if writes changed it, before the file's pages are
+// flushed on closing it
+void bitmap_index_flush(Table *index_table);
+// Free the decoded index, on closing the file
+void bitmap_index_unload(Table *index_table);
+// Start the file over as an empty decoded index, for a build
+void bitmap_index_reset(Table *index_table);
+// Write the decoded index back to the file's pages. If it no longer fits,
+// the file is marked invalid so no query trusts it.
+bool bitmap_index_save(Table *index_table);
+
+// True if any index of the table is a bitmap index
+bool bitmap_index_any(const TableDef *table_def);
+
+// After a write: move the row's id from the bitmap of its old value to the
+// one of its new value in the decoded index of an open index file, which
+// bitmap_index_flush writes out. old_row is NULL for an insert, new_row for
+// a delete. False if the file holds no valid index.
+bool bitmap_index_apply(TableDef *table_def, IndexDef *index_def,
+                        Table *index_table, DynamicRow *old_row,
+                        DynamicRow *new_row);
+
+// A WHERE condition answered by bitmap indexes
+typedef struct BitmapExpr
+{
+  SqlExprType type;
+  // SQL_EXPR_COMPARE: column = value, or column != value if negate
+  IndexDef *index;
+  bool negate;
+  uint32_t key_size;
+  uint8_t key[BITMAP_INDEX_MAX_KEY];
+  char *literal; // For EXPLAIN
+  // SQL_EXPR_AND / SQL_EXPR_OR
+  struct BitmapExpr *left;
+  struct BitmapExpr *right;
+} BitmapExpr;
+
+// The condition as bitmap operations, or NULL unless every comparison in
+// it is = or != on a bitmap-indexed column. A partial index is only used
+// if where, the whole WHERE clause, implies its condition.
+BitmapExpr *bitmap_expr_compile(const SqlExpr *expr, TableDef *table_def,
+                                const SqlExpr *where);
+// left AND right, taking both
+BitmapExpr *bitmap_expr_and(BitmapExpr *left, BitmapExpr *right);
+// Bitmap lookups the condition makes
+uint32_t bitmap_expr_lookups(const BitmapExpr *expr);
+// The matching row ids. False if an index file cannot be read.
+bool bitmap_expr_eval(const BitmapExpr *expr, RoaringBitmap *out);
+void bitmap_expr_format(const BitmapExpr *expr, char *buffer, size_t size);
+void bitmap_expr_free(BitmapExpr *expr);
+
+#endif
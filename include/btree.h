@@ -74,51 +74,98 @@ typedef enum
   NODE_INTERNAL,
   NODE_LEAF
 } NodeType;
+
+typedef enum
+{
+  BTREE_INSERT_SUCCESS,
+  BTREE_INSERT_DUPLICATE
+} BtreeInsertResult;
 // Function declarations
 uint32_t *node_parent(void *node);
-void update_internal_node_key(void *node, uint32_t old_key, uint32_t new_key);
-void internal_node_insert(Table *table, uint32_t parent_page_num, uint32_t child_page_num);
-uint32_t internal_node_find_child(void *node, uint32_t key);
+// Bytes in each key of this node. Kept in the bits of the root flag byte
+// above the flag itself; zero there means the original 4-byte keys, so
+// files from before wider keys read unchanged.
+uint32_t node_key_size(void *node);
+void set_node_key_size(void *node, uint32_t key_size);
+uint32_t internal_node_find_child(const KeyDesc *key_desc, void *node, const void *key);
 
 /*** Leaf Node start ***/
 void initialize_leaf_node(void *node);
 uint32_t *leaf_node_num_cells(void *node);
 void *leaf_node_cell(void *node, uint32_t cell_num);
+// Key bytes of a cell. Only a KEY_UINT32 tree can read them as the integer.
 uint32_t *leaf_node_key(void *node, uint32_t cell_num);
 void *leaf_node_value(void *node, uint32_t cell_num);
 uint32_t *leaf_node_value_size(void *node, uint32_t cell_num);
 uint32_t leaf_node_cell_size(void *node, uint32_t cell_num);
+// Key and value size in front of each value of this leaf
+uint32_t leaf_node_cell_header_size(void *node);
 void *leaf_node_next_cell(void *node, uint32_t cell_num);
-void leaf_node_insert(Cursor *cursor, uint32_t key, DynamicRow *row, TableDef *table_def);
+void leaf_node_insert(Cursor *cursor, const void *key, DynamicRow *row, TableDef *table_def);
+// Replace the value of the cell under the cursor. A value of the same size is
+// overwritten in place; any other size shifts the cells after it, and the
+// leaf is split if the new value no longer fits.
+void leaf_node_update(Cursor *cursor, DynamicRow *row, TableDef *table_def);
+// The table_* functions taking a uint32_t key are for KEY_UINT32 trees
+// (every index, and tables keyed on one INT column); the _key variants take
+// a key encoded as table->key describes.
 Cursor *table_find(Table *table, uint32_t key);
-Cursor *leaf_node_find(Table *table, uint32_t page_num, uint32_t key);
-void leaf_node_split_and_insert(Cursor *cursor, uint32_t key, DynamicRow *row, TableDef *table_def);
+Cursor *table_find_key(Table *table, const void *key);
+// Position at the first cell whose key is >= key
+Cursor *table_seek(Table *table, uint32_t key);
+Cursor *table_seek_key(Table *table, const void *key);
+// The same, always descending the tree: the table's hot index belongs to
+// the session's thread, so other threads seek this way
+Cursor *table_seek_key_direct(Table *table, const void *key);
+// Position at the last cell whose key is <= key, for reverse scans
+Cursor *table_seek_last(Table *table, uint32_t key);
+Cursor *table_seek_last_key(Table *table, const void *key);
+// Rows in the table, summed from leaf cell counts without reading a cell
+uint32_t table_count_rows(Table *table);
+// Descend with latch coupling; the returned cursor holds the leaf in leaf_mode
+Cursor *table_find_latched(Table *table, const void *key, LatchMode leaf_mode);
+// Thread-safe insert: optimistic descent, restarts exclusively only to split
+BtreeInsertResult table_insert(Table *table, uint32_t key, DynamicRow *row, TableDef *table_def);
+BtreeInsertResult table_insert_key(Table *table, const void *key, DynamicRow *row,
+                                   TableDef *table_def);
+// Remove the rows with these keys, given in ascending order and packed
+// table->key.size bytes apart. Each leaf is compacted once for all of its
+// keys, then underfull nodes are merged with or refilled from a sibling and
+// emptied pages go back to the pager. Returns the number of rows removed.
+uint32_t table_delete_keys(Table *table, const void *keys, uint32_t num_keys);
+bool leaf_node_needs_split(void *node, uint32_t value_size);
+Cursor *leaf_node_find(Table *table, uint32_t page_num, const void *key);
+void leaf_node_split_and_insert(Cursor *cursor, const void *key, DynamicRow *row, TableDef *table_def);
 uint32_t *leaf_node_next_leaf(void *node);
 /*** Leaf Node end ***/
 
 NodeType get_node_type(void *node);
 void set_node_type(void *node, NodeType type);
 uint32_t get_unused_page_num(Pager *pager);
-uint32_t get_node_max_key(Pager *pager, void *node);
+// Largest key under node, pointing into the rightmost leaf
+void *get_node_max_key(Pager *pager, void *node);
 
 /*** Internal Node start ***/
 uint32_t *internal_node_num_keys(void *node);
 uint32_t *internal_node_right_child(void *node);
 void *internal_node_cell(void *node, uint32_t cell_num);
+uint32_t internal_node_cell_size(void *node);
 uint32_t *internal_node_child(void *node, uint32_t child_num);
 uint32_t *internal_node_key(void *node, uint32_t key_num);
 void initialize_internal_node(void *node);
-Cursor *internal_node_find(Table *table, uint32_t page_num, uint32_t key);
+Cursor *internal_node_find(Table *table, uint32_t page_num, const void *key);
+Cursor *internal_node_find_latched(Table *table, uint32_t page_num, const void *key,
+                                   LatchMode leaf_mode);
 /*** Internal Node end ***/
 
 /*** Root Node start ***/
 bool is_node_root(void *node);
 void set_node_root(void *node, bool is_root);
-void create_root_node(Table *table, uint32_t right_child_page_num);
 /*** Root Node end ***/
 
-// Add print_tree function declaration so it's visible to command_processor.c
-void print_tree(Pager *pager, uint32_t page_num, uint32_t indentation_level);
+// Print the tree's pages and keys; table_def names the columns of a
+// composite key, and may be NULL
+void print_tree(Table *table, TableDef *table_def, uint32_t page_num);
 void indent(uint32_t level);
 
 #endif
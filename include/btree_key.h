@@ -0,0 +1,66 @@
+#ifndef BTREE_KEY_H
+#define BTREE_KEY_H
+
+#include "db_types.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Widest key a node cell holds, and the most columns a primary key spans
+#define BTREE_MAX_KEY_SIZE 64
+#define MAX_KEY_COLUMNS 4
+
+typedef enum
+{
+  KEY_UINT32, // A 4-byte unsigned integer, the layout of every older tree
+  KEY_INT64,  // A signed 64-bit integer, for a BIGINT or TIMESTAMP key
+  KEY_BYTES   // Key columns encoded so memcmp order is key order
+} KeyType;
+
+// How a tree's keys are stored and compared. Every node of a tree records
+// the key size in its header; the type comes from the table definition.
+typedef struct
+{
+  KeyType type;
+  uint32_t size;
+} KeyDesc;
+
+#define KEY_DESC_DEFAULT ((KeyDesc){KEY_UINT32, sizeof(uint32_t)})
+
+int key_compare(const KeyDesc *desc, const void *a, const void *b);
+
+// Integer searches narrow the range with a branch-free binary search down
+// to this many keys, then compare all of those at once
+#define KEY_SEARCH_WINDOW 16
+
+// Index of the first of n keys (in ascending order) that is >= key. The
+// comparison is picked once per call, and the search itself moves a base
+// pointer with a conditional select rather than branching on each probe.
+uint32_t key_lower_bound(const KeyDesc *desc, const uint8_t *const *keys,
+                         uint32_t n, const void *key);
+
+// The same over integer keys packed in an array
+uint32_t key_search_u32(const uint32_t *keys, uint32_t n, uint32_t key);
+uint32_t key_search_i64(const int64_t *keys, uint32_t n, int64_t key);
+
+// Name of the window kernel chosen at startup ("avx2", "sse4.2", "sse2" or
+// "scalar")
+const char *key_search_isa();
+
+// The key of an integer for a KEY_UINT32 or KEY_INT64 tree
+void key_from_int(const KeyDesc *desc, int64_t value, void *key);
+// The integer of a KEY_UINT32 or KEY_INT64 key
+int64_t key_to_int(const KeyDesc *desc, const void *key);
+// The smallest possible key
+void key_min(const KeyDesc *desc, void *key);
+
+// Work out table_def->key from its key columns. False with error filled if
+// a column cannot be part of a key or the key is too wide.
+bool key_desc_build(TableDef *table_def, char *error, size_t error_size);
+// Encode the key of a row
+void key_from_row(TableDef *table_def, DynamicRow *row, void *key);
+// The key as text: the integer, or the key columns as (a, b)
+void key_format(TableDef *table_def, const KeyDesc *desc, const void *key,
+                char *buffer, size_t size);
+
+#endif
@@ -11,17 +11,26 @@ struct Catalog
     uint32_t num_tables;
     TableDef tables[MAX_TABLES];
     uint32_t active_table; // Add this field if it's not there
+    uint32_t version;      // Moved on by every save, so cached plans see DDL;
+                           // not stored
 };
 
 // Initialize catalog
 void catalog_init(Catalog *catalog);
 
 // Add a table definition to the catalog
-bool catalog_add_table(Catalog *catalog, const char *name, ColumnDef *columns, uint32_t num_columns);
+bool catalog_add_table(Catalog *catalog, const char *name, ColumnDef *columns, uint32_t num_columns,
+                       const uint32_t *key_columns, uint32_t num_key_columns);
 
 // Find a table by name
 int catalog_find_table(Catalog *catalog, const char *name);
 
+// Find a column of a table by name (case-insensitive), -1 if missing
+int table_def_find_column(TableDef *table_def, const char *name);
+
+// Whether a column is part of the table's primary key
+bool table_def_is_key_column(TableDef *table_def, uint32_t column_idx);
+
 // Set active table by name
 bool catalog_set_active_table(Catalog *catalog, const char *name);
 
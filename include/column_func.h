@@ -0,0 +1,65 @@
+#ifndef COLUMN_FUNC_H
+#define COLUMN_FUNC_H
+
+#include "db_types.h"
+#include "schema.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Functions of one column that a WHERE clause can compare and an index can
+// be keyed on:
+//
+//   lower(c), upper(c)       a STRING column
+//   substr(c, start[, len])  a STRING column, start counting from 1
+//   date(c)                  the day of a TIMESTAMP or BIGINT holding
+//                            seconds since the epoch (c / 86400, rounded
+//                            down); a DATE column as it is
+//   cast(c as int)           a STRING (as atoi reads it), FLOAT
+//                            (truncated), BOOLEAN or integer column
+//
+// Text results are kept lowered, because string comparisons ignore case;
+// lower(c) and upper(c) therefore compare, and index, alike. Numeric
+// results compare as integers.
+
+typedef struct
+{
+  bool is_text;
+  int64_t number;
+  uint32_t length;
+  char text[MAX_COLUMN_SIZE]; // Lowered and terminated
+} ColumnFuncValue;
+
+// The function a name calls (lower, upper, substr, date or cast), false if
+// it is none of them
+bool column_func_lookup(const char *name, ColumnFuncType *type);
+
+// True if the function can be applied to a column of the type
+bool column_func_supports(const ColumnFunc *func, ColumnType type);
+
+bool column_func_equal(const ColumnFunc *a, const ColumnFunc *b);
+
+// True for the functions that keep a string's value up to case: none,
+// lower and upper. Equality on any of them is the same comparison.
+bool column_func_case_only(const ColumnFunc *func, ColumnType type);
+
+// Apply the function to a column value in a row's bytes
+void column_func_eval(const ColumnFunc *func, ColumnType type,
+                      const uint8_t *value, ColumnFuncValue *out);
+
+// A literal converted to the kind of value the function returns
+void column_func_literal(const ColumnFunc *func, const char *literal,
+                         ColumnFuncValue *out);
+
+// <0, 0 or >0 as a orders before, with or after b, both of one kind
+int column_func_compare(const ColumnFuncValue *a, const ColumnFuncValue *b);
+
+// The bytes index entries are keyed on: the lowered text, or the number as
+// an INT. Returns their size; key holds MAX_COLUMN_SIZE bytes.
+uint32_t column_func_key(const ColumnFuncValue *value, uint8_t *key);
+
+// "lower(email)", or just the column name for COLUMN_FUNC_NONE
+void column_func_format(const ColumnFunc *func, const char *column,
+                        char *buffer, size_t size);
+
+#endif
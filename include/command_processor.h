@@ -7,6 +7,7 @@
 #include "table.h"
 #include "catalog.h"
 #include "database.h"
+#include "sql_parser.h"
 
 typedef enum
 {
@@ -60,7 +61,13 @@ typedef enum
   // Add new statement types for authentication
   STATEMENT_LOGIN,
   STATEMENT_LOGOUT,
-  STATEMENT_CREATE_USER
+  STATEMENT_CREATE_USER,
+  // Prepared statements
+  STATEMENT_PREPARE,
+  STATEMENT_EXECUTE,
+  STATEMENT_DEALLOCATE,
+  // Planner statistics
+  STATEMENT_ANALYZE
 } StatementType;
 
 typedef struct
@@ -68,17 +75,18 @@ typedef struct
   StatementType type;
   Row row_to_insert;
   uint32_t id_to_select;
-  uint32_t id_to_update;
-  uint32_t id_to_delete;
 
-  // Fields for update operation
-  char column_to_update[MAX_COLUMN_NAME];
-  char update_value[COLUMN_EMAIL_SIZE]; // Using email size as it's larger
+  // Fields for update operation: SET assignments with placeholders bound,
+  // freed by execute_update. The rows to update are those where_expr matches.
+  SqlAssignment *assignments;
+  uint32_t num_assignments;
 
   // New fields for table operations
   char table_name[MAX_TABLE_NAME];
   ColumnDef columns[MAX_COLUMNS];
   uint32_t num_columns;
+  uint32_t key_columns[MAX_KEY_COLUMNS]; // PRIMARY KEY (...), if given
+  uint32_t num_key_columns;
 
   // New fields for variable-column insert values
   char **values;
@@ -96,15 +104,41 @@ typedef struct
   char where_column[MAX_COLUMN_NAME];
   char where_value[COLUMN_EMAIL_SIZE];
   bool has_where_clause;
+  char table_alias[MAX_TABLE_NAME]; // FROM table alias
+  bool has_join;       // FROM table JOIN join ON ...
+  SqlJoin join;
+  SqlExpr *where_expr; // Bound WHERE tree, freed by the executor
+  SqlOrderBy *order_by; // ORDER BY keys, freed by execute_filtered_select
+  uint32_t num_order_by;
+  bool has_aggregates;  // Aggregate calls or GROUP BY
+  SqlAggregateFunc *select_functions; // Per selected column, with aggregates
+  char (*group_by)[MAX_COLUMN_NAME];
+  uint32_t num_group_by;
+  bool has_limit;       // LIMIT n: stop after limit rows
+  uint32_t limit;
+  uint32_t offset;      // OFFSET m: skip the first m rows
+  bool explain;        // Print the query plan instead of running the query
+  bool explain_analyze; // Run the query, then report per-operator profile
+  // EXECUTE: the prepared statement's access path, reused by the planner
+  struct PlanChoice *plan_choice;
 
   // Fields for index operations
   char index_name[MAX_INDEX_NAME];
+  IndexType index_type; // CREATE INDEX ... USING HASH | BTREE
+  char include_columns[MAX_INDEX_INCLUDE][MAX_COLUMN_NAME]; // ... INCLUDE (a, b)
+  uint32_t num_include_columns;
+  bool index_online; // ... ONLINE: build in the background, see online_index.h
+  char index_predicate[MAX_INDEX_PREDICATE]; // ... WHERE cond: a partial index
+  ColumnFunc index_expr; // ... (lower(column)): an expression index
   bool use_index; // Flag to indicate if an index should be used for queries
 
   // Authentication fields
   char auth_username[64];
   char auth_password[64];
   UserRole auth_role;
+
+  // Parsed PREPARE / EXECUTE / DEALLOCATE, consumed by execute_statement
+  SqlStatement *sql;
 } Statement;
 
 void free_columns_to_select(Statement *statement);
@@ -114,7 +148,7 @@ MetaCommandResult do_meta_command(Input_Buffer *buf, Database *db);
 // Prepare statement functions
 PrepareResult prepare_statement(Input_Buffer *buf, Statement *statement);
 PrepareResult prepare_insert(Input_Buffer *buf, Statement *statement);
-PrepareResult prepare_select(Input_Buffer *buf, Statement *statement);
+PrepareResult prepare_sql_statement(Input_Buffer *buf, Statement *statement);
 PrepareResult prepare_create_table(Input_Buffer *buf, Statement *statement);
 PrepareResult prepare_use_table(Input_Buffer *buf, Statement *statement);
 PrepareResult prepare_show_tables(Input_Buffer *buf, Statement *statement);
@@ -124,6 +158,7 @@ PrepareResult prepare_database_statement(Input_Buffer *buf, Statement *statement
 
 // Execute statement functions
 ExecuteResult execute_statement(Statement *statement, Database *db);
+ExecuteResult execute_prepared_statement(Statement *statement, Database *db);
 ExecuteResult execute_insert(Statement *statement, Table *table);
 ExecuteResult execute_select(Statement *statement, Table *table);
 ExecuteResult execute_filtered_select(Statement *statement, Table *table);
@@ -141,6 +176,8 @@ ExecuteResult execute_create_index(Statement *statement, Database *db);
 // Add these declarations
 PrepareResult prepare_show_indexes(Input_Buffer *buf, Statement *statement);
 ExecuteResult execute_show_indexes(Statement *statement, Database *db);
+// Collect planner statistics for the active table
+ExecuteResult execute_analyze(Statement *statement, Database *db);
 // Utility functions
 void print_constants();
 
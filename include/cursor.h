@@ -2,6 +2,7 @@
 #define CURSOR_H
 
 #include "db_types.h" // Include common type definitions
+#include "pager.h"
 #include <stdint.h>
 #include <stdbool.h>
 
@@ -11,6 +12,7 @@ struct Cursor
    uint32_t page_num;
    uint32_t cell_num;
    bool end_of_table;
+   LatchMode latch; // latch held on page_num (and the tree latch) until cursor_close
 };
 
 Cursor *table_start(Table *table);
@@ -18,4 +20,8 @@ Cursor *table_start(Table *table);
 // instead we use method that searches for the given key defined in btree.h
 void *cursor_value(Cursor *cursor);
 void cursor_advance(Cursor *cursor);
+// Step back one cell; sets end_of_table when moving before the first row
+void cursor_retreat(Cursor *cursor);
+// Release any latches held by the cursor and free it
+void cursor_close(Cursor *cursor);
 #endif // CURSOR_H
\ No newline at end of file
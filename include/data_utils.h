@@ -1,6 +1,7 @@
 #ifndef DATA_UTILS_H
 #define DATA_UTILS_H
 
+#include "schema.h"
 #include <stdint.h>
 #include <stdbool.h>
 #include <time.h>
@@ -70,4 +71,14 @@ bool parse_time(const char* str, Time* time);
 // Parse timestamp from string (YYYY-MM-DD HH:MM:SS)
 bool parse_timestamp(const char* str, Timestamp* ts);
 
+// The value a DATE, TIME or TIMESTAMP column stores for a literal: days
+// since 1970-01-01, seconds since midnight or seconds since the epoch. The
+// literal is either that number or YYYY-MM-DD, HH:MM:SS or
+// YYYY-MM-DD[ HH:MM:SS] respectively. False if it is neither.
+bool parse_temporal_literal(ColumnType type, const char* str, int64_t* value);
+
+// The integer a WHERE literal compares as against a column of the type:
+// the temporal forms above for DATE, TIME and TIMESTAMP, else atoll
+int64_t integer_literal_value(ColumnType type, const char* str);
+
 #endif // DATA_UTILS_H
@@ -7,6 +7,7 @@
 #include "schema.h"
 #include "transaction.h"
 #include "auth.h"  // Add this include
+#include "sql_parser.h"
 
 #define MAX_OPEN_INDEXES 16
 
@@ -34,6 +35,9 @@ typedef struct
     char table_directory[512];
     OpenIndexes active_indexes;     // Add this field
     UserManager user_manager;       // Add user management
+    uint32_t scan_threads;          // Worker threads for full table scans
+    size_t work_memory;             // Bytes a sort or aggregation may hold
+    PlanCache plan_cache;           // Statements registered with PREPARE
 } Database;
 
 // Create a database directory structure
@@ -43,7 +47,9 @@ Database *db_create_database(const char *name);
 Database *db_open_database(const char *name);
 
 // Create a new table in the database
-bool db_create_table(Database *db, const char *name, ColumnDef *columns, uint32_t num_columns);
+// With no key columns the table is keyed on its first column
+bool db_create_table(Database *db, const char *name, ColumnDef *columns, uint32_t num_columns,
+                     const uint32_t *key_columns, uint32_t num_key_columns);
 
 // Open a specific table in the database
 bool db_use_table(Database *db, const char *table_name);
@@ -12,6 +12,8 @@
 #define MAX_COLUMNS 16
 #define MAX_INDEXES_PER_TABLE 16
 #define MAX_COLUMN_SIZE 256
+#define MAX_INDEX_INCLUDE 8 // Columns one index can carry with INCLUDE
+#define MAX_INDEX_PREDICATE 256 // WHERE text of a partial index
 
 // Forward declarations for other types
 typedef struct Pager Pager;
@@ -20,14 +22,38 @@ typedef struct Catalog Catalog;
 typedef struct Cursor Cursor;
 typedef struct TableDef TableDef;
 typedef struct DynamicRow DynamicRow;
+typedef struct HotIndex HotIndex;
+typedef struct BitmapIndex BitmapIndex;
+typedef struct FullTextIndex FullTextIndex;
+typedef struct IndexPredicate IndexPredicate;
 
 // Define IndexType enum
 typedef enum
 {
-    INDEX_TYPE_BTREE = 0,
-    // Future index types could be added here
+    INDEX_TYPE_BTREE = 0, // Entries in a B-tree keyed on the value's hash
+    INDEX_TYPE_HASH = 1,  // A linear hash file, see hash_index.h
+    INDEX_TYPE_BITMAP = 2, // Row id bitmaps per value, see bitmap_index.h
+    INDEX_TYPE_FULLTEXT = 3, // Posting lists per word, see fulltext_index.h
 } IndexType;
 
+// A deterministic function of one column, see column_func.h
+typedef enum
+{
+    COLUMN_FUNC_NONE = 0, // The column itself
+    COLUMN_FUNC_LOWER,
+    COLUMN_FUNC_UPPER,
+    COLUMN_FUNC_SUBSTR,
+    COLUMN_FUNC_DATE,
+    COLUMN_FUNC_INT, // CAST(column AS INT)
+} ColumnFuncType;
+
+typedef struct
+{
+    ColumnFuncType type;
+    int32_t start;  // SUBSTR: first character, counting from 1
+    int32_t length; // SUBSTR: characters taken, or -1 for the rest
+} ColumnFunc;
+
 // Full definition of IndexDef (not just forward declaration)
 typedef struct IndexDef
 {
@@ -37,6 +63,16 @@ typedef struct IndexDef
     uint32_t root_page_num;
     char filename[256];
     bool is_unique;
+    // CREATE INDEX ... INCLUDE (...): columns whose values each entry
+    // carries after its key, by position in the table
+    uint32_t num_include;
+    uint32_t include_columns[MAX_INDEX_INCLUDE];
+    // CREATE INDEX ... WHERE: the condition a row must meet to have an
+    // entry, as written; empty for an index on every row
+    char predicate[MAX_INDEX_PREDICATE];
+    // CREATE INDEX ... (lower(column)): entries are keyed on the function
+    // of the column instead of its value
+    ColumnFunc expr;
 } IndexDef;
 
 #endif // DB_TYPES_H
\ No newline at end of file
@@ -0,0 +1,52 @@
+#ifndef EXPR_EVAL_H
+#define EXPR_EVAL_H
+
+#include "schema.h"
+#include "sql_parser.h"
+#include "table.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct CompiledExpr CompiledExpr;
+
+// Each node is compiled to the evaluator for its exact column type and
+// operator, so evaluating a row is a chain of direct calls on the raw row
+// bytes with no type dispatch and no literal parsing.
+typedef bool (*ExprEvalFn)(const CompiledExpr *expr, const uint8_t *row);
+
+struct CompiledExpr
+{
+  ExprEvalFn eval;
+  uint32_t offset; // Column offset within the row
+  int64_t int_value;
+  float float_value;
+  char *text; // Lower-cased string literal or LIKE pattern
+  uint32_t text_length;
+  ColumnFunc func; // Applied to the column first, see column_func.h
+  ColumnType column_type;
+  struct FullTextQuery *query; // MATCH, see fulltext_index.h
+  CompiledExpr *left; // AND / OR operands
+  CompiledExpr *right;
+};
+
+// Compile a bound WHERE tree against a table. Returns NULL and fills error
+// if it references an unknown column or an unsupported comparison.
+CompiledExpr *expr_compile(SqlExpr *expr, TableDef *table_def, char *error,
+                           size_t error_size);
+
+// AND together a list of conjuncts; NULL if the list is empty
+CompiledExpr *expr_compile_conjuncts(SqlExpr **conjuncts, uint32_t count,
+                                     TableDef *table_def, char *error,
+                                     size_t error_size);
+
+static inline bool expr_eval(const CompiledExpr *expr, DynamicRow *row)
+{
+  return expr->eval(expr, row->data);
+}
+
+// ScanPredicate adapter; ctx is the CompiledExpr
+bool expr_scan_predicate(DynamicRow *row, TableDef *table_def, void *ctx);
+
+void expr_free(CompiledExpr *expr);
+
+#endif
@@ -0,0 +1,144 @@
+#ifndef FULLTEXT_INDEX_H
+#define FULLTEXT_INDEX_H
+
+#include "schema.h"
+#include "table.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// An inverted index over the words of a STRING column, for CREATE INDEX
+// ... USING FULLTEXT, and the MATCH condition it answers:
+//
+//   WHERE body MATCH 'disk AND (cache OR buffer)'
+//
+// A word is a run of letters and digits (any byte of a UTF-8 character
+// counts as a letter), lowered and cut to FULLTEXT_MAX_TERM bytes. A query
+// is words joined by AND and OR, written in capitals, with brackets;
+// words next to each other are ANDed.
+//
+// Each word has a posting list: the ids of the rows holding it, ascending,
+// each stored as the gap from the one before and followed by the word's
+// count in the row, both as varints. The index also keeps every row's
+// length in words, so a search ranks its matches by BM25. INSERT, UPDATE
+// and DELETE keep the lists current. The file holds one stream over its
+// pages, as a bitmap index file does, and the table cache handle keeps it
+// decoded while it is open; posting lists stay compressed in memory too.
+
+// Longest word kept, in bytes
+#define FULLTEXT_MAX_TERM 32
+
+// BM25 parameters: how fast repeats of a word stop adding to a row's
+// score, and how much a row's length discounts it
+#define FULLTEXT_BM25_K1 1.2
+#define FULLTEXT_BM25_B 0.75
+
+typedef struct
+{
+  char term[FULLTEXT_MAX_TERM + 1];
+  uint32_t num_rows; // Rows holding the term
+  uint32_t last_row; // Largest row id in the list
+  uint8_t *postings; // (row id gap, count) varint pairs
+  uint32_t size;
+  uint32_t capacity;
+} FullTextTerm;
+
+typedef struct
+{
+  uint32_t row_id;
+  uint32_t length; // Words in the row
+} FullTextRow;
+
+struct FullTextIndex
+{
+  FullTextTerm *terms; // Sorted by term
+  uint32_t num_terms;
+  uint32_t term_capacity;
+  FullTextRow *rows; // Sorted by row id
+  uint32_t num_rows;
+  uint32_t row_capacity;
+  uint64_t total_length; // Words over every row
+  bool dirty;            // Changed since it was loaded or saved
+};
+
+typedef enum
+{
+  FULLTEXT_QUERY_TERM,
+  FULLTEXT_QUERY_AND,
+  FULLTEXT_QUERY_OR
+} FullTextQueryType;
+
+typedef struct FullTextQuery
+{
+  FullTextQueryType type;
+  char term[FULLTEXT_MAX_TERM + 1]; // FULLTEXT_QUERY_TERM
+  struct FullTextQuery *left;       // FULLTEXT_QUERY_AND / OR
+  struct FullTextQuery *right;
+} FullTextQuery;
+
+typedef struct
+{
+  uint32_t row_id;
+  double score;
+} FullTextMatch;
+
+// Rows a search matched, ascending by row id until ranked
+typedef struct
+{
+  FullTextMatch *matches;
+  uint32_t count;
+} FullTextMatches;
+
+// The next word of text[0..length) from *position on, lowered into term
+// (FULLTEXT_MAX_TERM + 1 bytes). Returns its length, 0 once none is left.
+uint32_t fulltext_next_token(const char *text, size_t length, size_t *position,
+                             char *term);
+
+// Parse the text of a MATCH. Returns NULL and fills error on failure.
+FullTextQuery *fulltext_query_parse(const char *text, char *error,
+                                    size_t error_size);
+// True if the words of text satisfy the query, for a row read without the
+// index
+bool fulltext_query_matches(const FullTextQuery *query, const char *text,
+                            size_t length);
+// Words the query looks up
+uint32_t fulltext_query_terms(const FullTextQuery *query);
+// The query as its words were indexed: "disk AND (cache OR buffer)"
+void fulltext_query_format(const FullTextQuery *query, char *buffer,
+                           size_t size);
+void fulltext_query_free(FullTextQuery *query);
+
+// Scan the table into a fresh full-text index file
+bool fulltext_index_build(Table *table, TableDef *table_def, IndexDef *index_def,
+                          Table *index_table);
+
+// The decoded index of an open index file, or NULL if the file does not
+// hold a valid full-text index
+FullTextIndex *fulltext_index_get(Table *index_table);
+// Save the decoded index if writes changed it, before the file's pages are
+// flushed on closing it
+void fulltext_index_flush(Table *index_table);
+// Free the decoded index, on closing the file
+void fulltext_index_unload(Table *index_table);
+// Start the file over as an empty decoded index, for a build
+void fulltext_index_reset(Table *index_table);
+// Write the decoded index back to the file's pages. If it no longer fits,
+// the file is marked invalid so no query trusts it.
+bool fulltext_index_save(Table *index_table);
+
+// After a write: replace the row's words in the decoded index of an open
+// index file, which fulltext_index_flush writes out. old_row is NULL for an
+// insert, new_row for a delete. False if the file holds no valid index.
+bool fulltext_index_apply(TableDef *table_def, IndexDef *index_def,
+                          Table *index_table, DynamicRow *old_row,
+                          DynamicRow *new_row);
+
+// The rows of the index that match the query, each scored by BM25. False
+// if the index file cannot be read.
+bool fulltext_index_search(const IndexDef *index_def, const FullTextQuery *query,
+                           FullTextMatches *out);
+// Order the matches best first, ties by row id
+void fulltext_matches_rank(FullTextMatches *matches);
+void fulltext_matches_free(FullTextMatches *matches);
+
+#endif
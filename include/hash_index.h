@@ -0,0 +1,43 @@
+#ifndef HASH_INDEX_H
+#define HASH_INDEX_H
+
+#include "secondary_index.h"
+#include "table.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+// A secondary index kept as a linear hash table in its own file, for
+// CREATE INDEX ... USING HASH. Page 0 holds the header and the page of
+// each bucket; a bucket is a chain of pages of (hash, row id, key, INCLUDE
+// values) entries.
+// The table starts with HASH_INDEX_INITIAL_BUCKETS buckets and splits one
+// bucket at a time, in order, whenever the entries fill more than
+// HASH_INDEX_MAX_FILL of the bucket pages, so a probe reads the header and
+// about one bucket page however many rows there are.
+//
+// There is no order between buckets, so the index only answers equality.
+
+#define HASH_INDEX_INITIAL_BUCKETS 4
+#define HASH_INDEX_MAX_FILL 0.75
+
+// Pages a probe is expected to read: the header and one bucket page
+#define HASH_INDEX_PROBE_PAGES 2
+
+// Make the index file an empty hash table, dropping whatever it held
+bool hash_index_init(Table *index_table);
+
+// True if the file holds a hash index header
+bool hash_index_valid(Table *index_table);
+
+bool hash_index_insert(Table *index_table, uint32_t hash, uint32_t row_id,
+                       const void *key_data, uint32_t key_size,
+                       const uint8_t *include, uint32_t include_size);
+
+// Add the entries whose key is key_data to matches
+void hash_index_probe(Table *index_table, uint32_t hash, const void *key_data,
+                      uint32_t key_size, IndexMatches *matches);
+
+// Remove the row's entry under hash; false if there is none
+bool hash_index_delete(Table *index_table, uint32_t hash, uint32_t row_id);
+
+#endif
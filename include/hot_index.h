@@ -0,0 +1,57 @@
+#ifndef HOT_INDEX_H
+#define HOT_INDEX_H
+
+#include "arena.h"
+#include "cursor.h"
+#include "table.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+// An optional in-memory adaptive radix tree over a table's primary keys,
+// mapping each key to the leaf page and cell holding its row, so a point
+// lookup is one walk of small in-memory nodes instead of a descent through
+// the pages. It is built from the leaves on the first lookup after it is
+// enabled, and inserts and splits re-register the cells of the leaves they
+// change. Every location is checked against the leaf before it is used, so
+// one a delete or merge moved is never trusted: the lookup descends the
+// tree instead and records where the key is now.
+//
+// Lookups only go through it while the pager is not latched; concurrent
+// B-tree users descend the tree as before.
+
+// Prefix bytes an inner node keeps. Longer prefixes are checked at the leaf.
+#define HOT_INDEX_MAX_PREFIX 10
+
+struct HotIndex
+{
+  Arena arena; // Nodes and leaves, dropped together
+  void *root;
+  uint32_t key_size;
+  bool built;
+
+  // For .hotindex
+  uint64_t entries;
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t builds;
+};
+
+// Turn the hot index on or off for a table. Turning it on is cheap; the
+// tree is built by the first lookup.
+void hot_index_enable(Table *table);
+void hot_index_disable(Table *table);
+
+// The row for key, or NULL if the hot index has no valid location for it
+// (the caller then searches the B-tree and reports what it found)
+Cursor *hot_index_find(Table *table, const void *key);
+
+// After a B-tree search for key: record where it is, or that it is gone
+void hot_index_found(Table *table, const void *key, const Cursor *cursor,
+                     bool present);
+
+// Re-register every cell of a leaf whose cells moved
+void hot_index_note_leaf(Table *table, uint32_t page_num);
+
+void hot_index_print(Table *table, const char *name);
+
+#endif
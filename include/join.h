@@ -0,0 +1,121 @@
+#ifndef JOIN_H
+#define JOIN_H
+
+#include "arena.h"
+#include "database.h"
+#include "expr_eval.h"
+#include "query_planner.h"
+#include "sort.h"
+#include "sql_parser.h"
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Once the build side outgrows the work memory, both sides are split by
+// hash into this many partition files and joined a partition at a time
+#define JOIN_PARTITIONS 8
+#define JOIN_INITIAL_BUCKETS 1024
+
+typedef enum
+{
+  JOIN_HASH,               // Hash one side, probe it with the other
+  JOIN_NESTED_PRIMARY_KEY, // Look each outer row up in the inner B-tree
+  JOIN_NESTED_INDEX        // Probe the inner table's secondary index
+} JoinMethod;
+
+typedef struct
+{
+  Table *table;
+  TableDef *table_def;
+  bool owns_table; // Acquired for the join and released with the plan
+  char name[MAX_TABLE_NAME]; // Alias, or the table name
+  int key_column;            // This side's ON column
+  SortKey key;
+  uint32_t row_size;
+  uint32_t first_column; // Where this side's columns start in a joined row
+  uint32_t offset;       // Where this side's bytes start in a joined row
+
+  // The WHERE conjuncts that only look at this side: an access method for
+  // scanning it, and the same conditions compiled for rows a nested loop
+  // fetches by key
+  QueryPlan plan;
+  CompiledExpr *filter;
+} JoinSide;
+
+typedef struct
+{
+  JoinMethod method;
+  uint32_t inner; // Build side of a hash join, probed side of a nested loop
+  double cost;
+} JoinCandidate;
+
+#define MAX_JOIN_CANDIDATES 4
+
+typedef struct
+{
+  JoinSide sides[2]; // The FROM table, then the JOIN table
+  // Both sides' columns, named alias.column, in one row laid out left then
+  // right, so the operators after the join see an ordinary table
+  TableDef joined;
+  uint32_t row_size;
+  // The ON columns' common type and width, at offset 0, for comparing a
+  // key of one side with a key of the other
+  SortKey compare;
+
+  JoinMethod method;
+  uint32_t inner;
+  IndexDef *index; // JOIN_NESTED_INDEX
+  CompiledExpr *residual; // WHERE conditions no single side answers
+  QueryPlan output;       // Sort, aggregation and LIMIT over joined rows
+
+  double cost;
+  double rows;
+  JoinCandidate candidates[MAX_JOIN_CANDIDATES];
+  uint32_t num_candidates;
+} JoinPlan;
+
+// A bucket chain entry: a build-side row and its key hash
+typedef struct JoinEntry
+{
+  struct JoinEntry *next;
+  uint64_t hash;
+  uint8_t row[];
+} JoinEntry;
+
+typedef struct
+{
+  Arena arena;
+  JoinEntry **buckets;
+  uint32_t num_buckets; // Power of two
+  uint32_t num_entries;
+} JoinHashTable;
+
+// Open the JOIN table and lay out the joined schema. table is the FROM
+// table, already open. Returns false and fills error if a table or an ON
+// column does not exist or the ON columns cannot be compared; the plan must
+// be freed either way.
+bool join_open(JoinPlan *plan, Database *db, Table *table, TableDef *table_def,
+               const char *alias, const SqlJoin *join, char *error,
+               size_t error_size);
+
+// Column of the joined schema that column ("x" or "a.x") refers to, or -1
+// with error filled if there is none or "x" is in both tables
+int join_find_column(const JoinPlan *plan, const char *column, char *error,
+                     size_t error_size);
+
+// Push the WHERE conjuncts on one table down to its access method, keep
+// the rest for the joined rows, and pick the join method by cost
+bool join_plan_build(JoinPlan *plan, SqlExpr *where,
+                     const SelectOptions *options, char *error,
+                     size_t error_size);
+
+void join_plan_explain(const JoinPlan *plan);
+
+// Run the join into result, as query_plan_execute does for one table
+void join_execute(JoinPlan *plan, uint32_t num_threads, QueryResult *result,
+                  QueryProfile *profile);
+
+void join_plan_free(JoinPlan *plan);
+
+#endif
@@ -0,0 +1,62 @@
+#ifndef ONLINE_INDEX_H
+#define ONLINE_INDEX_H
+
+#include "catalog.h"
+#include "schema.h"
+#include "table.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+// CREATE INDEX ... ONLINE builds the index on a background thread while
+// the table keeps taking writes. The builder copies the table one leaf at a
+// time, and a write only waits for the leaf copy in progress, never for the
+// build. Every write made after the build starts also goes to a side log.
+// Once the scan is done the log is replayed onto the new index. Replaying a
+// change the scan already saw leaves the index as it is, so the result is
+// the table as of the last write. The index is then published in the
+// catalog between two statements, so a query sees either no index or a
+// complete one.
+
+// Builds running at once, over every table
+#define ONLINE_INDEX_MAX_BUILDS 4
+
+// Rows copied per hold of the write lock, at most one leaf's worth
+#define ONLINE_INDEX_BATCH_ROWS 64
+
+// The builder keeps replaying the side log until fewer changes than this
+// are left. The statement that publishes the index replays the rest.
+#define ONLINE_INDEX_HANDOFF_CHANGES 32
+
+// Start building index_def, which is not in the catalog yet, on a copy of
+// table_def. False if the build could not start.
+bool online_index_start(Catalog *catalog, const char *db_name,
+                        TableDef *table_def, IndexDef *index_def);
+
+// INSERT, UPDATE and DELETE run between these, so no write changes a leaf
+// while the builder copies it
+void online_index_write_begin(void);
+void online_index_write_end(void);
+
+// After a write, with the write lock held: log the change for every build
+// on the table. old_row is NULL for an insert, new_row for a delete.
+void online_index_note_row(TableDef *table_def, DynamicRow *old_row,
+                           DynamicRow *new_row);
+
+// Before each statement: publish the builds of this catalog that have
+// finished scanning, and report the ones that failed
+void online_index_publish_ready(Catalog *catalog);
+
+// On closing the database: wait for every build of this catalog and
+// publish it
+void online_index_finish_all(Catalog *catalog);
+
+// True if an index of that name is being built on the table
+bool online_index_building(const char *table_name, const char *index_name);
+// Builds running on the table; each will take an index slot
+uint32_t online_index_pending(const char *table_name);
+
+// Progress of the builds on the table: rows scanned, changes logged and an
+// estimate of the time left. Prints nothing if there are none.
+void online_index_print(const char *table_name);
+
+#endif
@@ -0,0 +1,33 @@
+#ifndef PAGE_STREAM_H
+#define PAGE_STREAM_H
+
+#include "pager.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Bitmap and full-text index files are not B-trees: their pages, in order,
+// hold one stream of bytes that the index is decoded from when the file is
+// opened and encoded into when it is saved. Every page starts with a prefix
+// whose first byte marks it as the stream's first page or a later one, so
+// none looks like a freed page.
+#define PAGE_STREAM_PREFIX 4
+
+// Most bytes one file's stream can hold
+size_t page_stream_capacity(void);
+
+// The start of the stream, in the first page, or NULL if that page is not
+// marked header_type
+const uint8_t *page_stream_start(Pager *pager, uint8_t header_type);
+
+// The first size bytes of the stream, malloc'd
+uint8_t *page_stream_read(Pager *pager, size_t size);
+
+// Write size bytes (at most page_stream_capacity()) over the pages, the
+// first marked header_type and the rest data_type. Only the pages whose
+// bytes change are marked dirty, and closing the file writes back only
+// those.
+void page_stream_write(Pager *pager, uint8_t header_type, uint8_t data_type,
+                       const uint8_t *stream, size_t size);
+
+#endif
@@ -2,6 +2,7 @@
 #define PAGER_H
 
 #include "db_types.h"
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -11,6 +12,21 @@
 // struct for pages
 #define TABLE_MAX_PAGES 100
 
+// First byte of a page a delete released, where a B-tree node keeps its
+// type. The free list is rebuilt from these marks the first time a page is
+// allocated after opening the file.
+#define PAGE_FREE_MARKER 0xFF
+
+// Latch modes. Lookups, scans and inserts that fit in their leaf descend
+// with latch coupling: shared on internal nodes, the leaf in the mode asked
+// for. A split, merge or delete does not crab; it takes the tree latch
+// exclusively and so runs alone.
+typedef enum {
+    LATCH_NONE,
+    LATCH_SHARED,
+    LATCH_EXCLUSIVE
+} LatchMode;
+
 struct Pager {
     int file_descriptor;  // basically number return by os when file is opened that
                           // if read or write to file
@@ -19,10 +35,49 @@ struct Pager {
     void *
         pages[TABLE_MAX_PAGES]; // array of pointrs where each pointer refers to a
                                 // page and which takes data from disk as needed
+
+    // Released pages, reused before the file grows
+    uint32_t free_pages[TABLE_MAX_PAGES];
+    uint32_t num_free_pages;
+    bool free_pages_loaded;
+
+    // Bitmap and full-text index files (see page_stream.h): closing one
+    // writes back only the pages page_stream_write changed
+    bool stream_file;
+    bool page_dirty[TABLE_MAX_PAGES];
+
+    // Concurrency control. Latches and the frame lock are only taken once
+    // latching is enabled, so the single-threaded shell pays nothing for them.
+    // The frame lock alone is also taken while other threads only read the
+    // pager beside its owner (pager_share_frames).
+    bool latching;
+    uint32_t frame_sharers;
+    pthread_mutex_t frame_lock;   // guards page loads (misses only) and num_pages
+    pthread_rwlock_t tree_latch;  // shared by every operation, exclusive while
+                                  // the tree changes shape
+    pthread_mutex_t tree_gate;    // keeps a waiting split from being starved by readers
+    pthread_rwlock_t frame_latches[TABLE_MAX_PAGES]; // one reader/writer latch per frame
 };
 
 Pager *pager_open(const char *file_name);
 void *get_page(Pager *pager, uint32_t page_num);
 void pager_flush(Pager *pager, uint32_t page_num);
+// A page for a new node: a released one if there is any, else the next page
+// past the end of the file
+uint32_t pager_allocate_page(Pager *pager);
+// Mark a page no node refers to any more as free for pager_allocate_page
+void pager_free_page(Pager *pager, uint32_t page_num);
+
+// Latching
+void pager_enable_latching(Pager *pager);
+// Serialize page loads while another thread reads the pager; frame contents
+// stay unlatched, so the owner must not change them meanwhile unless the
+// readers are held off some other way. Calls nest.
+void pager_share_frames(Pager *pager);
+void pager_unshare_frames(Pager *pager);
+void pager_latch(Pager *pager, uint32_t page_num, LatchMode mode);
+void pager_unlatch(Pager *pager, uint32_t page_num);
+void pager_tree_latch(Pager *pager, LatchMode mode);
+void pager_tree_unlatch(Pager *pager);
 
-#endif // PAGER_H
\ No newline at end of file
+#endif // PAGER_H
@@ -0,0 +1,48 @@
+#ifndef PARALLEL_SCAN_H
+#define PARALLEL_SCAN_H
+
+#include "schema.h"
+#include "table.h"
+#include "vector_filter.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#define SCAN_MAX_THREADS 64
+// Below this many leaves per worker the thread start-up cost dominates
+#define SCAN_MIN_LEAVES_PER_THREAD 2
+
+// Returns true if the row should be part of the scan result
+typedef bool (*ScanPredicate)(DynamicRow *row, TableDef *table_def, void *ctx);
+
+// Matching rows in primary key order. Each row owns its data.
+typedef struct
+{
+  DynamicRow *rows;
+  uint32_t num_rows;
+  uint32_t capacity;
+} ScanResult;
+
+// Number of worker threads to use when none has been configured
+uint32_t parallel_scan_default_threads();
+
+// Collect the leaf pages of the tree in key order by walking the internal nodes
+uint32_t *scan_collect_leaves(Table *table, uint32_t *num_leaves);
+
+// Scan every row of the table, keeping those accepted by the predicate (all
+// rows if it is NULL). Leaves are split into contiguous ranges, one per
+// worker, and the per-range results are concatenated so the output order is
+// the same as a serial scan regardless of the thread count.
+void parallel_scan(Table *table, TableDef *table_def, ScanPredicate predicate,
+                   void *ctx, uint32_t num_threads, ScanResult *result);
+
+// Same as parallel_scan, but the predicate is evaluated a leaf at a time
+// into a selection bitmap and only selected rows are deserialized
+void parallel_scan_compiled(Table *table, TableDef *table_def,
+                            const CompiledPredicate *predicate,
+                            uint32_t num_threads, ScanResult *result);
+
+// Take ownership of row's data
+void scan_result_append(ScanResult *result, DynamicRow *row);
+void scan_result_free(ScanResult *result);
+
+#endif
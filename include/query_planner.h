@@ -0,0 +1,296 @@
+#ifndef QUERY_PLANNER_H
+#define QUERY_PLANNER_H
+
+#include "aggregate.h"
+#include "bitmap_index.h"
+#include "catalog.h"
+#include "expr_eval.h"
+#include "fulltext_index.h"
+#include "parallel_scan.h"
+#include "query_profile.h"
+#include "secondary_index.h"
+#include "sort.h"
+#include "sql_parser.h"
+#include "table.h"
+#include "vector_filter.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+// Cost units: reading one page is 1, looking at one row is CPU_ROW_COST.
+// The pager reads pages one at a time into the same frame array whether a
+// scan or a lookup asked for them, so there is no separate random page cost.
+#define PAGE_COST 1.0
+#define CPU_ROW_COST 0.01
+// Until ANALYZE runs, row counts are guessed from the file size
+#define PLANNER_DEFAULT_ROWS_PER_PAGE 40
+
+typedef enum
+{
+  ACCESS_FULL_SCAN,
+  ACCESS_PRIMARY_KEY,       // Point lookup in the table B-tree
+  ACCESS_PRIMARY_KEY_RANGE, // Walk the leaves between two keys
+  ACCESS_SECONDARY_INDEX,   // Probe an index file, then fetch by primary key
+  ACCESS_BITMAP_INDEX,      // Combine bitmap indexes, then fetch by primary key
+  ACCESS_FULLTEXT_INDEX     // Search a full-text index, then fetch by primary key
+} AccessMethod;
+
+// Rows, leaf pages and tree depth: from ANALYZE if it has run, otherwise
+// guessed from the file size
+typedef struct
+{
+  double rows;
+  double pages;
+  double depth;
+} TableShape;
+
+typedef struct
+{
+  AccessMethod access;
+  IndexDef *index;
+  double cost;
+  double rows; // Rows the access method produces before the residual
+  bool index_only; // The index entries hold every column the query reads
+} PlanCandidate;
+
+#define MAX_PLAN_CANDIDATES (5 + MAX_INDEXES_PER_TABLE)
+
+// What a SELECT asks for besides its WHERE clause
+typedef struct
+{
+  const SqlOrderBy *order_by;
+  uint32_t num_order_by;
+  bool has_limit;
+  uint32_t limit;
+  uint32_t offset;
+  size_t work_memory; // Bytes a sort or aggregation may hold before spilling
+  const AggregateSpec *aggregate; // NULL unless the select list aggregates
+  // Columns the select list names; none means every column. UPDATE and
+  // DELETE leave it empty, as they need whole rows.
+  char **select_columns;
+  uint32_t num_select_columns;
+} SelectOptions;
+
+typedef struct
+{
+  AccessMethod access;
+  int64_t key;           // ACCESS_PRIMARY_KEY: primary key to look up
+  int64_t range_low;     // ACCESS_PRIMARY_KEY_RANGE: inclusive bounds
+  int64_t range_high;
+  bool range_empty;      // The bounds cannot match any key
+  IndexDef *index;       // ACCESS_SECONDARY_INDEX: index to probe
+  // ACCESS_SECONDARY_INDEX: the key to look up, as the entries hold it:
+  // an INT value, or the result of the index's expression
+  uint8_t probe_key[MAX_COLUMN_SIZE];
+  uint32_t probe_key_size;
+  char probe_column[MAX_COLUMN_NAME];
+  // The index covers the query: rows are rebuilt from its entries (key,
+  // value and INCLUDE columns) without reading the table
+  bool index_only;
+  // ACCESS_BITMAP_INDEX: the conjuncts bitmap indexes answer, and every
+  // conjunct compiled, for a scan if an index file cannot be read
+  BitmapExpr *bitmap;
+  CompiledExpr *bitmap_fallback;
+  // ACCESS_FULLTEXT_INDEX: the MATCH the index (plan->index) answers, and
+  // every conjunct compiled, for a scan if the index file cannot be read
+  FullTextQuery *fulltext;
+  CompiledExpr *fulltext_fallback;
+  // Rows come back best BM25 score first, as a full-text search with no
+  // ORDER BY or aggregate returns them
+  bool ranked;
+
+  // Conjuncts the access method does not answer by itself; NULL if none
+  CompiledExpr *residual;
+
+  // A full scan with a single "column = literal" filter goes through the
+  // batched leaf filter instead of the row-at-a-time residual
+  bool use_batch;
+  CompiledPredicate batch;
+
+  // ORDER BY <primary key> DESC: rows come back in descending key order
+  bool descending;
+
+  // Any other ORDER BY goes through the sort operator, which keeps a top-N
+  // heap instead when the LIMIT fits its memory budget
+  bool sort;
+  SortSpec sort_spec;
+  size_t work_memory;
+
+  // Aggregates and GROUP BY go through the hash aggregation operator.
+  // COUNT(*) with no WHERE clause adds up leaf cell counts instead, and
+  // one whose WHERE clause bitmaps answer is the bitmap's cardinality.
+  const AggregateSpec *aggregate;
+  bool count_from_leaves;
+  bool count_from_bitmap;
+
+  // LIMIT/OFFSET. Without a sort, the leaf walks skip OFFSET rows by leaf
+  // cell counts and stop once LIMIT rows are in.
+  bool has_limit;
+  uint32_t limit;
+  uint32_t offset;
+
+  // Estimates, for EXPLAIN
+  double cost;
+  double rows; // Rows expected to pass the whole WHERE clause
+  PlanCandidate candidates[MAX_PLAN_CANDIDATES];
+  uint32_t num_candidates;
+} QueryPlan;
+
+// The access path a plan took, which a prepared statement keeps so later
+// executions plan only that path, with their own arguments. It holds while
+// the catalog is at the version it was picked under: DDL and ANALYZE save
+// the catalog, which moves the version on.
+typedef struct PlanChoice
+{
+  bool valid;
+  uint32_t catalog_version;
+  const TableDef *table_def;
+  AccessMethod access;
+  IndexDef *index;
+  int conjunct; // ACCESS_SECONDARY_INDEX: the WHERE conjunct it probes
+} PlanChoice;
+
+// EXPLAIN ANALYZE measurements for one step of the execution
+typedef struct
+{
+  char name[64];
+  uint64_t rows_in;
+  uint64_t rows_out;
+  double seconds;
+  uint64_t page_hits;
+  uint64_t page_reads;
+  uint64_t bytes_deserialized;
+} OperatorProfile;
+
+#define MAX_PROFILE_OPERATORS 8
+
+typedef struct
+{
+  OperatorProfile operators[MAX_PROFILE_OPERATORS];
+  uint32_t num_operators;
+  ProfileSnapshot mark;  // Where the current operator started
+  ProfileSnapshot start; // Where the query started
+} QueryProfile;
+
+// Start profiling; counters are global, so only one profile runs at a time
+void query_profile_begin(QueryProfile *profile);
+// Close the operator that began at the last mark. Rows in defaults to the
+// rows the operator scanned.
+OperatorProfile *query_profile_end(QueryProfile *profile, const char *name,
+                                   uint64_t rows_out);
+// Stop profiling and print the per-operator report
+void query_profile_finish(QueryProfile *profile);
+
+// Rows a plan produced: materialized in key order, streaming out of the
+// sort operator, or groups out of the aggregation operator
+typedef struct
+{
+  ScanResult rows;
+  uint32_t position;
+  Sorter *sorter;
+  DynamicRow current; // Points into the sorter's buffers
+  Aggregator *aggregator;
+  // EXPLAIN ANALYZE of a spilled aggregation, counting groups as they come
+  OperatorProfile *aggregate_profile;
+  // LIMIT/OFFSET still to apply, when the access method did not
+  bool has_limit;
+  uint32_t limit;
+  uint32_t offset;
+  uint32_t returned;
+} QueryResult;
+
+// Pick the cheapest access method for the WHERE clause (NULL for none),
+// costed from the statistics ANALYZE stored in the catalog. Returns false
+// and fills error if the clause or the ORDER BY does not compile.
+bool query_plan_build(SqlExpr *where, const SelectOptions *options,
+                      Table *table, TableDef *table_def, QueryPlan *plan,
+                      char *error, size_t error_size);
+
+// Same, reusing choice if it was picked for table_def under catalog_version;
+// otherwise the search runs and its pick is stored in choice. A reused
+// path these arguments rule out, such as a partial index whose condition
+// they do not imply, is searched for again. EXPLAIN leaves choice out, as
+// the alternatives are only costed by a full search.
+bool query_plan_build_cached(SqlExpr *where, const SelectOptions *options,
+                             Table *table, TableDef *table_def,
+                             PlanChoice *choice, uint32_t catalog_version,
+                             QueryPlan *plan, char *error, size_t error_size);
+
+void query_plan_table_shape(Table *table, TableDef *table_def,
+                            TableShape *shape);
+
+// Ordering, aggregation and LIMIT/OFFSET alone, for rows that come from a
+// join rather than an access method
+bool query_plan_build_operators(const SelectOptions *options,
+                                TableDef *table_def, QueryPlan *plan,
+                                char *error, size_t error_size);
+
+// The secondary index that answers equality on an INT column, or NULL.
+// A partial index is only considered if where implies its condition;
+// where may be NULL.
+IndexDef *query_plan_find_index(TableDef *table_def, int column_idx,
+                                const SqlExpr *where);
+
+// True if the index has an entry for every row where matches: always for
+// an index on every row, and for a partial index if where implies its
+// condition
+bool query_plan_index_usable(const IndexDef *index, const SqlExpr *where,
+                             TableDef *table_def);
+
+// The index file, acquired from the table cache, or NULL if it cannot be
+// opened or does not hold the kind of index the catalog says
+Table *query_plan_open_index(const IndexDef *index);
+
+// Pages read to reach an index's entries for one value: a descent for a
+// B-tree index, about one bucket for a hash index
+double query_plan_index_probe_cost(const IndexDef *index, double depth);
+
+// Primary keys of the rows an index file holds under a key, ascending and
+// without duplicates. The caller frees them.
+uint32_t *query_plan_probe_index(const IndexDef *index, Table *index_table,
+                                 const void *key_data, uint32_t key_size,
+                                 uint32_t *num_ids);
+// Same, keeping include_size bytes of each entry's INCLUDE values. The
+// caller frees matches->entries.
+void query_plan_probe_index_entries(const IndexDef *index, Table *index_table,
+                                    const void *key_data, uint32_t key_size,
+                                    uint32_t include_size,
+                                    IndexMatches *matches);
+
+const char *query_plan_access_name(AccessMethod access);
+
+// One line naming the access method, printed before results
+void query_plan_print(const QueryPlan *plan, TableDef *table_def);
+
+// EXPLAIN output: the chosen plan, its estimates and the alternatives
+void query_plan_explain(const QueryPlan *plan, TableDef *table_def);
+// Pieces of it: the access method and its filter, each line prefixed by
+// indent, and the sort, aggregate and limit lines
+void query_plan_explain_access(const QueryPlan *plan, TableDef *table_def,
+                               const char *indent);
+void query_plan_explain_operators(const QueryPlan *plan, TableDef *table_def,
+                                  bool stops_early);
+
+// Run the plan. Rows come out in primary key order (descending if the plan
+// says so) or in ORDER BY order when the plan sorts. Each step is recorded
+// in profile unless it is NULL.
+void query_plan_execute(QueryPlan *plan, Table *table, TableDef *table_def,
+                        uint32_t num_threads, QueryResult *result,
+                        QueryProfile *profile);
+
+// Feed rows from another producer, such as a join, through the plan's sort
+// or aggregation, or keep them as they come. Rows are copied.
+void query_result_begin(QueryResult *result, const QueryPlan *plan);
+void query_result_add(QueryResult *result, const uint8_t *data, uint32_t size);
+void query_result_end(QueryResult *result, QueryProfile *profile);
+
+// Next output row, or NULL after the last one or once LIMIT is reached.
+// OFFSET rows are skipped first.
+// The row stays valid until the next call.
+DynamicRow *query_result_next(QueryResult *result);
+// Same for an aggregating plan: the next group, read with aggregator_value
+const uint8_t *query_result_next_group(QueryResult *result);
+void query_result_free(QueryResult *result);
+
+void query_plan_free(QueryPlan *plan);
+
+#endif
@@ -0,0 +1,54 @@
+#ifndef QUERY_PROFILE_H
+#define QUERY_PROFILE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Counters for EXPLAIN ANALYZE. Hot paths bump them through PROFILE_COUNT,
+// which is a single predicted-not-taken branch while profiling is off.
+typedef enum
+{
+  PROFILE_PAGE_HITS,          // get_page found the frame loaded
+  PROFILE_PAGE_READS,         // get_page had to read the frame from disk
+  PROFILE_CURSOR_ADVANCES,
+  PROFILE_ROWS_SCANNED,       // Rows an access method looked at
+  PROFILE_ROWS_DESERIALIZED,
+  PROFILE_BYTES_DESERIALIZED,
+  PROFILE_NUM_COUNTERS
+} ProfileCounter;
+
+extern bool profile_enabled;
+extern uint64_t profile_counters[PROFILE_NUM_COUNTERS];
+
+// Relaxed atomics: parallel scan workers count into the same totals
+#define PROFILE_COUNT(counter, amount)                                   \
+  do                                                                     \
+  {                                                                      \
+    if (__builtin_expect(profile_enabled, 0))                            \
+    {                                                                    \
+      __atomic_fetch_add(&profile_counters[counter], (uint64_t)(amount), \
+                         __ATOMIC_RELAXED);                              \
+    }                                                                    \
+  } while (0)
+
+typedef struct
+{
+  double time; // Seconds, monotonic
+  uint64_t counters[PROFILE_NUM_COUNTERS];
+} ProfileSnapshot;
+
+// Zero the counters and start counting
+void profile_start();
+void profile_stop();
+
+void profile_snapshot(ProfileSnapshot *snapshot);
+
+// Counter growth between two snapshots
+static inline uint64_t profile_delta(const ProfileSnapshot *start,
+                                     const ProfileSnapshot *end,
+                                     ProfileCounter counter)
+{
+  return end->counters[counter] - start->counters[counter];
+}
+
+#endif
@@ -0,0 +1,61 @@
+#ifndef ROARING_H
+#define ROARING_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// A compressed set of 32-bit row ids. Ids are grouped by their high 16
+// bits into containers; a container holds its low 16 bits as a sorted
+// array while it has at most ROARING_ARRAY_MAX of them and as a 65536-bit
+// bitmap once it has more, so sparse and dense runs of ids both stay small.
+
+#define ROARING_ARRAY_MAX 4096
+#define ROARING_BITMAP_WORDS 1024 // 65536 bits
+
+typedef struct
+{
+  uint16_t key; // High 16 bits of every id in the container
+  bool is_bitmap;
+  uint32_t cardinality;
+  uint32_t capacity; // Array slots allocated
+  uint16_t *values;  // Array container: sorted low bits
+  uint64_t *words;   // Bitmap container
+} RoaringContainer;
+
+typedef struct
+{
+  RoaringContainer *containers; // Sorted by key
+  uint32_t num_containers;
+  uint32_t capacity;
+} RoaringBitmap;
+
+void roaring_init(RoaringBitmap *bitmap);
+void roaring_free(RoaringBitmap *bitmap);
+
+void roaring_add(RoaringBitmap *bitmap, uint32_t value);
+void roaring_remove(RoaringBitmap *bitmap, uint32_t value);
+bool roaring_contains(const RoaringBitmap *bitmap, uint32_t value);
+uint64_t roaring_cardinality(const RoaringBitmap *bitmap);
+
+// out = a AND b, a OR b, a AND NOT b. out is initialized by the call and
+// may not be a or b.
+void roaring_and(RoaringBitmap *out, const RoaringBitmap *a,
+                 const RoaringBitmap *b);
+void roaring_or(RoaringBitmap *out, const RoaringBitmap *a,
+                const RoaringBitmap *b);
+void roaring_andnot(RoaringBitmap *out, const RoaringBitmap *a,
+                    const RoaringBitmap *b);
+
+// The ids in ascending order; the caller frees them
+uint32_t *roaring_to_array(const RoaringBitmap *bitmap, uint32_t *count);
+
+// Serialized form: the container count, then each container's key, kind,
+// cardinality and contents, all 4-byte aligned
+size_t roaring_serialized_size(const RoaringBitmap *bitmap);
+size_t roaring_serialize(const RoaringBitmap *bitmap, uint8_t *buffer);
+// Bytes read, or 0 if the buffer does not hold a whole bitmap
+size_t roaring_deserialize(RoaringBitmap *bitmap, const uint8_t *buffer,
+                           size_t size);
+
+#endif
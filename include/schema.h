@@ -1,7 +1,9 @@
 #ifndef SCHEMA_H
 #define SCHEMA_H
 
+#include "btree_key.h"
 #include "db_types.h" // This now has the full IndexDef definition
+#include "table_stats.h"
 #include <stdint.h>
 
 // Constants are now in db_types.h
@@ -16,7 +18,8 @@ typedef enum
   COLUMN_TYPE_DATE,
   COLUMN_TYPE_TIME,
   COLUMN_TYPE_TIMESTAMP,
-  COLUMN_TYPE_BLOB
+  COLUMN_TYPE_BLOB,
+  COLUMN_TYPE_BIGINT
   // Add more types as needed
 } ColumnType;
 
@@ -38,6 +41,15 @@ struct TableDef
   // Add secondary index support
   uint32_t num_indexes;
   IndexDef indexes[MAX_INDEXES_PER_TABLE]; // IndexDef is now fully defined in db_types.h
+
+  // Primary key: the columns the B-tree is keyed on, in order, and how
+  // their encoded key is compared
+  uint32_t num_key_columns;
+  uint32_t key_columns[MAX_KEY_COLUMNS];
+  KeyDesc key;
+
+  // Planner statistics, filled in by ANALYZE
+  TableStats stats;
 };
 
 #endif // SCHEMA_H
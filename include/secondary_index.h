@@ -5,18 +5,68 @@
 #include <stdint.h>
 #include <stdbool.h>
 
+struct CompiledExpr;
+
 // Structure for secondary index entries
 typedef struct
 {
-    uint32_t row_id;    // The primary key of the indexed row
-    uint32_t key_size;  // Size of the indexed key data
-    uint8_t key_data[]; // Flexible array member for key data
+    uint32_t row_id;       // The primary key of the indexed row
+    uint16_t key_size;     // Size of the indexed key data
+    uint16_t include_size; // Bytes of INCLUDE column values after the key
+    uint8_t key_data[];    // Key data, then the INCLUDE column values
 } SecondaryIndexEntry;
 
+// B-tree index entries are keyed on (hash of the value, row id), both
+// big-endian so memcmp order is key order. Keys are unique, so a row's
+// entry is removed exactly, and one value's entries spread over leaves by
+// row id.
+#define SECONDARY_INDEX_KEY_SIZE 8
+
+// Largest INCLUDE payload, so an entry still fits a page with room to spare
+#define SECONDARY_INDEX_MAX_INCLUDE 1024
+
+// Entries an index probe matched, packed stride bytes apart: the row id,
+// then the entry's INCLUDE values. With no INCLUDE values it is an array
+// of row ids.
+typedef struct
+{
+    uint8_t *entries;
+    uint32_t stride;
+    uint32_t count;
+    uint32_t capacity;
+} IndexMatches;
+
 // Function declarations
 bool catalog_add_index(Catalog *catalog, const char *table_name,
                        const char *index_name, const char *column_name,
-                       bool is_unique);
+                       bool is_unique, IndexType type);
+
+// Bytes the INCLUDE columns of an index take in each entry
+uint32_t index_include_size(TableDef *table_def, const IndexDef *index_def);
+// Copy a row's INCLUDE column values into an entry payload, and back
+uint32_t index_include_from_row(TableDef *table_def, const IndexDef *index_def,
+                                DynamicRow *row, uint8_t *include);
+void index_include_to_row(TableDef *table_def, const IndexDef *index_def,
+                          const uint8_t *include, DynamicRow *row);
+
+// The compiled WHERE of a partial index, kept on the open index file's
+// handle so a write evaluates it without parsing it again. *predicate is
+// NULL for an index on every row. False, reported once per handle, if the
+// condition no longer compiles against the table: writes skip the index
+// and queries do not use it.
+bool index_predicate_get(Table *index_table, TableDef *table_def,
+                         const IndexDef *index_def,
+                         const struct CompiledExpr **predicate);
+// Free the compiled condition, on closing the file
+void index_predicate_unload(Table *index_table);
+// True if the row has an entry in an index with that condition
+bool index_predicate_holds(const struct CompiledExpr *predicate, DynamicRow *row);
+// Drop the rows of a write that a partial index has no entry for, as if
+// the write had not had them. False if neither is left, or if the
+// index's condition does not compile.
+bool index_predicate_filter(Table *index_table, TableDef *table_def,
+                            const IndexDef *index_def, DynamicRow **old_row,
+                            DynamicRow **new_row);
 
 int catalog_find_index(Catalog *catalog, const char *table_name, const char *index_name);
 
@@ -25,12 +75,41 @@ int catalog_find_index_by_column(Catalog *catalog, const char *table_name, const
 bool create_secondary_index(Table *table, TableDef *table_def, IndexDef *index_def);
 
 bool secondary_index_insert(Table *index_table, uint32_t hash_key, uint32_t row_id,
-                            void *key_data, uint32_t key_size);
+                            void *key_data, uint32_t key_size,
+                            const uint8_t *include, uint32_t include_size);
+
+// Key a B-tree index file's handle. False for a file written when entries
+// were keyed on the hash alone: writes skip it and queries do not use it
+// until it is rebuilt, which USE TABLE does.
+bool secondary_index_set_key(Table *index_table);
+void secondary_index_key(uint32_t hash_key, uint32_t row_id, uint8_t *key);
 
+// Cursor at the first entry under hash_key
 Cursor *secondary_index_find(Table *index_table, uint32_t hash_key);
 
 bool secondary_index_delete(Table *index_table, uint32_t hash_key, uint32_t row_id);
 
+// After a write: move the row's entries in every index of the table from
+// its old values to its new ones. old_row is NULL for an insert, new_row
+// for a delete.
+void secondary_indexes_note_row(TableDef *table_def, DynamicRow *old_row,
+                                DynamicRow *new_row);
+
+// Get an index file of any type ready for a build from an empty table
+bool secondary_index_prepare(IndexDef *index_def, Table *index_table);
+// Move one row's entry in an open index file of any type. Applying a write
+// the file already reflects leaves it as it is. False if the index cannot
+// be maintained.
+bool secondary_index_apply(TableDef *table_def, IndexDef *index_def,
+                           Table *index_table, DynamicRow *old_row,
+                           DynamicRow *new_row);
+
+void index_matches_init(IndexMatches *matches, uint32_t include_size);
+void index_matches_add(IndexMatches *matches, uint32_t row_id,
+                       const uint8_t *include, uint32_t include_size);
+// Sort by row id and drop repeated ids
+void index_matches_finish(IndexMatches *matches);
+
 uint32_t hash_key_for_value(void *key, uint32_t key_size);
 
 void *get_column_value(DynamicRow *row, TableDef *table_def, uint32_t column_idx, uint32_t *size);
@@ -0,0 +1,115 @@
+#ifndef SORT_H
+#define SORT_H
+
+#include "schema.h"
+#include "sql_parser.h"
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Memory the sort operator may hold before it spills sorted runs to disk
+#define SORT_DEFAULT_MEMORY_BUDGET (4 * 1024 * 1024)
+#define SORT_MIN_MEMORY_BUDGET (4 * 1024)
+// Runs merged at once; more than this are merged in several passes
+#define SORT_MERGE_FAN_IN 16
+
+typedef struct
+{
+  uint32_t column;
+  uint32_t offset; // Where the column sits in a deserialized row
+  uint32_t width;
+  ColumnType type;
+  bool descending;
+} SortKey;
+
+typedef struct
+{
+  // The ORDER BY keys, then the primary key so ties come out the same way
+  // whatever order the rows arrived in
+  SortKey keys[MAX_COLUMNS + 1];
+  uint32_t num_keys;
+  uint32_t num_order_by; // Keys from the ORDER BY itself
+  uint32_t row_size; // Every deserialized row of a table has the same size
+} SortSpec;
+
+// A sorted run spilled to a temporary file
+typedef struct
+{
+  FILE *file;
+  uint64_t num_rows;
+  uint64_t rows_read;
+  uint8_t *buffer; // Rows read ahead for the merge
+  uint32_t buffer_rows;
+  uint32_t buffered;
+  uint32_t position;
+} SortRun;
+
+typedef struct
+{
+  SortSpec spec;
+  size_t memory_budget;
+  pthread_mutex_t lock; // Parallel scan workers add rows concurrently
+
+  // LIMIT n with n rows fitting the budget: only the best n rows are kept,
+  // in a max-heap whose root is the first row to give up its slot
+  bool top_n;
+  uint64_t limit;
+
+  // Rows held in memory and pointers to them, sorted once a run is done
+  uint8_t *rows;
+  uint8_t **order;
+  uint32_t num_rows;
+  uint32_t allocated; // Row slots allocated so far
+  uint32_t capacity;  // Row slots the budget allows
+
+  SortRun *runs;
+  uint32_t num_runs;
+
+  // Output: either the in-memory order or a merge over the runs
+  uint32_t next;
+  uint32_t *heap; // Run indexes, the run with the smallest row first
+  uint32_t heap_size;
+  uint8_t *current; // The row last returned by the merge
+
+  // For EXPLAIN ANALYZE
+  uint64_t rows_in;
+  uint64_t runs_spilled;
+  uint64_t bytes_spilled;
+  uint32_t merge_passes;
+} Sorter;
+
+// Describe one column of table_def as a sort key
+void sort_key_init(SortKey *key, TableDef *table_def, uint32_t column_idx,
+                   bool descending);
+
+// Compare the key's column in two rows, ignoring the key's direction
+int sort_compare_key(const SortKey *key, const uint8_t *a, const uint8_t *b);
+
+// Resolve the ORDER BY columns. Returns false and fills error if one does
+// not exist.
+bool sort_spec_build(TableDef *table_def, const SqlOrderBy *order_by,
+                     uint32_t num_order_by, SortSpec *spec, char *error,
+                     size_t error_size);
+
+// Negative, zero or positive as row a sorts before, with or after row b
+int sort_compare_rows(const SortSpec *spec, const uint8_t *a, const uint8_t *b);
+
+// Whether LIMIT limit can be answered by the top-N heap within the budget
+bool sort_fits_top_n(const SortSpec *spec, size_t memory_budget,
+                     uint64_t limit);
+
+// Without a limit every row is sorted, spilling runs once the budget is
+// full. With one that fits the budget only the top limit rows are kept.
+void sorter_init(Sorter *sorter, const SortSpec *spec, size_t memory_budget,
+                 bool has_limit, uint64_t limit);
+// Copy a deserialized row into the sort; safe to call from several threads
+void sorter_add(Sorter *sorter, const uint8_t *row);
+// No more rows: sort what is in memory and set up the merge
+void sorter_finish(Sorter *sorter);
+// Next row in order, or NULL. The row stays valid until the next call.
+const uint8_t *sorter_next(Sorter *sorter);
+void sorter_free(Sorter *sorter);
+
+#endif
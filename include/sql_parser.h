@@ -0,0 +1,238 @@
+#ifndef SQL_PARSER_H
+#define SQL_PARSER_H
+
+#include "db_types.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define SQL_MAX_TOKEN_TEXT 256
+#define SQL_MAX_ERROR 128
+#define MAX_PLAN_NAME 64
+#define MAX_PREPARED_STATEMENTS 32
+
+typedef enum
+{
+  SQL_TOKEN_IDENTIFIER, // Bare words, including keywords
+  SQL_TOKEN_NUMBER,
+  SQL_TOKEN_STRING,     // Quoted with ' or "
+  SQL_TOKEN_PARAM,      // ? or $N placeholder
+  SQL_TOKEN_STAR,
+  SQL_TOKEN_COMMA,
+  SQL_TOKEN_DOT,
+  SQL_TOKEN_LPAREN,
+  SQL_TOKEN_RPAREN,
+  SQL_TOKEN_SEMICOLON,
+  SQL_TOKEN_EQ,
+  SQL_TOKEN_NE,
+  SQL_TOKEN_LT,
+  SQL_TOKEN_LE,
+  SQL_TOKEN_GT,
+  SQL_TOKEN_GE,
+  SQL_TOKEN_END,
+  SQL_TOKEN_ERROR
+} SqlTokenType;
+
+typedef struct
+{
+  SqlTokenType type;
+  const char *start; // Points into the source text
+  uint32_t length;
+  uint32_t param_index; // For SQL_TOKEN_PARAM, zero based
+} SqlToken;
+
+typedef struct
+{
+  const char *source;
+  const char *current;
+  uint32_t next_param; // Next index handed out to a bare ?
+} SqlLexer;
+
+typedef enum
+{
+  SQL_VALUE_LITERAL,
+  SQL_VALUE_PARAM
+} SqlValueKind;
+
+typedef struct
+{
+  SqlValueKind kind;
+  char text[SQL_MAX_TOKEN_TEXT]; // Literal text with quotes removed
+  bool quoted;
+  uint32_t param_index;
+} SqlValue;
+
+// UPDATE ... SET column = value
+typedef struct
+{
+  char column[MAX_COLUMN_NAME];
+  SqlValue value;
+} SqlAssignment;
+
+typedef enum
+{
+  SQL_EXPR_COMPARE,
+  SQL_EXPR_AND,
+  SQL_EXPR_OR
+} SqlExprType;
+
+typedef enum
+{
+  SQL_OP_EQ,
+  SQL_OP_NE,
+  SQL_OP_LT,
+  SQL_OP_LE,
+  SQL_OP_GT,
+  SQL_OP_GE,
+  SQL_OP_LIKE,
+  SQL_OP_MATCH // Words of a STRING column, see fulltext_index.h
+} SqlCompareOp;
+
+typedef struct SqlExpr
+{
+  SqlExprType type;
+  // SQL_EXPR_COMPARE: column op value, or func(column) op value
+  char column[MAX_COLUMN_NAME];
+  ColumnFunc func;
+  SqlCompareOp op;
+  SqlValue value;
+  // SQL_EXPR_AND / SQL_EXPR_OR
+  struct SqlExpr *left;
+  struct SqlExpr *right;
+} SqlExpr;
+
+typedef struct
+{
+  char column[MAX_COLUMN_NAME];
+  bool descending;
+} SqlOrderBy;
+
+// SELECT ... FROM a JOIN b ON a.x = b.y
+typedef struct
+{
+  char table[MAX_TABLE_NAME];
+  char alias[MAX_TABLE_NAME]; // Empty if none was given
+  // The ON columns as written, possibly qualified
+  char left_column[MAX_COLUMN_NAME];
+  char right_column[MAX_COLUMN_NAME];
+} SqlJoin;
+
+typedef enum
+{
+  SQL_AGG_NONE, // A plain column
+  SQL_AGG_COUNT,
+  SQL_AGG_SUM,
+  SQL_AGG_AVG,
+  SQL_AGG_MIN,
+  SQL_AGG_MAX
+} SqlAggregateFunc;
+
+typedef enum
+{
+  SQL_SELECT,
+  SQL_INSERT,
+  SQL_UPDATE,
+  SQL_DELETE,
+  SQL_PREPARE,
+  SQL_EXECUTE,
+  SQL_DEALLOCATE,
+  SQL_ANALYZE
+} SqlStatementType;
+
+typedef struct SqlStatement
+{
+  SqlStatementType type;
+  char table_name[MAX_TABLE_NAME];
+  char table_alias[MAX_TABLE_NAME]; // SELECT ... FROM table alias
+  bool has_join;
+  SqlJoin join;
+  bool explain; // EXPLAIN SELECT: show the plan instead of running it
+  bool explain_analyze; // EXPLAIN ANALYZE SELECT: run it and profile it
+
+  // SELECT column list; empty means *. An aggregate call has its argument
+  // column (or "*" for COUNT(*)) here and the function in functions.
+  char (*columns)[MAX_COLUMN_NAME];
+  SqlAggregateFunc *functions;
+  uint32_t num_columns;
+  bool has_aggregates; // Some aggregate call, or a GROUP BY
+
+  // SELECT ... GROUP BY columns
+  char (*group_by)[MAX_COLUMN_NAME];
+  uint32_t num_group_by;
+
+  SqlExpr *where; // NULL if there is no WHERE clause
+
+  // SELECT ... ORDER BY keys, most significant first
+  SqlOrderBy *order_by;
+  uint32_t num_order_by;
+
+  // SELECT ... LIMIT n OFFSET m
+  bool has_limit;
+  uint32_t limit;
+  uint32_t offset;
+
+  // INSERT values, or EXECUTE arguments
+  SqlValue *values;
+  uint32_t num_values;
+
+  // UPDATE ... SET column = value { ',' column = value }
+  SqlAssignment *assignments;
+  uint32_t num_assignments;
+
+  // PREPARE / EXECUTE / DEALLOCATE
+  char plan_name[MAX_PLAN_NAME];
+  struct SqlStatement *body; // Statement being prepared
+
+  uint32_t num_params; // Placeholders the statement expects
+} SqlStatement;
+
+// Named statements kept parsed between executions
+typedef struct
+{
+  char name[MAX_PLAN_NAME];
+  SqlStatement *statement;
+  uint32_t executions;
+  // The access path its executions reuse (see query_planner.h), allocated
+  // by the first one
+  struct PlanChoice *choice;
+} PreparedPlan;
+
+typedef struct
+{
+  PreparedPlan plans[MAX_PREPARED_STATEMENTS];
+  uint32_t num_plans;
+} PlanCache;
+
+// Lexer
+void sql_lexer_init(SqlLexer *lexer, const char *source);
+SqlToken sql_lexer_next(SqlLexer *lexer);
+
+// Parse one statement. Returns NULL and fills error on failure.
+SqlStatement *sql_parse(const char *source, char *error, size_t error_size);
+void sql_statement_free(SqlStatement *statement);
+
+// Parse a bare condition, as written after WHERE. Placeholders are not
+// allowed. Returns NULL and fills error on failure.
+SqlExpr *sql_parse_expr(const char *source, char *error, size_t error_size);
+
+// Parse a column or a function of one, as CREATE INDEX names what it keys
+// on: "email" or "lower(email)". Returns false and fills error on failure.
+bool sql_parse_column_func(const char *source, char *column, ColumnFunc *func,
+                           char *error, size_t error_size);
+
+// Deep copy of an expression with placeholders replaced by args. Returns
+// NULL if a placeholder has no matching argument.
+SqlExpr *sql_expr_bind(const SqlExpr *expr, const SqlValue *args,
+                       uint32_t num_args);
+void sql_expr_free(SqlExpr *expr);
+
+// True for statements sql_parse understands, judged by the first keyword
+bool sql_is_parsable(const char *source);
+
+// Plan cache
+bool plan_cache_put(PlanCache *cache, const char *name, SqlStatement *statement);
+PreparedPlan *plan_cache_get(PlanCache *cache, const char *name);
+bool plan_cache_remove(PlanCache *cache, const char *name);
+void plan_cache_clear(PlanCache *cache);
+
+#endif
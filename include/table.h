@@ -57,12 +57,20 @@ struct Table
 {
   Pager *pager;
   uint32_t root_page_num;
+  KeyDesc key; // From the table definition; index trees keep the default
+  HotIndex *hot_index; // In-memory key to row map, NULL unless enabled
+  BitmapIndex *bitmap_index; // Decoded bitmap index file, NULL until used
+  FullTextIndex *fulltext_index; // Decoded full-text index file, likewise
+  IndexPredicate *index_predicate; // Compiled WHERE of a partial index file
 };
 
 Table *new_table();
 void free_table(Table *table);
 void *row_slot(Table *table, uint32_t row_num);
 Table *db_open(const char *file_name);
+// Key the table's tree as its definition says. An empty tree is stamped
+// with the key width; a tree with rows must already have it.
+void table_set_key(Table *table, const KeyDesc *key);
 
 void db_close(Table *table);
 // Functions to work with dynamic rows
@@ -74,8 +82,11 @@ void dynamic_row_set_boolean(DynamicRow *row, TableDef *table_def, uint32_t col_
 void dynamic_row_set_date(DynamicRow *row, TableDef *table_def, uint32_t col_idx, int32_t value);
 void dynamic_row_set_time(DynamicRow *row, TableDef *table_def, uint32_t col_idx, int32_t value);
 void dynamic_row_set_timestamp(DynamicRow *row, TableDef *table_def, uint32_t col_idx, int64_t value);
+void dynamic_row_set_bigint(DynamicRow *row, TableDef *table_def, uint32_t col_idx, int64_t value);
 void dynamic_row_set_blob(DynamicRow *row, TableDef *table_def, uint32_t col_idx, const void *data, uint32_t size);
 
+uint32_t get_column_offset(TableDef *table_def, uint32_t col_idx);
+
 int32_t dynamic_row_get_int(DynamicRow *row, TableDef *table_def, uint32_t col_idx);
 char *dynamic_row_get_string(DynamicRow *row, TableDef *table_def, uint32_t col_idx);
 float dynamic_row_get_float(DynamicRow *row, TableDef *table_def, uint32_t col_idx);
@@ -83,6 +94,7 @@ bool dynamic_row_get_boolean(DynamicRow *row, TableDef *table_def, uint32_t col_
 int32_t dynamic_row_get_date(DynamicRow *row, TableDef *table_def, uint32_t col_idx);
 int32_t dynamic_row_get_time(DynamicRow *row, TableDef *table_def, uint32_t col_idx);
 int64_t dynamic_row_get_timestamp(DynamicRow *row, TableDef *table_def, uint32_t col_idx);
+int64_t dynamic_row_get_bigint(DynamicRow *row, TableDef *table_def, uint32_t col_idx);
 void *dynamic_row_get_blob(DynamicRow *row, TableDef *table_def, uint32_t col_idx, uint32_t *size);
 
 void dynamic_row_free(DynamicRow *row);
@@ -0,0 +1,53 @@
+#ifndef TABLE_CACHE_H
+#define TABLE_CACHE_H
+
+#include "table.h"
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// Table and index files stay open after their last user lets go, so
+// switching tables or reopening an index does not pay a full open, flush
+// and close. Unreferenced handles are closed least recently used first once
+// there are more than this many, or once all open files together hold more
+// than TABLE_CACHE_MAX_PAGES pages in memory.
+#define TABLE_CACHE_CAPACITY 16
+#define TABLE_CACHE_MAX_PAGES (4 * TABLE_MAX_PAGES)
+
+typedef struct
+{
+  char filename[256];
+  Table *table;
+  uint32_t refcount;
+  uint64_t last_used;
+} TableHandle;
+
+typedef struct
+{
+  TableHandle handles[TABLE_CACHE_CAPACITY];
+  uint32_t num_handles;
+  uint64_t clock;
+  pthread_mutex_t lock;
+
+  // For .tablecache
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t evictions;
+} TableCache;
+
+// The open table for filename, opening it if no handle is cached. Every
+// acquire is paired with a table_cache_release. Callers set root_page_num
+// from the catalog as they would after db_open.
+Table *table_cache_acquire(const char *filename);
+
+// Give up a reference. The handle stays open for the next acquire. A table
+// the cache had no room for is closed here.
+void table_cache_release(Table *table);
+
+// Flush and close every unreferenced handle, e.g. when the database closes
+void table_cache_close_all(void);
+
+// Print the open handles and hit counts
+void table_cache_print(void);
+
+#endif
@@ -0,0 +1,61 @@
+#ifndef TABLE_STATS_H
+#define TABLE_STATS_H
+
+#include "db_types.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#define STATS_HISTOGRAM_BUCKETS 16
+#define HLL_PRECISION 10
+#define HLL_REGISTERS (1 << HLL_PRECISION)
+
+// Used by the planner until ANALYZE has run
+#define STATS_DEFAULT_EQ_SELECTIVITY 0.005
+#define STATS_DEFAULT_RANGE_SELECTIVITY (1.0 / 3.0)
+#define STATS_DEFAULT_LIKE_SELECTIVITY 0.1
+
+typedef struct
+{
+  double distinct; // HyperLogLog estimate
+  // Numeric columns only: min, max and the upper bound of each equi-depth
+  // bucket (every bucket holds the same number of rows)
+  bool has_range;
+  double min_value;
+  double max_value;
+  uint32_t num_buckets;
+  double bucket_bounds[STATS_HISTOGRAM_BUCKETS];
+} ColumnStats;
+
+typedef struct
+{
+  bool analyzed;
+  uint32_t row_count;
+  uint32_t leaf_pages;
+  uint32_t depth; // Levels from the root to the leaves, 1 for a lone leaf
+  ColumnStats columns[MAX_COLUMNS];
+} TableStats;
+
+// HyperLogLog sketch used while collecting
+typedef struct
+{
+  uint8_t registers[HLL_REGISTERS];
+} HyperLogLog;
+
+void hll_init(HyperLogLog *hll);
+void hll_add(HyperLogLog *hll, uint64_t hash);
+double hll_estimate(const HyperLogLog *hll);
+
+// Scan the table once and replace stats with what was found
+void table_stats_collect(Table *table, TableDef *table_def, TableStats *stats);
+
+void table_stats_print(const TableStats *stats, TableDef *table_def);
+
+// Fraction of rows where column = value
+double stats_eq_selectivity(const TableStats *stats, uint32_t column_idx);
+
+// Fraction of rows where column < value (or <= if inclusive), from the
+// histogram when there is one
+double stats_less_selectivity(const TableStats *stats, uint32_t column_idx,
+                              double value, bool inclusive);
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef VECTOR_FILTER_H
+#define VECTOR_FILTER_H
+
+#include "schema.h"
+#include "table.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+// A leaf cell is at least its header, so this bounds the cells in one leaf
+#define VECTOR_BATCH_MAX 512
+#define SELECTION_WORDS (VECTOR_BATCH_MAX / 64)
+
+// A "column = literal" predicate with the literal parsed once up front
+typedef struct
+{
+  ColumnType type;
+  uint32_t column_offset; // Byte offset of the column within a row
+  int32_t int_value;
+  float float_value;
+  uint8_t bool_value;
+  char string_value[COLUMN_EMAIL_SIZE + 1]; // Lower-cased literal
+  uint32_t string_length;
+  bool never_matches; // Column type has no equality support
+} CompiledPredicate;
+
+// One bit per row of a batch; bit i set means row i passed the predicate
+typedef struct
+{
+  uint64_t words[SELECTION_WORDS];
+} SelectionBitmap;
+
+void predicate_compile(TableDef *table_def, uint32_t column_idx,
+                       const char *literal, CompiledPredicate *predicate);
+
+// Evaluate the predicate over every row of a leaf node. The row values of
+// the leaf are written to values (in cell order) so callers can project the
+// selected rows without walking the cells again. Returns the number of cells.
+uint32_t predicate_eval_leaf(void *node, const CompiledPredicate *predicate,
+                             void **values, SelectionBitmap *selection);
+
+static inline bool selection_test(const SelectionBitmap *selection, uint32_t i)
+{
+  return (selection->words[i / 64] >> (i % 64)) & 1;
+}
+
+// Name of the kernel chosen at startup ("avx2", "sse2" or "scalar")
+const char *vector_filter_isa();
+// Switch to the named kernels, so tests can check each against the row
+// predicates. False if the CPU or the build has none by that name. Not to
+// be called while a scan runs.
+bool vector_filter_use_isa(const char *isa);
+
+#endif
@@ -0,0 +1,593 @@
+#include "../include/aggregate.h"
+#include "../include/catalog.h"
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+// Hash bits that pick a spill partition, per level
+#define AGGREGATE_SPILL_BITS 3
+#define AGGREGATE_INITIAL_SLOTS 64
+
+// Running state of one aggregate in a group. MIN and MAX keep the current
+// value's column bytes right after it.
+typedef struct
+{
+  uint64_t count;
+  int64_t int_sum;
+  double float_sum;
+} AggregateState;
+
+static const char *function_name(SqlAggregateFunc function)
+{
+  switch (function)
+  {
+  case SQL_AGG_COUNT:
+    return "count";
+  case SQL_AGG_SUM:
+    return "sum";
+  case SQL_AGG_AVG:
+    return "avg";
+  case SQL_AGG_MIN:
+    return "min";
+  case SQL_AGG_MAX:
+    return "max";
+  default:
+    return "";
+  }
+}
+
+static uint32_t align8(uint32_t size)
+{
+  return (size + 7) & ~7u;
+}
+
+bool aggregate_spec_build(TableDef *table_def, char **columns,
+                          const SqlAggregateFunc *functions,
+                          uint32_t num_columns,
+                          char (*group_by)[MAX_COLUMN_NAME],
+                          uint32_t num_group_by, AggregateSpec *spec,
+                          char *error, size_t error_size)
+{
+  memset(spec, 0, sizeof(AggregateSpec));
+  if (num_columns == 0)
+  {
+    snprintf(error, error_size, "SELECT * cannot be used with GROUP BY");
+    return false;
+  }
+
+  uint32_t key_offsets[MAX_COLUMNS];
+  for (uint32_t g = 0; g < num_group_by && g < MAX_COLUMNS; g++)
+  {
+    int column_idx = table_def_find_column(table_def, group_by[g]);
+    if (column_idx == -1)
+    {
+      snprintf(error, error_size, "unknown column '%s' in GROUP BY",
+               group_by[g]);
+      return false;
+    }
+    SortKey *key = &spec->group_keys[spec->num_group_keys++];
+    sort_key_init(key, table_def, column_idx, false);
+    key_offsets[g] = spec->key_size;
+    spec->key_size += key->width;
+  }
+
+  uint32_t state_end = align8(spec->key_size);
+  spec->count_only = spec->num_group_keys == 0;
+  for (uint32_t i = 0; i < num_columns && i < MAX_COLUMNS; i++)
+  {
+    AggregateOutput *output = &spec->outputs[spec->num_outputs++];
+    output->function = functions ? functions[i] : SQL_AGG_NONE;
+    output->column = -1;
+    if (strcmp(columns[i], "*") == 0)
+    {
+      snprintf(output->name, sizeof(output->name), "count(*)");
+    }
+    else
+    {
+      output->column = table_def_find_column(table_def, columns[i]);
+      if (output->column == -1)
+      {
+        snprintf(error, error_size, "unknown column '%s'", columns[i]);
+        return false;
+      }
+      sort_key_init(&output->value, table_def, output->column, false);
+      const char *name = table_def->columns[output->column].name;
+      if (output->function == SQL_AGG_NONE)
+      {
+        snprintf(output->name, sizeof(output->name), "%s", name);
+      }
+      else
+      {
+        snprintf(output->name, sizeof(output->name), "%s(%s)",
+                 function_name(output->function), name);
+      }
+    }
+
+    ColumnType type = output->column >= 0
+                          ? table_def->columns[output->column].type
+                          : COLUMN_TYPE_INT;
+    switch (output->function)
+    {
+    case SQL_AGG_NONE:
+    {
+      uint32_t g = 0;
+      while (g < spec->num_group_keys &&
+             spec->group_keys[g].column != (uint32_t)output->column)
+      {
+        g++;
+      }
+      if (g == spec->num_group_keys)
+      {
+        snprintf(error, error_size,
+                 "column '%s' must appear in GROUP BY or be used in an "
+                 "aggregate",
+                 columns[i]);
+        return false;
+      }
+      output->offset = key_offsets[g];
+      break;
+    }
+    case SQL_AGG_SUM:
+    case SQL_AGG_AVG:
+      if (type == COLUMN_TYPE_STRING || type == COLUMN_TYPE_BLOB)
+      {
+        snprintf(error, error_size, "%s needs a numeric column, '%s' is not",
+                 function_name(output->function), columns[i]);
+        return false;
+      }
+      output->offset = state_end;
+      state_end += align8(sizeof(AggregateState));
+      break;
+    case SQL_AGG_MIN:
+    case SQL_AGG_MAX:
+      if (type == COLUMN_TYPE_BLOB)
+      {
+        snprintf(error, error_size, "%s cannot compare BLOB column '%s'",
+                 function_name(output->function), columns[i]);
+        return false;
+      }
+      output->offset = state_end;
+      state_end += align8(sizeof(AggregateState) + output->value.width);
+      break;
+    case SQL_AGG_COUNT:
+      output->offset = state_end;
+      state_end += align8(sizeof(AggregateState));
+      break;
+    }
+    if (output->function != SQL_AGG_COUNT)
+    {
+      spec->count_only = false;
+    }
+  }
+  spec->group_size = state_end;
+
+  SortKey last;
+  sort_key_init(&last, table_def, table_def->num_columns - 1, false);
+  spec->row_size = last.offset + last.width;
+  return true;
+}
+
+// FNV-1a followed by a 64-bit finalizer, so both the low bits (table
+// slots) and the high bits (spill partitions) are usable. String equality
+// ignores case, so string columns are hashed lowered.
+static uint64_t hash_key(const AggregateSpec *spec, const uint8_t *key)
+{
+  uint64_t hash = 14695981039346656037ULL;
+  for (uint32_t g = 0; g < spec->num_group_keys; g++)
+  {
+    const SortKey *column = &spec->group_keys[g];
+    bool fold_case = column->type == COLUMN_TYPE_STRING;
+    for (uint32_t i = 0; i < column->width; i++)
+    {
+      uint8_t c = fold_case ? (uint8_t)tolower(key[i]) : key[i];
+      hash = (hash ^ c) * 1099511628211ULL;
+    }
+    key += column->width;
+  }
+  hash ^= hash >> 33;
+  hash *= 0xff51afd7ed558ccdULL;
+  hash ^= hash >> 33;
+  hash *= 0xc4ceb9fe1a85ec53ULL;
+  hash ^= hash >> 33;
+  return hash;
+}
+
+static void make_key(const AggregateSpec *spec, const uint8_t *row,
+                     uint8_t *key)
+{
+  for (uint32_t g = 0; g < spec->num_group_keys; g++)
+  {
+    const SortKey *column = &spec->group_keys[g];
+    if (column->type == COLUMN_TYPE_STRING)
+    {
+      // Bytes after the terminator are not part of the value
+      strncpy((char *)key, (const char *)row + column->offset, column->width);
+    }
+    else
+    {
+      memcpy(key, row + column->offset, column->width);
+    }
+    key += column->width;
+  }
+}
+
+// True if two keys are the same group; a group keeps the spelling of its
+// first row
+static bool same_key(const AggregateSpec *spec, const uint8_t *a,
+                     const uint8_t *b)
+{
+  for (uint32_t g = 0; g < spec->num_group_keys; g++)
+  {
+    const SortKey *column = &spec->group_keys[g];
+    if (column->type == COLUMN_TYPE_STRING
+            ? strncasecmp((const char *)a, (const char *)b, column->width) != 0
+            : memcmp(a, b, column->width) != 0)
+    {
+      return false;
+    }
+    a += column->width;
+    b += column->width;
+  }
+  return true;
+}
+
+static void add_numeric(AggregateState *state, const SortKey *column,
+                        const uint8_t *row)
+{
+  const uint8_t *value = row + column->offset;
+  switch (column->type)
+  {
+  case COLUMN_TYPE_FLOAT:
+  {
+    float f;
+    memcpy(&f, value, sizeof(f));
+    state->float_sum += f;
+    break;
+  }
+  case COLUMN_TYPE_BIGINT:
+  case COLUMN_TYPE_TIMESTAMP:
+  {
+    int64_t i;
+    memcpy(&i, value, sizeof(i));
+    state->int_sum += i;
+    break;
+  }
+  case COLUMN_TYPE_BOOLEAN:
+    state->int_sum += value[0];
+    break;
+  default:
+  {
+    int32_t i;
+    memcpy(&i, value, sizeof(i));
+    state->int_sum += i;
+    break;
+  }
+  }
+}
+
+static void accumulate(const AggregateSpec *spec, uint8_t *group,
+                       const uint8_t *row)
+{
+  for (uint32_t i = 0; i < spec->num_outputs; i++)
+  {
+    const AggregateOutput *output = &spec->outputs[i];
+    AggregateState *state = (AggregateState *)(group + output->offset);
+    switch (output->function)
+    {
+    case SQL_AGG_NONE:
+      break;
+    case SQL_AGG_COUNT:
+      state->count++;
+      break;
+    case SQL_AGG_SUM:
+    case SQL_AGG_AVG:
+      add_numeric(state, &output->value, row);
+      state->count++;
+      break;
+    case SQL_AGG_MIN:
+    case SQL_AGG_MAX:
+    {
+      const uint8_t *value = row + output->value.offset;
+      uint8_t *current = (uint8_t *)(state + 1);
+      SortKey stored = output->value;
+      stored.offset = 0;
+      int cmp = state->count ? sort_compare_key(&stored, value, current) : 0;
+      if (state->count == 0 || (output->function == SQL_AGG_MIN && cmp < 0) ||
+          (output->function == SQL_AGG_MAX && cmp > 0))
+      {
+        memcpy(current, value, output->value.width);
+      }
+      state->count++;
+      break;
+    }
+    }
+  }
+}
+
+static AggregateSlot *lookup(Aggregator *aggregator, uint64_t hash)
+{
+  uint32_t mask = aggregator->capacity - 1;
+  for (uint32_t i = hash & mask;; i = (i + 1) & mask)
+  {
+    AggregateSlot *slot = &aggregator->slots[i];
+    if (!slot->group ||
+        (slot->hash == hash &&
+         same_key(&aggregator->spec, slot->group, aggregator->key)))
+    {
+      return slot;
+    }
+  }
+}
+
+static void grow(Aggregator *aggregator)
+{
+  AggregateSlot *old_slots = aggregator->slots;
+  uint32_t old_capacity = aggregator->capacity;
+  aggregator->capacity *= 2;
+  aggregator->slots = calloc(aggregator->capacity, sizeof(AggregateSlot));
+  uint32_t mask = aggregator->capacity - 1;
+  for (uint32_t i = 0; i < old_capacity; i++)
+  {
+    if (!old_slots[i].group)
+    {
+      continue;
+    }
+    uint32_t j = old_slots[i].hash & mask;
+    while (aggregator->slots[j].group)
+    {
+      j = (j + 1) & mask;
+    }
+    aggregator->slots[j] = old_slots[i];
+  }
+  free(old_slots);
+}
+
+static size_t memory_used(Aggregator *aggregator)
+{
+  return aggregator->arena.allocated +
+         aggregator->capacity * sizeof(AggregateSlot);
+}
+
+// Park a row whose group has no room in the table. Returns false if no
+// partition file could be created.
+static bool spill_row(Aggregator *aggregator, uint64_t hash, const uint8_t *row)
+{
+  uint32_t shift = 64 - AGGREGATE_SPILL_BITS * (aggregator->level + 1);
+  uint32_t partition = (hash >> shift) & (AGGREGATE_SPILL_PARTITIONS - 1);
+  if (!aggregator->spill[partition])
+  {
+    aggregator->spill[partition] = tmpfile();
+    if (!aggregator->spill[partition])
+    {
+      return false;
+    }
+  }
+  fwrite(row, aggregator->spec.row_size, 1, aggregator->spill[partition]);
+  aggregator->rows_spilled++;
+  return true;
+}
+
+static uint8_t *find_or_create_group(Aggregator *aggregator, uint64_t hash,
+                                     const uint8_t *row)
+{
+  AggregateSlot *slot = lookup(aggregator, hash);
+  if (slot->group)
+  {
+    return slot->group;
+  }
+
+  // Groups already in the table keep absorbing their rows; new ones go to
+  // disk once the table is full
+  const AggregateSpec *spec = &aggregator->spec;
+  if (row && aggregator->level < AGGREGATE_MAX_SPILL_LEVELS &&
+      aggregator->num_groups > 0 &&
+      memory_used(aggregator) + spec->group_size > aggregator->memory_budget &&
+      spill_row(aggregator, hash, row))
+  {
+    return NULL;
+  }
+
+  uint8_t *group = arena_alloc(&aggregator->arena, spec->group_size);
+  memcpy(group, aggregator->key, spec->key_size);
+  slot->hash = hash;
+  slot->group = group;
+  aggregator->num_groups++;
+  if (aggregator->num_groups * 2 > aggregator->capacity)
+  {
+    grow(aggregator);
+  }
+  return group;
+}
+
+static void aggregate_row(Aggregator *aggregator, const uint8_t *row)
+{
+  make_key(&aggregator->spec, row, aggregator->key);
+  uint64_t hash = hash_key(&aggregator->spec, aggregator->key);
+  uint8_t *group = find_or_create_group(aggregator, hash, row);
+  if (group)
+  {
+    accumulate(&aggregator->spec, group, row);
+  }
+}
+
+void aggregator_init(Aggregator *aggregator, const AggregateSpec *spec,
+                     size_t memory_budget)
+{
+  memset(aggregator, 0, sizeof(Aggregator));
+  aggregator->spec = *spec;
+  aggregator->memory_budget = memory_budget;
+  pthread_mutex_init(&aggregator->lock, NULL);
+  arena_init(&aggregator->arena);
+  aggregator->capacity = AGGREGATE_INITIAL_SLOTS;
+  aggregator->slots = calloc(aggregator->capacity, sizeof(AggregateSlot));
+  aggregator->key = calloc(1, spec->key_size + 1);
+}
+
+void aggregator_add(Aggregator *aggregator, const uint8_t *row)
+{
+  pthread_mutex_lock(&aggregator->lock);
+  aggregator->rows_in++;
+  aggregate_row(aggregator, row);
+  pthread_mutex_unlock(&aggregator->lock);
+}
+
+void aggregator_add_count(Aggregator *aggregator, uint64_t rows)
+{
+  pthread_mutex_lock(&aggregator->lock);
+  aggregator->rows_in += rows;
+  uint8_t *group = find_or_create_group(
+      aggregator, hash_key(&aggregator->spec, aggregator->key), NULL);
+  const AggregateSpec *spec = &aggregator->spec;
+  for (uint32_t i = 0; i < spec->num_outputs; i++)
+  {
+    if (spec->outputs[i].function == SQL_AGG_COUNT)
+    {
+      ((AggregateState *)(group + spec->outputs[i].offset))->count += rows;
+    }
+  }
+  pthread_mutex_unlock(&aggregator->lock);
+}
+
+// Queue this level's partition files for after the table is output
+static void queue_spills(Aggregator *aggregator)
+{
+  for (uint32_t p = 0; p < AGGREGATE_SPILL_PARTITIONS; p++)
+  {
+    if (!aggregator->spill[p])
+    {
+      continue;
+    }
+    aggregator->pending =
+        realloc(aggregator->pending,
+                (aggregator->num_pending + 1) * sizeof(AggregatePartition));
+    AggregatePartition *partition =
+        &aggregator->pending[aggregator->num_pending++];
+    partition->file = aggregator->spill[p];
+    partition->level = aggregator->level + 1;
+    aggregator->spill[p] = NULL;
+    aggregator->partitions_spilled++;
+  }
+  aggregator->next_slot = 0;
+}
+
+void aggregator_finish(Aggregator *aggregator)
+{
+  // Without GROUP BY there is exactly one group, even over no rows
+  if (aggregator->spec.num_group_keys == 0 && aggregator->num_groups == 0)
+  {
+    find_or_create_group(aggregator,
+                         hash_key(&aggregator->spec, aggregator->key), NULL);
+  }
+  queue_spills(aggregator);
+}
+
+// Start over with an empty table for a spilled partition
+static void load_partition(Aggregator *aggregator,
+                           AggregatePartition *partition)
+{
+  arena_free(&aggregator->arena);
+  memset(aggregator->slots, 0, aggregator->capacity * sizeof(AggregateSlot));
+  aggregator->num_groups = 0;
+  aggregator->level = partition->level;
+
+  uint8_t *row = malloc(aggregator->spec.row_size);
+  rewind(partition->file);
+  while (fread(row, aggregator->spec.row_size, 1, partition->file) == 1)
+  {
+    aggregate_row(aggregator, row);
+  }
+  free(row);
+  fclose(partition->file);
+  queue_spills(aggregator);
+}
+
+const uint8_t *aggregator_next(Aggregator *aggregator)
+{
+  for (;;)
+  {
+    while (aggregator->next_slot < aggregator->capacity)
+    {
+      AggregateSlot *slot = &aggregator->slots[aggregator->next_slot++];
+      if (slot->group)
+      {
+        return slot->group;
+      }
+    }
+    if (aggregator->num_pending == 0)
+    {
+      return NULL;
+    }
+    AggregatePartition partition =
+        aggregator->pending[--aggregator->num_pending];
+    load_partition(aggregator, &partition);
+  }
+}
+
+void aggregator_value(const AggregateSpec *spec, const uint8_t *group,
+                      uint32_t output_idx, AggregateValue *value)
+{
+  const AggregateOutput *output = &spec->outputs[output_idx];
+  const AggregateState *state =
+      (const AggregateState *)(group + output->offset);
+  memset(value, 0, sizeof(AggregateValue));
+
+  switch (output->function)
+  {
+  case SQL_AGG_NONE:
+    value->kind = AGGREGATE_VALUE_COLUMN;
+    value->bytes = group + output->offset;
+    return;
+  case SQL_AGG_COUNT:
+    value->kind = AGGREGATE_VALUE_INT;
+    value->int_value = state->count;
+    return;
+  default:
+    break;
+  }
+
+  if (state->count == 0)
+  {
+    value->kind = AGGREGATE_VALUE_NULL;
+    return;
+  }
+  bool is_float = output->value.type == COLUMN_TYPE_FLOAT;
+  switch (output->function)
+  {
+  case SQL_AGG_SUM:
+    value->kind = is_float ? AGGREGATE_VALUE_FLOAT : AGGREGATE_VALUE_INT;
+    value->int_value = state->int_sum;
+    value->float_value = state->float_sum;
+    break;
+  case SQL_AGG_AVG:
+    value->kind = AGGREGATE_VALUE_FLOAT;
+    value->float_value =
+        (is_float ? state->float_sum : (double)state->int_sum) / state->count;
+    break;
+  default:
+    value->kind = AGGREGATE_VALUE_COLUMN;
+    value->bytes = (const uint8_t *)(state + 1);
+    break;
+  }
+}
+
+void aggregator_free(Aggregator *aggregator)
+{
+  for (uint32_t p = 0; p < AGGREGATE_SPILL_PARTITIONS; p++)
+  {
+    if (aggregator->spill[p])
+    {
+      fclose(aggregator->spill[p]);
+    }
+  }
+  for (uint32_t i = 0; i < aggregator->num_pending; i++)
+  {
+    fclose(aggregator->pending[i].file);
+  }
+  free(aggregator->pending);
+  free(aggregator->slots);
+  free(aggregator->key);
+  arena_free(&aggregator->arena);
+  pthread_mutex_destroy(&aggregator->lock);
+  memset(aggregator, 0, sizeof(Aggregator));
+}
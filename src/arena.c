@@ -0,0 +1,44 @@
+#include "../include/arena.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define ARENA_ALIGNMENT 8
+
+void arena_init(Arena *arena)
+{
+  arena->blocks = NULL;
+  arena->allocated = 0;
+}
+
+void *arena_alloc(Arena *arena, size_t size)
+{
+  size = (size + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+  ArenaBlock *block = arena->blocks;
+  if (!block || block->used + size > block->size)
+  {
+    // Oversized requests get a block of their own
+    size_t block_size = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+    block = malloc(sizeof(ArenaBlock) + block_size);
+    block->next = arena->blocks;
+    block->used = 0;
+    block->size = block_size;
+    arena->blocks = block;
+    arena->allocated += sizeof(ArenaBlock) + block_size;
+  }
+  void *memory = block->data + block->used;
+  block->used += size;
+  memset(memory, 0, size);
+  return memory;
+}
+
+void arena_free(Arena *arena)
+{
+  ArenaBlock *block = arena->blocks;
+  while (block)
+  {
+    ArenaBlock *next = block->next;
+    free(block);
+    block = next;
+  }
+  arena_init(arena);
+}
@@ -0,0 +1,608 @@
+#include "../include/bitmap_index.h"
+#include "../include/catalog.h"
+#include "../include/cursor.h"
+#include "../include/data_utils.h"
+#include "../include/expr_eval.h"
+#include "../include/page_stream.h"
+#include "../include/query_planner.h"
+#include "../include/secondary_index.h"
+#include "../include/table_cache.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+// The file's page stream (see page_stream.h) holds the header, then each
+// value's key size, key (padded to 4) and serialized bitmap.
+#define BITMAP_PAGE_HEADER 0x4D
+#define BITMAP_PAGE_DATA 0x44
+
+#define BITMAP_INDEX_MAGIC 0x584D4249 // "IBMX"
+
+typedef struct
+{
+  uint32_t magic;
+  uint32_t num_values;
+  uint32_t stream_bytes; // Header included
+} BitmapIndexHeader;
+
+bool bitmap_index_supports(ColumnType type)
+{
+  switch (type)
+  {
+  case COLUMN_TYPE_INT:
+  case COLUMN_TYPE_DATE:
+  case COLUMN_TYPE_TIME:
+  case COLUMN_TYPE_BIGINT:
+  case COLUMN_TYPE_TIMESTAMP:
+  case COLUMN_TYPE_BOOLEAN:
+  case COLUMN_TYPE_STRING:
+    return true;
+  default:
+    return false;
+  }
+}
+
+// The value of a column as the index stores it
+static void value_key_from_row(TableDef *table_def, uint32_t column_idx,
+                               DynamicRow *row, uint8_t *key,
+                               uint32_t *key_size)
+{
+  const uint8_t *value =
+      (const uint8_t *)row->data + get_column_offset(table_def, column_idx);
+  switch (table_def->columns[column_idx].type)
+  {
+  case COLUMN_TYPE_BIGINT:
+  case COLUMN_TYPE_TIMESTAMP:
+    memcpy(key, value, sizeof(int64_t));
+    *key_size = sizeof(int64_t);
+    break;
+  case COLUMN_TYPE_BOOLEAN:
+    key[0] = value[0] != 0;
+    *key_size = 1;
+    break;
+  case COLUMN_TYPE_STRING:
+  {
+    uint32_t limit = table_def->columns[column_idx].size;
+    uint32_t length = 0;
+    while (length < limit && length < BITMAP_INDEX_MAX_KEY - 1 && value[length])
+    {
+      key[length] = tolower(value[length]);
+      length++;
+    }
+    *key_size = length;
+    break;
+  }
+  default:
+    memcpy(key, value, sizeof(int32_t));
+    *key_size = sizeof(int32_t);
+    break;
+  }
+}
+
+// The value of a WHERE literal, parsed the way the filter parses it. False
+// if no stored value could equal it.
+static bool value_key_from_text(ColumnType type, const char *text,
+                                uint8_t *key, uint32_t *key_size)
+{
+  switch (type)
+  {
+  case COLUMN_TYPE_BIGINT:
+  case COLUMN_TYPE_TIMESTAMP:
+  {
+    int64_t value = integer_literal_value(type, text);
+    memcpy(key, &value, sizeof(value));
+    *key_size = sizeof(value);
+    return true;
+  }
+  case COLUMN_TYPE_BOOLEAN:
+    key[0] = strcasecmp(text, "true") == 0 || strcmp(text, "1") == 0;
+    *key_size = 1;
+    return true;
+  case COLUMN_TYPE_STRING:
+  {
+    uint32_t length = strlen(text);
+    if (length >= BITMAP_INDEX_MAX_KEY)
+    {
+      return false;
+    }
+    for (uint32_t i = 0; i < length; i++)
+    {
+      key[i] = tolower((unsigned char)text[i]);
+    }
+    *key_size = length;
+    return true;
+  }
+  default:
+  {
+    int32_t value = (int32_t)integer_literal_value(type, text);
+    memcpy(key, &value, sizeof(value));
+    *key_size = sizeof(value);
+    return true;
+  }
+  }
+}
+
+static BitmapIndexValue *find_value(BitmapIndex *index, const uint8_t *key,
+                                    uint32_t key_size)
+{
+  for (uint32_t i = 0; i < index->num_values; i++)
+  {
+    BitmapIndexValue *value = &index->values[i];
+    if (value->key_size == key_size && memcmp(value->key, key, key_size) == 0)
+    {
+      return value;
+    }
+  }
+  return NULL;
+}
+
+static BitmapIndexValue *add_value(BitmapIndex *index, const uint8_t *key,
+                                   uint32_t key_size)
+{
+  if (index->num_values == index->capacity)
+  {
+    index->capacity = index->capacity ? index->capacity * 2 : 8;
+    index->values =
+        realloc(index->values, index->capacity * sizeof(BitmapIndexValue));
+  }
+  BitmapIndexValue *value = &index->values[index->num_values++];
+  value->key_size = key_size;
+  memcpy(value->key, key, key_size);
+  roaring_init(&value->rows);
+  return value;
+}
+
+static void remove_value(BitmapIndex *index, BitmapIndexValue *value)
+{
+  roaring_free(&value->rows);
+  *value = index->values[--index->num_values];
+}
+
+static void free_index(BitmapIndex *index)
+{
+  for (uint32_t i = 0; i < index->num_values; i++)
+  {
+    roaring_free(&index->values[i].rows);
+  }
+  free(index->values);
+  free(index);
+}
+
+static uint32_t padded(uint32_t size)
+{
+  return (size + 3) & ~3u;
+}
+
+bool bitmap_index_save(Table *index_table)
+{
+  BitmapIndex *index = index_table->bitmap_index;
+  size_t size = sizeof(BitmapIndexHeader);
+  for (uint32_t i = 0; i < index->num_values; i++)
+  {
+    size += sizeof(uint32_t) + padded(index->values[i].key_size) +
+            roaring_serialized_size(&index->values[i].rows);
+  }
+
+  uint8_t *stream = calloc(1, size);
+  BitmapIndexHeader header = {BITMAP_INDEX_MAGIC, index->num_values,
+                              (uint32_t)size};
+  uint8_t *at = stream + sizeof(header);
+  for (uint32_t i = 0; i < index->num_values; i++)
+  {
+    BitmapIndexValue *value = &index->values[i];
+    memcpy(at, &value->key_size, sizeof(uint32_t));
+    memcpy(at + sizeof(uint32_t), value->key, value->key_size);
+    at += sizeof(uint32_t) + padded(value->key_size);
+    at += roaring_serialize(&value->rows, at);
+  }
+
+  bool fits = size <= page_stream_capacity();
+  if (!fits)
+  {
+    printf("Error: Bitmap index no longer fits in its file; rebuild it "
+           "with fewer distinct values.\n");
+    header.magic = 0;
+    size = sizeof(header);
+  }
+  memcpy(stream, &header, sizeof(header));
+  index->dirty = false;
+  page_stream_write(index_table->pager, BITMAP_PAGE_HEADER, BITMAP_PAGE_DATA,
+                    stream, size);
+  free(stream);
+  return fits;
+}
+
+static BitmapIndex *load_index(Table *index_table)
+{
+  const uint8_t *start = page_stream_start(index_table->pager, BITMAP_PAGE_HEADER);
+  BitmapIndexHeader header;
+  if (!start)
+  {
+    return NULL;
+  }
+  memcpy(&header, start, sizeof(header));
+  if (header.magic != BITMAP_INDEX_MAGIC || header.stream_bytes < sizeof(header) ||
+      header.stream_bytes > page_stream_capacity())
+  {
+    return NULL;
+  }
+
+  uint8_t *stream = page_stream_read(index_table->pager, header.stream_bytes);
+
+  BitmapIndex *index = calloc(1, sizeof(BitmapIndex));
+  const uint8_t *at = stream + sizeof(header);
+  const uint8_t *end = stream + header.stream_bytes;
+  bool valid = true;
+  for (uint32_t i = 0; i < header.num_values && valid; i++)
+  {
+    uint32_t key_size;
+    if (end - at < (ptrdiff_t)sizeof(uint32_t))
+    {
+      valid = false;
+      break;
+    }
+    memcpy(&key_size, at, sizeof(uint32_t));
+    at += sizeof(uint32_t);
+    if (key_size >= BITMAP_INDEX_MAX_KEY || end - at < (ptrdiff_t)padded(key_size))
+    {
+      valid = false;
+      break;
+    }
+    BitmapIndexValue *value = add_value(index, at, key_size);
+    at += padded(key_size);
+    size_t used = roaring_deserialize(&value->rows, at, end - at);
+    valid = used > 0;
+    at += used;
+  }
+  free(stream);
+  if (!valid)
+  {
+    free_index(index);
+    return NULL;
+  }
+  return index;
+}
+
+void bitmap_index_reset(Table *index_table)
+{
+  bitmap_index_unload(index_table);
+  index_table->bitmap_index = calloc(1, sizeof(BitmapIndex));
+}
+
+BitmapIndex *bitmap_index_get(Table *index_table)
+{
+  if (!index_table->bitmap_index)
+  {
+    index_table->bitmap_index = load_index(index_table);
+  }
+  return index_table->bitmap_index;
+}
+
+void bitmap_index_flush(Table *index_table)
+{
+  if (index_table->bitmap_index && index_table->bitmap_index->dirty)
+  {
+    bitmap_index_save(index_table);
+  }
+}
+
+void bitmap_index_unload(Table *index_table)
+{
+  if (index_table->bitmap_index)
+  {
+    free_index(index_table->bitmap_index);
+    index_table->bitmap_index = NULL;
+  }
+}
+
+bool bitmap_index_build(Table *table, TableDef *table_def, IndexDef *index_def,
+                        Table *index_table)
+{
+  int column_idx = table_def_find_column(table_def, index_def->column_name);
+  uint32_t id_column = table_def->key_columns[0];
+
+  const CompiledExpr *predicate;
+  if (!index_predicate_get(index_table, table_def, index_def, &predicate))
+  {
+    return false;
+  }
+  bitmap_index_reset(index_table);
+  BitmapIndex *index = index_table->bitmap_index;
+
+  Cursor *cursor = table_start(table);
+  DynamicRow row;
+  dynamic_row_init(&row, table_def);
+  uint32_t records_indexed = 0;
+  while (!cursor->end_of_table)
+  {
+    deserialize_dynamic_row(cursor_value(cursor), table_def, &row);
+    if (!index_predicate_holds(predicate, &row))
+    {
+      cursor_advance(cursor);
+      continue;
+    }
+    uint8_t key[BITMAP_INDEX_MAX_KEY];
+    uint32_t key_size;
+    value_key_from_row(table_def, column_idx, &row, key, &key_size);
+    BitmapIndexValue *value = find_value(index, key, key_size);
+    if (!value)
+    {
+      value = add_value(index, key, key_size);
+    }
+    roaring_add(&value->rows, dynamic_row_get_int(&row, table_def, id_column));
+    records_indexed++;
+    cursor_advance(cursor);
+  }
+  dynamic_row_free(&row);
+  cursor_close(cursor);
+
+  if (!bitmap_index_save(index_table))
+  {
+    bitmap_index_unload(index_table);
+    return false;
+  }
+  printf("Index created with %u records in %u bitmaps.\n", records_indexed,
+         index->num_values);
+  return true;
+}
+
+bool bitmap_index_any(const TableDef *table_def)
+{
+  for (uint32_t i = 0; i < table_def->num_indexes; i++)
+  {
+    if (table_def->indexes[i].type == INDEX_TYPE_BITMAP)
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Move a row's id from the bitmap of its old value to the one of its new
+// value. old_row is NULL for an insert, new_row for a delete.
+static void move_row(BitmapIndex *index, TableDef *table_def,
+                     uint32_t column_idx, DynamicRow *old_row,
+                     DynamicRow *new_row)
+{
+  uint32_t id_column = table_def->key_columns[0];
+  index->dirty = true;
+  if (old_row)
+  {
+    uint8_t key[BITMAP_INDEX_MAX_KEY];
+    uint32_t key_size;
+    value_key_from_row(table_def, column_idx, old_row, key, &key_size);
+    BitmapIndexValue *value = find_value(index, key, key_size);
+    if (value)
+    {
+      roaring_remove(&value->rows,
+                     dynamic_row_get_int(old_row, table_def, id_column));
+      if (value->rows.num_containers == 0)
+      {
+        remove_value(index, value);
+      }
+    }
+  }
+  if (new_row)
+  {
+    uint8_t key[BITMAP_INDEX_MAX_KEY];
+    uint32_t key_size;
+    value_key_from_row(table_def, column_idx, new_row, key, &key_size);
+    BitmapIndexValue *value = find_value(index, key, key_size);
+    if (!value)
+    {
+      value = add_value(index, key, key_size);
+    }
+    roaring_add(&value->rows, dynamic_row_get_int(new_row, table_def, id_column));
+  }
+}
+
+// True if the write leaves the row's id in the bitmap it was in
+static bool same_value(TableDef *table_def, uint32_t column_idx,
+                       DynamicRow *old_row, DynamicRow *new_row)
+{
+  if (!old_row || !new_row)
+  {
+    return false;
+  }
+  uint32_t id_column = table_def->key_columns[0];
+  uint8_t old_key[BITMAP_INDEX_MAX_KEY], new_key[BITMAP_INDEX_MAX_KEY];
+  uint32_t old_size, new_size;
+  value_key_from_row(table_def, column_idx, old_row, old_key, &old_size);
+  value_key_from_row(table_def, column_idx, new_row, new_key, &new_size);
+  return old_size == new_size && memcmp(old_key, new_key, old_size) == 0 &&
+         dynamic_row_get_int(old_row, table_def, id_column) ==
+             dynamic_row_get_int(new_row, table_def, id_column);
+}
+
+bool bitmap_index_apply(TableDef *table_def, IndexDef *index_def,
+                        Table *index_table, DynamicRow *old_row,
+                        DynamicRow *new_row)
+{
+  int column_idx = table_def_find_column(table_def, index_def->column_name);
+  BitmapIndex *index = bitmap_index_get(index_table);
+  if (column_idx == -1 || !index)
+  {
+    return false;
+  }
+  if (index_predicate_filter(index_table, table_def, index_def, &old_row,
+                             &new_row) &&
+      !same_value(table_def, column_idx, old_row, new_row))
+  {
+    move_row(index, table_def, column_idx, old_row, new_row);
+  }
+  return true;
+}
+
+BitmapExpr *bitmap_expr_compile(const SqlExpr *expr, TableDef *table_def,
+                                const SqlExpr *where)
+{
+  if (expr->type != SQL_EXPR_COMPARE)
+  {
+    BitmapExpr *left = bitmap_expr_compile(expr->left, table_def, where);
+    BitmapExpr *right = left ? bitmap_expr_compile(expr->right, table_def, where) : NULL;
+    if (!right)
+    {
+      bitmap_expr_free(left);
+      return NULL;
+    }
+    BitmapExpr *node = calloc(1, sizeof(BitmapExpr));
+    node->type = expr->type;
+    node->left = left;
+    node->right = right;
+    return node;
+  }
+
+  if ((expr->op != SQL_OP_EQ && expr->op != SQL_OP_NE) ||
+      expr->func.type != COLUMN_FUNC_NONE)
+  {
+    return NULL;
+  }
+  int column_idx = table_def_find_column(table_def, expr->column);
+  if (column_idx == -1)
+  {
+    return NULL;
+  }
+  IndexDef *index = NULL;
+  for (uint32_t i = 0; i < table_def->num_indexes && !index; i++)
+  {
+    if (table_def->indexes[i].type == INDEX_TYPE_BITMAP &&
+        strcasecmp(table_def->indexes[i].column_name,
+                   table_def->columns[column_idx].name) == 0 &&
+        query_plan_index_usable(&table_def->indexes[i], where, table_def))
+    {
+      index = &table_def->indexes[i];
+    }
+  }
+  if (!index)
+  {
+    return NULL;
+  }
+
+  BitmapExpr *node = calloc(1, sizeof(BitmapExpr));
+  node->type = SQL_EXPR_COMPARE;
+  node->index = index;
+  node->negate = expr->op == SQL_OP_NE;
+  if (!value_key_from_text(table_def->columns[column_idx].type,
+                           expr->value.text, node->key, &node->key_size))
+  {
+    free(node);
+    return NULL;
+  }
+  node->literal = strdup(expr->value.text);
+  return node;
+}
+
+BitmapExpr *bitmap_expr_and(BitmapExpr *left, BitmapExpr *right)
+{
+  BitmapExpr *node = calloc(1, sizeof(BitmapExpr));
+  node->type = SQL_EXPR_AND;
+  node->left = left;
+  node->right = right;
+  return node;
+}
+
+uint32_t bitmap_expr_lookups(const BitmapExpr *expr)
+{
+  if (expr->type == SQL_EXPR_COMPARE)
+  {
+    return 1;
+  }
+  return bitmap_expr_lookups(expr->left) + bitmap_expr_lookups(expr->right);
+}
+
+static bool eval_compare(const BitmapExpr *expr, RoaringBitmap *out)
+{
+  roaring_init(out);
+  Table *index_table = table_cache_acquire(expr->index->filename);
+  BitmapIndex *index = index_table ? bitmap_index_get(index_table) : NULL;
+  if (!index)
+  {
+    if (index_table)
+    {
+      table_cache_release(index_table);
+    }
+    return false;
+  }
+
+  // != is the union of every other value's bitmap
+  for (uint32_t i = 0; i < index->num_values; i++)
+  {
+    BitmapIndexValue *value = &index->values[i];
+    bool equal = value->key_size == expr->key_size &&
+                 memcmp(value->key, expr->key, expr->key_size) == 0;
+    if (equal != expr->negate)
+    {
+      RoaringBitmap combined;
+      roaring_or(&combined, out, &value->rows);
+      roaring_free(out);
+      *out = combined;
+    }
+  }
+  table_cache_release(index_table);
+  return true;
+}
+
+bool bitmap_expr_eval(const BitmapExpr *expr, RoaringBitmap *out)
+{
+  if (expr->type == SQL_EXPR_COMPARE)
+  {
+    return eval_compare(expr, out);
+  }
+
+  RoaringBitmap left, right;
+  if (!bitmap_expr_eval(expr->left, &left))
+  {
+    return false;
+  }
+  if (!bitmap_expr_eval(expr->right, &right))
+  {
+    roaring_free(&left);
+    return false;
+  }
+  if (expr->type == SQL_EXPR_AND)
+  {
+    roaring_and(out, &left, &right);
+  }
+  else
+  {
+    roaring_or(out, &left, &right);
+  }
+  roaring_free(&left);
+  roaring_free(&right);
+  return true;
+}
+
+void bitmap_expr_format(const BitmapExpr *expr, char *buffer, size_t size)
+{
+  if (expr->type == SQL_EXPR_COMPARE)
+  {
+    snprintf(buffer, size, "%s %s %s", expr->index->column_name,
+             expr->negate ? "!=" : "=", expr->literal);
+    return;
+  }
+
+  char left[256], right[256];
+  bitmap_expr_format(expr->left, left, sizeof(left));
+  bitmap_expr_format(expr->right, right, sizeof(right));
+  // OR binds looser than AND, so it is bracketed under an AND
+  bool bracket = expr->type == SQL_EXPR_AND;
+  bool left_or = bracket && expr->left->type == SQL_EXPR_OR;
+  bool right_or = bracket && expr->right->type == SQL_EXPR_OR;
+  snprintf(buffer, size, "%s%s%s %s %s%s%s", left_or ? "(" : "", left,
+           left_or ? ")" : "", expr->type == SQL_EXPR_AND ? "AND" : "OR",
+           right_or ? "(" : "", right, right_or ? ")" : "");
+}
+
+void bitmap_expr_free(BitmapExpr *expr)
+{
+  if (!expr)
+  {
+    return;
+  }
+  bitmap_expr_free(expr->left);
+  bitmap_expr_free(expr->right);
+  free(expr->literal);
+  free(expr);
+}
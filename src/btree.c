@@ -1,12 +1,19 @@
 #include "../include/btree.h"
+#include "../include/hot_index.h"
 #include "../include/stack.h"
 
 #include <stdint.h>
 #include <string.h>
 
 // Declare missing functions
-void internal_node_split_and_insert(Table *table, uint32_t parent_page_num, uint32_t child_page_num);
+void internal_node_split_and_insert(Table *table, uint32_t page_num, uint32_t index,
+                                    uint32_t child_page_num, const void *key);
 void create_new_root(Table *table, uint32_t right_child_page_num);
+static void internal_node_insert_cell(Table *table, uint32_t page_num, uint32_t index,
+                                      uint32_t child_page_num, const void *key);
+static void internal_node_insert_split_child(Table *table, uint32_t parent_page_num,
+                                             uint32_t left_page_num, const void *left_max,
+                                             uint32_t right_page_num);
 void indent(uint32_t level);
 
 // Define missing constants
@@ -45,17 +52,31 @@ uint32_t *leaf_node_key(void *node, uint32_t cell_num)
 }
 
 uint32_t *leaf_node_value_size(void *node, uint32_t cell_num) {
-  return (uint32_t *)((uint8_t *)leaf_node_cell(node, cell_num) + LEAF_NODE_KEY_SIZE);
+  return (uint32_t *)((uint8_t *)leaf_node_cell(node, cell_num) + node_key_size(node));
 }
 
 void *leaf_node_value(void *node, uint32_t cell_num)
 {
-  return (uint8_t *)leaf_node_cell(node, cell_num) + LEAF_NODE_CELL_HEADER_SIZE;
+  return (uint8_t *)leaf_node_cell(node, cell_num) + leaf_node_cell_header_size(node);
 }
 
 uint32_t leaf_node_cell_size(void *node, uint32_t cell_num) {
   uint32_t value_size = *leaf_node_value_size(node, cell_num);
-  return LEAF_NODE_CELL_HEADER_SIZE + value_size;
+  return leaf_node_cell_header_size(node) + value_size;
+}
+
+uint32_t leaf_node_cell_header_size(void *node)
+{
+  return node_key_size(node) + LEAF_NODE_VALUE_SIZE_SIZE;
+}
+
+// Value size of the cell at cell, for walking a leaf without re-deriving
+// the key width from the header
+static uint32_t cell_value_size(const uint8_t *cell, uint32_t key_size)
+{
+  uint32_t value_size;
+  memcpy(&value_size, cell + key_size, sizeof(value_size));
+  return value_size;
 }
 
 void *leaf_node_next_cell(void *node, uint32_t cell_num) {
@@ -68,6 +89,7 @@ void initialize_leaf_node(void *node)
 {
   set_node_type(node, NODE_LEAF);
   set_node_root(node, false);
+  set_node_key_size(node, LEAF_NODE_KEY_SIZE);
   *leaf_node_num_cells(node) = 0;
   *leaf_node_next_leaf(node) = 0; // 0 means no sibling
 }
@@ -75,15 +97,16 @@ void initialize_leaf_node(void *node)
 // Remove the old Row-based implementation
 // void leaf_node_insert(Cursor *cursor, uint32_t key, Row *value) { ... }
 
-void leaf_node_insert(Cursor *cursor, uint32_t key, DynamicRow *row, TableDef *table_def)
+void leaf_node_insert(Cursor *cursor, const void *key, DynamicRow *row, TableDef *table_def)
 {
   void *node = get_page(cursor->table->pager, cursor->page_num);
   uint32_t num_cells = *leaf_node_num_cells(node);
+  uint32_t key_size = node_key_size(node);
   uint32_t value_size = row->data_size;
-  uint32_t cell_size = LEAF_NODE_CELL_HEADER_SIZE + value_size;
-  
+  uint32_t cell_size = key_size + LEAF_NODE_VALUE_SIZE_SIZE + value_size;
+
   // Check if we have enough space
-  if (num_cells >= LEAF_NODE_MAX_CELLS || cell_size > LEAF_NODE_SPACE_FOR_CELLS / (num_cells + 1))
+  if (leaf_node_needs_split(node, value_size))
   {
     // Node full
     leaf_node_split_and_insert(cursor, key, row, table_def);
@@ -108,65 +131,306 @@ void leaf_node_insert(Cursor *cursor, uint32_t key, DynamicRow *row, TableDef *t
   }
 
   // Write key and value size
-  void *cell = leaf_node_cell(node, cursor->cell_num);
-  *(uint32_t *)cell = key;
-  *((uint32_t *)cell + 1) = value_size;
+  uint8_t *cell = leaf_node_cell(node, cursor->cell_num);
+  memcpy(cell, key, key_size);
+  memcpy(cell + key_size, &value_size, sizeof(value_size));
   
   // Write the actual row data
-  void *value_dest = (uint8_t *)cell + LEAF_NODE_CELL_HEADER_SIZE;
+  void *value_dest = cell + key_size + LEAF_NODE_VALUE_SIZE_SIZE;
   memcpy(value_dest, row->data, value_size);
 
   *(leaf_node_num_cells(node)) += 1;
+  hot_index_note_leaf(cursor->table, cursor->page_num);
 }
 
-Cursor *table_find(Table *table, uint32_t key)
+static uint32_t leaf_node_used_space(void *node)
 {
-  uint32_t root_page_num = table->root_page_num;
-  void *root_node = get_page(table->pager, root_page_num);
+  uint32_t num_cells = *leaf_node_num_cells(node);
+  if (num_cells == 0)
+  {
+    return 0;
+  }
+  uint8_t *last = leaf_node_cell(node, num_cells - 1);
+  return (uint32_t)(last - ((uint8_t *)node + LEAF_NODE_HEADER_SIZE)) +
+         leaf_node_cell_size(node, num_cells - 1);
+}
 
-  if (get_node_type(root_node) == NODE_LEAF)
+void leaf_node_update(Cursor *cursor, DynamicRow *row, TableDef *table_def)
+{
+  void *node = get_page(cursor->table->pager, cursor->page_num);
+  uint8_t *cell = leaf_node_cell(node, cursor->cell_num);
+  uint32_t key_size = node_key_size(node);
+  uint32_t header_size = leaf_node_cell_header_size(node);
+  uint32_t old_size = cell_value_size(cell, key_size);
+  uint32_t new_size = row->data_size;
+
+  if (new_size == old_size)
   {
-    return leaf_node_find(table, root_page_num, key);
+    memcpy(cell + header_size, row->data, new_size);
+    return;
   }
-  else
+
+  // Bytes of the cells after this one, which move with the size change
+  uint8_t *next = cell + header_size + old_size;
+  uint32_t used = leaf_node_used_space(node);
+  uint32_t tail = (uint32_t)(((uint8_t *)node + LEAF_NODE_HEADER_SIZE + used) -
+                             next);
+
+  if (used - old_size + new_size <= LEAF_NODE_SPACE_FOR_CELLS)
   {
-    return internal_node_find(table, root_page_num, key);
+    memmove(cell + header_size + new_size, next, tail);
+    memcpy(cell + key_size, &new_size, sizeof(new_size));
+    memcpy(cell + header_size, row->data, new_size);
+    return;
   }
+
+  // Take the cell out and insert it again through the split, which puts it
+  // back at the cursor's position in whichever half it belongs to
+  uint8_t key[BTREE_MAX_KEY_SIZE];
+  memcpy(key, cell, key_size);
+  memmove(cell, next, tail);
+  *leaf_node_num_cells(node) -= 1;
+  leaf_node_split_and_insert(cursor, key, row, table_def);
 }
-Cursor *leaf_node_find(Table *table, uint32_t page_num, uint32_t key)
+
+bool leaf_node_needs_split(void *node, uint32_t value_size)
 {
-  void *node = get_page(table->pager, page_num);
   uint32_t num_cells = *leaf_node_num_cells(node);
+  uint32_t cell_size = leaf_node_cell_header_size(node) + value_size;
+  // Cells vary in size, so check the bytes actually used rather than an
+  // even share of the page
+  return num_cells >= LEAF_NODE_MAX_CELLS ||
+         leaf_node_used_space(node) + cell_size > LEAF_NODE_SPACE_FOR_CELLS;
+}
 
-  Cursor *cursor = malloc(sizeof(Cursor));
-  cursor->table = table;
-  cursor->page_num = page_num;
+Cursor *table_find(Table *table, uint32_t key)
+{
+  uint8_t encoded[BTREE_MAX_KEY_SIZE];
+  key_from_int(&table->key, key, encoded);
+  return table_find_key(table, encoded);
+}
+
+static bool cursor_at_key(Cursor *cursor, void *node, const void *key);
+
+Cursor *table_find_key(Table *table, const void *key)
+{
+  if (!table->hot_index)
+  {
+    return table_find_latched(table, key, LATCH_SHARED);
+  }
+
+  Cursor *cursor = hot_index_find(table, key);
+  if (!cursor)
+  {
+    cursor = table_find_latched(table, key, LATCH_SHARED);
+    void *node = get_page(table->pager, cursor->page_num);
+    hot_index_found(table, key, cursor, cursor_at_key(cursor, node, key));
+  }
+  return cursor;
+}
+
+Cursor *table_seek(Table *table, uint32_t key)
+{
+  uint8_t encoded[BTREE_MAX_KEY_SIZE];
+  key_from_int(&table->key, key, encoded);
+  return table_seek_key(table, encoded);
+}
 
-  // Binary search
-  uint32_t min_index = 0;
-  uint32_t one_past_max_index = num_cells;
-  while (one_past_max_index != min_index)
+// leaf_node_find gives the first cell >= key in the leaf the descent
+// reaches. A separator can be left above its subtree's real maximum by a
+// delete, so that leaf may end before key; the next one starts after it.
+static Cursor *seek_from_found(Table *table, Cursor *cursor)
+{
+  void *node = get_page(table->pager, cursor->page_num);
+  cursor->end_of_table = false;
+  if (cursor->cell_num >= *leaf_node_num_cells(node))
   {
-    uint32_t index = (min_index + one_past_max_index) / 2;
-    uint32_t key_at_index = *leaf_node_key(node, index);
-    if (key == key_at_index)
+    if (cursor->cell_num == 0)
     {
-      cursor->cell_num = index;
-      cursor->end_of_table = false;
+      cursor->end_of_table = true;
       return cursor;
     }
-    if (key < key_at_index)
+    cursor->cell_num--;
+    cursor_advance(cursor);
+  }
+  return cursor;
+}
+
+Cursor *table_seek_key(Table *table, const void *key)
+{
+  return seek_from_found(table, table_find_key(table, key));
+}
+
+Cursor *table_seek_key_direct(Table *table, const void *key)
+{
+  return seek_from_found(table, table_find_latched(table, key, LATCH_SHARED));
+}
+
+Cursor *table_seek_last(Table *table, uint32_t key)
+{
+  uint8_t encoded[BTREE_MAX_KEY_SIZE];
+  key_from_int(&table->key, key, encoded);
+  return table_seek_last_key(table, encoded);
+}
+
+Cursor *table_seek_last_key(Table *table, const void *key)
+{
+  // Step past the cells equal to the bound, then back one. Running off the
+  // end leaves the cursor one past the last cell of the rightmost leaf.
+  Cursor *cursor = table_seek_key(table, key);
+  while (!cursor->end_of_table)
+  {
+    void *node = get_page(table->pager, cursor->page_num);
+    if (key_compare(&table->key, leaf_node_key(node, cursor->cell_num), key) > 0)
     {
-      one_past_max_index = index;
+      break;
     }
-    else
+    cursor_advance(cursor);
+  }
+  if (cursor->end_of_table)
+  {
+    void *node = get_page(table->pager, cursor->page_num);
+    cursor->cell_num = *leaf_node_num_cells(node);
+    cursor->end_of_table = false;
+  }
+  cursor_retreat(cursor);
+  return cursor;
+}
+
+uint32_t table_count_rows(Table *table)
+{
+  // Down the leftmost edge, then along the sibling links, reading only the
+  // cell count in each leaf header
+  void *node = get_page(table->pager, table->root_page_num);
+  while (get_node_type(node) == NODE_INTERNAL)
+  {
+    node = get_page(table->pager, *internal_node_child(node, 0));
+  }
+
+  uint32_t count = 0;
+  for (;;)
+  {
+    count += *leaf_node_num_cells(node);
+    uint32_t next = *leaf_node_next_leaf(node);
+    if (next == 0)
     {
-      min_index = index + 1;
+      return count;
     }
+    node = get_page(table->pager, next);
+  }
+}
+
+Cursor *table_find_latched(Table *table, const void *key, LatchMode leaf_mode)
+{
+  Pager *pager = table->pager;
+  if (!pager->latching)
+  {
+    leaf_mode = LATCH_NONE;
   }
 
-  cursor->cell_num = min_index;
-  cursor->end_of_table = (min_index == num_cells);
+  // Every latched operation holds the tree latch in shared mode; only a
+  // restarted (pessimistic) split takes it exclusively.
+  pager_tree_latch(pager, leaf_mode == LATCH_NONE ? LATCH_NONE : LATCH_SHARED);
+
+  uint32_t root_page_num = table->root_page_num;
+  void *root_node = get_page(pager, root_page_num);
+
+  Cursor *cursor;
+  if (get_node_type(root_node) == NODE_LEAF)
+  {
+    pager_latch(pager, root_page_num, leaf_mode);
+    cursor = leaf_node_find(table, root_page_num, key);
+  }
+  else
+  {
+    pager_latch(pager, root_page_num, leaf_mode == LATCH_NONE ? LATCH_NONE : LATCH_SHARED);
+    cursor = internal_node_find_latched(table, root_page_num, key, leaf_mode);
+  }
+  cursor->latch = leaf_mode;
+  return cursor;
+}
+
+BtreeInsertResult table_insert(Table *table, uint32_t key, DynamicRow *row, TableDef *table_def)
+{
+  uint8_t encoded[BTREE_MAX_KEY_SIZE];
+  key_from_int(&table->key, key, encoded);
+  return table_insert_key(table, encoded, row, table_def);
+}
+
+static bool cursor_at_key(Cursor *cursor, void *node, const void *key)
+{
+  return cursor->cell_num < *leaf_node_num_cells(node) &&
+         key_compare(&cursor->table->key, leaf_node_key(node, cursor->cell_num),
+                     key) == 0;
+}
+
+BtreeInsertResult table_insert_key(Table *table, const void *key, DynamicRow *row,
+                                   TableDef *table_def)
+{
+  // Optimistic pass: shared latches down the tree, exclusive on the leaf only
+  Cursor *cursor = table_find_latched(table, key, LATCH_EXCLUSIVE);
+  void *node = get_page(table->pager, cursor->page_num);
+
+  if (cursor_at_key(cursor, node, key))
+  {
+    cursor_close(cursor);
+    return BTREE_INSERT_DUPLICATE;
+  }
+
+  if (cursor->latch == LATCH_NONE || !leaf_node_needs_split(node, row->data_size))
+  {
+    leaf_node_insert(cursor, key, row, table_def);
+    cursor_close(cursor);
+    return BTREE_INSERT_SUCCESS;
+  }
+
+  // The leaf would split, which touches ancestors we only latched shared.
+  // Restart with the whole tree latched exclusively.
+  cursor_close(cursor);
+  pager_tree_latch(table->pager, LATCH_EXCLUSIVE);
+
+  cursor = table_find_latched(table, key, LATCH_NONE);
+  node = get_page(table->pager, cursor->page_num);
+  BtreeInsertResult result = BTREE_INSERT_SUCCESS;
+  if (cursor_at_key(cursor, node, key))
+  {
+    result = BTREE_INSERT_DUPLICATE;
+  }
+  else
+  {
+    leaf_node_insert(cursor, key, row, table_def);
+  }
+  cursor_close(cursor);
+
+  pager_tree_unlatch(table->pager);
+  return result;
+}
+
+Cursor *leaf_node_find(Table *table, uint32_t page_num, const void *key)
+{
+  void *node = get_page(table->pager, page_num);
+  uint32_t num_cells = *leaf_node_num_cells(node);
+
+  Cursor *cursor = malloc(sizeof(Cursor));
+  cursor->table = table;
+  cursor->page_num = page_num;
+  cursor->latch = LATCH_NONE;
+
+  // Cells vary in size, so finding the nth one means walking the cells
+  // before it. Walk them once to collect where each key is, then binary
+  // search those. Duplicates (in index trees) land on the first of the run.
+  const uint8_t *keys[LEAF_NODE_MAX_CELLS + 1];
+  uint32_t key_size = node_key_size(node);
+  uint32_t n = num_cells <= LEAF_NODE_MAX_CELLS + 1 ? num_cells : LEAF_NODE_MAX_CELLS + 1;
+  const uint8_t *cell = (uint8_t *)node + LEAF_NODE_HEADER_SIZE;
+  for (uint32_t i = 0; i < n; i++)
+  {
+    keys[i] = cell;
+    cell += key_size + LEAF_NODE_VALUE_SIZE_SIZE + cell_value_size(cell, key_size);
+  }
+
+  cursor->cell_num = key_lower_bound(&table->key, keys, n, key);
+  cursor->end_of_table = (cursor->cell_num == num_cells);
   return cursor;
 }
 NodeType get_node_type(void *node)
@@ -183,23 +447,25 @@ void set_node_type(void *node, NodeType type)
 // Remove the old Row-based implementation
 // void leaf_node_split_and_insert(Cursor *cursor, uint32_t key, Row *value) { ... }
 
-void leaf_node_split_and_insert(Cursor *cursor, uint32_t key, DynamicRow *row, TableDef *table_def)
+void leaf_node_split_and_insert(Cursor *cursor, const void *key, DynamicRow *row, TableDef *table_def)
 {
   (void)table_def; // Mark as used to avoid the warning
   
   // Get the old node and create a new one
   void *old_node = get_page(cursor->table->pager, cursor->page_num);
-  uint32_t old_max = get_node_max_key(cursor->table->pager, old_node);
   uint32_t new_page_num = get_unused_page_num(cursor->table->pager);
   void *new_node = get_page(cursor->table->pager, new_page_num);
+  uint32_t key_size = node_key_size(old_node);
+  uint32_t header_size = key_size + LEAF_NODE_VALUE_SIZE_SIZE;
   initialize_leaf_node(new_node);
+  set_node_key_size(new_node, key_size);
   *node_parent(new_node) = *node_parent(old_node);
   *leaf_node_next_leaf(new_node) = *leaf_node_next_leaf(old_node);
   *leaf_node_next_leaf(old_node) = new_page_num;
 
   // Create temporary storage for all cell data
   struct {
-    uint32_t key;
+    uint8_t key[BTREE_MAX_KEY_SIZE];
     uint32_t value_size;
     void* data;
   } temp_cells[LEAF_NODE_MAX_CELLS + 1];
@@ -207,7 +473,7 @@ void leaf_node_split_and_insert(Cursor *cursor, uint32_t key, DynamicRow *row, T
   // Copy existing cells to temp storage
   uint32_t num_cells = *leaf_node_num_cells(old_node);
   for (uint32_t i = 0; i < num_cells; i++) {
-    temp_cells[i].key = *leaf_node_key(old_node, i);
+    memcpy(temp_cells[i].key, leaf_node_key(old_node, i), key_size);
     temp_cells[i].value_size = *leaf_node_value_size(old_node, i);
     temp_cells[i].data = malloc(temp_cells[i].value_size);
     memcpy(temp_cells[i].data, leaf_node_value(old_node, i), temp_cells[i].value_size);
@@ -218,7 +484,7 @@ void leaf_node_split_and_insert(Cursor *cursor, uint32_t key, DynamicRow *row, T
   for (uint32_t i = num_cells; i > insertion_index; i--) {
     temp_cells[i] = temp_cells[i-1];
   }
-  temp_cells[insertion_index].key = key;
+  memcpy(temp_cells[insertion_index].key, key, key_size);
   temp_cells[insertion_index].value_size = row->data_size;
   temp_cells[insertion_index].data = malloc(row->data_size);
   memcpy(temp_cells[insertion_index].data, row->data, row->data_size);
@@ -227,36 +493,74 @@ void leaf_node_split_and_insert(Cursor *cursor, uint32_t key, DynamicRow *row, T
   *leaf_node_num_cells(old_node) = 0;
   *leaf_node_num_cells(new_node) = 0;
   
+  // Split where the left half reaches half the bytes, leaving at least one
+  // cell on each side. With equal-size cells this is the usual
+  // LEAF_NODE_LEFT_SPLIT_COUNT; a split forced by a few large cells still
+  // leaves both halves fitting.
+  uint32_t total_bytes = 0;
+  for (uint32_t i = 0; i <= num_cells; i++) {
+    total_bytes += header_size + temp_cells[i].value_size;
+  }
+  uint32_t left_count = 0;
+  uint32_t left_bytes = 0;
+  while (left_count < num_cells && left_bytes * 2 < total_bytes) {
+    left_bytes += header_size + temp_cells[left_count].value_size;
+    left_count++;
+  }
+  if (left_count == 0) {
+    left_count = 1;
+    left_bytes = header_size + temp_cells[0].value_size;
+  }
+
+  // With very uneven cells the byte midpoint can leave one half over a page;
+  // take the most even split point where both halves fit instead
+  if (left_bytes > LEAF_NODE_SPACE_FOR_CELLS ||
+      total_bytes - left_bytes > LEAF_NODE_SPACE_FOR_CELLS) {
+    uint32_t best_diff = UINT32_MAX;
+    uint32_t bytes = 0;
+    for (uint32_t count = 1; count <= num_cells; count++) {
+      bytes += header_size + temp_cells[count - 1].value_size;
+      uint32_t diff = bytes * 2 > total_bytes ? bytes * 2 - total_bytes
+                                              : total_bytes - bytes * 2;
+      if (bytes <= LEAF_NODE_SPACE_FOR_CELLS &&
+          total_bytes - bytes <= LEAF_NODE_SPACE_FOR_CELLS && diff < best_diff) {
+        best_diff = diff;
+        left_count = count;
+      }
+    }
+  }
+
   // Distribute cells between old and new nodes
   uint32_t cell_index = 0;
   void* cell_dest = (uint8_t*)old_node + LEAF_NODE_HEADER_SIZE;
   
   // Copy cells to old node (left)
-  for (uint32_t i = 0; i < LEAF_NODE_LEFT_SPLIT_COUNT; i++) {
-    if (cell_index >= num_cells + 1) break; // Safety check
+  for (uint32_t i = 0; i < left_count; i++) {
     
-    *(uint32_t *)cell_dest = temp_cells[cell_index].key;
-    *((uint32_t *)cell_dest + 1) = temp_cells[cell_index].value_size;
-    memcpy((uint8_t *)cell_dest + LEAF_NODE_CELL_HEADER_SIZE, 
+    memcpy(cell_dest, temp_cells[cell_index].key, key_size);
+    memcpy((uint8_t *)cell_dest + key_size, &temp_cells[cell_index].value_size,
+           sizeof(uint32_t));
+    memcpy((uint8_t *)cell_dest + header_size, 
            temp_cells[cell_index].data, 
            temp_cells[cell_index].value_size);
     
     (*leaf_node_num_cells(old_node))++;
-    cell_dest = (uint8_t *)cell_dest + LEAF_NODE_CELL_HEADER_SIZE + temp_cells[cell_index].value_size;
+    cell_dest = (uint8_t *)cell_dest + header_size + temp_cells[cell_index].value_size;
     cell_index++;
   }
   
   // Copy cells to new node (right)
   cell_dest = (uint8_t*)new_node + LEAF_NODE_HEADER_SIZE;
   for (; cell_index < num_cells + 1; cell_index++) {
-    *(uint32_t *)cell_dest = temp_cells[cell_index].key;
-    *((uint32_t *)cell_dest + 1) = temp_cells[cell_index].value_size;
-    memcpy((uint8_t *)cell_dest + LEAF_NODE_CELL_HEADER_SIZE, 
+    memcpy(cell_dest, temp_cells[cell_index].key, key_size);
+    memcpy((uint8_t *)cell_dest + key_size, &temp_cells[cell_index].value_size,
+           sizeof(uint32_t));
+    memcpy((uint8_t *)cell_dest + header_size, 
            temp_cells[cell_index].data, 
            temp_cells[cell_index].value_size);
     
     (*leaf_node_num_cells(new_node))++;
-    cell_dest = (uint8_t *)cell_dest + LEAF_NODE_CELL_HEADER_SIZE + temp_cells[cell_index].value_size;
+    cell_dest = (uint8_t *)cell_dest + header_size + temp_cells[cell_index].value_size;
   }
   
   // Free temporary cell data
@@ -264,145 +568,142 @@ void leaf_node_split_and_insert(Cursor *cursor, uint32_t key, DynamicRow *row, T
     free(temp_cells[i].data);
   }
 
-  // Update parent or create new root as in original code
+  // Update parent or create new root
+  uint32_t left_page_num = cursor->page_num;
   if (is_node_root(old_node)) {
     create_new_root(cursor->table, new_page_num);
+    // The left half moved off the root into a page of its own
+    left_page_num = *internal_node_child(old_node, 0);
   } else {
     uint32_t parent_page_num = *node_parent(old_node);
-    uint32_t new_max = get_node_max_key(cursor->table->pager, old_node);
-    void *parent = get_page(cursor->table->pager, parent_page_num);
-
-    update_internal_node_key(parent, old_max, new_max);
-    internal_node_insert(cursor->table, parent_page_num, new_page_num);
+    uint8_t new_max[BTREE_MAX_KEY_SIZE];
+    memcpy(new_max, get_node_max_key(cursor->table->pager, old_node), key_size);
+    internal_node_insert_split_child(cursor->table, parent_page_num, cursor->page_num,
+                                     new_max, new_page_num);
   }
+  hot_index_note_leaf(cursor->table, left_page_num);
+  hot_index_note_leaf(cursor->table, new_page_num);
 }
 
-void internal_node_insert(Table *table, uint32_t parent_page_num, uint32_t child_page_num)
+/*
+After the child routed through slot `index` splits into left_page_num (keys
+<= left_max) and right_page_num, the slot is re-pointed at the right half and
+a new (left, left_max) cell is inserted in front of it.
+*/
+static void internal_node_insert_split_child(Table *table, uint32_t parent_page_num,
+                                             uint32_t left_page_num, const void *left_max,
+                                             uint32_t right_page_num)
 {
-  /*
-  Add a new child/key pair to parent that corresponds to child
-  */
   void *parent = get_page(table->pager, parent_page_num);
-  void *child = get_page(table->pager, child_page_num);
-  uint32_t child_max_key = get_node_max_key(table->pager, child);
-  uint32_t index = internal_node_find_child(parent, child_max_key);
-
-  uint32_t original_num_keys = *internal_node_num_keys(parent);
+  uint32_t num_keys = *internal_node_num_keys(parent);
+  uint32_t index = internal_node_find_child(&table->key, parent, left_max);
 
-  if (original_num_keys >= INTERNAL_NODE_MAX_CELLS)
+  if (index == num_keys)
   {
-    internal_node_split_and_insert(table, parent_page_num, child_page_num);
-    return;
+    *internal_node_right_child(parent) = right_page_num;
   }
-
-  uint32_t right_child_page_num = *internal_node_right_child(parent);
-  /*
-  An internal node with a right child of INVALID_PAGE_NUM is empty
-  */
-  if (right_child_page_num == INVALID_PAGE_NUM)
+  else
   {
-    *internal_node_right_child(parent) = child_page_num;
-    return;
+    *(uint32_t *)internal_node_cell(parent, index) = right_page_num;
   }
+  *node_parent(get_page(table->pager, right_page_num)) = parent_page_num;
 
-  void *right_child = get_page(table->pager, right_child_page_num);
-  /*
-  If we are already at the max number of cells for a node, we cannot increment
-  before splitting. Incrementing without inserting a new key/child pair
-  and immediately calling internal_node_split_and_insert has the effect
-  of creating a new key at (max_cells + 1) with an uninitialized value
-  */
-  *internal_node_num_keys(parent) = original_num_keys + 1;
+  internal_node_insert_cell(table, parent_page_num, index, left_page_num, left_max);
+}
 
-  if (child_max_key > get_node_max_key(table->pager, right_child))
+static void internal_node_insert_cell(Table *table, uint32_t page_num, uint32_t index,
+                                      uint32_t child_page_num, const void *key)
+{
+  void *node = get_page(table->pager, page_num);
+  uint32_t num_keys = *internal_node_num_keys(node);
+
+  if (num_keys >= INTERNAL_NODE_MAX_CELLS)
   {
-    /* Replace right child */
-    *internal_node_child(parent, original_num_keys) = right_child_page_num;
-    *internal_node_key(parent, original_num_keys) = get_node_max_key(table->pager, right_child);
-    *internal_node_right_child(parent) = child_page_num;
+    internal_node_split_and_insert(table, page_num, index, child_page_num, key);
+    return;
   }
-  else
+
+  /* Make room for the new cell */
+  memmove(internal_node_cell(node, index + 1), internal_node_cell(node, index),
+          (num_keys - index) * internal_node_cell_size(node));
+  *(uint32_t *)internal_node_cell(node, index) = child_page_num;
+  memcpy(internal_node_key(node, index), key, node_key_size(node));
+  *internal_node_num_keys(node) = num_keys + 1;
+  *node_parent(get_page(table->pager, child_page_num)) = page_num;
+}
+
+void internal_node_split_and_insert(Table *table, uint32_t page_num, uint32_t index,
+                                    uint32_t child_page_num, const void *key)
+{
+  Pager *pager = table->pager;
+  void *old_node = get_page(pager, page_num);
+  uint32_t num_keys = *internal_node_num_keys(old_node);
+  uint32_t right_child_page_num = *internal_node_right_child(old_node);
+  uint32_t key_size = node_key_size(old_node);
+
+  // Gather the cells as they would be after the insertion
+  uint32_t total = num_keys + 1;
+  uint32_t children[INTERNAL_NODE_MAX_CELLS + 1] = {0};
+  uint8_t keys[INTERNAL_NODE_MAX_CELLS + 1][BTREE_MAX_KEY_SIZE];
+  for (uint32_t i = 0, j = 0; i < total; i++)
   {
-    /* Make room for the new cell */
-    for (uint32_t i = original_num_keys; i > index; i--)
+    if (i == index)
     {
-      void *destination = internal_node_cell(parent, i);
-      void *source = internal_node_cell(parent, i - 1);
-      memcpy(destination, source, INTERNAL_NODE_CELL_SIZE);
+      children[i] = child_page_num;
+      memcpy(keys[i], key, key_size);
+    }
+    else
+    {
+      children[i] = *(uint32_t *)internal_node_cell(old_node, j);
+      memcpy(keys[i], internal_node_key(old_node, j), key_size);
+      j++;
     }
-    *internal_node_child(parent, index) = child_page_num;
-    *internal_node_key(parent, index) = child_max_key;
   }
-}
-
-void internal_node_split_and_insert(Table *table, uint32_t parent_page_num, uint32_t child_page_num)
-{
-  uint32_t old_page_num = parent_page_num;
-  void *old_node = get_page(table->pager, parent_page_num);
-  uint32_t old_max = get_node_max_key(table->pager, old_node);
-
-  void *child = get_page(table->pager, child_page_num);
-  uint32_t child_max = get_node_max_key(table->pager, child);
 
-  uint32_t new_page_num = get_unused_page_num(table->pager);
+  // The middle cell's child becomes the left node's right child and its key
+  // (the left node's max) is promoted to the parent
+  uint32_t split = total / 2;
 
-  uint32_t splitting_root = is_node_root(old_node);
+  uint32_t new_page_num = get_unused_page_num(pager);
+  void *new_node = get_page(pager, new_page_num);
+  initialize_internal_node(new_node);
+  set_node_key_size(new_node, key_size);
 
-  void *parent;
-  void *new_node;
-  if (splitting_root)
+  *internal_node_num_keys(old_node) = split;
+  for (uint32_t i = 0; i < split; i++)
   {
-    create_new_root(table, new_page_num);
-    parent = get_page(table->pager, table->root_page_num);
-    old_page_num = *internal_node_child(parent, 0);
-    old_node = get_page(table->pager, old_page_num);
+    *(uint32_t *)internal_node_cell(old_node, i) = children[i];
+    memcpy(internal_node_key(old_node, i), keys[i], key_size);
+    *node_parent(get_page(pager, children[i])) = page_num;
   }
-  else
+  *internal_node_right_child(old_node) = children[split];
+  *node_parent(get_page(pager, children[split])) = page_num;
+
+  *internal_node_num_keys(new_node) = total - split - 1;
+  for (uint32_t i = split + 1; i < total; i++)
   {
-    parent = get_page(table->pager, *node_parent(old_node));
-    new_node = get_page(table->pager, new_page_num);
-    initialize_internal_node(new_node);
+    *(uint32_t *)internal_node_cell(new_node, i - split - 1) = children[i];
+    memcpy(internal_node_key(new_node, i - split - 1), keys[i], key_size);
+    *node_parent(get_page(pager, children[i])) = new_page_num;
   }
+  *internal_node_right_child(new_node) = right_child_page_num;
+  *node_parent(get_page(pager, right_child_page_num)) = new_page_num;
 
-  uint32_t *old_num_keys = internal_node_num_keys(old_node);
-
-  uint32_t cur_page_num = *internal_node_right_child(old_node);
-  void *cur = get_page(table->pager, cur_page_num);
-
-  internal_node_insert(table, new_page_num, cur_page_num);
-  *node_parent(cur) = new_page_num;
-  *internal_node_right_child(old_node) = INVALID_PAGE_NUM;
-
-  for (int i = INTERNAL_NODE_MAX_CELLS - 1; i > INTERNAL_NODE_MAX_CELLS / 2; i--)
+  if (is_node_root(old_node))
   {
-    cur_page_num = *internal_node_child(old_node, i);
-    cur = get_page(table->pager, cur_page_num);
-
-    internal_node_insert(table, new_page_num, cur_page_num);
-    *node_parent(cur) = new_page_num;
-
-    (*old_num_keys)--;
+    create_new_root(table, new_page_num);
   }
-
-  *internal_node_right_child(old_node) = *internal_node_child(old_node, *old_num_keys - 1);
-  (*old_num_keys)--;
-
-  uint32_t max_after_split = get_node_max_key(table->pager, old_node);
-
-  uint32_t destination_page_num = child_max < max_after_split ? old_page_num : new_page_num;
-
-  internal_node_insert(table, destination_page_num, child_page_num);
-  *node_parent(child) = destination_page_num;
-
-  update_internal_node_key(parent, old_max, get_node_max_key(table->pager, old_node));
-
-  if (!splitting_root)
+  else
   {
-    internal_node_insert(table, *node_parent(old_node), new_page_num);
-    *node_parent(new_node) = *node_parent(old_node);
+    internal_node_insert_split_child(table, *node_parent(old_node), page_num,
+                                     keys[split], new_page_num);
   }
 }
 
+/*
+The root always stays on root_page_num: its (already split) contents move to
+a fresh left page and the root becomes an internal node over left and right.
+*/
 void create_new_root(Table *table, uint32_t right_child_page_num)
 {
   void *root = get_page(table->pager, table->root_page_num);
@@ -410,12 +711,6 @@ void create_new_root(Table *table, uint32_t right_child_page_num)
   uint32_t left_child_page_num = get_unused_page_num(table->pager);
   void *left_child = get_page(table->pager, left_child_page_num);
 
-  if (get_node_type(root) == NODE_INTERNAL)
-  {
-    initialize_internal_node(right_child);
-    initialize_internal_node(left_child);
-  }
-
   memcpy(left_child, root, PAGE_SIZE);
   set_node_root(left_child, false);
 
@@ -431,19 +726,25 @@ void create_new_root(Table *table, uint32_t right_child_page_num)
     *node_parent(child) = left_child_page_num;
   }
 
+  uint32_t key_size = node_key_size(left_child);
+  uint8_t left_child_max_key[BTREE_MAX_KEY_SIZE];
+  memcpy(left_child_max_key, get_node_max_key(table->pager, left_child), key_size);
   initialize_internal_node(root);
   set_node_root(root, true);
+  set_node_key_size(root, key_size);
   *internal_node_num_keys(root) = 1;
   *internal_node_child(root, 0) = left_child_page_num;
-  uint32_t left_child_max_key = get_node_max_key(table->pager, left_child);
-  *internal_node_key(root, 0) = left_child_max_key;
+  memcpy(internal_node_key(root, 0), left_child_max_key, key_size);
   *internal_node_right_child(root) = right_child_page_num;
   *node_parent(left_child) = table->root_page_num;
   *node_parent(right_child) = table->root_page_num;
 }
 
-void print_tree_iterative(Pager *pager, uint32_t root_page_num)
+static void print_tree_iterative(Table *table, TableDef *table_def,
+                                 uint32_t root_page_num)
 {
+  Pager *pager = table->pager;
+  char key[256];
   Stack stack;
   stack_init(&stack);
 
@@ -466,7 +767,8 @@ void print_tree_iterative(Pager *pager, uint32_t root_page_num)
       for (uint32_t i = 0; i < num_cells; i++)
       {
         indent(level + 1);
-        printf("- %d\n", *leaf_node_key(node, i));
+        key_format(table_def, &table->key, leaf_node_key(node, i), key, sizeof(key));
+        printf("- %s\n", key);
       }
     }
     break;
@@ -497,7 +799,8 @@ void print_tree_iterative(Pager *pager, uint32_t root_page_num)
       for (uint32_t i = 0; i < num_keys; i++)
       {
         indent(level + 1);
-        printf("- key %d\n", *internal_node_key(node, i));
+        key_format(table_def, &table->key, internal_node_key(node, i), key, sizeof(key));
+        printf("- key %s\n", key);
       }
     }
     break;
@@ -507,46 +810,29 @@ void print_tree_iterative(Pager *pager, uint32_t root_page_num)
   stack_destroy(&stack);
 }
 
-// Fix the print_tree function to avoid the unused parameter warning
-void print_tree(Pager *pager, uint32_t page_num, uint32_t indentation_level)
+void print_tree(Table *table, TableDef *table_def, uint32_t page_num)
 {
-  // Pass indentation_level to the iterative version if needed, or just ignore it
-  (void)indentation_level; // Explicitly mark as unused to suppress warning
-  print_tree_iterative(pager, page_num);
+  print_tree_iterative(table, table_def, page_num);
 }
 
-void update_internal_node_key(void *node, uint32_t old_key, uint32_t new_key)
-{
-  uint32_t old_child_index = internal_node_find_child(node, old_key);
-  *internal_node_key(node, old_child_index) = new_key;
-}
-uint32_t internal_node_find_child(void *node, uint32_t key)
+uint32_t internal_node_find_child(const KeyDesc *key_desc, void *node, const void *key)
 {
   /*
   Return the index of the child which should contain
-  the given key.
+  the given key: the first whose separator is >= key, or the right child
+  (index num_keys) if there is none.
   */
   uint32_t num_keys = *internal_node_num_keys(node);
-
-  /* Binary search */
-  uint32_t min_index = 0;
-  uint32_t max_index = num_keys; /* there is one more child than key */
-
-  while (min_index != max_index)
+  const uint8_t *keys[INTERNAL_NODE_MAX_CELLS + 1];
+  if (num_keys > INTERNAL_NODE_MAX_CELLS + 1)
   {
-    uint32_t index = (min_index + max_index) / 2;
-    uint32_t key_to_right = *internal_node_key(node, index);
-    if (key_to_right >= key)
-    {
-      max_index = index;
-    }
-    else
-    {
-      min_index = index + 1;
-    }
+    num_keys = INTERNAL_NODE_MAX_CELLS + 1;
   }
-
-  return min_index;
+  for (uint32_t i = 0; i < num_keys; i++)
+  {
+    keys[i] = (const uint8_t *)internal_node_key(node, i);
+  }
+  return key_lower_bound(key_desc, keys, num_keys, key);
 }
 uint32_t *leaf_node_next_leaf(void *node)
 {
@@ -572,7 +858,12 @@ uint32_t *internal_node_right_child(void *node)
 
 void *internal_node_cell(void *node, uint32_t cell_num)
 {
-  return node + INTERNAL_NODE_HEADER_SIZE + cell_num * INTERNAL_NODE_CELL_SIZE;
+  return node + INTERNAL_NODE_HEADER_SIZE + cell_num * internal_node_cell_size(node);
+}
+
+uint32_t internal_node_cell_size(void *node)
+{
+  return INTERNAL_NODE_CHILD_SIZE + node_key_size(node);
 }
 
 uint32_t *internal_node_child(void *node, uint32_t child_num)
@@ -610,20 +901,37 @@ uint32_t *internal_node_key(void *node, uint32_t key_num)
   return (void *)internal_node_cell(node, key_num) + INTERNAL_NODE_CHILD_SIZE;
 }
 
-// Ensure internal_node_find always returns
-Cursor *internal_node_find(Table *table, uint32_t page_num, uint32_t key)
+Cursor *internal_node_find(Table *table, uint32_t page_num, const void *key)
 {
-  void *node = get_page(table->pager, page_num);
+  return internal_node_find_latched(table, page_num, key, LATCH_NONE);
+}
+
+// Latch coupling: the caller holds page_num; the child is latched before
+// page_num is released. Internal nodes are latched shared, the leaf in
+// leaf_mode.
+Cursor *internal_node_find_latched(Table *table, uint32_t page_num, const void *key,
+                                   LatchMode leaf_mode)
+{
+  Pager *pager = table->pager;
+  void *node = get_page(pager, page_num);
 
-  uint32_t child_index = internal_node_find_child(node, key);
+  uint32_t child_index = internal_node_find_child(&table->key, node, key);
   uint32_t child_num = *internal_node_child(node, child_index);
-  void *child = get_page(table->pager, child_num);
-  switch (get_node_type(child))
+  void *child = get_page(pager, child_num);
+  NodeType child_type = get_node_type(child);
+
+  if (leaf_mode != LATCH_NONE)
+  {
+    pager_latch(pager, child_num, child_type == NODE_LEAF ? leaf_mode : LATCH_SHARED);
+    pager_unlatch(pager, page_num);
+  }
+
+  switch (child_type)
   {
     case NODE_LEAF:
       return leaf_node_find(table, child_num, key);
     case NODE_INTERNAL:
-      return internal_node_find(table, child_num, key);
+      return internal_node_find_latched(table, child_num, key, leaf_mode);
     default:
       printf("Error: Unknown node type\n");
       exit(EXIT_FAILURE);
@@ -634,18 +942,19 @@ void initialize_internal_node(void *node)
 {
   set_node_type(node, NODE_INTERNAL);
   set_node_root(node, false);
+  set_node_key_size(node, LEAF_NODE_KEY_SIZE);
   *internal_node_num_keys(node) = 0;
   *internal_node_right_child(node) = INVALID_PAGE_NUM;
 }
 /*** Internal Node end ***/
 
-uint32_t get_unused_page_num(Pager *pager) { return pager->num_pages; }
+uint32_t get_unused_page_num(Pager *pager) { return pager_allocate_page(pager); }
 
-uint32_t get_node_max_key(Pager *pager, void *node)
+void *get_node_max_key(Pager *pager, void *node)
 {
   if (get_node_type(node) == NODE_LEAF)
   {
-    return *leaf_node_key(node, *leaf_node_num_cells(node) - 1);
+    return leaf_node_key(node, *leaf_node_num_cells(node) - 1);
   }
   void *right_child = get_page(pager, *internal_node_right_child(node));
   return get_node_max_key(pager, right_child);
@@ -654,32 +963,370 @@ uint32_t get_node_max_key(Pager *pager, void *node)
 bool is_node_root(void *node)
 {
   uint8_t value = *((uint8_t *)node + IS_ROOT_OFFSET);
-  return (bool)value;
+  return (bool)(value & 1);
 }
 
 void set_node_root(void *node, bool is_root)
 {
-  uint8_t value = is_root;
-  *((uint8_t *)node + IS_ROOT_OFFSET) = value;
+  uint8_t *value = (uint8_t *)node + IS_ROOT_OFFSET;
+  *value = (*value & ~1) | is_root;
 }
 
-void create_root_node(Table *table, uint32_t right_child_page_num)
+uint32_t node_key_size(void *node)
 {
-  void *root = get_page(table->pager, table->root_page_num);
-  void *right_child = get_page(table->pager, right_child_page_num);
-  uint32_t left_child_page_num = get_unused_page_num(table->pager);
-  void *left_child = get_page(table->pager, left_child_page_num);
+  uint8_t value = *((uint8_t *)node + IS_ROOT_OFFSET) >> 1;
+  return value ? value : LEAF_NODE_KEY_SIZE;
+}
 
-  memcpy(left_child, root, PAGE_SIZE);
-  set_node_root(left_child, false);
+void set_node_key_size(void *node, uint32_t key_size)
+{
+  uint8_t *value = (uint8_t *)node + IS_ROOT_OFFSET;
+  uint8_t stored = key_size == LEAF_NODE_KEY_SIZE ? 0 : key_size;
+  *value = (*value & 1) | (uint8_t)(stored << 1);
+}
 
-  initialize_internal_node(root);
-  set_node_root(root, true);
-  *(internal_node_num_keys(root)) = 1;
-  *(internal_node_child(root, 0)) = left_child_page_num;
-  uint32_t left_child_max_key = get_node_max_key(table->pager, left_child);
-  *(internal_node_key(root, 0)) = left_child_max_key;
-  *(internal_node_right_child(root)) = right_child_page_num;
-  *(node_parent(left_child)) = table->root_page_num;
-  *(node_parent(right_child)) = table->root_page_num;
+/*** Delete start ***/
+#define BTREE_MAX_DEPTH 32
+#define INTERNAL_NODE_MIN_KEYS (INTERNAL_NODE_MAX_CELLS / 2)
+
+// An internal node passed on the way down and the child slot taken from it
+typedef struct
+{
+  uint32_t page_num;
+  uint32_t child_index;
+} BtreePathStep;
+
+// Descend to the leaf for key, recording the path. Parent pointers are not
+// needed: the path also says which slot of each parent a node sits in.
+static uint32_t btree_find_path(Table *table, const void *key, BtreePathStep *path,
+                                uint32_t *depth)
+{
+  uint32_t page_num = table->root_page_num;
+  void *node = get_page(table->pager, page_num);
+  *depth = 0;
+  while (get_node_type(node) == NODE_INTERNAL && *depth < BTREE_MAX_DEPTH)
+  {
+    uint32_t index = internal_node_find_child(&table->key, node, key);
+    path[*depth].page_num = page_num;
+    path[*depth].child_index = index;
+    (*depth)++;
+    page_num = *internal_node_child(node, index);
+    node = get_page(table->pager, page_num);
+  }
+  return page_num;
+}
+
+// Under half full by both the cell limit and the bytes, as a split never
+// leaves a node
+static bool leaf_node_underfull(void *node)
+{
+  return *leaf_node_num_cells(node) * 2 < LEAF_NODE_MAX_CELLS &&
+         leaf_node_used_space(node) * 2 < LEAF_NODE_SPACE_FOR_CELLS;
+}
+
+static bool internal_node_underfull(void *node)
+{
+  return *internal_node_num_keys(node) < INTERNAL_NODE_MIN_KEYS;
+}
+
+// A node's largest key is the separator in the nearest ancestor it is not
+// the rightmost descendant of
+static void btree_update_separator(Table *table, BtreePathStep *path,
+                                   uint32_t depth, const void *max_key)
+{
+  while (depth-- > 0)
+  {
+    void *node = get_page(table->pager, path[depth].page_num);
+    if (path[depth].child_index < *internal_node_num_keys(node))
+    {
+      memcpy(internal_node_key(node, path[depth].child_index), max_key,
+             node_key_size(node));
+      return;
+    }
+  }
+}
+
+/*
+Move the right leaf's cells onto the end of the left one if they fit, and
+return true; the right page is then unused. Otherwise deal the cells of both
+out again, splitting by bytes as leaf_node_split_and_insert does, and return
+false.
+*/
+static bool leaf_nodes_rebalance(void *left, void *right)
+{
+  uint32_t left_cells = *leaf_node_num_cells(left);
+  uint32_t right_cells = *leaf_node_num_cells(right);
+  uint32_t left_used = leaf_node_used_space(left);
+  uint32_t right_used = leaf_node_used_space(right);
+  uint8_t *left_body = (uint8_t *)left + LEAF_NODE_HEADER_SIZE;
+  uint8_t *right_body = (uint8_t *)right + LEAF_NODE_HEADER_SIZE;
+  uint32_t key_size = node_key_size(left);
+  uint32_t header_size = leaf_node_cell_header_size(left);
+
+  if (left_cells + right_cells <= LEAF_NODE_MAX_CELLS &&
+      left_used + right_used <= LEAF_NODE_SPACE_FOR_CELLS)
+  {
+    memcpy(left_body + left_used, right_body, right_used);
+    *leaf_node_num_cells(left) += right_cells;
+    *leaf_node_next_leaf(left) = *leaf_node_next_leaf(right);
+    return true;
+  }
+
+  uint32_t num_cells = left_cells + right_cells;
+  uint32_t total_bytes = left_used + right_used;
+  uint8_t *cells = malloc(total_bytes);
+  memcpy(cells, left_body, left_used);
+  memcpy(cells + left_used, right_body, right_used);
+
+  uint32_t count = 0;
+  uint32_t bytes = 0;
+  while (count < num_cells - 1 && bytes * 2 < total_bytes)
+  {
+    bytes += header_size + cell_value_size(cells + bytes, key_size);
+    count++;
+  }
+  if (count == 0)
+  {
+    count = 1;
+    bytes = header_size + cell_value_size(cells, key_size);
+  }
+
+  // Mixed cell sizes can make the even split worse than what is there;
+  // keep the current halves then
+  if (count <= LEAF_NODE_MAX_CELLS && num_cells - count <= LEAF_NODE_MAX_CELLS &&
+      bytes <= LEAF_NODE_SPACE_FOR_CELLS &&
+      total_bytes - bytes <= LEAF_NODE_SPACE_FOR_CELLS)
+  {
+    memcpy(left_body, cells, bytes);
+    *leaf_node_num_cells(left) = count;
+    memcpy(right_body, cells + bytes, total_bytes - bytes);
+    *leaf_node_num_cells(right) = num_cells - count;
+  }
+  free(cells);
+  return false;
+}
+
+// Rewrite node with count children and the count - 1 keys between them, and
+// point the children back at it
+static void internal_node_fill(Table *table, void *node, uint32_t page_num,
+                               const uint32_t *children,
+                               uint8_t (*keys)[BTREE_MAX_KEY_SIZE], uint32_t count)
+{
+  *internal_node_num_keys(node) = count - 1;
+  for (uint32_t i = 0; i + 1 < count; i++)
+  {
+    *(uint32_t *)internal_node_cell(node, i) = children[i];
+    memcpy(internal_node_key(node, i), keys[i], node_key_size(node));
+  }
+  *internal_node_right_child(node) = children[count - 1];
+  for (uint32_t i = 0; i < count; i++)
+  {
+    *node_parent(get_page(table->pager, children[i])) = page_num;
+  }
+}
+
+/*
+The internal-node counterpart of leaf_nodes_rebalance. separator is the
+parent's key between the two, which becomes the key after the left node's
+right child. If the children are dealt out again, *separator is set to the
+new key for the parent.
+*/
+static bool internal_nodes_rebalance(Table *table, uint32_t left_page_num,
+                                     uint32_t right_page_num, uint8_t *separator)
+{
+  void *left = get_page(table->pager, left_page_num);
+  void *right = get_page(table->pager, right_page_num);
+  uint32_t key_size = node_key_size(left);
+  uint32_t children[2 * (INTERNAL_NODE_MAX_CELLS + 1)];
+  uint8_t keys[2 * (INTERNAL_NODE_MAX_CELLS + 1)][BTREE_MAX_KEY_SIZE];
+  uint32_t count = 0;
+
+  for (uint32_t i = 0; i < *internal_node_num_keys(left); i++, count++)
+  {
+    children[count] = *internal_node_child(left, i);
+    memcpy(keys[count], internal_node_key(left, i), key_size);
+  }
+  children[count] = *internal_node_right_child(left);
+  memcpy(keys[count++], separator, key_size);
+  for (uint32_t i = 0; i < *internal_node_num_keys(right); i++, count++)
+  {
+    children[count] = *internal_node_child(right, i);
+    memcpy(keys[count], internal_node_key(right, i), key_size);
+  }
+  children[count++] = *internal_node_right_child(right);
+
+  if (count <= INTERNAL_NODE_MAX_CELLS + 1)
+  {
+    internal_node_fill(table, left, left_page_num, children, keys, count);
+    return true;
+  }
+
+  uint32_t left_count = count / 2;
+  internal_node_fill(table, left, left_page_num, children, keys, left_count);
+  internal_node_fill(table, right, right_page_num, children + left_count,
+                     keys + left_count, count - left_count);
+  memcpy(separator, keys[left_count - 1], key_size);
+  return false;
+}
+
+// While the root is an internal node with a single child, pull the child up
+// into the root page
+static void btree_collapse_root(Table *table)
+{
+  Pager *pager = table->pager;
+  void *root = get_page(pager, table->root_page_num);
+  while (get_node_type(root) == NODE_INTERNAL && *internal_node_num_keys(root) == 0)
+  {
+    uint32_t child_page_num = *internal_node_right_child(root);
+    memcpy(root, get_page(pager, child_page_num), PAGE_SIZE);
+    set_node_root(root, true);
+    if (get_node_type(root) == NODE_INTERNAL)
+    {
+      for (uint32_t i = 0; i <= *internal_node_num_keys(root); i++)
+      {
+        *node_parent(get_page(pager, *internal_node_child(root, i))) =
+            table->root_page_num;
+      }
+    }
+    pager_free_page(pager, child_page_num);
+  }
+}
+
+/*
+Fix an underfull node bottom-up: merge it with a sibling under the same
+parent, preferring the left one, or even the two out if a merge would not
+fit. A merge removes a child from the parent, which may leave the parent
+underfull in turn.
+*/
+static void btree_rebalance(Table *table, BtreePathStep *path, uint32_t depth,
+                            uint32_t page_num)
+{
+  Pager *pager = table->pager;
+  for (; depth > 0; depth--)
+  {
+    void *node = get_page(pager, page_num);
+    bool is_leaf = get_node_type(node) == NODE_LEAF;
+    if (is_leaf ? !leaf_node_underfull(node) : !internal_node_underfull(node))
+    {
+      return;
+    }
+
+    BtreePathStep *step = &path[depth - 1];
+    void *parent = get_page(pager, step->page_num);
+    page_num = step->page_num;
+    if (*internal_node_num_keys(parent) == 0)
+    {
+      // Only child: nothing to merge with until the parent is fixed
+      continue;
+    }
+
+    uint32_t left_index = step->child_index > 0 ? step->child_index - 1 : 0;
+    uint32_t left_page_num = *internal_node_child(parent, left_index);
+    uint32_t right_page_num = *internal_node_child(parent, left_index + 1);
+    uint32_t key_size = node_key_size(parent);
+    uint8_t separator[BTREE_MAX_KEY_SIZE];
+    memcpy(separator, internal_node_key(parent, left_index), key_size);
+    bool merged;
+    if (is_leaf)
+    {
+      void *left = get_page(pager, left_page_num);
+      merged = leaf_nodes_rebalance(left, get_page(pager, right_page_num));
+      memcpy(separator, get_node_max_key(pager, left), key_size);
+    }
+    else
+    {
+      merged = internal_nodes_rebalance(table, left_page_num, right_page_num,
+                                        separator);
+    }
+
+    if (!merged)
+    {
+      memcpy(internal_node_key(parent, left_index), separator, key_size);
+      return;
+    }
+
+    // The merged node takes the right node's slot, whose key (or right
+    // child position) already bounds it, and the left slot goes away
+    *internal_node_child(parent, left_index + 1) = left_page_num;
+    uint32_t num_keys = *internal_node_num_keys(parent);
+    memmove(internal_node_cell(parent, left_index),
+            internal_node_cell(parent, left_index + 1),
+            (num_keys - left_index - 1) * internal_node_cell_size(parent));
+    *internal_node_num_keys(parent) = num_keys - 1;
+    pager_free_page(pager, right_page_num);
+  }
+  btree_collapse_root(table);
+}
+
+uint32_t table_delete_keys(Table *table, const void *keys, uint32_t num_keys)
+{
+  Pager *pager = table->pager;
+  const KeyDesc *desc = &table->key;
+  const uint8_t *key_at = keys;
+  BtreePathStep path[BTREE_MAX_DEPTH];
+  uint32_t deleted = 0;
+  uint32_t next = 0;
+
+  pager_tree_latch(pager, LATCH_EXCLUSIVE);
+  while (next < num_keys)
+  {
+    uint32_t depth;
+    uint32_t page_num = btree_find_path(table, key_at + next * desc->size, path,
+                                        &depth);
+    void *node = get_page(pager, page_num);
+    uint32_t num_cells = *leaf_node_num_cells(node);
+    uint32_t key_size = node_key_size(node);
+
+    // One pass over the leaf drops every cell whose key is in the batch and
+    // slides the kept cells down over them
+    uint32_t first = next;
+    uint32_t kept = 0;
+    uint8_t *read = (uint8_t *)node + LEAF_NODE_HEADER_SIZE;
+    uint8_t *write = read;
+    for (uint32_t i = 0; i < num_cells; i++)
+    {
+      uint32_t cell_size = key_size + LEAF_NODE_VALUE_SIZE_SIZE +
+                           cell_value_size(read, key_size);
+      int order = 0;
+      while (next < num_keys &&
+             (order = key_compare(desc, key_at + next * desc->size, read)) < 0)
+      {
+        next++;
+      }
+      if (next < num_keys && order == 0)
+      {
+        next++;
+      }
+      else
+      {
+        if (write != read)
+        {
+          memmove(write, read, cell_size);
+        }
+        write += cell_size;
+        kept++;
+      }
+      read += cell_size;
+    }
+    if (next == first)
+    {
+      // Not in the tree
+      next++;
+    }
+    if (kept == num_cells)
+    {
+      continue;
+    }
+
+    *leaf_node_num_cells(node) = kept;
+    deleted += num_cells - kept;
+    if (kept > 0)
+    {
+      btree_update_separator(table, path, depth, leaf_node_key(node, kept - 1));
+    }
+    btree_rebalance(table, path, depth, page_num);
+  }
+  pager_tree_unlatch(pager);
+  return deleted;
 }
+/*** Delete end ***/
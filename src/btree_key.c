@@ -0,0 +1,616 @@
+#include "../include/btree_key.h"
+#include "../include/table.h"
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+static void put_be32(uint8_t *p, uint32_t value)
+{
+  p[0] = (uint8_t)(value >> 24);
+  p[1] = (uint8_t)(value >> 16);
+  p[2] = (uint8_t)(value >> 8);
+  p[3] = (uint8_t)value;
+}
+
+static void put_be64(uint8_t *p, uint64_t value)
+{
+  put_be32(p, (uint32_t)(value >> 32));
+  put_be32(p + 4, (uint32_t)value);
+}
+
+static uint32_t get_be32(const uint8_t *p)
+{
+  return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+         ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+static uint64_t get_be64(const uint8_t *p)
+{
+  return ((uint64_t)get_be32(p) << 32) | get_be32(p + 4);
+}
+
+int key_compare(const KeyDesc *desc, const void *a, const void *b)
+{
+  switch (desc->type)
+  {
+  case KEY_UINT32:
+  {
+    uint32_t x, y;
+    memcpy(&x, a, sizeof(x));
+    memcpy(&y, b, sizeof(y));
+    return (x > y) - (x < y);
+  }
+  case KEY_INT64:
+  {
+    int64_t x, y;
+    memcpy(&x, a, sizeof(x));
+    memcpy(&y, b, sizeof(y));
+    return (x > y) - (x < y);
+  }
+  default:
+    return memcmp(a, b, desc->size);
+  }
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define KEY_SEARCH_X86 1
+#include <immintrin.h>
+#endif
+
+// Kernels count how many of n packed keys are less than key
+typedef uint32_t (*CountLessU32Kernel)(const uint32_t *keys, uint32_t n,
+                                       uint32_t key);
+typedef uint32_t (*CountLessI64Kernel)(const int64_t *keys, uint32_t n,
+                                       int64_t key);
+
+static uint32_t count_less_u32_range(const uint32_t *keys, uint32_t start,
+                                     uint32_t n, uint32_t key)
+{
+  uint32_t count = 0;
+  for (uint32_t i = start; i < n; i++)
+  {
+    count += keys[i] < key;
+  }
+  return count;
+}
+
+static uint32_t count_less_i64_range(const int64_t *keys, uint32_t start,
+                                     uint32_t n, int64_t key)
+{
+  uint32_t count = 0;
+  for (uint32_t i = start; i < n; i++)
+  {
+    count += keys[i] < key;
+  }
+  return count;
+}
+
+static uint32_t count_less_u32_scalar(const uint32_t *keys, uint32_t n,
+                                      uint32_t key)
+{
+  return count_less_u32_range(keys, 0, n, key);
+}
+
+static uint32_t count_less_i64_scalar(const int64_t *keys, uint32_t n,
+                                      int64_t key)
+{
+  return count_less_i64_range(keys, 0, n, key);
+}
+
+#ifdef KEY_SEARCH_X86
+// There is no unsigned 32-bit compare before AVX-512, so both sides are
+// biased by 2^31 and compared signed
+
+__attribute__((target("sse2"))) static uint32_t
+count_less_u32_sse2(const uint32_t *keys, uint32_t n, uint32_t key)
+{
+  __m128i bias = _mm_set1_epi32(INT32_MIN);
+  __m128i needle = _mm_set1_epi32((int32_t)(key ^ 0x80000000u));
+  uint32_t count = 0;
+  uint32_t i = 0;
+  for (; i + 4 <= n; i += 4)
+  {
+    __m128i lanes = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(keys + i)), bias);
+    count += __builtin_popcount(
+        _mm_movemask_ps(_mm_castsi128_ps(_mm_cmplt_epi32(lanes, needle))));
+  }
+  return count + count_less_u32_range(keys, i, n, key);
+}
+
+__attribute__((target("sse4.2"))) static uint32_t
+count_less_i64_sse42(const int64_t *keys, uint32_t n, int64_t key)
+{
+  __m128i needle = _mm_set1_epi64x(key);
+  uint32_t count = 0;
+  uint32_t i = 0;
+  for (; i + 2 <= n; i += 2)
+  {
+    __m128i lanes = _mm_loadu_si128((const __m128i *)(keys + i));
+    count += __builtin_popcount(
+        _mm_movemask_pd(_mm_castsi128_pd(_mm_cmpgt_epi64(needle, lanes))));
+  }
+  return count + count_less_i64_range(keys, i, n, key);
+}
+
+__attribute__((target("avx2"))) static uint32_t
+count_less_u32_avx2(const uint32_t *keys, uint32_t n, uint32_t key)
+{
+  __m256i bias = _mm256_set1_epi32(INT32_MIN);
+  __m256i needle = _mm256_set1_epi32((int32_t)(key ^ 0x80000000u));
+  uint32_t count = 0;
+  uint32_t i = 0;
+  for (; i + 8 <= n; i += 8)
+  {
+    __m256i lanes = _mm256_xor_si256(
+        _mm256_loadu_si256((const __m256i *)(keys + i)), bias);
+    count += __builtin_popcount(_mm256_movemask_ps(
+        _mm256_castsi256_ps(_mm256_cmpgt_epi32(needle, lanes))));
+  }
+  return count + count_less_u32_range(keys, i, n, key);
+}
+
+__attribute__((target("avx2"))) static uint32_t
+count_less_i64_avx2(const int64_t *keys, uint32_t n, int64_t key)
+{
+  __m256i needle = _mm256_set1_epi64x(key);
+  uint32_t count = 0;
+  uint32_t i = 0;
+  for (; i + 4 <= n; i += 4)
+  {
+    __m256i lanes = _mm256_loadu_si256((const __m256i *)(keys + i));
+    count += __builtin_popcount(_mm256_movemask_pd(
+        _mm256_castsi256_pd(_mm256_cmpgt_epi64(needle, lanes))));
+  }
+  return count + count_less_i64_range(keys, i, n, key);
+}
+#endif
+
+static uint32_t count_less_u32_first(const uint32_t *keys, uint32_t n,
+                                     uint32_t key);
+static uint32_t count_less_i64_first(const int64_t *keys, uint32_t n,
+                                     int64_t key);
+
+// Until the first search picks the kernels, the pointers lead to stubs that
+// do so, which keeps the check off every later call
+static CountLessU32Kernel count_less_u32 = count_less_u32_first;
+static CountLessI64Kernel count_less_i64 = count_less_i64_first;
+static const char *kernel_isa = "scalar";
+static pthread_once_t kernel_once = PTHREAD_ONCE_INIT;
+
+static void select_kernels()
+{
+  CountLessU32Kernel u32 = count_less_u32_scalar;
+  CountLessI64Kernel i64 = count_less_i64_scalar;
+#ifdef KEY_SEARCH_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+  {
+    u32 = count_less_u32_avx2;
+    i64 = count_less_i64_avx2;
+    kernel_isa = "avx2";
+  }
+  else if (__builtin_cpu_supports("sse4.2"))
+  {
+    u32 = count_less_u32_sse2;
+    i64 = count_less_i64_sse42;
+    kernel_isa = "sse4.2";
+  }
+  else if (__builtin_cpu_supports("sse2"))
+  {
+    u32 = count_less_u32_sse2;
+    kernel_isa = "sse2";
+  }
+#endif
+  __atomic_store_n(&count_less_u32, u32, __ATOMIC_RELEASE);
+  __atomic_store_n(&count_less_i64, i64, __ATOMIC_RELEASE);
+}
+
+static uint32_t count_less_u32_first(const uint32_t *keys, uint32_t n,
+                                     uint32_t key)
+{
+  pthread_once(&kernel_once, select_kernels);
+  return count_less_u32(keys, n, key);
+}
+
+static uint32_t count_less_i64_first(const int64_t *keys, uint32_t n,
+                                     int64_t key)
+{
+  pthread_once(&kernel_once, select_kernels);
+  return count_less_i64(keys, n, key);
+}
+
+const char *key_search_isa()
+{
+  pthread_once(&kernel_once, select_kernels);
+  return kernel_isa;
+}
+
+static inline uint32_t window_less_u32(const uint32_t *keys, uint32_t n,
+                                       uint32_t key)
+{
+  return __atomic_load_n(&count_less_u32, __ATOMIC_ACQUIRE)(keys, n, key);
+}
+
+static inline uint32_t window_less_i64(const int64_t *keys, uint32_t n,
+                                       int64_t key)
+{
+  return __atomic_load_n(&count_less_i64, __ATOMIC_ACQUIRE)(keys, n, key);
+}
+
+// The binary searches below keep the answer within [base, base + n): each
+// probe moves base with a conditional select, so there is no branch on the
+// key to mispredict. Once n is down to the window, the keys left are
+// counted with the SIMD kernel instead of probed one by one.
+
+uint32_t key_search_u32(const uint32_t *keys, uint32_t n, uint32_t key)
+{
+  uint32_t base = 0;
+  while (n > KEY_SEARCH_WINDOW)
+  {
+    uint32_t half = n / 2;
+    base = keys[base + half] < key ? base + half : base;
+    n -= half;
+  }
+  return base + window_less_u32(keys + base, n, key);
+}
+
+uint32_t key_search_i64(const int64_t *keys, uint32_t n, int64_t key)
+{
+  uint32_t base = 0;
+  while (n > KEY_SEARCH_WINDOW)
+  {
+    uint32_t half = n / 2;
+    base = keys[base + half] < key ? base + half : base;
+    n -= half;
+  }
+  return base + window_less_i64(keys + base, n, key);
+}
+
+static uint32_t lower_bound_uint32(const uint8_t *const *keys, uint32_t n,
+                                   const void *key)
+{
+  uint32_t target;
+  memcpy(&target, key, sizeof(target));
+  uint32_t base = 0;
+  while (n > KEY_SEARCH_WINDOW)
+  {
+    uint32_t half = n / 2;
+    uint32_t probe;
+    memcpy(&probe, keys[base + half], sizeof(probe));
+    base = probe < target ? base + half : base;
+    n -= half;
+  }
+  uint32_t window[KEY_SEARCH_WINDOW];
+  for (uint32_t i = 0; i < n; i++)
+  {
+    memcpy(&window[i], keys[base + i], sizeof(uint32_t));
+  }
+  return base + window_less_u32(window, n, target);
+}
+
+static uint32_t lower_bound_int64(const uint8_t *const *keys, uint32_t n,
+                                  const void *key)
+{
+  int64_t target;
+  memcpy(&target, key, sizeof(target));
+  uint32_t base = 0;
+  while (n > KEY_SEARCH_WINDOW)
+  {
+    uint32_t half = n / 2;
+    int64_t probe;
+    memcpy(&probe, keys[base + half], sizeof(probe));
+    base = probe < target ? base + half : base;
+    n -= half;
+  }
+  int64_t window[KEY_SEARCH_WINDOW];
+  for (uint32_t i = 0; i < n; i++)
+  {
+    memcpy(&window[i], keys[base + i], sizeof(int64_t));
+  }
+  return base + window_less_i64(window, n, target);
+}
+
+static uint32_t lower_bound_bytes(const uint8_t *const *keys, uint32_t n,
+                                  const void *key, uint32_t size)
+{
+  uint32_t base = 0;
+  while (n > 1)
+  {
+    uint32_t half = n / 2;
+    base = memcmp(keys[base + half], key, size) < 0 ? base + half : base;
+    n -= half;
+  }
+  return base + (memcmp(keys[base], key, size) < 0);
+}
+
+uint32_t key_lower_bound(const KeyDesc *desc, const uint8_t *const *keys,
+                         uint32_t n, const void *key)
+{
+  if (n == 0)
+  {
+    return 0;
+  }
+  switch (desc->type)
+  {
+  case KEY_UINT32:
+    return lower_bound_uint32(keys, n, key);
+  case KEY_INT64:
+    return lower_bound_int64(keys, n, key);
+  default:
+    return lower_bound_bytes(keys, n, key, desc->size);
+  }
+}
+
+void key_from_int(const KeyDesc *desc, int64_t value, void *key)
+{
+  if (desc->type == KEY_INT64)
+  {
+    memcpy(key, &value, sizeof(int64_t));
+  }
+  else
+  {
+    uint32_t narrow = (uint32_t)value;
+    memcpy(key, &narrow, sizeof(uint32_t));
+  }
+}
+
+int64_t key_to_int(const KeyDesc *desc, const void *key)
+{
+  if (desc->type == KEY_INT64)
+  {
+    int64_t value;
+    memcpy(&value, key, sizeof(value));
+    return value;
+  }
+  uint32_t value;
+  memcpy(&value, key, sizeof(value));
+  return value;
+}
+
+void key_min(const KeyDesc *desc, void *key)
+{
+  if (desc->type == KEY_INT64)
+  {
+    key_from_int(desc, INT64_MIN, key);
+  }
+  else
+  {
+    memset(key, 0, desc->size);
+  }
+}
+
+// Bytes a column takes in a KEY_BYTES key, 0 if it cannot be a key column
+static uint32_t key_column_size(const ColumnDef *column)
+{
+  switch (column->type)
+  {
+  case COLUMN_TYPE_INT:
+  case COLUMN_TYPE_FLOAT:
+  case COLUMN_TYPE_DATE:
+  case COLUMN_TYPE_TIME:
+    return 4;
+  case COLUMN_TYPE_BIGINT:
+  case COLUMN_TYPE_TIMESTAMP:
+    return 8;
+  case COLUMN_TYPE_BOOLEAN:
+    return 1;
+  case COLUMN_TYPE_STRING:
+    return column->size;
+  default:
+    return 0;
+  }
+}
+
+bool key_desc_build(TableDef *table_def, char *error, size_t error_size)
+{
+  if (table_def->num_key_columns == 0)
+  {
+    table_def->num_key_columns = 1;
+    table_def->key_columns[0] = 0;
+  }
+  if (table_def->num_key_columns > MAX_KEY_COLUMNS)
+  {
+    snprintf(error, error_size, "a primary key has at most %d columns",
+             MAX_KEY_COLUMNS);
+    return false;
+  }
+
+  uint32_t size = 0;
+  for (uint32_t i = 0; i < table_def->num_key_columns; i++)
+  {
+    uint32_t column_idx = table_def->key_columns[i];
+    if (column_idx >= table_def->num_columns)
+    {
+      snprintf(error, error_size, "primary key column %u does not exist",
+               column_idx);
+      return false;
+    }
+    ColumnDef *column = &table_def->columns[column_idx];
+    uint32_t column_size = key_column_size(column);
+    if (column_size == 0)
+    {
+      snprintf(error, error_size, "column '%s' cannot be part of a primary key",
+               column->name);
+      return false;
+    }
+    size += column_size;
+  }
+  if (size > BTREE_MAX_KEY_SIZE)
+  {
+    snprintf(error, error_size, "primary key is %u bytes, more than %d",
+             size, BTREE_MAX_KEY_SIZE);
+    return false;
+  }
+
+  // A single integer column keeps its native width and order; INT keys
+  // stay the 4-byte keys older tables were written with
+  ColumnType first = table_def->columns[table_def->key_columns[0]].type;
+  if (table_def->num_key_columns == 1 && first == COLUMN_TYPE_INT)
+  {
+    table_def->key = KEY_DESC_DEFAULT;
+  }
+  else if (table_def->num_key_columns == 1 &&
+           (first == COLUMN_TYPE_BIGINT || first == COLUMN_TYPE_TIMESTAMP))
+  {
+    table_def->key = (KeyDesc){KEY_INT64, sizeof(int64_t)};
+  }
+  else
+  {
+    table_def->key = (KeyDesc){KEY_BYTES, size};
+  }
+  return true;
+}
+
+void key_from_row(TableDef *table_def, DynamicRow *row, void *key)
+{
+  const KeyDesc *desc = &table_def->key;
+  if (desc->type != KEY_BYTES)
+  {
+    uint32_t column_idx = table_def->key_columns[0];
+    const uint8_t *field =
+        (uint8_t *)row->data + get_column_offset(table_def, column_idx);
+    if (desc->type == KEY_INT64)
+    {
+      memcpy(key, field, sizeof(int64_t));
+    }
+    else
+    {
+      memcpy(key, field, sizeof(uint32_t));
+    }
+    return;
+  }
+
+  // Integers go big-endian with the sign bit flipped, floats with every bit
+  // flipped when negative, strings zero-padded to the column size
+  uint8_t *out = key;
+  for (uint32_t i = 0; i < table_def->num_key_columns; i++)
+  {
+    uint32_t column_idx = table_def->key_columns[i];
+    ColumnDef *column = &table_def->columns[column_idx];
+    const uint8_t *field =
+        (uint8_t *)row->data + get_column_offset(table_def, column_idx);
+    switch (column->type)
+    {
+    case COLUMN_TYPE_INT:
+    case COLUMN_TYPE_DATE:
+    case COLUMN_TYPE_TIME:
+    {
+      uint32_t value;
+      memcpy(&value, field, sizeof(value));
+      put_be32(out, value ^ 0x80000000u);
+      out += 4;
+      break;
+    }
+    case COLUMN_TYPE_FLOAT:
+    {
+      uint32_t bits;
+      memcpy(&bits, field, sizeof(bits));
+      put_be32(out, (bits & 0x80000000u) ? ~bits : bits | 0x80000000u);
+      out += 4;
+      break;
+    }
+    case COLUMN_TYPE_BIGINT:
+    case COLUMN_TYPE_TIMESTAMP:
+    {
+      uint64_t value;
+      memcpy(&value, field, sizeof(value));
+      put_be64(out, value ^ 0x8000000000000000ull);
+      out += 8;
+      break;
+    }
+    case COLUMN_TYPE_BOOLEAN:
+      *out++ = *field != 0;
+      break;
+    case COLUMN_TYPE_STRING:
+    {
+      size_t length = strnlen((const char *)field, column->size);
+      memcpy(out, field, length);
+      memset(out + length, 0, column->size - length);
+      out += column->size;
+      break;
+    }
+    default:
+      break;
+    }
+  }
+}
+
+void key_format(TableDef *table_def, const KeyDesc *desc, const void *key,
+                char *buffer, size_t size)
+{
+  if (desc->type == KEY_UINT32)
+  {
+    uint32_t value;
+    memcpy(&value, key, sizeof(value));
+    snprintf(buffer, size, "%d", (int32_t)value);
+    return;
+  }
+  if (desc->type == KEY_INT64)
+  {
+    snprintf(buffer, size, "%" PRId64, key_to_int(desc, key));
+    return;
+  }
+
+  size_t used = 0;
+  const uint8_t *in = key;
+  if (!table_def || table_def->key.type != KEY_BYTES)
+  {
+    for (uint32_t i = 0; i < desc->size && used + 3 <= size; i++)
+    {
+      used += snprintf(buffer + used, size - used, "%02x", in[i]);
+    }
+    return;
+  }
+
+  used += snprintf(buffer, size, "(");
+  for (uint32_t i = 0; i < table_def->num_key_columns && used < size; i++)
+  {
+    ColumnDef *column = &table_def->columns[table_def->key_columns[i]];
+    const char *separator = i > 0 ? ", " : "";
+    switch (column->type)
+    {
+    case COLUMN_TYPE_INT:
+    case COLUMN_TYPE_DATE:
+    case COLUMN_TYPE_TIME:
+      used += snprintf(buffer + used, size - used, "%s%d", separator,
+                       (int32_t)(get_be32(in) ^ 0x80000000u));
+      in += 4;
+      break;
+    case COLUMN_TYPE_FLOAT:
+    {
+      uint32_t bits = get_be32(in);
+      bits = (bits & 0x80000000u) ? bits & 0x7fffffffu : ~bits;
+      float value;
+      memcpy(&value, &bits, sizeof(value));
+      used += snprintf(buffer + used, size - used, "%s%g", separator, value);
+      in += 4;
+      break;
+    }
+    case COLUMN_TYPE_BIGINT:
+    case COLUMN_TYPE_TIMESTAMP:
+      used += snprintf(buffer + used, size - used, "%s%" PRId64, separator,
+                       (int64_t)(get_be64(in) ^ 0x8000000000000000ull));
+      in += 8;
+      break;
+    case COLUMN_TYPE_BOOLEAN:
+      used += snprintf(buffer + used, size - used, "%s%s", separator,
+                       *in ? "true" : "false");
+      in += 1;
+      break;
+    case COLUMN_TYPE_STRING:
+      used += snprintf(buffer + used, size - used, "%s'%.*s'", separator,
+                       (int)strnlen((const char *)in, column->size),
+                       (const char *)in);
+      in += column->size;
+      break;
+    default:
+      break;
+    }
+  }
+  if (used < size)
+  {
+    snprintf(buffer + used, size - used, ")");
+  }
+}
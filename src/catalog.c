@@ -1,6 +1,7 @@
 #include "../include/catalog.h"
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <stdio.h>
 
 void catalog_init(Catalog *catalog)
@@ -8,9 +9,11 @@ void catalog_init(Catalog *catalog)
     catalog->num_tables = 0;
     catalog->active_table = 0;
     catalog->database_name[0] = '\0'; // Initialize database name as empty
+    catalog->version = 0;
 }
 
-bool catalog_add_table(Catalog *catalog, const char *name, ColumnDef *columns, uint32_t num_columns)
+bool catalog_add_table(Catalog *catalog, const char *name, ColumnDef *columns, uint32_t num_columns,
+                       const uint32_t *key_columns, uint32_t num_key_columns)
 {
     if (catalog->num_tables >= MAX_TABLES)
     {
@@ -31,6 +34,7 @@ bool catalog_add_table(Catalog *catalog, const char *name, ColumnDef *columns, u
     table->name[MAX_TABLE_NAME - 1] = '\0';
 
     table->num_columns = num_columns;
+    memset(&table->stats, 0, sizeof(TableStats));
     for (uint32_t i = 0; i < num_columns; i++)
     {
         table->columns[i] = columns[i];
@@ -49,6 +53,18 @@ bool catalog_add_table(Catalog *catalog, const char *name, ColumnDef *columns, u
         }
     }
 
+    table->num_key_columns = num_key_columns;
+    for (uint32_t i = 0; i < num_key_columns && i < MAX_KEY_COLUMNS; i++)
+    {
+        table->key_columns[i] = key_columns[i];
+    }
+    char error[128];
+    if (!key_desc_build(table, error, sizeof(error)))
+    {
+        printf("Error: %s.\n", error);
+        return false;
+    }
+
     // Fix the potential buffer overflow warning - use a fixed buffer size
     char filename_buffer[512]; // Use a larger buffer
     snprintf(filename_buffer, sizeof(filename_buffer), "Database/%s/Tables/%s.tbl",
@@ -80,6 +96,30 @@ int catalog_find_table(Catalog *catalog, const char *name)
     return -1;
 }
 
+int table_def_find_column(TableDef *table_def, const char *name)
+{
+    for (uint32_t i = 0; i < table_def->num_columns; i++)
+    {
+        if (strcasecmp(table_def->columns[i].name, name) == 0)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+bool table_def_is_key_column(TableDef *table_def, uint32_t column_idx)
+{
+    for (uint32_t i = 0; i < table_def->num_key_columns; i++)
+    {
+        if (table_def->key_columns[i] == column_idx)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
 bool catalog_set_active_table(Catalog *catalog, const char *name)
 {
     int idx = catalog_find_table(catalog, name);
@@ -101,12 +141,267 @@ TableDef *catalog_get_active_table(Catalog *catalog)
     return &catalog->tables[catalog->active_table];
 }
 
+// Statistics follow the table definitions so catalogs written before
+// ANALYZE existed still load; a missing or short section reads as
+// "not analyzed"
+#define CATALOG_STATS_MAGIC 0x54415453 // "STAT"
+
+static void catalog_write_stats(Catalog *catalog, FILE *file)
+{
+    uint32_t magic = CATALOG_STATS_MAGIC;
+    fwrite(&magic, sizeof(uint32_t), 1, file);
+
+    for (uint32_t i = 0; i < catalog->num_tables; i++)
+    {
+        TableDef *table = &catalog->tables[i];
+        TableStats *stats = &table->stats;
+        fwrite(&stats->analyzed, sizeof(bool), 1, file);
+        fwrite(&stats->row_count, sizeof(uint32_t), 1, file);
+        fwrite(&stats->leaf_pages, sizeof(uint32_t), 1, file);
+        fwrite(&stats->depth, sizeof(uint32_t), 1, file);
+
+        for (uint32_t j = 0; j < table->num_columns; j++)
+        {
+            ColumnStats *column = &stats->columns[j];
+            fwrite(&column->distinct, sizeof(double), 1, file);
+            fwrite(&column->has_range, sizeof(bool), 1, file);
+            fwrite(&column->min_value, sizeof(double), 1, file);
+            fwrite(&column->max_value, sizeof(double), 1, file);
+            fwrite(&column->num_buckets, sizeof(uint32_t), 1, file);
+            fwrite(column->bucket_bounds, sizeof(double), STATS_HISTOGRAM_BUCKETS, file);
+        }
+    }
+}
+
+static void catalog_read_stats(Catalog *catalog, FILE *file)
+{
+    for (uint32_t i = 0; i < catalog->num_tables; i++)
+    {
+        memset(&catalog->tables[i].stats, 0, sizeof(TableStats));
+    }
+
+    uint32_t magic;
+    if (fread(&magic, sizeof(uint32_t), 1, file) != 1 || magic != CATALOG_STATS_MAGIC)
+    {
+        return;
+    }
+
+    for (uint32_t i = 0; i < catalog->num_tables; i++)
+    {
+        TableDef *table = &catalog->tables[i];
+        TableStats *stats = &table->stats;
+        bool ok = fread(&stats->analyzed, sizeof(bool), 1, file) == 1 &&
+                  fread(&stats->row_count, sizeof(uint32_t), 1, file) == 1 &&
+                  fread(&stats->leaf_pages, sizeof(uint32_t), 1, file) == 1 &&
+                  fread(&stats->depth, sizeof(uint32_t), 1, file) == 1;
+
+        for (uint32_t j = 0; ok && j < table->num_columns; j++)
+        {
+            ColumnStats *column = &stats->columns[j];
+            ok = fread(&column->distinct, sizeof(double), 1, file) == 1 &&
+                 fread(&column->has_range, sizeof(bool), 1, file) == 1 &&
+                 fread(&column->min_value, sizeof(double), 1, file) == 1 &&
+                 fread(&column->max_value, sizeof(double), 1, file) == 1 &&
+                 fread(&column->num_buckets, sizeof(uint32_t), 1, file) == 1 &&
+                 fread(column->bucket_bounds, sizeof(double), STATS_HISTOGRAM_BUCKETS,
+                       file) == STATS_HISTOGRAM_BUCKETS &&
+                 column->num_buckets <= STATS_HISTOGRAM_BUCKETS;
+        }
+
+        if (!ok)
+        {
+            memset(stats, 0, sizeof(TableStats));
+            return;
+        }
+    }
+}
+
+// Primary keys follow the statistics, with the same fallback: a catalog
+// from before composite keys keys every table on its first column
+#define CATALOG_KEYS_MAGIC 0x5359454b // "KEYS"
+
+static void catalog_write_keys(Catalog *catalog, FILE *file)
+{
+    uint32_t magic = CATALOG_KEYS_MAGIC;
+    fwrite(&magic, sizeof(uint32_t), 1, file);
+
+    for (uint32_t i = 0; i < catalog->num_tables; i++)
+    {
+        TableDef *table = &catalog->tables[i];
+        fwrite(&table->num_key_columns, sizeof(uint32_t), 1, file);
+        fwrite(table->key_columns, sizeof(uint32_t), table->num_key_columns, file);
+    }
+}
+
+static void catalog_read_keys(Catalog *catalog, FILE *file)
+{
+    uint32_t magic;
+    bool ok = fread(&magic, sizeof(uint32_t), 1, file) == 1 && magic == CATALOG_KEYS_MAGIC;
+
+    for (uint32_t i = 0; i < catalog->num_tables; i++)
+    {
+        TableDef *table = &catalog->tables[i];
+        ok = ok && fread(&table->num_key_columns, sizeof(uint32_t), 1, file) == 1 &&
+             table->num_key_columns <= MAX_KEY_COLUMNS &&
+             fread(table->key_columns, sizeof(uint32_t), table->num_key_columns,
+                   file) == table->num_key_columns;
+
+        char error[128];
+        if (!ok || !key_desc_build(table, error, sizeof(error)))
+        {
+            table->num_key_columns = 0;
+            key_desc_build(table, error, sizeof(error));
+        }
+    }
+}
+
+// INCLUDE columns of each index come last; a catalog without them loads
+// with no index carrying any
+#define CATALOG_INCLUDE_MAGIC 0x4c434e49 // "INCL"
+
+static void catalog_write_includes(Catalog *catalog, FILE *file)
+{
+    uint32_t magic = CATALOG_INCLUDE_MAGIC;
+    fwrite(&magic, sizeof(uint32_t), 1, file);
+
+    for (uint32_t i = 0; i < catalog->num_tables; i++)
+    {
+        TableDef *table = &catalog->tables[i];
+        for (uint32_t j = 0; j < table->num_indexes; j++)
+        {
+            IndexDef *index = &table->indexes[j];
+            fwrite(&index->num_include, sizeof(uint32_t), 1, file);
+            fwrite(index->include_columns, sizeof(uint32_t), index->num_include, file);
+        }
+    }
+}
+
+static void catalog_read_includes(Catalog *catalog, FILE *file)
+{
+    uint32_t magic;
+    bool ok = fread(&magic, sizeof(uint32_t), 1, file) == 1 && magic == CATALOG_INCLUDE_MAGIC;
+
+    for (uint32_t i = 0; i < catalog->num_tables; i++)
+    {
+        TableDef *table = &catalog->tables[i];
+        for (uint32_t j = 0; j < table->num_indexes; j++)
+        {
+            IndexDef *index = &table->indexes[j];
+            ok = ok && fread(&index->num_include, sizeof(uint32_t), 1, file) == 1 &&
+                 index->num_include <= MAX_INDEX_INCLUDE &&
+                 fread(index->include_columns, sizeof(uint32_t), index->num_include,
+                       file) == index->num_include;
+            for (uint32_t k = 0; ok && k < index->num_include; k++)
+            {
+                ok = index->include_columns[k] < table->num_columns;
+            }
+            if (!ok)
+            {
+                index->num_include = 0;
+            }
+        }
+    }
+}
+
+// Partial index predicates come after the INCLUDE columns, as a length and
+// the text for each index; a catalog without them loads with every index
+// on every row
+#define CATALOG_PREDICATE_MAGIC 0x44455250 // "PRED"
+
+static void catalog_write_predicates(Catalog *catalog, FILE *file)
+{
+    uint32_t magic = CATALOG_PREDICATE_MAGIC;
+    fwrite(&magic, sizeof(uint32_t), 1, file);
+
+    for (uint32_t i = 0; i < catalog->num_tables; i++)
+    {
+        TableDef *table = &catalog->tables[i];
+        for (uint32_t j = 0; j < table->num_indexes; j++)
+        {
+            IndexDef *index = &table->indexes[j];
+            uint32_t length = strlen(index->predicate);
+            fwrite(&length, sizeof(uint32_t), 1, file);
+            fwrite(index->predicate, 1, length, file);
+        }
+    }
+}
+
+static void catalog_read_predicates(Catalog *catalog, FILE *file)
+{
+    uint32_t magic;
+    bool ok = fread(&magic, sizeof(uint32_t), 1, file) == 1 && magic == CATALOG_PREDICATE_MAGIC;
+
+    for (uint32_t i = 0; i < catalog->num_tables; i++)
+    {
+        TableDef *table = &catalog->tables[i];
+        for (uint32_t j = 0; j < table->num_indexes; j++)
+        {
+            IndexDef *index = &table->indexes[j];
+            uint32_t length = 0;
+            ok = ok && fread(&length, sizeof(uint32_t), 1, file) == 1 &&
+                 length < MAX_INDEX_PREDICATE &&
+                 fread(index->predicate, 1, length, file) == length;
+            index->predicate[ok ? length : 0] = '\0';
+        }
+    }
+}
+
+// Expression indexes come after the predicates: the function each index
+// applies to its column, with the SUBSTR bounds
+#define CATALOG_EXPRESSION_MAGIC 0x52505845 // "EXPR"
+
+static void catalog_write_expressions(Catalog *catalog, FILE *file)
+{
+    uint32_t magic = CATALOG_EXPRESSION_MAGIC;
+    fwrite(&magic, sizeof(uint32_t), 1, file);
+
+    for (uint32_t i = 0; i < catalog->num_tables; i++)
+    {
+        TableDef *table = &catalog->tables[i];
+        for (uint32_t j = 0; j < table->num_indexes; j++)
+        {
+            ColumnFunc *expr = &table->indexes[j].expr;
+            int32_t fields[3] = {(int32_t)expr->type, expr->start, expr->length};
+            fwrite(fields, sizeof(int32_t), 3, file);
+        }
+    }
+}
+
+static void catalog_read_expressions(Catalog *catalog, FILE *file)
+{
+    uint32_t magic;
+    bool ok = fread(&magic, sizeof(uint32_t), 1, file) == 1 && magic == CATALOG_EXPRESSION_MAGIC;
+
+    for (uint32_t i = 0; i < catalog->num_tables; i++)
+    {
+        TableDef *table = &catalog->tables[i];
+        for (uint32_t j = 0; j < table->num_indexes; j++)
+        {
+            ColumnFunc *expr = &table->indexes[j].expr;
+            int32_t fields[3];
+            ok = ok && fread(fields, sizeof(int32_t), 3, file) == 3 &&
+                 fields[0] >= COLUMN_FUNC_NONE && fields[0] <= COLUMN_FUNC_INT;
+            expr->type = ok ? (ColumnFuncType)fields[0] : COLUMN_FUNC_NONE;
+            expr->start = ok ? fields[1] : 0;
+            expr->length = ok ? fields[2] : 0;
+        }
+    }
+}
+
 bool catalog_save(Catalog *catalog, const char *db_name)
 {
+    // Whatever changed, access paths picked before may no longer apply
+    catalog->version++;
+
     char filename[512];
     snprintf(filename, sizeof(filename), "Database/%s/%s.catalog", db_name, db_name);
 
-    FILE *file = fopen(filename, "wb");
+    // Written beside the catalog and renamed over it, so a reader (or a
+    // crash) sees the old catalog or the new one and never half of each
+    char temp_filename[520];
+    snprintf(temp_filename, sizeof(temp_filename), "%s.tmp", filename);
+
+    FILE *file = fopen(temp_filename, "wb");
     if (!file)
     {
         return false;
@@ -161,7 +456,17 @@ bool catalog_save(Catalog *catalog, const char *db_name)
         }
     }
 
-    fclose(file);
+    catalog_write_stats(catalog, file);
+    catalog_write_keys(catalog, file);
+    catalog_write_includes(catalog, file);
+    catalog_write_predicates(catalog, file);
+    catalog_write_expressions(catalog, file);
+
+    if (fclose(file) != 0 || rename(temp_filename, filename) != 0)
+    {
+        remove(temp_filename);
+        return false;
+    }
     return true;
 }
 
@@ -181,6 +486,8 @@ bool catalog_load(Catalog *catalog, const char *db_name)
         return true;
     }
 
+    catalog->version = 0;
+
     // Read number of tables
     if (fread(&catalog->num_tables, sizeof(uint32_t), 1, file) != 1) {
         fclose(file);
@@ -245,6 +552,12 @@ bool catalog_load(Catalog *catalog, const char *db_name)
         }
     }
 
+    catalog_read_stats(catalog, file);
+    catalog_read_keys(catalog, file);
+    catalog_read_includes(catalog, file);
+    catalog_read_predicates(catalog, file);
+    catalog_read_expressions(catalog, file);
+
     fclose(file);
     return true;
 }
@@ -277,6 +590,8 @@ bool catalog_load_from_path(Catalog *catalog, const char *path)
         return true;
     }
 
+    catalog->version = 0;
+
     // Read number of tables
     fread(&catalog->num_tables, sizeof(uint32_t), 1, file);
 
@@ -332,6 +647,12 @@ bool catalog_load_from_path(Catalog *catalog, const char *path)
         }
     }
 
+    catalog_read_stats(catalog, file);
+    catalog_read_keys(catalog, file);
+    catalog_read_includes(catalog, file);
+    catalog_read_predicates(catalog, file);
+    catalog_read_expressions(catalog, file);
+
     fclose(file);
     return true;
 }
\ No newline at end of file
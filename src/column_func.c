@@ -0,0 +1,247 @@
+#include "../include/column_func.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#define SECONDS_PER_DAY 86400
+
+static const struct
+{
+  const char *name;
+  ColumnFuncType type;
+} functions[] = {
+    {"lower", COLUMN_FUNC_LOWER},
+    {"upper", COLUMN_FUNC_UPPER},
+    {"substr", COLUMN_FUNC_SUBSTR},
+    {"date", COLUMN_FUNC_DATE},
+    {"cast", COLUMN_FUNC_INT},
+};
+
+bool column_func_lookup(const char *name, ColumnFuncType *type)
+{
+  for (size_t i = 0; i < sizeof(functions) / sizeof(functions[0]); i++)
+  {
+    if (strcasecmp(name, functions[i].name) == 0)
+    {
+      *type = functions[i].type;
+      return true;
+    }
+  }
+  return false;
+}
+
+static bool text_result(ColumnFuncType type)
+{
+  return type == COLUMN_FUNC_LOWER || type == COLUMN_FUNC_UPPER ||
+         type == COLUMN_FUNC_SUBSTR;
+}
+
+bool column_func_supports(const ColumnFunc *func, ColumnType type)
+{
+  switch (func->type)
+  {
+  case COLUMN_FUNC_NONE:
+    return true;
+  case COLUMN_FUNC_LOWER:
+  case COLUMN_FUNC_UPPER:
+  case COLUMN_FUNC_SUBSTR:
+    return type == COLUMN_TYPE_STRING;
+  case COLUMN_FUNC_DATE:
+    return type == COLUMN_TYPE_TIMESTAMP || type == COLUMN_TYPE_BIGINT ||
+           type == COLUMN_TYPE_DATE;
+  case COLUMN_FUNC_INT:
+    return type != COLUMN_TYPE_BLOB;
+  }
+  return false;
+}
+
+bool column_func_equal(const ColumnFunc *a, const ColumnFunc *b)
+{
+  return a->type == b->type &&
+         (a->type != COLUMN_FUNC_SUBSTR ||
+          (a->start == b->start && a->length == b->length));
+}
+
+bool column_func_case_only(const ColumnFunc *func, ColumnType type)
+{
+  return type == COLUMN_TYPE_STRING &&
+         (func->type == COLUMN_FUNC_NONE || func->type == COLUMN_FUNC_LOWER ||
+          func->type == COLUMN_FUNC_UPPER);
+}
+
+static void set_text(ColumnFuncValue *out, const char *text, size_t length)
+{
+  if (length >= sizeof(out->text))
+  {
+    length = sizeof(out->text) - 1;
+  }
+  out->is_text = true;
+  out->number = 0;
+  out->length = length;
+  for (size_t i = 0; i < length; i++)
+  {
+    out->text[i] = tolower((unsigned char)text[i]);
+  }
+  out->text[length] = '\0';
+}
+
+static void set_number(ColumnFuncValue *out, int64_t number)
+{
+  out->is_text = false;
+  out->number = number;
+  out->length = 0;
+  out->text[0] = '\0';
+}
+
+static int64_t integer_value(ColumnType type, const uint8_t *value)
+{
+  switch (type)
+  {
+  case COLUMN_TYPE_BIGINT:
+  case COLUMN_TYPE_TIMESTAMP:
+  {
+    int64_t wide;
+    memcpy(&wide, value, sizeof(wide));
+    return wide;
+  }
+  case COLUMN_TYPE_BOOLEAN:
+    return value[0] != 0;
+  case COLUMN_TYPE_FLOAT:
+  {
+    float real;
+    memcpy(&real, value, sizeof(real));
+    return (int64_t)real;
+  }
+  case COLUMN_TYPE_STRING:
+    return atoi((const char *)value);
+  default:
+  {
+    int32_t narrow;
+    memcpy(&narrow, value, sizeof(narrow));
+    return narrow;
+  }
+  }
+}
+
+void column_func_eval(const ColumnFunc *func, ColumnType type,
+                      const uint8_t *value, ColumnFuncValue *out)
+{
+  switch (func->type)
+  {
+  case COLUMN_FUNC_NONE:
+  case COLUMN_FUNC_LOWER:
+  case COLUMN_FUNC_UPPER:
+    if (type == COLUMN_TYPE_STRING)
+    {
+      set_text(out, (const char *)value, strlen((const char *)value));
+    }
+    else
+    {
+      set_number(out, integer_value(type, value));
+    }
+    break;
+  case COLUMN_FUNC_SUBSTR:
+  {
+    const char *text = (const char *)value;
+    size_t length = strlen(text);
+    size_t start = func->start > 1 ? (size_t)func->start - 1 : 0;
+    start = start < length ? start : length;
+    size_t taken = length - start;
+    if (func->length >= 0 && (size_t)func->length < taken)
+    {
+      taken = func->length;
+    }
+    set_text(out, text + start, taken);
+    break;
+  }
+  case COLUMN_FUNC_DATE:
+  {
+    int64_t seconds = integer_value(type, value);
+    if (type == COLUMN_TYPE_DATE)
+    {
+      set_number(out, seconds);
+      break;
+    }
+    int64_t day = seconds / SECONDS_PER_DAY;
+    if (seconds % SECONDS_PER_DAY < 0)
+    {
+      day--;
+    }
+    set_number(out, day);
+    break;
+  }
+  case COLUMN_FUNC_INT:
+    set_number(out, (int32_t)integer_value(type, value));
+    break;
+  }
+}
+
+void column_func_literal(const ColumnFunc *func, const char *literal,
+                         ColumnFuncValue *out)
+{
+  if (func->type == COLUMN_FUNC_NONE || text_result(func->type))
+  {
+    set_text(out, literal, strlen(literal));
+  }
+  else
+  {
+    set_number(out, atoll(literal));
+  }
+}
+
+int column_func_compare(const ColumnFuncValue *a, const ColumnFuncValue *b)
+{
+  if (a->is_text)
+  {
+    return strcmp(a->text, b->text);
+  }
+  return (a->number > b->number) - (a->number < b->number);
+}
+
+uint32_t column_func_key(const ColumnFuncValue *value, uint8_t *key)
+{
+  if (value->is_text)
+  {
+    memcpy(key, value->text, value->length);
+    return value->length;
+  }
+  int32_t number = (int32_t)value->number;
+  memcpy(key, &number, sizeof(number));
+  return sizeof(number);
+}
+
+void column_func_format(const ColumnFunc *func, const char *column,
+                        char *buffer, size_t size)
+{
+  switch (func->type)
+  {
+  case COLUMN_FUNC_NONE:
+    snprintf(buffer, size, "%s", column);
+    break;
+  case COLUMN_FUNC_SUBSTR:
+    if (func->length >= 0)
+    {
+      snprintf(buffer, size, "substr(%s, %d, %d)", column, func->start,
+               func->length);
+    }
+    else
+    {
+      snprintf(buffer, size, "substr(%s, %d)", column, func->start);
+    }
+    break;
+  case COLUMN_FUNC_INT:
+    snprintf(buffer, size, "cast(%s as int)", column);
+    break;
+  default:
+    for (size_t i = 0; i < sizeof(functions) / sizeof(functions[0]); i++)
+    {
+      if (functions[i].type == func->type)
+      {
+        snprintf(buffer, size, "%s(%s)", functions[i].name, column);
+      }
+    }
+    break;
+  }
+}
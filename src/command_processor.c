@@ -4,6 +4,18 @@
 #include "../include/cursor.h"
 #include "../include/utils.h"
 #include "../include/json_formatter.h" // Add this include for JSON formatting functions
+#include "../include/hot_index.h"
+#include "../include/bitmap_index.h"
+#include "../include/column_func.h"
+#include "../include/join.h"
+#include "../include/online_index.h"
+#include "../include/table_cache.h"
+#include "../include/parallel_scan.h"
+#include "../include/query_planner.h"
+#include "../include/sql_parser.h"
+#include "../include/data_utils.h"
+#include <errno.h>
+#include <ctype.h>
 #include <math.h>
 #include <stdint.h>
 #include <stdlib.h>
@@ -52,7 +64,7 @@ MetaCommandResult do_meta_command(Input_Buffer *buf, Database *db)
         return META_COMMAND_SUCCESS;
       }
 
-      // Open the table temporarily if it's not the active one
+      // Borrow the table from the cache if it's not the active one
       Table *table_to_show = NULL;
       bool temp_table = false;
 
@@ -65,20 +77,21 @@ MetaCommandResult do_meta_command(Input_Buffer *buf, Database *db)
       }
       else
       {
-        // Open the table temporarily
-        table_to_show = db_open(db->catalog.tables[table_idx].filename);
+        table_to_show =
+            table_cache_acquire(db->catalog.tables[table_idx].filename);
         table_to_show->root_page_num =
             db->catalog.tables[table_idx].root_page_num;
+        table_set_key(table_to_show, &db->catalog.tables[table_idx].key);
         temp_table = true;
       }
 
       printf("Tree for table '%s':\n", table_name);
-      print_tree(table_to_show->pager, table_to_show->root_page_num, 0);
+      print_tree(table_to_show, &db->catalog.tables[table_idx],
+                 table_to_show->root_page_num);
 
-      // Close the temporary table if we created one
       if (temp_table)
       {
-        db_close(table_to_show);
+        table_cache_release(table_to_show);
       }
     }
     else
@@ -92,7 +105,8 @@ MetaCommandResult do_meta_command(Input_Buffer *buf, Database *db)
 
       TableDef *active_table_def = catalog_get_active_table(&db->catalog);
       printf("Tree for active table '%s':\n", active_table_def->name);
-      print_tree(db->active_table->pager, db->active_table->root_page_num, 0);
+      print_tree(db->active_table, active_table_def,
+                 db->active_table->root_page_num);
     }
 
     return META_COMMAND_SUCCESS;
@@ -162,352 +176,358 @@ MetaCommandResult do_meta_command(Input_Buffer *buf, Database *db)
     return META_COMMAND_SUCCESS;
   }
 
-  return META_COMMAND_UNRECOGNIZED_COMMAND;
-}
+  else if (strncmp(buf->buffer, ".threads", 8) == 0)
+  {
+    int num_threads = 0;
+    int args = sscanf(buf->buffer, ".threads %d", &num_threads);
 
-PrepareResult prepare_insert(Input_Buffer *buf, Statement *statement)
-{
-  statement->type = STATEMENT_INSERT;
+    if (args != 1)
+    {
+      printf("Usage: .threads N\n");
+      printf("Current scan threads: %u\n", db->scan_threads);
+      return META_COMMAND_SUCCESS;
+    }
 
-  char *sql = buf->buffer;
+    if (num_threads < 1 || num_threads > SCAN_MAX_THREADS)
+    {
+      printf("Thread count must be between 1 and %d\n", SCAN_MAX_THREADS);
+      return META_COMMAND_SUCCESS;
+    }
 
-  // Check for "INSERT INTO table_name VALUES (values...)" syntax
-  char *into_keyword = strcasestr(sql, "into");
-  char *values_keyword = strcasestr(sql, "values");
+    db->scan_threads = num_threads;
+    printf("Scan threads set to %d\n", num_threads);
+    return META_COMMAND_SUCCESS;
+  }
 
-  if (into_keyword && values_keyword)
+  else if (strcmp(buf->buffer, ".tablecache") == 0)
   {
-    // New syntax: INSERT INTO table_name VALUES (1, "name", etc)
-    char table_name[MAX_TABLE_NAME];
-
-    // Extract table name between "into" and "values"
-    int table_name_start = (into_keyword - sql) + 4; // Skip "into"
-    while (sql[table_name_start] == ' ')
-      table_name_start++; // Skip spaces
-
-    int table_name_end = (values_keyword - sql);
-    while (sql[table_name_end - 1] == ' ')
-      table_name_end--; // Trim trailing spaces
+    table_cache_print();
+    return META_COMMAND_SUCCESS;
+  }
 
-    int table_name_len = table_name_end - table_name_start;
-    if (table_name_len <= 0 || table_name_len >= MAX_TABLE_NAME)
+  else if (strncmp(buf->buffer, ".hotindex", 9) == 0)
+  {
+    if (!db->active_table)
     {
-      return PREPARE_SYNTAX_ERROR;
+      printf("Error: No active table selected.\n");
+      return META_COMMAND_SUCCESS;
     }
 
-    strncpy(table_name, sql + table_name_start, table_name_len);
-    table_name[table_name_len] = '\0';
+    char setting[8] = {0};
+    int args = sscanf(buf->buffer, ".hotindex %7s", setting);
+    if (args == 1 && strcasecmp(setting, "on") == 0)
+    {
+      hot_index_enable(db->active_table);
+      printf("Hot index enabled for '%s'\n", db->active_table_name);
+    }
+    else if (args == 1 && strcasecmp(setting, "off") == 0)
+    {
+      hot_index_disable(db->active_table);
+      printf("Hot index disabled for '%s'\n", db->active_table_name);
+    }
+    else if (args == 1)
+    {
+      printf("Usage: .hotindex [on|off]\n");
+    }
+    else
+    {
+      hot_index_print(db->active_table, db->active_table_name);
+    }
+    return META_COMMAND_SUCCESS;
+  }
 
-    // Store table name in statement
-    strncpy(statement->table_name, table_name, MAX_TABLE_NAME - 1);
-    statement->table_name[MAX_TABLE_NAME - 1] = '\0';
+  else if (strncmp(buf->buffer, ".workmem", 8) == 0)
+  {
+    int kilobytes = 0;
+    int args = sscanf(buf->buffer, ".workmem %d", &kilobytes);
 
-    // Now extract the values - find opening parenthesis after VALUES
-    char *open_paren = strchr(values_keyword, '(');
-    if (!open_paren)
+    if (args != 1)
     {
-      return PREPARE_SYNTAX_ERROR;
+      printf("Usage: .workmem KB\n");
+      printf("Current work memory: %zu KB\n", db->work_memory / 1024);
+      return META_COMMAND_SUCCESS;
     }
 
-    // Find closing parenthesis
-    char *close_paren = strrchr(open_paren, ')');
-    if (!close_paren)
+    if (kilobytes < SORT_MIN_MEMORY_BUDGET / 1024)
     {
-      return PREPARE_SYNTAX_ERROR;
+      printf("Work memory must be at least %d KB\n",
+             SORT_MIN_MEMORY_BUDGET / 1024);
+      return META_COMMAND_SUCCESS;
     }
 
-    // This is where we'll store our values
-    statement->num_values = 0;
-    statement->values = NULL;
+    db->work_memory = (size_t)kilobytes * 1024;
+    printf("Work memory set to %d KB\n", kilobytes);
+    return META_COMMAND_SUCCESS;
+  }
 
-    // Extract all values between parentheses
-    char *value_str = open_paren + 1;
-    while (value_str < close_paren && statement->num_values < MAX_COLUMNS)
-    {
-      while (*value_str == ' ' || *value_str == '\t')
-        value_str++; // Skip spaces
+  return META_COMMAND_UNRECOGNIZED_COMMAND;
+}
 
-      if (value_str >= close_paren)
-        break;
+// Legacy positional syntax kept for the original fixed-row tables:
+// insert 1 username email. SQL INSERT goes through the parser.
+PrepareResult prepare_insert(Input_Buffer *buf, Statement *statement)
+{
+  statement->type = STATEMENT_INSERT;
 
-      // Allocate space for the new value
-      statement->values = realloc(statement->values,
-                                  (statement->num_values + 1) * sizeof(char *));
-      if (!statement->values)
-      {
-        return PREPARE_SYNTAX_ERROR;
-      }
+  char *id_string = strtok(buf->buffer, " "); // Will get "insert"
+  id_string = strtok(NULL, " ");              // Get the actual ID
+  char *username = strtok(NULL, " ");
+  char *email = strtok(NULL, " ");
 
-      // Handle quoted strings
-      if (*value_str == '"' || *value_str == '\'')
-      {
-        char quote_char = *value_str;
-        value_str++; // Skip opening quote
+  if (id_string == NULL || username == NULL || email == NULL)
+  {
+    return PREPARE_SYNTAX_ERROR;
+  }
 
-        // Find closing quote
-        char *end_quote = strchr(value_str, quote_char);
-        if (!end_quote || end_quote >= close_paren)
-        {
-          return PREPARE_SYNTAX_ERROR;
-        }
+  int id = atoi(id_string);
+  if (id < 0)
+  {
+    return PREPARE_NEGATIVE_ID;
+  }
 
-        int value_len = end_quote - value_str;
-        char *value = malloc(value_len + 1);
-        if (!value)
-          return PREPARE_SYNTAX_ERROR;
+  if (strlen(username) > COLUMN_USERNAME_SIZE)
+  {
+    return PREPARE_STRING_TOO_LONG;
+  }
 
-        strncpy(value, value_str, value_len);
-        value[value_len] = '\0';
+  if (strlen(email) > COLUMN_EMAIL_SIZE)
+  {
+    return PREPARE_STRING_TOO_LONG;
+  }
 
-        statement->values[statement->num_values++] = value;
-        value_str = end_quote + 1;
-      }
-      else
-      {
-        // Handle non-quoted values (numbers, etc.)
-        char *comma = strchr(value_str, ',');
-        if (!comma || comma > close_paren)
-          comma = close_paren;
-
-        int value_len = comma - value_str;
-        while (value_len > 0 && (value_str[value_len - 1] == ' ' ||
-                                 value_str[value_len - 1] == '\t'))
-          value_len--; // Trim trailing spaces
-
-        char *value = malloc(value_len + 1);
-        if (!value)
-          return PREPARE_SYNTAX_ERROR;
+  statement->row_to_insert.id = id;
+  strcpy(statement->row_to_insert.username, username);
+  strcpy(statement->row_to_insert.email, email);
 
-        strncpy(value, value_str, value_len);
-        value[value_len] = '\0';
+  return PREPARE_SUCCESS;
+}
+
+// Text of a parsed value, substituting EXECUTE arguments for placeholders.
+// Returns NULL if the placeholder has no argument.
+static const char *bind_value(SqlValue *value, SqlValue *args, uint32_t num_args)
+{
+  if (value->kind == SQL_VALUE_LITERAL)
+  {
+    return value->text;
+  }
+  if (value->param_index >= num_args)
+  {
+    return NULL;
+  }
+  return args[value->param_index].text;
+}
 
-        statement->values[statement->num_values++] = value;
-        value_str = comma;
+// Lower a parsed statement into the Statement the executors consume,
+// binding placeholder values from args
+static PrepareResult bind_sql_statement(SqlStatement *sql, SqlValue *args,
+                                        uint32_t num_args, Statement *statement)
+{
+  strncpy(statement->table_name, sql->table_name, MAX_TABLE_NAME - 1);
+  statement->table_name[MAX_TABLE_NAME - 1] = '\0';
+
+  switch (sql->type)
+  {
+  case SQL_SELECT:
+  {
+    statement->type = STATEMENT_SELECT;
+    statement->explain = sql->explain;
+    statement->explain_analyze = sql->explain_analyze;
+    memcpy(statement->table_alias, sql->table_alias, MAX_TABLE_NAME);
+    statement->has_join = sql->has_join;
+    statement->join = sql->join;
+    if (sql->num_order_by > 0)
+    {
+      statement->order_by = malloc(sql->num_order_by * sizeof(SqlOrderBy));
+      memcpy(statement->order_by, sql->order_by,
+             sql->num_order_by * sizeof(SqlOrderBy));
+      statement->num_order_by = sql->num_order_by;
+    }
+    statement->has_limit = sql->has_limit;
+    statement->limit = sql->limit;
+    statement->offset = sql->offset;
+
+    if (sql->where)
+    {
+      statement->where_expr = sql_expr_bind(sql->where, args, num_args);
+      if (!statement->where_expr)
+      {
+        return PREPARE_SYNTAX_ERROR;
       }
+      statement->has_where_clause = true;
 
-      // Skip comma if present
-      if (*value_str == ',')
-        value_str++;
+      // Single comparisons are still mirrored into the flat fields
+      SqlExpr *where = statement->where_expr;
+      if (where->type == SQL_EXPR_COMPARE)
+      {
+        strncpy(statement->where_column, where->column, MAX_COLUMN_NAME - 1);
+        statement->where_column[MAX_COLUMN_NAME - 1] = '\0';
+        strncpy(statement->where_value, where->value.text, COLUMN_EMAIL_SIZE - 1);
+        statement->where_value[COLUMN_EMAIL_SIZE - 1] = '\0';
+      }
     }
 
-    // For backward compatibility, still populate the old row_to_insert
-    // structure
-    if (statement->num_values >= 1)
+    if (sql->num_columns > 0)
     {
-      statement->row_to_insert.id = atoi(statement->values[0]);
-      // Check for negative ID - must check after conversion to int
-      if (atoi(statement->values[0]) < 0)
+      statement->columns_to_select = malloc(sql->num_columns * sizeof(char *));
+      for (uint32_t i = 0; i < sql->num_columns; i++)
       {
-        for (uint32_t i = 0; i < statement->num_values; i++)
-        {
-          free(statement->values[i]);
-        }
-        free(statement->values);
-        return PREPARE_NEGATIVE_ID;
+        statement->columns_to_select[i] = my_strdup(sql->columns[i]);
+      }
+      statement->num_columns_to_select = sql->num_columns;
+    }
+    if (sql->has_aggregates)
+    {
+      statement->has_aggregates = true;
+      if (sql->num_columns > 0)
+      {
+        statement->select_functions =
+            malloc(sql->num_columns * sizeof(SqlAggregateFunc));
+        memcpy(statement->select_functions, sql->functions,
+               sql->num_columns * sizeof(SqlAggregateFunc));
+      }
+      if (sql->num_group_by > 0)
+      {
+        statement->group_by = malloc(sql->num_group_by * MAX_COLUMN_NAME);
+        memcpy(statement->group_by, sql->group_by,
+               sql->num_group_by * MAX_COLUMN_NAME);
+        statement->num_group_by = sql->num_group_by;
       }
     }
+    return PREPARE_SUCCESS;
+  }
+
+  case SQL_INSERT:
+  {
+    statement->type = STATEMENT_INSERT;
+    if (sql->num_values == 0 || sql->num_values > MAX_COLUMNS)
+    {
+      return PREPARE_SYNTAX_ERROR;
+    }
+
+    statement->values = malloc(sql->num_values * sizeof(char *));
+    statement->num_values = 0;
+    for (uint32_t i = 0; i < sql->num_values; i++)
+    {
+      const char *text = bind_value(&sql->values[i], args, num_args);
+      statement->values[statement->num_values++] = my_strdup(text ? text : "");
+    }
 
+    // For backward compatibility, still populate the old row_to_insert
+    // structure
+    // Negative keys are checked at execution, once the key type is known
+    statement->row_to_insert.id = atoi(statement->values[0]);
     if (statement->num_values >= 2)
     {
       strncpy(statement->row_to_insert.username, statement->values[1],
               COLUMN_USERNAME_SIZE);
       statement->row_to_insert.username[COLUMN_USERNAME_SIZE] = '\0';
     }
-
     if (statement->num_values >= 3)
     {
       strncpy(statement->row_to_insert.email, statement->values[2],
               COLUMN_EMAIL_SIZE);
       statement->row_to_insert.email[COLUMN_EMAIL_SIZE] = '\0';
     }
-
     return PREPARE_SUCCESS;
   }
-  else
-  {
-    // Check for alternate syntax: INSERT INTO table_name (val1, val2, ...)
-    // without the VALUES keyword
-    if (into_keyword) {
-      char table_name[MAX_TABLE_NAME];
-
-      // Extract table name after "into"
-      int table_name_start = (into_keyword - sql) + 4; // Skip "into"
-      while (sql[table_name_start] == ' ')
-        table_name_start++; // Skip spaces
 
-      // Find opening parenthesis
-      char *open_paren = strchr(into_keyword, '(');
-      if (!open_paren) {
-        return PREPARE_SYNTAX_ERROR;
-      }
-
-      // Extract table name between "into" and "("
-      int table_name_end = (open_paren - sql);
-      while (sql[table_name_end - 1] == ' ')
-        table_name_end--; // Trim trailing spaces
-
-      int table_name_len = table_name_end - table_name_start;
-      if (table_name_len <= 0 || table_name_len >= MAX_TABLE_NAME)
-      {
-        return PREPARE_SYNTAX_ERROR;
-      }
-
-      strncpy(table_name, sql + table_name_start, table_name_len);
-      table_name[table_name_len] = '\0';
-
-      // Store table name in statement
-      strncpy(statement->table_name, table_name, MAX_TABLE_NAME - 1);
-      statement->table_name[MAX_TABLE_NAME - 1] = '\0';
-
-      // Find closing parenthesis
-      char *close_paren = strrchr(open_paren, ')');
-      if (!close_paren)
+  case SQL_UPDATE:
+  {
+    statement->type = STATEMENT_UPDATE;
+    statement->assignments =
+        malloc(sql->num_assignments * sizeof(SqlAssignment));
+    for (uint32_t i = 0; i < sql->num_assignments; i++)
+    {
+      SqlAssignment *assignment = &statement->assignments[i];
+      *assignment = sql->assignments[i];
+      if (!bind_value(&assignment->value, args, num_args))
       {
+        free(statement->assignments);
+        statement->assignments = NULL;
         return PREPARE_SYNTAX_ERROR;
       }
-
-      // This is where we'll store our values
-      statement->num_values = 0;
-      statement->values = NULL;
-
-      // Extract all values between parentheses
-      char *value_str = open_paren + 1;
-      while (value_str < close_paren && statement->num_values < MAX_COLUMNS)
-      {
-        while (*value_str == ' ' || *value_str == '\t')
-          value_str++; // Skip spaces
-
-        if (value_str >= close_paren)
-          break;
-
-        // Allocate space for the new value
-        statement->values = realloc(statement->values,
-                                   (statement->num_values + 1) * sizeof(char *));
-        if (!statement->values)
-        {
-          return PREPARE_SYNTAX_ERROR;
-        }
-
-        // Handle quoted strings
-        if (*value_str == '"' || *value_str == '\'')
-        {
-          char quote_char = *value_str;
-          value_str++; // Skip opening quote
-
-          // Find closing quote
-          char *end_quote = strchr(value_str, quote_char);
-          if (!end_quote || end_quote >= close_paren)
-          {
-            return PREPARE_SYNTAX_ERROR;
-          }
-
-          int value_len = end_quote - value_str;
-          char *value = malloc(value_len + 1);
-          if (!value)
-            return PREPARE_SYNTAX_ERROR;
-
-          strncpy(value, value_str, value_len);
-          value[value_len] = '\0';
-
-          statement->values[statement->num_values++] = value;
-          value_str = end_quote + 1;
-        }
-        else
-        {
-          // Handle non-quoted values (numbers, etc.)
-          char *comma = strchr(value_str, ',');
-          if (!comma || comma > close_paren)
-            comma = close_paren;
-
-          int value_len = comma - value_str;
-          while (value_len > 0 && (value_str[value_len - 1] == ' ' ||
-                                  value_str[value_len - 1] == '\t'))
-            value_len--; // Trim trailing spaces
-
-          char *value = malloc(value_len + 1);
-          if (!value)
-            return PREPARE_SYNTAX_ERROR;
-
-          strncpy(value, value_str, value_len);
-          value[value_len] = '\0';
-
-          statement->values[statement->num_values++] = value;
-          value_str = comma;
-        }
-
-        // Skip comma if present
-        if (*value_str == ',')
-          value_str++;
-      }
-
-      // For backward compatibility, still populate the old row_to_insert
-      // structure
-      if (statement->num_values >= 1)
-      {
-        statement->row_to_insert.id = atoi(statement->values[0]);
-        // Check for negative ID - must check after conversion to int
-        if (atoi(statement->values[0]) < 0)
-        {
-          for (uint32_t i = 0; i < statement->num_values; i++)
-          {
-            free(statement->values[i]);
-          }
-          free(statement->values);
-          return PREPARE_NEGATIVE_ID;
-        }
-      }
-
-      if (statement->num_values >= 2)
-      {
-        strncpy(statement->row_to_insert.username, statement->values[1],
-                COLUMN_USERNAME_SIZE);
-        statement->row_to_insert.username[COLUMN_USERNAME_SIZE] = '\0';
-      }
-
-      if (statement->num_values >= 3)
+      if (assignment->value.kind == SQL_VALUE_PARAM)
       {
-        strncpy(statement->row_to_insert.email, statement->values[2],
-                COLUMN_EMAIL_SIZE);
-        statement->row_to_insert.email[COLUMN_EMAIL_SIZE] = '\0';
+        assignment->value = args[assignment->value.param_index];
       }
-
-      return PREPARE_SUCCESS;
     }
-
-    // Old syntax: insert 1 username email
-    // Use the existing implementation
-    char *id_string = strtok(buf->buffer, " "); // Will get "insert"
-    id_string = strtok(NULL, " ");              // Get the actual ID
-    char *username = strtok(NULL, " ");
-    char *email = strtok(NULL, " ");
-
-    if (id_string == NULL || username == NULL || email == NULL)
+    statement->num_assignments = sql->num_assignments;
+    if (sql->where)
     {
-      return PREPARE_SYNTAX_ERROR;
+      statement->where_expr = sql_expr_bind(sql->where, args, num_args);
+      if (!statement->where_expr)
+      {
+        free(statement->assignments);
+        statement->assignments = NULL;
+        statement->num_assignments = 0;
+        return PREPARE_SYNTAX_ERROR;
+      }
+      statement->has_where_clause = true;
     }
+    return PREPARE_SUCCESS;
+  }
 
-    int id = atoi(id_string);
-    if (id < 0)
+  case SQL_DELETE:
+    statement->type = STATEMENT_DELETE;
+    if (sql->where)
     {
-      return PREPARE_NEGATIVE_ID;
+      statement->where_expr = sql_expr_bind(sql->where, args, num_args);
+      if (!statement->where_expr)
+      {
+        return PREPARE_SYNTAX_ERROR;
+      }
+      statement->has_where_clause = true;
     }
+    return PREPARE_SUCCESS;
 
-    if (strlen(username) > COLUMN_USERNAME_SIZE)
-    {
-      return PREPARE_STRING_TOO_LONG;
-    }
+  case SQL_ANALYZE:
+    statement->type = STATEMENT_ANALYZE;
+    return PREPARE_SUCCESS;
 
-    if (strlen(email) > COLUMN_EMAIL_SIZE)
-    {
-      return PREPARE_STRING_TOO_LONG;
-    }
+  default:
+    return PREPARE_UNRECOGNIZED_STATEMENT;
+  }
+}
 
-    statement->row_to_insert.id = id;
-    strcpy(statement->row_to_insert.username, username);
-    strcpy(statement->row_to_insert.email, email);
+// SELECT, INSERT, UPDATE, DELETE and the prepared statement commands
+PrepareResult prepare_sql_statement(Input_Buffer *buf, Statement *statement)
+{
+  char error[SQL_MAX_ERROR];
+  SqlStatement *sql = sql_parse(buf->buffer, error, sizeof(error));
+  if (!sql)
+  {
+    printf("Parse error: %s\n", error);
+    return PREPARE_SYNTAX_ERROR;
+  }
 
+  switch (sql->type)
+  {
+  case SQL_PREPARE:
+    statement->type = STATEMENT_PREPARE;
+    statement->sql = sql;
+    return PREPARE_SUCCESS;
+  case SQL_EXECUTE:
+    statement->type = STATEMENT_EXECUTE;
+    statement->sql = sql;
     return PREPARE_SUCCESS;
+  case SQL_DEALLOCATE:
+    statement->type = STATEMENT_DEALLOCATE;
+    statement->sql = sql;
+    return PREPARE_SUCCESS;
+  default:
+    break;
+  }
+
+  if (sql->num_params > 0)
+  {
+    printf("Parse error: placeholders are only allowed in PREPARE\n");
+    sql_statement_free(sql);
+    return PREPARE_SYNTAX_ERROR;
   }
+
+  PrepareResult result = bind_sql_statement(sql, NULL, 0, statement);
+  sql_statement_free(sql);
+  return result;
 }
 
 PrepareResult prepare_statement(Input_Buffer *buf, Statement *statement)
@@ -534,179 +554,24 @@ PrepareResult prepare_statement(Input_Buffer *buf, Statement *statement)
   // Rest of command processing
   if (strncasecmp(buf->buffer, "insert", 6) == 0)
   {
-    return prepare_insert(buf, statement);
+    // Positional legacy form: insert 1 username email
+    char *after = buf->buffer + 6;
+    while (*after == ' ')
+      after++;
+    if (isdigit((unsigned char)*after) || *after == '-')
+    {
+      return prepare_insert(buf, statement);
+    }
   }
-  else if (strncasecmp(buf->buffer, "select", 6) == 0)
+
+  if (sql_is_parsable(buf->buffer))
   {
-    return prepare_select(buf, statement);
+    return prepare_sql_statement(buf, statement);
   }
   else if (strncasecmp(buf->buffer, "create index", 12) == 0)
   {
     return prepare_create_index(buf, statement);
   }
-  else if (strncasecmp(buf->buffer, "update", 6) == 0)
-  {
-    statement->type = STATEMENT_UPDATE;
-
-    // SQL-like syntax: UPDATE table_name SET column = value WHERE id = X
-    char *sql = buf->buffer;
-    char *table_start = sql + 6; // Skip "update"
-    while (*table_start == ' ')
-      table_start++; // Skip spaces
-
-    // Find table name end (space before SET)
-    char *table_end = strcasestr(table_start, "set");
-    if (!table_end)
-    {
-      return PREPARE_SYNTAX_ERROR;
-    }
-
-    // Extract table name
-    int table_name_len = table_end - table_start;
-    while (table_start[table_name_len - 1] == ' ')
-      table_name_len--; // Trim trailing spaces
-
-    if (table_name_len <= 0 || table_name_len >= MAX_TABLE_NAME)
-    {
-      return PREPARE_SYNTAX_ERROR;
-    }
-
-    strncpy(statement->table_name, table_start, table_name_len);
-    statement->table_name[table_name_len] = '\0';
-
-    // Find column name and value
-    char *column_start = table_end + 3; // Skip "set"
-    while (*column_start == ' ')
-      column_start++; // Skip spaces
-
-    char *equals_pos = strchr(column_start, '=');
-    if (!equals_pos)
-    {
-      return PREPARE_SYNTAX_ERROR;
-    }
-
-    // Extract column name
-    int column_name_len = equals_pos - column_start;
-    while (column_start[column_name_len - 1] == ' ')
-      column_name_len--; // Trim trailing spaces
-
-    char column_name[MAX_COLUMN_NAME] = {0};
-    strncpy(column_name, column_start, column_name_len);
-    column_name[column_name_len] = '\0';
-
-    // Extract value (handling quotes)
-    char *value_start = equals_pos + 1;
-    while (*value_start == ' ')
-      value_start++; // Skip spaces
-
-    char *value_end;
-    char update_value[COLUMN_EMAIL_SIZE] = {
-        0}; // Using email size as it's larger
-
-    if (*value_start == '"' || *value_start == '\'')
-    {
-      // Value is in quotes
-      char quote_char = *value_start;
-      value_start++; // Skip opening quote
-      value_end = strchr(value_start, quote_char);
-      if (!value_end)
-      {
-        return PREPARE_SYNTAX_ERROR;
-      }
-
-      int value_len = value_end - value_start;
-      strncpy(update_value, value_start, value_len);
-      update_value[value_len] = '\0';
-    }
-    else
-    {
-      // Value is not in quotes
-      value_end = strcasestr(value_start, "where");
-      if (!value_end)
-      {
-        value_end = value_start + strlen(value_start);
-      }
-
-      int value_len = value_end - value_start;
-      while (value_start[value_len - 1] == ' ')
-        value_len--; // Trim trailing spaces
-
-      strncpy(update_value, value_start, value_len);
-      update_value[value_len] = '\0';
-    }
-
-    // Save update info to statement
-    strncpy(statement->column_to_update, column_name, MAX_COLUMN_NAME - 1);
-    statement->column_to_update[MAX_COLUMN_NAME - 1] = '\0';
-
-    strncpy(statement->update_value, update_value, COLUMN_EMAIL_SIZE - 1);
-    statement->update_value[COLUMN_EMAIL_SIZE - 1] = '\0';
-
-    // Find ID to update
-    char *id_str = strstr(buf->buffer, "where id =");
-    if (id_str)
-    {
-      statement->id_to_update = atoi(id_str + 10);
-      return PREPARE_SUCCESS;
-    }
-    else
-    {
-      return PREPARE_SYNTAX_ERROR;
-    }
-  }
-  else if (strncasecmp(buf->buffer, "delete", 6) == 0)
-  {
-    statement->type = STATEMENT_DELETE;
-
-    // New SQL-like syntax: DELETE FROM table_name WHERE id = X
-    char *sql = buf->buffer;
-    char *from_keyword = strcasestr(sql, "from");
-
-    if (from_keyword)
-    {
-      // Extract table name
-      char *table_start = from_keyword + 4; // Skip "from"
-      while (*table_start == ' ')
-        table_start++; // Skip spaces
-
-      char *table_end = strcasestr(table_start, "where");
-      if (!table_end)
-      {
-        return PREPARE_SYNTAX_ERROR;
-      }
-
-      int table_name_len = table_end - table_start;
-      while (table_start[table_name_len - 1] == ' ')
-        table_name_len--; // Trim trailing spaces
-
-      if (table_name_len <= 0 || table_name_len >= MAX_TABLE_NAME)
-      {
-        return PREPARE_SYNTAX_ERROR;
-      }
-
-      strncpy(statement->table_name, table_start, table_name_len);
-      statement->table_name[table_name_len] = '\0';
-
-      // Parse id in "where id = X"
-      char *id_str = strstr(table_end, "id =");
-      if (id_str)
-      {
-        statement->id_to_delete = atoi(id_str + 4);
-        return PREPARE_SUCCESS;
-      }
-    }
-
-    // Fallback to old syntax
-    char *id_str = strstr(buf->buffer, "where id =");
-    if (id_str)
-    {
-      statement->id_to_delete = atoi(id_str + 10);
-      return PREPARE_SUCCESS;
-    }
-
-    return PREPARE_SYNTAX_ERROR;
-  }
-
   else if (strncasecmp(buf->buffer, "create table", 12) == 0)
   {
     return prepare_create_table(buf, statement);
@@ -727,222 +592,129 @@ PrepareResult prepare_statement(Input_Buffer *buf, Statement *statement)
   return PREPARE_UNRECOGNIZED_STATEMENT;
 }
 
-PrepareResult prepare_select(Input_Buffer *buf, Statement *statement)
+void free_columns_to_select(Statement *statement)
 {
-  statement->type = STATEMENT_SELECT;
-  char *sql = buf->buffer;
-
-  // Find FROM keyword
-  char *from_keyword = strcasestr(sql, "from");
-  if (!from_keyword)
-  {
-    return PREPARE_SYNTAX_ERROR;
-  }
-
-  // Extract columns to select
-  char *columns_part = sql + 6; // Skip 'select'
-  while (*columns_part == ' ')
-    columns_part++; // Skip spaces
-
-  int columns_len = from_keyword - columns_part;
-  while (columns_part[columns_len - 1] == ' ')
-    columns_len--; // Skip trailing spaces
-
-  // Handle column select
-  if (columns_len == 1 && columns_part[0] == '*')
+  if (statement->columns_to_select)
   {
-    // Select all Columns
+    for (uint32_t i = 0; i < statement->num_columns_to_select; i++)
+    {
+      free(statement->columns_to_select[i]);
+    }
+    free(statement->columns_to_select);
     statement->columns_to_select = NULL;
     statement->num_columns_to_select = 0;
   }
-  else
-  {
-    // Parse specific columns
-    char columns_buffer[MAX_COLUMN_SIZE];
-    strncpy(columns_buffer, columns_part,
-            columns_len > (MAX_COLUMN_SIZE - 1) ? (MAX_COLUMN_SIZE - 1) : columns_len);
-    columns_buffer[columns_len > (MAX_COLUMN_SIZE - 1) ? (MAX_COLUMN_SIZE - 1) : columns_len] = '\0';
+  free(statement->select_functions);
+  statement->select_functions = NULL;
+  free(statement->group_by);
+  statement->group_by = NULL;
+  statement->num_group_by = 0;
+  statement->has_aggregates = false;
+}
+
+// Modify the execute_insert function to support transactions:
 
-    // Count commas to determine number of columns (commas + 1)
-    uint32_t num_columns = 1;
-    for (int i = 0; i < columns_len; i++)
+// Free the values array of an INSERT once the row is built or rejected.
+static void free_insert_values(Statement *statement)
+{
+  if (statement->values)
+  {
+    for (uint32_t i = 0; i < statement->num_values; i++)
     {
-      if (columns_buffer[i] == ',')
-      {
-        num_columns++;
-      }
+      free(statement->values[i]);
     }
+    free(statement->values);
+    statement->values = NULL;
+    statement->num_values = 0;
+  }
+}
 
-    // Allocate memory for columns
-    statement->columns_to_select = malloc(num_columns * sizeof(char *));
-    if (!statement->columns_to_select)
+// Set a column from the text of a literal. False if the literal is not a
+// value of the column's type, or the type (BLOB) takes no literal.
+static bool set_column_from_text(DynamicRow *row, TableDef *table_def,
+                                 uint32_t column_idx, const char *value)
+{
+  ColumnType type = table_def->columns[column_idx].type;
+  char *end = NULL;
+  errno = 0;
+  switch (type)
+  {
+  case COLUMN_TYPE_INT:
+  {
+    long number = strtol(value, &end, 10);
+    if (end == value || *end != '\0' || errno == ERANGE ||
+        number < INT32_MIN || number > INT32_MAX)
     {
-      return PREPARE_SYNTAX_ERROR;
+      return false;
     }
-
-    // Parse column names
-    char *column_start = columns_buffer;
-    uint32_t column_index = 0;
-
-    for (int i = 0; i <= columns_len; i++)
+    dynamic_row_set_int(row, table_def, column_idx, (int32_t)number);
+    return true;
+  }
+  case COLUMN_TYPE_BIGINT:
+  {
+    long long number = strtoll(value, &end, 10);
+    if (end == value || *end != '\0' || errno == ERANGE)
     {
-      if (columns_buffer[i] == ',' || columns_buffer[i] == '\0')
-      {
-        // Found a delimiter or end of string
-        columns_buffer[i] = '\0'; // Mark end of this column name
-
-        // Trim leading and trailing spaces
-        char *column_name = column_start;
-        while (*column_name == ' ')
-          column_name++;
-
-        char *end = column_name + strlen(column_name) - 1;
-        while (end > column_name && *end == ' ')
-        {
-          *end = '\0';
-          end--;
-        }
-
-        if (*column_name != '\0')
-        { // Skip empty column names
-          statement->columns_to_select[column_index] = my_strdup(column_name);
-          if (!statement->columns_to_select[column_index])
-          {
-            // Handle allocation failure
-            for (uint32_t j = 0; j < column_index; j++)
-            {
-              free(statement->columns_to_select[j]);
-            }
-            free(statement->columns_to_select);
-            statement->columns_to_select = NULL;
-            return PREPARE_SYNTAX_ERROR;
-          }
-          column_index++;
-        }
-
-        // Move to next column
-        column_start = &columns_buffer[i + 1];
-      }
+      return false;
     }
-
-    statement->num_columns_to_select = column_index;
-
-    // If no valid columns found, select all
-    if (statement->num_columns_to_select == 0)
+    dynamic_row_set_bigint(row, table_def, column_idx, number);
+    return true;
+  }
+  case COLUMN_TYPE_STRING:
+    dynamic_row_set_string(row, table_def, column_idx, value);
+    return true;
+  case COLUMN_TYPE_FLOAT:
+  {
+    double number = strtod(value, &end);
+    if (end == value || *end != '\0')
     {
-      free(statement->columns_to_select);
-      statement->columns_to_select = NULL;
-      statement->num_columns_to_select = 0;
+      return false;
     }
+    dynamic_row_set_float(row, table_def, column_idx, (float)number);
+    return true;
   }
-
-  // Extract table name between 'from' and potential 'where'
-  char *table_start = from_keyword + 4; // Skip from
-  while (*table_start == ' ')
-    table_start++; // Skip spaces
-
-  // Find end of table name (space or end of string)
-  char *table_end = table_start;
-  while (*table_end && *table_end != ' ' && *table_end != '\0')
-    table_end++;
-
-  int table_name_len = table_end - table_start;
-  if (table_name_len <= 0 || table_name_len >= MAX_TABLE_NAME)
+  case COLUMN_TYPE_BOOLEAN:
   {
-    // No table name found
-    // Free allocated memory
-    free_columns_to_select(statement);
-    return PREPARE_SYNTAX_ERROR;
+    bool truth = strcasecmp(value, "true") == 0 || strcmp(value, "1") == 0;
+    if (!truth && strcasecmp(value, "false") != 0 && strcmp(value, "0") != 0)
+    {
+      return false;
+    }
+    dynamic_row_set_boolean(row, table_def, column_idx, truth);
+    return true;
   }
-
-  // Store table name
-  strncpy(statement->table_name, table_start, table_name_len);
-  statement->table_name[table_name_len] = '\0';
-
-  // Check for 'where' clause
-  char *where_keyword = strcasestr(table_end, "where");
-  if (where_keyword)
+  case COLUMN_TYPE_DATE:
+  case COLUMN_TYPE_TIME:
+  case COLUMN_TYPE_TIMESTAMP:
   {
-    statement->has_where_clause = true;
-
-    char *condition_start = where_keyword + 5; // Skip "where"
-    while (*condition_start == ' ')
-      condition_start++;
-
-    // parse condition in format "column = value"
-    char *equals_pos = strchr(condition_start, '=');
-    if (!equals_pos)
+    int64_t number;
+    if (!parse_temporal_literal(type, value, &number))
     {
-      free_columns_to_select(statement);
-      return PREPARE_SYNTAX_ERROR;
+      return false;
     }
-
-    // Extract column name
-    int column_name_len = equals_pos - condition_start;
-    while (condition_start[column_name_len - 1] == ' ')
-      column_name_len--; // Trim trailing spaces
-    if (column_name_len <= 0 || column_name_len >= MAX_COLUMN_NAME)
+    if (type == COLUMN_TYPE_TIMESTAMP)
     {
-      free_columns_to_select(statement);
-      return PREPARE_SYNTAX_ERROR;
+      dynamic_row_set_timestamp(row, table_def, column_idx, number);
     }
-
-    strncpy(statement->where_column, condition_start, column_name_len);
-    statement->where_column[column_name_len] = '\0';
-
-    // Extract value
-    char *value_start = equals_pos + 1;
-    while (*value_start == ' ')
-      value_start++; // Skip spaces
-
-    // Handle quoted value
-    if (*value_start == '"' || *value_start == '\'')
+    else if (number < INT32_MIN || number > INT32_MAX)
     {
-      char quote_char = *value_start;
-      value_start++; // Skip opening quote
-
-      char *value_end = strchr(value_start, quote_char);
-      if (!value_end)
-      {
-        free_columns_to_select(statement);
-        return PREPARE_SYNTAX_ERROR;
-      }
-
-      int value_len = value_end - value_start;
-      strncpy(statement->where_value, value_start, value_len);
-      statement->where_value[value_len] = '\0';
+      return false;
     }
-    else
+    else if (type == COLUMN_TYPE_DATE)
     {
-      // Unquoted value - read until space or end of string
-      char *value_end = value_start;
-      while (*value_end && *value_end != ' ' && *value_end != '\0')
-        value_end++;
-
-      int value_len = value_end - value_start;
-      strncpy(statement->where_value, value_start, value_len);
-      statement->where_value[value_len] = '\0';
+      dynamic_row_set_date(row, table_def, column_idx, (int32_t)number);
     }
-  }
-  return PREPARE_SUCCESS;
-}
-
-void free_columns_to_select(Statement *statement)
-{
-  if (statement->columns_to_select)
-  {
-    for (uint32_t i = 0; i < statement->num_columns_to_select; i++)
+    else
     {
-      free(statement->columns_to_select[i]);
+      dynamic_row_set_time(row, table_def, column_idx, (int32_t)number);
     }
-    free(statement->columns_to_select);
-    statement->columns_to_select = NULL;
-    statement->num_columns_to_select = 0;
+    return true;
+  }
+  default:
+    return false;
   }
 }
 
-// Modify the execute_insert function to support transactions:
-
 ExecuteResult execute_insert(Statement *statement, Table *table)
 {
   // Get active table definition from database catalog
@@ -975,7 +747,7 @@ ExecuteResult execute_insert(Statement *statement, Table *table)
   DynamicRow row;
   dynamic_row_init(&row, table_def);
 
-  // Get primary key from the first value
+  // The legacy statement form sets the first column to its id
   uint32_t key_to_insert = 0;
 
   // Check if we have values to insert
@@ -1025,7 +797,6 @@ ExecuteResult execute_insert(Statement *statement, Table *table)
   else
   {
     // Use the new values array for more flexible column handling
-    key_to_insert = atoi(statement->values[0]);
 #ifdef DEBUG
     printf("DEBUG: Inserting new row with %d columns\n", statement->num_values);
 #endif
@@ -1034,97 +805,63 @@ ExecuteResult execute_insert(Statement *statement, Table *table)
     for (uint32_t i = 0;
          i < table_def->num_columns && i < statement->num_values; i++)
     {
-      ColumnDef *col = &table_def->columns[i];
       char *value = statement->values[i];
 
 #ifdef DEBUG
-      printf("DEBUG: Setting column %d (%s) to value '%s'\n", i, col->name,
-             value);
+      printf("DEBUG: Setting column %d (%s) to value '%s'\n", i,
+             table_def->columns[i].name, value);
 #endif
 
-      switch (col->type)
+      if (!set_column_from_text(&row, table_def, i, value))
       {
-      case COLUMN_TYPE_INT:
-        dynamic_row_set_int(&row, table_def, i, atoi(value));
-        break;
-      case COLUMN_TYPE_STRING:
-        dynamic_row_set_string(&row, table_def, i, value);
-        break;
-      case COLUMN_TYPE_FLOAT:
-        dynamic_row_set_float(&row, table_def, i, atof(value));
-        break;
-      case COLUMN_TYPE_BOOLEAN:
-        dynamic_row_set_boolean(
-            &row, table_def, i,
-            (strcasecmp(value, "true") == 0 || strcmp(value, "1") == 0));
-        break;
-      // Add other cases as needed
-      default:
-        // For now, just skip unsupported types
-#ifdef DEBUG
-        printf("DEBUG: Unsupported type for column %d\n", i);
-#endif
-        break;
+        // A value that would be stored as something else is not stored
+        printf("Error: Invalid value '%s' for column '%s'.\n", value,
+               table_def->columns[i].name);
+        dynamic_row_free(&row);
+        free_insert_values(statement);
+        return EXECUTE_ERROR;
       }
     }
   }
 
 // Debug print: Show what we're about to insert
 #ifdef DEBUG
-  printf("Inserting row with key: %d\n", key_to_insert);
+  printf("Inserting row with key: %d\n", dynamic_row_get_int(&row, table_def, 0));
   print_dynamic_row(
       &row, table_def); // Add this to see the row content before insertion
 #endif
 
-  Cursor *cursor = table_find(table, key_to_insert);
-  if (!cursor)
-  {
-    printf("Error: Failed to create cursor for insertion.\n");
-    dynamic_row_free(&row);
-    return EXECUTE_UNRECOGNIZED_STATEMENT;
-  }
+  // The key is encoded from the row's primary key columns
+  uint8_t key[BTREE_MAX_KEY_SIZE];
+  char key_text[256];
+  key_from_row(table_def, &row, key);
+  key_format(table_def, &table->key, key, key_text, sizeof(key_text));
+
+  // 4-byte keys compare unsigned, so only wider keys may be negative
+  bool negative = table->key.type == KEY_UINT32 &&
+                  (int32_t)key_to_int(&table->key, key) < 0;
 
   // Handle duplicate key
-  void *cur_node = get_page(table->pager, cursor->page_num);
-  if (cursor->cell_num < (*leaf_node_num_cells(cur_node)) &&
-      key_to_insert == *leaf_node_key(cur_node, cursor->cell_num))
+  if (negative ||
+      table_insert_key(table, key, &row, table_def) == BTREE_INSERT_DUPLICATE)
   {
-    printf("Error: Duplicate key detected: %d\n", key_to_insert);
-    dynamic_row_free(&row);
-    free(cursor);
-
-    // Free the values array if it exists
-    if (statement->values)
+    if (negative)
     {
-      for (uint32_t i = 0; i < statement->num_values; i++)
-      {
-        free(statement->values[i]);
-      }
-      free(statement->values);
-      statement->values = NULL;
-      statement->num_values = 0;
+      printf("ID must be positive.\n");
     }
-
+    else
+    {
+      printf("Error: Duplicate key detected: %s\n", key_text);
+    }
+    dynamic_row_free(&row);
+    free_insert_values(statement);
     return EXECUTE_DUPLICATE_KEY;
   }
+  printf("Row successfully inserted with key: %s\n", key_text);
+  secondary_indexes_note_row(table_def, NULL, &row);
 
-  leaf_node_insert(cursor, key_to_insert, &row, table_def);
-  printf("Row successfully inserted with key: %d\n", key_to_insert);
-
-  free(cursor);
   dynamic_row_free(&row);
-
-  // Free the values array if it exists
-  if (statement->values)
-  {
-    for (uint32_t i = 0; i < statement->num_values; i++)
-    {
-      free(statement->values[i]);
-    }
-    free(statement->values);
-    statement->values = NULL;
-    statement->num_values = 0;
-  }
+  free_insert_values(statement);
 
   // After successful insertion and before returning:
   if (txn_id != 0)
@@ -1154,7 +891,10 @@ ExecuteResult execute_select(Statement *statement, Table *table)
 #endif
 
   // If the statement has a where clause, it's a filtered select
-  if (statement->has_where_clause)
+  if (statement->has_where_clause || statement->num_order_by > 0 ||
+      statement->has_limit || statement->offset > 0 ||
+      statement->has_aggregates || statement->explain ||
+      statement->explain_analyze || statement->has_join)
   {
     return execute_filtered_select(statement, table);
   }
@@ -1282,7 +1022,7 @@ ExecuteResult execute_select(Statement *statement, Table *table)
   }
 
   dynamic_row_free(&row);
-  free(cursor);
+  cursor_close(cursor);
 
   // Free allocated memory for columns
   free_columns_to_select(statement);
@@ -1334,96 +1074,186 @@ ExecuteResult execute_select_by_id(Statement *statement, Table *table)
     }
   }
 
-  free(cursor);
+  cursor_close(cursor);
   return EXECUTE_SUCCESS;
 }
 
-ExecuteResult execute_update(Statement *statement, Table *table)
+// Plan the rows a SELECT, UPDATE or DELETE reads. An EXECUTE reuses the
+// access path its prepared statement picked before, except under EXPLAIN,
+// which shows every alternative.
+static bool plan_where(Statement *statement, SqlExpr *where,
+                       const SelectOptions *options, Table *table,
+                       TableDef *table_def, QueryPlan *plan, char *error,
+                       size_t error_size)
 {
-  // Find the row with the given id
-  Cursor *cursor = table_find(table, statement->id_to_update);
-
-  if (cursor->end_of_table)
+  if (statement->plan_choice && !statement->explain &&
+      !statement->explain_analyze)
   {
-    printf("No row found with id %d\n", statement->id_to_update);
-    free(cursor);
-    return EXECUTE_SUCCESS;
+    return query_plan_build_cached(where, options, table, table_def,
+                                   statement->plan_choice,
+                                   statement->db->catalog.version, plan, error,
+                                   error_size);
   }
+  return query_plan_build(where, options, table, table_def, plan, error,
+                          error_size);
+}
 
-  // Get current row data
-  Row row;
-  deserialize_row(cursor_value(cursor), &row);
+ExecuteResult execute_update(Statement *statement, Table *table)
+{
+  TableDef *table_def = catalog_get_active_table(&statement->db->catalog);
+  SqlAssignment *assignments = statement->assignments;
+  uint32_t num_assignments = statement->num_assignments;
+  SqlExpr *where = statement->where_expr;
+  statement->assignments = NULL;
+  statement->num_assignments = 0;
+  statement->where_expr = NULL;
 
-  // Update the appropriate field based on column name
-  if (strcasecmp(statement->column_to_update, "name") == 0 ||
-      strcasecmp(statement->column_to_update, "username") == 0)
+  // Resolve every SET column before any row is written
+  int *columns = malloc(num_assignments * sizeof(int));
+  char error[SQL_MAX_ERROR] = "";
+  for (uint32_t i = 0; i < num_assignments && table_def && !error[0]; i++)
   {
-    strncpy(row.username, statement->update_value, COLUMN_USERNAME_SIZE);
+    int column_idx = table_def_find_column(table_def, assignments[i].column);
+    if (column_idx == -1)
+    {
+      snprintf(error, sizeof(error), "unknown column '%s'",
+               assignments[i].column);
+    }
+    else if (table_def_is_key_column(table_def, column_idx))
+    {
+      snprintf(error, sizeof(error),
+               "cannot update the primary key column '%s'",
+               assignments[i].column);
+    }
+    else
+    {
+      DynamicRow probe;
+      dynamic_row_init(&probe, table_def);
+      if (!set_column_from_text(&probe, table_def, column_idx,
+                                assignments[i].value.text))
+      {
+        snprintf(error, sizeof(error), "Invalid value '%s' for column '%s'.",
+                 assignments[i].value.text, assignments[i].column);
+      }
+      dynamic_row_free(&probe);
+    }
+    columns[i] = column_idx;
   }
-  else if (strcasecmp(statement->column_to_update, "email") == 0)
+
+  // Rows are found the way SELECT finds them: by primary key, key range or
+  // index when the WHERE clause allows, with a full scan otherwise
+  QueryPlan plan;
+  SelectOptions options = {0};
+  options.work_memory = statement->db->work_memory;
+  bool planned = table_def && !error[0] &&
+                 plan_where(statement, where, &options, table, table_def,
+                            &plan, error, sizeof(error));
+  sql_expr_free(where);
+  if (!planned)
   {
-    strncpy(row.email, statement->update_value, COLUMN_EMAIL_SIZE);
+    if (error[0])
+    {
+      printf("Error: %s\n", error);
+    }
+    free(columns);
+    free(assignments);
+    return EXECUTE_UNRECOGNIZED_STATEMENT;
   }
-  else
+
+  // Every matching row is collected before the first one is written, so a
+  // row that moves to another leaf is not visited twice
+  QueryResult matches;
+  query_plan_execute(&plan, table, table_def, statement->db->scan_threads,
+                     &matches, NULL);
+  uint32_t num_updated = 0;
+  bool indexed = table_def->num_indexes > 0 ||
+                 online_index_pending(table_def->name) > 0;
+  DynamicRow *row;
+  while ((row = query_result_next(&matches)))
   {
-    printf("Unknown column: %s\n", statement->column_to_update);
-    free(cursor);
-    return EXECUTE_SUCCESS;
+    DynamicRow old_row = {NULL, 0};
+    if (indexed)
+    {
+      old_row.data = malloc(row->data_size);
+      old_row.data_size = row->data_size;
+      memcpy(old_row.data, row->data, row->data_size);
+    }
+    for (uint32_t i = 0; i < num_assignments; i++)
+    {
+      set_column_from_text(row, table_def, columns[i],
+                           assignments[i].value.text);
+    }
+    uint8_t key[BTREE_MAX_KEY_SIZE];
+    key_from_row(table_def, row, key);
+    Cursor *cursor = table_find_key(table, key);
+    leaf_node_update(cursor, row, table_def);
+    cursor_close(cursor);
+    if (indexed)
+    {
+      secondary_indexes_note_row(table_def, &old_row, row);
+      free(old_row.data);
+    }
+    num_updated++;
   }
+  printf("%u row(s) updated.\n", num_updated);
 
-  // Save updated row back to the database
-  serialize_row(&row, cursor_value(cursor));
-
-  free(cursor);
+  query_result_free(&matches);
+  query_plan_free(&plan);
+  free(columns);
+  free(assignments);
   return EXECUTE_SUCCESS;
 }
 
-ExecuteResult execute_delete(Statement *statement, Table *table)
-{
-  // Find the row with the given id
-  Cursor *cursor = table_find(table, statement->id_to_delete);
-
-  if (cursor->end_of_table)
-  {
-    printf("No row found with id %d\n", statement->id_to_delete);
-    free(cursor);
-    return EXECUTE_SUCCESS;
-  }
-
-  // Get the leaf node and number of cells
-  void *node = get_page(table->pager, cursor->page_num);
-  uint32_t num_cells = *leaf_node_num_cells(node);
-
-  // Shift cells to overwrite the one being deleted
-  if (cursor->cell_num < num_cells - 1)
-  {
-    // For variable-sized cells, we need to manually copy and shift each cell
-    uint32_t current_pos = cursor->cell_num;
-
-    // Get pointer to the cell being deleted
-    void *cell_to_delete = leaf_node_cell(node, current_pos);
-
-    // Get pointer to the next cell
-    void *next_cell = leaf_node_next_cell(node, current_pos);
+ExecuteResult execute_delete(Statement *statement, Table *table)
+{
+  TableDef *table_def = catalog_get_active_table(&statement->db->catalog);
+  SqlExpr *where = statement->where_expr;
+  statement->where_expr = NULL;
 
-    // Calculate total size of data after this cell
-    uint32_t bytes_to_move = 0;
-    for (uint32_t i = current_pos + 1; i < num_cells; i++)
+  // Matching rows are found as UPDATE finds them, and all of them are known
+  // before the tree changes shape
+  QueryPlan plan;
+  SelectOptions options = {0};
+  options.work_memory = statement->db->work_memory;
+  char error[SQL_MAX_ERROR] = "";
+  bool planned = table_def && plan_where(statement, where, &options, table,
+                                         table_def, &plan, error, sizeof(error));
+  sql_expr_free(where);
+  if (!planned)
+  {
+    if (error[0])
     {
-      bytes_to_move += leaf_node_cell_size(node, i);
+      printf("Error: %s\n", error);
     }
+    return EXECUTE_UNRECOGNIZED_STATEMENT;
+  }
 
-    // Move all following cells backward
-    if (bytes_to_move > 0)
+  QueryResult matches;
+  query_plan_execute(&plan, table, table_def, statement->db->scan_threads,
+                     &matches, NULL);
+  uint32_t key_size = table->key.size;
+  uint32_t capacity = 64;
+  uint32_t num_keys = 0;
+  uint8_t *keys = malloc(capacity * key_size);
+  DynamicRow *row;
+  while ((row = query_result_next(&matches)))
+  {
+    if (num_keys == capacity)
     {
-      memmove(cell_to_delete, next_cell, bytes_to_move);
+      capacity *= 2;
+      keys = realloc(keys, capacity * key_size);
     }
+    key_from_row(table_def, row, keys + num_keys * key_size);
+    num_keys++;
+    secondary_indexes_note_row(table_def, row, NULL);
   }
+  query_result_free(&matches);
+  query_plan_free(&plan);
 
-  // Decrement number of cells
-  (*leaf_node_num_cells(node))--;
-
-  free(cursor);
+  // Results come back in key order, which the batched delete relies on
+  uint32_t num_deleted = table_delete_keys(table, keys, num_keys);
+  printf("%u row(s) deleted.\n", num_deleted);
+  free(keys);
   return EXECUTE_SUCCESS;
 }
 
@@ -1444,14 +1274,52 @@ PrepareResult prepare_create_table(Input_Buffer *buf, Statement *statement)
   strncpy(statement->table_name, token, MAX_TABLE_NAME - 1);
   statement->table_name[MAX_TABLE_NAME - 1] = '\0';
 
-  // Parse columns: col1 type1, col2 type2, ...
+  // Parse columns: col1 type1, col2 type2, ... [, PRIMARY KEY (a, b)]
   statement->num_columns = 0;
+  statement->num_key_columns = 0;
 
   // Tokenize the column definitions
   char *col_name = strtok(NULL, " \t,)");
   col_name++; // Skip the opening parenthesis
   while (col_name && statement->num_columns < MAX_COLUMNS)
   {
+    if (strcasecmp(col_name, "PRIMARY") == 0)
+    {
+      // Table constraint, last in the list: the key columns in order
+      char *key = strtok(NULL, " \t,)");
+      if (!key || strncasecmp(key, "KEY", 3) != 0)
+      {
+        return PREPARE_SYNTAX_ERROR;
+      }
+      char *name = key[3] ? key + 3 : strtok(NULL, " \t,)");
+      while (name)
+      {
+        name += strspn(name, "(");
+        if (*name)
+        {
+          int column_idx = -1;
+          for (uint32_t i = 0; i < statement->num_columns; i++)
+          {
+            if (strcasecmp(statement->columns[i].name, name) == 0)
+            {
+              column_idx = i;
+            }
+          }
+          if (column_idx == -1 || statement->num_key_columns >= MAX_KEY_COLUMNS)
+          {
+            return PREPARE_SYNTAX_ERROR;
+          }
+          statement->key_columns[statement->num_key_columns++] = column_idx;
+        }
+        name = strtok(NULL, " \t,)");
+      }
+      if (statement->num_key_columns == 0)
+      {
+        return PREPARE_SYNTAX_ERROR;
+      }
+      break;
+    }
+
     // Get column type
     char *col_type = strtok(NULL, " \t,)");
     if (!col_type)
@@ -1493,6 +1361,11 @@ PrepareResult prepare_create_table(Input_Buffer *buf, Statement *statement)
       column->type = COLUMN_TYPE_TIMESTAMP;
       column->size = sizeof(int64_t);
     }
+    else if (strcasecmp(col_type, "BIGINT") == 0)
+    {
+      column->type = COLUMN_TYPE_BIGINT;
+      column->size = sizeof(int64_t);
+    }
     else if (strncasecmp(col_type, "BLOB", 4) == 0)
     {
       column->type = COLUMN_TYPE_BLOB;
@@ -1528,7 +1401,8 @@ PrepareResult prepare_create_table(Input_Buffer *buf, Statement *statement)
     {
       column->type = COLUMN_TYPE_STRING;
 
-      // Check if string has a size: STRING(n)
+      // Check if string has a size: STRING(n). The tokenizer splits on ')',
+      // so the closing parenthesis is usually already gone.
       char *size_start = strchr(col_type, '(');
       if (size_start)
       {
@@ -1536,17 +1410,13 @@ PrepareResult prepare_create_table(Input_Buffer *buf, Statement *statement)
         if (size_end)
         {
           *size_end = '\0';
-          char *size_str = size_start + 1;
-          column->size = atoi(size_str);
-          if (column->size ==
-              0)
-          {                     // Set default if parsing failed or explicit 0
-            column->size = 255; // Default string size
-          }
         }
-        else
-        {
-          column->size = 255; // Default if parsing failed
+        char *size_str = size_start + 1;
+        column->size = atoi(size_str);
+        if (column->size ==
+            0)
+        {                     // Set default if parsing failed or explicit 0
+          column->size = 255; // Default string size
         }
       }
       else
@@ -1611,7 +1481,8 @@ PrepareResult prepare_show_tables(Input_Buffer *buf, Statement *statement)
 ExecuteResult execute_create_table(Statement *statement, Database *db)
 {
   if (db_create_table(db, statement->table_name, statement->columns,
-                      statement->num_columns))
+                      statement->num_columns, statement->key_columns,
+                      statement->num_key_columns))
   {
     printf("Table created: %s\n", statement->table_name);
     return EXECUTE_SUCCESS;
@@ -1648,11 +1519,11 @@ ExecuteResult execute_use_table(Statement *statement, Database *db)
   db->catalog.active_table = table_idx;
 
   printf("Debug: Checking existing active table\n");
-  // If there's an existing active table, close it first
+  // Let go of the existing active table; the cache keeps it open
   if (db->active_table)
   {
-    printf("Debug: Closing existing active table\n");
-    db_close(db->active_table);
+    printf("Debug: Releasing existing active table\n");
+    table_cache_release(db->active_table);
     db->active_table = NULL;
   }
 
@@ -1663,7 +1534,7 @@ ExecuteResult execute_use_table(Statement *statement, Database *db)
            db->name, statement->table_name);
 
   printf("Debug: Opening table at %s\n", table_path);
-  db->active_table = db_open(table_path);
+  db->active_table = table_cache_acquire(table_path);
   if (!db->active_table)
   {
     printf("Error: Failed to open table '%s'.\n", statement->table_name);
@@ -1672,6 +1543,7 @@ ExecuteResult execute_use_table(Statement *statement, Database *db)
 
   // Set the root page number from catalog
   db->active_table->root_page_num = db->catalog.tables[table_idx].root_page_num;
+  table_set_key(db->active_table, &db->catalog.tables[table_idx].key);
 
   // ADD THIS: Open all indexes associated with this table
   TableDef *table_def = &db->catalog.tables[table_idx];
@@ -1681,7 +1553,7 @@ ExecuteResult execute_use_table(Statement *statement, Database *db)
     printf("Debug: Opening index '%s' at %s\n", index_def->name, index_def->filename);
 
     // Open the index file
-    Table *index_table = db_open(index_def->filename);
+    Table *index_table = table_cache_acquire(index_def->filename);
     if (!index_table)
     {
       printf("Warning: Failed to open index '%s' on table '%s'\n",
@@ -1691,10 +1563,28 @@ ExecuteResult execute_use_table(Statement *statement, Database *db)
 
     // Set the root page number from catalog
     index_table->root_page_num = index_def->root_page_num;
-
-    // We should store this open index table somewhere
-    // For now, we'll just close it since we'll reopen when needed
-    db_close(index_table);
+    bool legacy = index_def->type == INDEX_TYPE_BTREE &&
+                  !secondary_index_set_key(index_table);
+    // Compiles a partial index's condition for the writes to come, and
+    // reports one that no longer compiles
+    const CompiledExpr *predicate;
+    index_predicate_get(index_table, table_def, index_def, &predicate);
+
+    // The cache keeps it open for the queries that probe it
+    table_cache_release(index_table);
+
+    // Writes never kept a tree keyed on the hash alone current, so it is
+    // built again from the table
+    if (legacy)
+    {
+      printf("Rebuilding index '%s', written in an older format.\n",
+             index_def->name);
+      if (!create_secondary_index(db->active_table, table_def, index_def))
+      {
+        printf("Warning: Failed to rebuild index '%s' on table '%s'\n",
+               index_def->name, table_def->name);
+      }
+    }
   }
 
   printf("Debug: Saving table name\n");
@@ -1706,6 +1596,92 @@ ExecuteResult execute_use_table(Statement *statement, Database *db)
   return EXECUTE_SUCCESS;
 }
 // Add the execute statement implementation
+// PREPARE stores the parsed statement in the database's plan cache;
+// EXECUTE binds its arguments into the cached statement and runs it without
+// going back to the SQL text, on the access path the first execution picked
+// for as long as the catalog is unchanged.
+ExecuteResult execute_prepared_statement(Statement *statement, Database *db)
+{
+  SqlStatement *sql = statement->sql;
+  statement->sql = NULL;
+  ExecuteResult result = EXECUTE_SUCCESS;
+
+  switch (statement->type)
+  {
+  case STATEMENT_PREPARE:
+    if (!plan_cache_put(&db->plan_cache, sql->plan_name, sql->body))
+    {
+      printf("Error: Too many prepared statements (max %d).\n",
+             MAX_PREPARED_STATEMENTS);
+      result = EXECUTE_ERROR;
+      break;
+    }
+    sql->body = NULL; // Now owned by the cache
+    break;
+
+  case STATEMENT_DEALLOCATE:
+    if (!plan_cache_remove(&db->plan_cache, sql->plan_name))
+    {
+      printf("Error: Prepared statement '%s' not found.\n", sql->plan_name);
+      result = EXECUTE_ERROR;
+    }
+    break;
+
+  case STATEMENT_EXECUTE:
+  {
+    PreparedPlan *plan = plan_cache_get(&db->plan_cache, sql->plan_name);
+    if (!plan)
+    {
+      printf("Error: Prepared statement '%s' not found.\n", sql->plan_name);
+      result = EXECUTE_ERROR;
+      break;
+    }
+    if (sql->num_values != plan->statement->num_params)
+    {
+      printf("Error: Prepared statement '%s' expects %u argument(s), got %u.\n",
+             plan->name, plan->statement->num_params, sql->num_values);
+      result = EXECUTE_ERROR;
+      break;
+    }
+
+    Statement bound;
+    memset(&bound, 0, sizeof(Statement));
+    bound.db = db;
+    switch (bind_sql_statement(plan->statement, sql->values, sql->num_values,
+                               &bound))
+    {
+    case PREPARE_SUCCESS:
+      plan->executions++;
+      if (!plan->choice)
+      {
+        plan->choice = calloc(1, sizeof(PlanChoice));
+      }
+      bound.plan_choice = plan->choice;
+      result = execute_statement(&bound, db);
+      sql_expr_free(bound.where_expr); // Still set if no select ran
+      free(bound.order_by);
+      break;
+    case PREPARE_NEGATIVE_ID:
+      printf("ID must be positive.\n");
+      result = EXECUTE_ERROR;
+      break;
+    default:
+      printf("Error: Could not bind arguments for '%s'.\n", plan->name);
+      result = EXECUTE_ERROR;
+      break;
+    }
+    break;
+  }
+
+  default:
+    result = EXECUTE_UNRECOGNIZED_STATEMENT;
+    break;
+  }
+
+  sql_statement_free(sql);
+  return result;
+}
+
 ExecuteResult execute_statement(Statement *statement, Database *db)
 {
   // Handle authentication commands regardless of active table
@@ -1718,8 +1694,20 @@ ExecuteResult execute_statement(Statement *statement, Database *db)
       
     case STATEMENT_CREATE_USER:
       return execute_create_user(statement, db);
+
+    case STATEMENT_PREPARE:
+    case STATEMENT_EXECUTE:
+    case STATEMENT_DEALLOCATE:
+      return execute_prepared_statement(statement, db);
+
+    default:
+      break;
   }
 
+  // Indexes built online since the last statement go into the catalog
+  // before this one is planned
+  online_index_publish_ready(&db->catalog);
+
   // Check if we need to switch tables first, but skip this for CREATE TABLE
   if (statement->table_name[0] != '\0' &&
       statement->type != STATEMENT_CREATE_TABLE)
@@ -1776,6 +1764,7 @@ ExecuteResult execute_statement(Statement *statement, Database *db)
     case STATEMENT_CREATE_TABLE:
     case STATEMENT_CREATE_INDEX:
     case STATEMENT_CREATE_DATABASE:
+    case STATEMENT_ANALYZE:
       operation = "CREATE";
       break;
       
@@ -1802,12 +1791,18 @@ ExecuteResult execute_statement(Statement *statement, Database *db)
   switch (statement->type)
   {
   case STATEMENT_INSERT:
+  {
     if (db->active_table == NULL)
     {
       printf("Error: No active table selected.\n");
       return EXECUTE_SUCCESS;
     }
-    return execute_insert(statement, db->active_table);
+    // Writes wait for an online index build's leaf copy, never the build
+    online_index_write_begin();
+    ExecuteResult result = execute_insert(statement, db->active_table);
+    online_index_write_end();
+    return result;
+  }
 
   case STATEMENT_SELECT:
     if (db->active_table == NULL)
@@ -1826,20 +1821,32 @@ ExecuteResult execute_statement(Statement *statement, Database *db)
     return execute_select_by_id(statement, db->active_table);
 
   case STATEMENT_UPDATE:
+  {
     if (db->active_table == NULL)
     {
       printf("Error: No active table selected.\n");
       return EXECUTE_SUCCESS;
     }
-    return execute_update(statement, db->active_table);
+    // Writes wait for an online index build's leaf copy, never the build
+    online_index_write_begin();
+    ExecuteResult result = execute_update(statement, db->active_table);
+    online_index_write_end();
+    return result;
+  }
 
   case STATEMENT_DELETE:
+  {
     if (db->active_table == NULL)
     {
       printf("Error: No active table selected.\n");
       return EXECUTE_SUCCESS;
     }
-    return execute_delete(statement, db->active_table);
+    // Writes wait for an online index build's leaf copy, never the build
+    online_index_write_begin();
+    ExecuteResult result = execute_delete(statement, db->active_table);
+    online_index_write_end();
+    return result;
+  }
 
   case STATEMENT_CREATE_TABLE:
     return execute_create_table(statement, db);
@@ -1856,6 +1863,9 @@ ExecuteResult execute_statement(Statement *statement, Database *db)
   case STATEMENT_SHOW_INDEXES:
     return execute_show_indexes(statement, db);
 
+  case STATEMENT_ANALYZE:
+    return execute_analyze(statement, db);
+
   case STATEMENT_CREATE_DATABASE:
   case STATEMENT_USE_DATABASE:
     // These should be handled separately
@@ -2068,29 +2078,168 @@ PrepareResult prepare_create_index(Input_Buffer *buf, Statement *statement)
   strncpy(statement->table_name, table_name_start, table_name_len);
   statement->table_name[table_name_len] = '\0';
 
-  // Extract column name
+  // Extract the column, or a function of it such as lower(email), up to
+  // the parenthesis that closes the list
   char *column_name_start = paren_start + 1; // Skip "("
   while (*column_name_start == ' ')
     column_name_start++; // Skip spaces
 
-  char *paren_end = strchr(column_name_start, ')');
-  if (!paren_end)
+  char *paren_end = column_name_start;
+  int depth = 0;
+  while (*paren_end && (depth > 0 || *paren_end != ')'))
+  {
+    depth += *paren_end == '(' ? 1 : *paren_end == ')' ? -1 : 0;
+    paren_end++;
+  }
+  if (!*paren_end)
   {
     return PREPARE_SYNTAX_ERROR;
   }
 
   int column_name_len = paren_end - column_name_start;
-  // Trim trailing spaces
-  while (column_name_len > 0 && column_name_start[column_name_len - 1] == ' ')
-    column_name_len--;
-
   if (column_name_len <= 0 || column_name_len >= MAX_COLUMN_NAME)
   {
     return PREPARE_SYNTAX_ERROR;
   }
 
-  strncpy(statement->where_column, column_name_start, column_name_len);
-  statement->where_column[column_name_len] = '\0';
+  char column_text[MAX_COLUMN_NAME];
+  memcpy(column_text, column_name_start, column_name_len);
+  column_text[column_name_len] = '\0';
+  char error[SQL_MAX_ERROR];
+  if (!sql_parse_column_func(column_text, statement->where_column,
+                             &statement->index_expr, error, sizeof(error)))
+  {
+    printf("Error: Invalid index column: %s.\n", error);
+    return PREPARE_SYNTAX_ERROR;
+  }
+
+  // Optional, in any order: USING BTREE (the default), HASH, BITMAP or
+  // FULLTEXT, INCLUDE (column, ...) for values the entries carry, and ONLINE to
+  // build without holding up writes. Then WHERE condition, for an index
+  // on only the rows that meet it.
+  statement->index_type = INDEX_TYPE_BTREE;
+  statement->num_include_columns = 0;
+  statement->index_online = false;
+  statement->index_predicate[0] = '\0';
+  char *rest = paren_end + 1;
+  while (true)
+  {
+    while (*rest == ' ')
+      rest++;
+    if (strncasecmp(rest, "using", 5) == 0)
+    {
+      rest += 5;
+      while (*rest == ' ')
+        rest++;
+      char method[16];
+      int method_len = 0;
+      while (rest[method_len] && rest[method_len] != ' ' && rest[method_len] != ';' &&
+             method_len < (int)sizeof(method) - 1)
+      {
+        method[method_len] = rest[method_len];
+        method_len++;
+      }
+      method[method_len] = '\0';
+      rest += method_len;
+
+      if (strcasecmp(method, "hash") == 0)
+      {
+        statement->index_type = INDEX_TYPE_HASH;
+      }
+      else if (strcasecmp(method, "bitmap") == 0)
+      {
+        statement->index_type = INDEX_TYPE_BITMAP;
+      }
+      else if (strcasecmp(method, "fulltext") == 0)
+      {
+        statement->index_type = INDEX_TYPE_FULLTEXT;
+      }
+      else if (strcasecmp(method, "btree") != 0)
+      {
+        printf("Error: Unknown index type '%s', expected BTREE, HASH, BITMAP or "
+               "FULLTEXT.\n",
+               method);
+        return PREPARE_SYNTAX_ERROR;
+      }
+    }
+    else if (strncasecmp(rest, "include", 7) == 0)
+    {
+      rest += 7;
+      while (*rest == ' ')
+        rest++;
+      char *include_end = *rest == '(' ? strchr(rest, ')') : NULL;
+      if (!include_end)
+      {
+        return PREPARE_SYNTAX_ERROR;
+      }
+      char *name = rest + 1;
+      while (name < include_end)
+      {
+        while (*name == ' ' || *name == ',')
+          name++;
+        int name_len = 0;
+        while (name + name_len < include_end && name[name_len] != ',' &&
+               name[name_len] != ' ')
+          name_len++;
+        if (name_len == 0)
+        {
+          break;
+        }
+        if (name_len >= MAX_COLUMN_NAME)
+        {
+          return PREPARE_SYNTAX_ERROR;
+        }
+        if (statement->num_include_columns == MAX_INDEX_INCLUDE)
+        {
+          printf("Error: INCLUDE takes at most %d columns.\n", MAX_INDEX_INCLUDE);
+          return PREPARE_SYNTAX_ERROR;
+        }
+        char *column = statement->include_columns[statement->num_include_columns++];
+        strncpy(column, name, name_len);
+        column[name_len] = '\0';
+        name += name_len;
+      }
+      if (statement->num_include_columns == 0)
+      {
+        return PREPARE_SYNTAX_ERROR;
+      }
+      rest = include_end + 1;
+    }
+    else if (strncasecmp(rest, "online", 6) == 0)
+    {
+      statement->index_online = true;
+      rest += 6;
+    }
+    else if (strncasecmp(rest, "where", 5) == 0 && (rest[5] == ' ' || rest[5] == '('))
+    {
+      // The condition runs to the end of the statement
+      rest += 5;
+      while (*rest == ' ')
+        rest++;
+      size_t predicate_len = strlen(rest);
+      while (predicate_len > 0 && (rest[predicate_len - 1] == ' ' ||
+                                   rest[predicate_len - 1] == ';' ||
+                                   rest[predicate_len - 1] == '\n'))
+        predicate_len--;
+      if (predicate_len == 0)
+      {
+        return PREPARE_SYNTAX_ERROR;
+      }
+      if (predicate_len >= MAX_INDEX_PREDICATE)
+      {
+        printf("Error: Index condition is longer than %d characters.\n",
+               MAX_INDEX_PREDICATE - 1);
+        return PREPARE_SYNTAX_ERROR;
+      }
+      memcpy(statement->index_predicate, rest, predicate_len);
+      statement->index_predicate[predicate_len] = '\0';
+      break;
+    }
+    else
+    {
+      break;
+    }
+  }
 
   return PREPARE_SUCCESS;
 }
@@ -2106,9 +2255,124 @@ ExecuteResult execute_create_index(Statement *statement, Database *db)
     return EXECUTE_UNRECOGNIZED_STATEMENT;
   }
 
+  // Index entries point back at their rows by a 4-byte row id
+  if (db->catalog.tables[table_idx].key.type != KEY_UINT32)
+  {
+    printf("Error: Indexes need a table keyed on a single INT column.\n");
+    return EXECUTE_UNRECOGNIZED_STATEMENT;
+  }
+
+  int column_idx = table_def_find_column(&db->catalog.tables[table_idx],
+                                         statement->where_column);
+
+  // An expression index keys on a function of the column
+  char indexed[MAX_COLUMN_NAME + 32];
+  column_func_format(&statement->index_expr, statement->where_column, indexed,
+                     sizeof(indexed));
+  if (statement->index_expr.type != COLUMN_FUNC_NONE)
+  {
+    if (column_idx == -1)
+    {
+      printf("Error: Column '%s' not found.\n", statement->where_column);
+      return EXECUTE_UNRECOGNIZED_STATEMENT;
+    }
+    if (!column_func_supports(&statement->index_expr,
+                              db->catalog.tables[table_idx].columns[column_idx].type))
+    {
+      printf("Error: Cannot index %s: the function does not apply to the "
+             "column's type.\n",
+             indexed);
+      return EXECUTE_UNRECOGNIZED_STATEMENT;
+    }
+    if (statement->index_type == INDEX_TYPE_BITMAP)
+    {
+      printf("Error: Bitmap indexes are on plain columns.\n");
+      return EXECUTE_UNRECOGNIZED_STATEMENT;
+    }
+    if (statement->index_type == INDEX_TYPE_FULLTEXT)
+    {
+      printf("Error: Full-text indexes are on plain columns.\n");
+      return EXECUTE_UNRECOGNIZED_STATEMENT;
+    }
+  }
+  if (statement->index_type == INDEX_TYPE_BITMAP && column_idx != -1 &&
+      !bitmap_index_supports(db->catalog.tables[table_idx].columns[column_idx].type))
+  {
+    printf("Error: Bitmap indexes need a column compared exactly, not FLOAT or BLOB.\n");
+    return EXECUTE_UNRECOGNIZED_STATEMENT;
+  }
+
+  if (statement->index_type == INDEX_TYPE_FULLTEXT && column_idx != -1 &&
+      db->catalog.tables[table_idx].columns[column_idx].type != COLUMN_TYPE_STRING)
+  {
+    printf("Error: Full-text indexes need a STRING column.\n");
+    return EXECUTE_UNRECOGNIZED_STATEMENT;
+  }
+
+  // INCLUDE columns ride along in B-tree and hash entries
+  uint32_t include_columns[MAX_INDEX_INCLUDE];
+  if (statement->num_include_columns > 0 && statement->index_type == INDEX_TYPE_BITMAP)
+  {
+    printf("Error: Bitmap indexes cannot INCLUDE columns.\n");
+    return EXECUTE_UNRECOGNIZED_STATEMENT;
+  }
+  if (statement->num_include_columns > 0 && statement->index_type == INDEX_TYPE_FULLTEXT)
+  {
+    printf("Error: Full-text indexes cannot INCLUDE columns.\n");
+    return EXECUTE_UNRECOGNIZED_STATEMENT;
+  }
+  for (uint32_t i = 0; i < statement->num_include_columns; i++)
+  {
+    int include_idx = table_def_find_column(&db->catalog.tables[table_idx],
+                                            statement->include_columns[i]);
+    if (include_idx == -1)
+    {
+      printf("Error: Column '%s' not found.\n", statement->include_columns[i]);
+      return EXECUTE_UNRECOGNIZED_STATEMENT;
+    }
+    include_columns[i] = include_idx;
+  }
+
+  // A partial index's condition must compile against the table, as the
+  // filter of every write will
+  if (statement->index_predicate[0])
+  {
+    char error[SQL_MAX_ERROR];
+    SqlExpr *predicate = sql_parse_expr(statement->index_predicate, error,
+                                        sizeof(error));
+    CompiledExpr *compiled =
+        predicate ? expr_compile(predicate, &db->catalog.tables[table_idx],
+                                 error, sizeof(error))
+                  : NULL;
+    sql_expr_free(predicate);
+    if (!compiled)
+    {
+      printf("Error: Invalid index condition: %s.\n", error);
+      return EXECUTE_UNRECOGNIZED_STATEMENT;
+    }
+    expr_free(compiled);
+  }
+
+  // An index still being built online already holds its name and a slot
+  if (online_index_building(statement->table_name, statement->index_name))
+  {
+    printf("Error: Index '%s' is already being built on table '%s'.\n",
+           statement->index_name, statement->table_name);
+    return EXECUTE_UNRECOGNIZED_STATEMENT;
+  }
+  if (db->catalog.tables[table_idx].num_indexes +
+          online_index_pending(statement->table_name) >=
+      MAX_INDEXES_PER_TABLE)
+  {
+    printf("Error: Maximum number of indexes reached for table '%s'.\n",
+           statement->table_name);
+    return EXECUTE_UNRECOGNIZED_STATEMENT;
+  }
+
   // Add the index to the catalog
   if (!catalog_add_index(&db->catalog, statement->table_name,
-                         statement->index_name, statement->where_column, false))
+                         statement->index_name, statement->where_column, false,
+                         statement->index_type))
   {
     return EXECUTE_UNRECOGNIZED_STATEMENT;
   }
@@ -2125,46 +2389,223 @@ ExecuteResult execute_create_index(Statement *statement, Database *db)
   }
 
   IndexDef *index_def = &table_def->indexes[index_idx];
+  memcpy(index_def->predicate, statement->index_predicate, MAX_INDEX_PREDICATE);
+  index_def->expr = statement->index_expr;
+  index_def->num_include = statement->num_include_columns;
+  memcpy(index_def->include_columns, include_columns,
+         statement->num_include_columns * sizeof(uint32_t));
+  if (index_include_size(table_def, index_def) > SECONDARY_INDEX_MAX_INCLUDE)
+  {
+    printf("Error: INCLUDE columns take more than %d bytes.\n",
+           SECONDARY_INDEX_MAX_INCLUDE);
+    table_def->num_indexes--;
+    return EXECUTE_UNRECOGNIZED_STATEMENT;
+  }
+
+  // An online build takes the definition out of the catalog again; it goes
+  // back in, with the built file, once the build is published
+  if (statement->index_online)
+  {
+    IndexDef pending = *index_def;
+    table_def->num_indexes--;
+    if (!online_index_start(&db->catalog, db->name, table_def, &pending))
+    {
+      printf("Error: Failed to create index.\n");
+      return EXECUTE_UNRECOGNIZED_STATEMENT;
+    }
+    printf("Building index '%s' on table '%s' online; SHOW INDEXES FROM %s "
+           "reports its progress.\n",
+           statement->index_name, statement->table_name, statement->table_name);
+    return EXECUTE_SUCCESS;
+  }
 
   // Create the index (build it by scanning the table)
   Table *table = db->active_table;
   if (!table || strcmp(table_def->name, statement->table_name) != 0)
   {
-    // We need to temporarily open the table
-    char table_path[512];
-    snprintf(table_path, sizeof(table_path), "Database/%s/Tables/%s.tbl",
-             db->name, statement->table_name);
+    // We need to temporarily open the table
+    char table_path[512];
+    snprintf(table_path, sizeof(table_path), "Database/%s/Tables/%s.tbl",
+             db->name, statement->table_name);
+
+    table = table_cache_acquire(table_path);
+    if (!table)
+    {
+      printf("Error: Failed to open table '%s'.\n", statement->table_name);
+      return EXECUTE_UNRECOGNIZED_STATEMENT;
+    }
+    table->root_page_num = table_def->root_page_num;
+    table_set_key(table, &table_def->key);
+  }
+
+  bool result = create_secondary_index(table, table_def, index_def);
+
+  // If this wasn't the active table, release it
+  if (table != db->active_table)
+  {
+    table_cache_release(table);
+  }
+
+  // Save the updated catalog
+  catalog_save(&db->catalog, db->name);
+
+  if (result)
+  {
+    printf("Index '%s' created on table '%s' for %s '%s'%s%s.\n",
+           statement->index_name, statement->table_name,
+           index_def->expr.type == COLUMN_FUNC_NONE ? "column" : "expression",
+           indexed,
+           index_def->predicate[0] ? " where " : "", index_def->predicate);
+    return EXECUTE_SUCCESS;
+  }
+  else
+  {
+    printf("Error: Failed to create index.\n");
+    return EXECUTE_UNRECOGNIZED_STATEMENT;
+  }
+}
+
+// One aggregate output of a group, formatted like a column value. Plain
+// and MIN/MAX columns are copied into a scratch row and printed from there.
+static void print_aggregate_value(const AggregateSpec *spec,
+                                  const uint8_t *group, uint32_t output_idx,
+                                  TableDef *table_def, DynamicRow *scratch,
+                                  bool json)
+{
+  AggregateValue value;
+  aggregator_value(spec, group, output_idx, &value);
+  switch (value.kind)
+  {
+  case AGGREGATE_VALUE_NULL:
+    printf(json ? "null" : "NULL");
+    break;
+  case AGGREGATE_VALUE_INT:
+    printf("%lld", (long long)value.int_value);
+    break;
+  case AGGREGATE_VALUE_FLOAT:
+    printf("%.2f", value.float_value);
+    break;
+  case AGGREGATE_VALUE_COLUMN:
+  {
+    const SortKey *column = &spec->outputs[output_idx].value;
+    memcpy((uint8_t *)scratch->data + column->offset, value.bytes,
+           column->width);
+    if (json)
+    {
+      format_column_value_as_json(scratch, table_def, column->column);
+    }
+    else
+    {
+      print_dynamic_column(scratch, table_def, column->column);
+    }
+    break;
+  }
+  }
+}
+
+// Print the groups of an aggregating SELECT; returns how many there were
+static uint32_t print_groups(QueryResult *matches, const AggregateSpec *spec,
+                             TableDef *table_def, OutputFormat format)
+{
+  DynamicRow scratch;
+  scratch.data = calloc(1, spec->row_size);
+  scratch.data_size = spec->row_size;
+  uint32_t group_count = 0;
+  const uint8_t *group;
+
+  if (format == OUTPUT_FORMAT_JSON)
+  {
+    start_json_result();
+    while ((group = query_result_next_group(matches)))
+    {
+      printf(group_count++ == 0 ? "    {" : ",\n    {");
+      for (uint32_t i = 0; i < spec->num_outputs; i++)
+      {
+        printf("%s\"%s\": ", i ? ", " : "", spec->outputs[i].name);
+        print_aggregate_value(spec, group, i, table_def, &scratch, true);
+      }
+      printf("}");
+    }
+    end_json_result(group_count);
+  }
+  else
+  {
+    printf("| ");
+    for (uint32_t i = 0; i < spec->num_outputs; i++)
+    {
+      printf("%s | ", spec->outputs[i].name);
+    }
+    printf("\n|");
+    for (uint32_t i = 0; i < spec->num_outputs; i++)
+    {
+      printf("------------|");
+    }
+    printf("\n");
 
-    table = db_open(table_path);
-    if (!table)
+    while ((group = query_result_next_group(matches)))
     {
-      printf("Error: Failed to open table '%s'.\n", statement->table_name);
-      return EXECUTE_UNRECOGNIZED_STATEMENT;
+      group_count++;
+      printf("| ");
+      for (uint32_t i = 0; i < spec->num_outputs; i++)
+      {
+        print_aggregate_value(spec, group, i, table_def, &scratch, false);
+        printf(" | ");
+      }
+      printf("\n");
+    }
+    if (group_count == 0)
+    {
+      printf("No matching records found.\n");
     }
   }
 
-  bool result = create_secondary_index(table, table_def, index_def);
+  free(scratch.data);
+  return group_count;
+}
 
-  // If this wasn't the active table, close it
-  if (table != db->active_table)
+// Rewrite the select list, ORDER BY and GROUP BY to the joined schema's
+// alias.column names, so the output and the operators see one table
+static bool qualify_join_columns(Statement *statement, const JoinPlan *join,
+                                 char *error, size_t error_size)
+{
+  for (uint32_t i = 0; i < statement->num_columns_to_select; i++)
   {
-    db_close(table);
+    char *column = statement->columns_to_select[i];
+    if (strcmp(column, "*") == 0)
+    {
+      continue;
+    }
+    int column_idx = join_find_column(join, column, error, error_size);
+    if (column_idx == -1)
+    {
+      return false;
+    }
+    statement->columns_to_select[i] =
+        my_strdup(join->joined.columns[column_idx].name);
+    free(column);
   }
-
-  // Save the updated catalog
-  catalog_save(&db->catalog, db->name);
-
-  if (result)
+  for (uint32_t i = 0; i < statement->num_order_by; i++)
   {
-    printf("Index '%s' created on table '%s' for column '%s'.\n",
-           statement->index_name, statement->table_name, statement->where_column);
-    return EXECUTE_SUCCESS;
+    int column_idx = join_find_column(join, statement->order_by[i].column,
+                                      error, error_size);
+    if (column_idx == -1)
+    {
+      return false;
+    }
+    strcpy(statement->order_by[i].column,
+           join->joined.columns[column_idx].name);
   }
-  else
+  for (uint32_t i = 0; i < statement->num_group_by; i++)
   {
-    printf("Error: Failed to create index.\n");
-    return EXECUTE_UNRECOGNIZED_STATEMENT;
+    int column_idx =
+        join_find_column(join, statement->group_by[i], error, error_size);
+    if (column_idx == -1)
+    {
+      return false;
+    }
+    strcpy(statement->group_by[i], join->joined.columns[column_idx].name);
   }
+  return true;
 }
 
 ExecuteResult execute_filtered_select(Statement *statement, Table *table)
@@ -2172,364 +2613,258 @@ ExecuteResult execute_filtered_select(Statement *statement, Table *table)
   TableDef *table_def = catalog_get_active_table(&statement->db->catalog);
   if (!table_def)
   {
+    sql_expr_free(statement->where_expr);
+    statement->where_expr = NULL;
+    free(statement->order_by);
+    statement->order_by = NULL;
     return EXECUTE_UNRECOGNIZED_STATEMENT;
   }
 
-  // Find column index for the where condition
-  int where_column_idx = -1;
-  for (uint32_t i = 0; i < table_def->num_columns; i++)
-  {
-    if (strcasecmp(table_def->columns[i].name, statement->where_column) == 0)
-    {
-      where_column_idx = i;
-      break;
+  // The planner picks the cheapest access method for the WHERE clause and
+  // leaves whatever it cannot answer directly as a compiled residual
+  QueryPlan plan;
+  char error[SQL_MAX_ERROR];
+  AggregateSpec aggregate;
+  SelectOptions options = {statement->order_by,
+                           statement->num_order_by,
+                           statement->has_limit,
+                           statement->limit,
+                           statement->offset,
+                           statement->db->work_memory,
+                           statement->has_aggregates ? &aggregate : NULL,
+                           statement->columns_to_select,
+                           statement->num_columns_to_select};
+  // A join hands the operators and the output its joined schema in place
+  // of the FROM table's
+  JoinPlan join;
+  TableDef *output_def = table_def;
+  bool planned = true;
+  if (statement->has_join)
+  {
+    planned = join_open(&join, statement->db, table, table_def,
+                        statement->table_alias, &statement->join, error,
+                        sizeof(error)) &&
+              qualify_join_columns(statement, &join, error, sizeof(error));
+    output_def = &join.joined;
+  }
+  planned =
+      planned &&
+      (!statement->has_aggregates ||
+       aggregate_spec_build(output_def, statement->columns_to_select,
+                            statement->select_functions,
+                            statement->num_columns_to_select,
+                            statement->group_by, statement->num_group_by,
+                            &aggregate, error, sizeof(error))) &&
+      (statement->has_join
+           ? join_plan_build(&join, statement->where_expr, &options, error,
+                             sizeof(error))
+           : plan_where(statement, statement->where_expr, &options, table,
+                        table_def, &plan, error, sizeof(error)));
+  sql_expr_free(statement->where_expr);
+  statement->where_expr = NULL;
+  free(statement->order_by);
+  statement->order_by = NULL;
+  statement->num_order_by = 0;
+  if (!planned)
+  {
+    printf("Error: %s\n", error);
+    if (statement->has_join)
+    {
+      join_plan_free(&join);
     }
-  }
-
-  if (where_column_idx == -1)
-  {
-    printf("Error: Column '%s' not found in table\n", statement->where_column);
     // Free allocated memory before returning
     free_columns_to_select(statement);
     return EXECUTE_UNRECOGNIZED_STATEMENT;
   }
 
-  int row_count = 0;
-  bool rows_found = false;
-  bool show_query_plan = true; // Set to true to enable query plan logging
-
-  // Special case: if filtering by ID, use the more efficient btree search
-  if (strcasecmp(statement->where_column, "id") == 0 || where_column_idx == 0)
+  if (statement->explain)
   {
-    // Log query execution plan
-    if (show_query_plan)
+    if (statement->has_join)
     {
-      printf("QUERY PLAN: Using primary key B-tree index on column 'id'\n");
+      join_plan_explain(&join);
+      join_plan_free(&join);
     }
-
-    int id_value = atoi(statement->where_value);
-    Cursor *cursor = table_find(table, id_value);
-
-    if (!cursor->end_of_table)
+    else
     {
-      DynamicRow row;
-      dynamic_row_init(&row, table_def);
-
-      deserialize_dynamic_row(cursor_value(cursor), table_def, &row);
-
-      // Choose output format
-      if (statement->db->output_format == OUTPUT_FORMAT_JSON)
-      {
-        start_json_result();
-        printf("    ");
-        format_row_as_json(&row, table_def, statement->columns_to_select,
-                           statement->num_columns_to_select);
-        end_json_result(1);
-      }
-      else
-      {
-        // Table format (existing implementation)
-        // Print column names as header
-        printf("| ");
-        if (statement->num_columns_to_select > 0)
-        {
-          // Print only selected columns
-          for (uint32_t i = 0; i < statement->num_columns_to_select; i++)
-          {
-            printf("%s | ", statement->columns_to_select[i]);
-          }
-        }
-        else
-        {
-          // Print all column names
-          for (uint32_t i = 0; i < table_def->num_columns; i++)
-          {
-            printf("%s | ", table_def->columns[i].name);
-          }
-        }
-        printf("\n");
+      query_plan_explain(&plan, table_def);
+      query_plan_free(&plan);
+    }
+    free_columns_to_select(statement);
+    return EXECUTE_SUCCESS;
+  }
 
-        // Print separator line
-        for (uint32_t i = 0; i < (statement->num_columns_to_select > 0
-                                  ? statement->num_columns_to_select
-                                  : table_def->num_columns);
-         i++)
-        {
-          printf("|-%s-", "----------");
-        }
-        printf("|\n");
+  bool show_query_plan = true; // Set to true to enable query plan logging
+  if (show_query_plan && !statement->explain_analyze && !statement->has_join)
+  {
+    query_plan_print(&plan, table_def);
+  }
 
-        // Print row data
-        printf("| ");
+  QueryProfile profile;
+  QueryProfile *active_profile = NULL;
+  if (statement->explain_analyze)
+  {
+    active_profile = &profile;
+    query_profile_begin(active_profile);
+  }
 
-        if (statement->num_columns_to_select > 0)
-        {
-          // Print only selected columns
-          for (uint32_t i = 0; i < statement->num_columns_to_select; i++)
-          {
-            // Find column index by name
-            int column_idx = -1;
-            for (uint32_t j = 0; j < table_def->num_columns; j++)
-            {
-              if (strcasecmp(table_def->columns[j].name,
-                           statement->columns_to_select[i]) == 0)
-              {
-                column_idx = j;
-                break;
-              }
-            }
+  // Results come back in key order whichever access method was used, so
+  // the output matches a serial scan, unless ORDER BY asked for a sort
+  QueryResult matches;
+  if (statement->has_join)
+  {
+    join_execute(&join, statement->db->scan_threads, &matches,
+                 active_profile);
+  }
+  else
+  {
+    query_plan_execute(&plan, table, table_def, statement->db->scan_threads,
+                       &matches, active_profile);
+  }
+  uint32_t row_count = 0;
+  DynamicRow *row;
 
-            if (column_idx != -1)
-            {
-              print_dynamic_column(&row, table_def, column_idx);
-            }
-            else
-            {
-              printf("N/A");
-            }
-            printf(" | ");
-          }
-        }
-        else
-        {
-          // Print all columns
-          for (uint32_t i = 0; i < table_def->num_columns; i++)
-          {
-            print_dynamic_column(&row, table_def, i);
-            printf(" | ");
-          }
-        }
-        printf("\n");
-        rows_found = true;
-      }
+  // Choose output format
+  if (statement->has_aggregates)
+  {
+    row_count = print_groups(&matches, &aggregate, output_def,
+                             statement->db->output_format);
+  }
+  else if (statement->db->output_format == OUTPUT_FORMAT_JSON)
+  {
+    start_json_result();
 
-      dynamic_row_free(&row);
+    while ((row = query_result_next(&matches)))
+    {
+      printf(row_count++ == 0 ? "    " : ",\n    ");
+      format_row_as_json(row, output_def, statement->columns_to_select,
+                         statement->num_columns_to_select);
     }
-    free(cursor);
+
+    end_json_result(row_count);
   }
   else
   {
-    // For other columns, do a full table scan
-    Cursor *cursor = table_start(table);
-    DynamicRow row;
-    dynamic_row_init(&row, table_def);
-
-    // Choose output format
-    if (statement->db->output_format == OUTPUT_FORMAT_JSON)
+    // TABLE FORMAT OUTPUT
+    // Print column headers
+    printf("| ");
+    if (statement->num_columns_to_select > 0)
     {
-      start_json_result();
-      bool first_match = true;
-
-      while (!(cursor->end_of_table))
+      // Print only selected columns
+      for (uint32_t i = 0; i < statement->num_columns_to_select; i++)
       {
-        void *value = cursor_value(cursor);
-        deserialize_dynamic_row(value, table_def, &row);
-
-        // Check if row matches condition
-        bool row_matches = false;
-
-        switch (table_def->columns[where_column_idx].type)
-        {
-          case COLUMN_TYPE_INT:
-          {
-            int col_value = dynamic_row_get_int(&row, table_def, where_column_idx);
-            int where_value = atoi(statement->where_value);
-            row_matches = (col_value == where_value);
-            break;
-          }
-          case COLUMN_TYPE_STRING:
-          {
-            char *col_value = dynamic_row_get_string(&row, table_def, where_column_idx);
-            row_matches = (strcasecmp(col_value, statement->where_value) == 0);
-            break;
-          }
-          case COLUMN_TYPE_FLOAT:
-          {
-            float col_value = dynamic_row_get_float(&row, table_def, where_column_idx);
-            float where_value = atof(statement->where_value);
-            row_matches = (fabs(col_value - where_value) < 0.0001);
-            break;
-          }
-          case COLUMN_TYPE_BOOLEAN:
-          {
-            bool col_value = dynamic_row_get_boolean(&row, table_def, where_column_idx);
-            bool where_value = (strcasecmp(statement->where_value, "true") == 0 ||
-                            strcmp(statement->where_value, "1") == 0);
-            row_matches = (col_value == where_value);
-            break;
-          }
-          default:
-            row_matches = false;
-            break;
-        }
-
-        if (row_matches)
-        {
-          rows_found = true;
-          row_count++;
-
-          if (!first_match)
-          {
-            printf(",\n    ");
-          }
-          else
-          {
-            printf("    ");
-            first_match = false;
-          }
-
-          format_row_as_json(&row, table_def, statement->columns_to_select,
-                         statement->num_columns_to_select);
-        }
-
-        cursor_advance(cursor);
+        printf("%s | ", statement->columns_to_select[i]);
       }
-
-      end_json_result(row_count);
     }
     else
     {
-      // TABLE FORMAT OUTPUT
-      // Print column headers
-      printf("| ");
-      if (statement->num_columns_to_select > 0)
-      {
-        // Print only selected columns
-        for (uint32_t i = 0; i < statement->num_columns_to_select; i++)
-        {
-          printf("%s | ", statement->columns_to_select[i]);
-        }
-      }
-      else
-      {
-        // Print all column names
-        for (uint32_t i = 0; i < table_def->num_columns; i++)
-        {
-          printf("%s | ", table_def->columns[i].name);
-        }
-      }
-      printf("\n");
-
-      // Print separator line
-      printf("|");
-      for (uint32_t i = 0; i < (statement->num_columns_to_select > 0
-                              ? statement->num_columns_to_select
-                              : table_def->num_columns);
-           i++)
+      // Print all column names
+      for (uint32_t i = 0; i < output_def->num_columns; i++)
       {
-        printf("------------|");
+        printf("%s | ", output_def->columns[i].name);
       }
-      printf("\n");
+    }
+    printf("\n");
 
-      // Scan the table for matching rows
-      while (!(cursor->end_of_table))
-      {
-        void *value = cursor_value(cursor);
-        deserialize_dynamic_row(value, table_def, &row);
+    // Print separator line
+    printf("|");
+    for (uint32_t i = 0; i < (statement->num_columns_to_select > 0
+                            ? statement->num_columns_to_select
+                            : output_def->num_columns);
+         i++)
+    {
+      printf("------------|");
+    }
+    printf("\n");
 
-        // Check if row matches condition
-        bool row_matches = false;
+    while ((row = query_result_next(&matches)))
+    {
+      row_count++;
 
-        switch (table_def->columns[where_column_idx].type)
-        {
-          case COLUMN_TYPE_INT:
-          {
-            int col_value = dynamic_row_get_int(&row, table_def, where_column_idx);
-            int where_value = atoi(statement->where_value);
-            row_matches = (col_value == where_value);
-            break;
-          }
-          case COLUMN_TYPE_STRING:
-          {
-            char *col_value = dynamic_row_get_string(&row, table_def, where_column_idx);
-            row_matches = (strcasecmp(col_value, statement->where_value) == 0);
-            break;
-          }
-          case COLUMN_TYPE_FLOAT:
-          {
-            float col_value = dynamic_row_get_float(&row, table_def, where_column_idx);
-            float where_value = atof(statement->where_value);
-            row_matches = (fabs(col_value - where_value) < 0.0001);
-            break;
-          }
-          case COLUMN_TYPE_BOOLEAN:
-          {
-            bool col_value = dynamic_row_get_boolean(&row, table_def, where_column_idx);
-            bool where_value = (strcasecmp(statement->where_value, "true") == 0 ||
-                                strcmp(statement->where_value, "1") == 0);
-            row_matches = (col_value == where_value);
-            break;
-          }
-          default:
-            row_matches = false;
-            break;
-        }     
+      // Print row data
+      printf("| ");
 
-        if (row_matches)
+      if (statement->num_columns_to_select > 0)
+      {
+        // Print only selected columns
+        for (uint32_t i = 0; i < statement->num_columns_to_select; i++)
         {
-          rows_found = true;
-          row_count++;
-
-          // Print row data
-          printf("| ");
-
-          if (statement->num_columns_to_select > 0)
+          int column_idx = table_def_find_column(output_def,
+                                                 statement->columns_to_select[i]);
+          if (column_idx != -1)
           {
-            // Print only selected columns
-            for (uint32_t i = 0; i < statement->num_columns_to_select; i++)
-            {
-              // Find column index by name
-              int column_idx = -1;
-              for (uint32_t j = 0; j < table_def->num_columns; j++)
-              {
-                if (strcasecmp(table_def->columns[j].name, statement->columns_to_select[i]) == 0)
-                {
-                  column_idx = j;
-                  break;
-                }
-              }
-
-              if (column_idx != -1)
-              {
-                print_dynamic_column(&row, table_def, column_idx);
-              }
-              else
-              {
-                printf("N/A");
-              }
-              printf(" | ");
-            }
+            print_dynamic_column(row, output_def, column_idx);
           }
           else
           {
-            // Print all columns
-            for (uint32_t i = 0; i < table_def->num_columns; i++)
-            {
-              print_dynamic_column(&row, table_def, i);
-              printf(" | ");
-            }
+            printf("N/A");
           }
-          printf("\n");
+          printf(" | ");
         }
-
-        cursor_advance(cursor);
       }
-
-      if (!rows_found)
+      else
       {
-        printf("No matching records found.\n");
+        // Print all columns
+        for (uint32_t i = 0; i < output_def->num_columns; i++)
+        {
+          print_dynamic_column(row, output_def, i);
+          printf(" | ");
+        }
       }
+      printf("\n");
     }
 
-    dynamic_row_free(&row);
-    free(cursor);
+    if (row_count == 0)
+    {
+      printf("No matching records found.\n");
+    }
+  }
+
+  if (active_profile)
+  {
+    OperatorProfile *output = query_profile_end(active_profile, "Output",
+                                                row_count);
+    output->rows_in = row_count;
+    if (statement->has_join)
+    {
+      join_plan_explain(&join);
+    }
+    else
+    {
+      query_plan_explain(&plan, table_def);
+    }
+    query_profile_finish(active_profile);
+  }
+  if (statement->has_join)
+  {
+    join_plan_free(&join);
   }
+  else
+  {
+    query_plan_free(&plan);
+  }
+  query_result_free(&matches);
 
   // Free allocated memory for columns
   free_columns_to_select(statement);
   return EXECUTE_SUCCESS;
 }
 
+ExecuteResult execute_analyze(Statement *statement, Database *db)
+{
+  (void)statement;
+  TableDef *table_def = catalog_get_active_table(&db->catalog);
+  if (db->active_table == NULL || !table_def)
+  {
+    printf("Error: No active table selected.\n");
+    return EXECUTE_ERROR;
+  }
+
+  table_stats_collect(db->active_table, table_def, &table_def->stats);
+  catalog_save(&db->catalog, db->name);
+  table_stats_print(&table_def->stats, table_def);
+  return EXECUTE_SUCCESS;
+}
+
 ExecuteResult execute_show_tables(Statement *statement, Database *db)
 {
   (void)statement; // Mark parameter as used
@@ -2592,22 +2927,46 @@ ExecuteResult execute_show_indexes(Statement *statement, Database *db)
 
   if (table_def->num_indexes == 0)
   {
-    printf("  No indexes found.\n");
+    if (online_index_pending(table_def->name) == 0)
+    {
+      printf("  No indexes found.\n");
+    }
   }
   else
   {
-    printf("  %-20s | %-20s | %-10s\n", "NAME", "COLUMN", "UNIQUE");
-    printf("  %-20s | %-20s | %-10s\n", "--------------------", "--------------------", "----------");
+    printf("  %-20s | %-20s | %-8s | %-10s | %s\n", "NAME", "COLUMN", "TYPE", "UNIQUE", "INCLUDE");
+    printf("  %-20s | %-20s | %-8s | %-10s | %s\n", "--------------------", "--------------------", "--------", "----------", "-------");
 
     for (uint32_t i = 0; i < table_def->num_indexes; i++)
     {
       IndexDef *index = &table_def->indexes[i];
-      printf("  %-20s | %-20s | %-10s\n",
+      char include[MAX_INDEX_INCLUDE * (MAX_COLUMN_NAME + 2)] = "";
+      for (uint32_t j = 0; j < index->num_include; j++)
+      {
+        if (j > 0)
+        {
+          strcat(include, ", ");
+        }
+        strcat(include, table_def->columns[index->include_columns[j]].name);
+      }
+      char indexed[MAX_COLUMN_NAME + 32];
+      column_func_format(&index->expr, index->column_name, indexed, sizeof(indexed));
+      printf("  %-20s | %-20s | %-8s | %-10s | %s\n",
              index->name,
-             index->column_name,
-             index->is_unique ? "YES" : "NO");
+             indexed,
+             index->type == INDEX_TYPE_HASH       ? "HASH"
+             : index->type == INDEX_TYPE_BITMAP   ? "BITMAP"
+             : index->type == INDEX_TYPE_FULLTEXT ? "FULLTEXT"
+                                                  : "BTREE",
+             index->is_unique ? "YES" : "NO",
+             include);
+      if (index->predicate[0])
+      {
+        printf("  %-20s   WHERE %s\n", "", index->predicate);
+      }
     }
   }
+  online_index_print(table_def->name);
 
   return EXECUTE_SUCCESS;
 }
\ No newline at end of file
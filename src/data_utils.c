@@ -1,4 +1,5 @@
 #include "../include/data_utils.h"
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -96,7 +97,7 @@ Time int32_to_time(int32_t seconds) {
 
 // Convert Timestamp to int64_t (seconds since epoch)
 int64_t timestamp_to_int64(const Timestamp* ts) {
-    int64_t seconds = date_to_int32(&ts->date) * 86400; // Days to seconds
+    int64_t seconds = (int64_t)date_to_int32(&ts->date) * 86400; // Days to seconds
     seconds += time_to_int32(&ts->time);
     return seconds;
 }
@@ -221,3 +222,74 @@ bool parse_timestamp(const char* str, Timestamp* ts) {
     
     return parse_date(date_str, &ts->date) && parse_time(time_str, &ts->time);
 }
+
+// The whole of str as a decimal integer
+static bool parse_whole_integer(const char* str, int64_t* value) {
+    char* end;
+    errno = 0;
+    long long parsed = strtoll(str, &end, 10);
+    if (end == str || *end != '\0' || errno == ERANGE) {
+        return false;
+    }
+    *value = parsed;
+    return true;
+}
+
+bool parse_temporal_literal(ColumnType type, const char* str, int64_t* value) {
+    if (parse_whole_integer(str, value)) {
+        return true;
+    }
+
+    // The text forms, with nothing after them
+    int used = 0;
+    int a, b, c;
+    Date date;
+    Time time = {0, 0, 0};
+    switch (type) {
+        case COLUMN_TYPE_DATE:
+            if (sscanf(str, "%d-%d-%d%n", &a, &b, &c, &used) != 3 ||
+                str[used] != '\0' || !parse_date(str, &date)) {
+                return false;
+            }
+            *value = date_to_int32(&date);
+            return true;
+        case COLUMN_TYPE_TIME:
+            if (sscanf(str, "%d:%d:%d%n", &a, &b, &c, &used) != 3 ||
+                str[used] != '\0' || !parse_time(str, &time)) {
+                return false;
+            }
+            *value = time_to_int32(&time);
+            return true;
+        case COLUMN_TYPE_TIMESTAMP:
+        {
+            if (sscanf(str, "%d-%d-%d%n", &a, &b, &c, &used) != 3 ||
+                !parse_date(str, &date)) {
+                return false;
+            }
+            const char* rest = str + used;
+            if (*rest == ' ') {
+                if (sscanf(rest + 1, "%d:%d:%d%n", &a, &b, &c, &used) != 3 ||
+                    !parse_time(rest + 1, &time)) {
+                    return false;
+                }
+                rest += 1 + used;
+            }
+            if (*rest != '\0') {
+                return false;
+            }
+            Timestamp ts = {date, time};
+            *value = timestamp_to_int64(&ts);
+            return true;
+        }
+        default:
+            return false;
+    }
+}
+
+int64_t integer_literal_value(ColumnType type, const char* str) {
+    int64_t value;
+    if (parse_temporal_literal(type, str, &value)) {
+        return value;
+    }
+    return atoll(str);
+}
@@ -1,5 +1,12 @@
 #include "../include/database.h"
 #include "../include/auth.h"
+#include "../include/bitmap_index.h"
+#include "../include/fulltext_index.h"
+#include "../include/hash_index.h"
+#include "../include/online_index.h"
+#include "../include/parallel_scan.h"
+#include "../include/sort.h"
+#include "../include/table_cache.h"
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
@@ -157,6 +164,9 @@ Database *db_open_database(const char *name)
 
     // Set default output format
     db->output_format = OUTPUT_FORMAT_TABLE;
+    db->scan_threads = parallel_scan_default_threads();
+    db->work_memory = SORT_DEFAULT_MEMORY_BUDGET;
+    db->plan_cache.num_plans = 0;
 
     // Load or initialize catalog
     char catalog_path[512];
@@ -204,10 +214,11 @@ Database *db_open_database(const char *name)
         TableDef *table_def = catalog_get_active_table(&db->catalog);
         if (table_def)
         {
-            db->active_table = db_open(table_def->filename);
+            db->active_table = table_cache_acquire(table_def->filename);
             if (db->active_table)
             {
                 db->active_table->root_page_num = table_def->root_page_num;
+                table_set_key(db->active_table, &table_def->key);
             }
         }
     }
@@ -220,7 +231,8 @@ Database *db_open_database(const char *name)
     return db;
 }
 
-bool db_create_table(Database *db, const char *name, ColumnDef *columns, uint32_t num_columns)
+bool db_create_table(Database *db, const char *name, ColumnDef *columns, uint32_t num_columns,
+                     const uint32_t *key_columns, uint32_t num_key_columns)
 {
     // Make sure the Tables directory exists
     snprintf(tables_dir_buffer, sizeof(tables_dir_buffer), "Database/%s/Tables", db->name);
@@ -239,7 +251,8 @@ bool db_create_table(Database *db, const char *name, ColumnDef *columns, uint32_
     }
 
     // Add table to catalog
-    if (!catalog_add_table(&db->catalog, name, columns, num_columns))
+    if (!catalog_add_table(&db->catalog, name, columns, num_columns, key_columns,
+                           num_key_columns))
     {
         return false;
     }
@@ -248,17 +261,17 @@ bool db_create_table(Database *db, const char *name, ColumnDef *columns, uint32_
     catalog_set_active_table(&db->catalog, name);
     TableDef *table_def = catalog_get_active_table(&db->catalog);
 
-    // Close current active table if any
+    // Let go of the current active table; it stays open in the cache
     if (db->active_table)
     {
-        table_def->root_page_num = db->active_table->root_page_num;
-        db_close(db->active_table);
+        table_cache_release(db->active_table);
         db->active_table = NULL;
     }
 
     // Open new table
-    db->active_table = db_open(table_def->filename);
+    db->active_table = table_cache_acquire(table_def->filename);
     table_def->root_page_num = db->active_table->root_page_num;
+    table_set_key(db->active_table, &table_def->key);
 
     // Save updated catalog
     catalog_save(&db->catalog, db->name);
@@ -276,14 +289,11 @@ bool db_use_table(Database *db, const char *table_name)
 
     TableDef *table_def = catalog_get_active_table(&db->catalog);
 
-    // Close current active table if any
+    // Let go of the current active table. It stays open in the table cache,
+    // so switching back to it does not reopen the file.
     if (db->active_table)
     {
-        // Save current table's root page number before closing
-        TableDef *current_table_def = catalog_get_active_table(&db->catalog);
-        current_table_def->root_page_num = db->active_table->root_page_num;
-
-        db_close(db->active_table);
+        table_cache_release(db->active_table);
         db->active_table = NULL;
     }
 
@@ -301,10 +311,11 @@ bool db_use_table(Database *db, const char *table_name)
     }
 
     // Open new active table
-    db->active_table = db_open(table_def->filename);
+    db->active_table = table_cache_acquire(table_def->filename);
 
     // Update root page number from catalog
     db->active_table->root_page_num = table_def->root_page_num;
+    table_set_key(db->active_table, &table_def->key);
 
     // Save updated catalog
     catalog_save(&db->catalog, db->name);
@@ -317,6 +328,9 @@ void db_close_database(Database *db)
     if (!db)
         return;
 
+    // Indexes still being built online are finished and published first
+    online_index_finish_all(&db->catalog);
+
     // Rollback any active transaction
     if (db->active_txn_id != 0)
     {
@@ -328,6 +342,7 @@ void db_close_database(Database *db)
 
     // Free transaction manager resources
     txn_manager_free(&db->txn_manager);
+    plan_cache_clear(&db->plan_cache);
 
     // Save current active table's root page number
     if (db->active_table)
@@ -338,10 +353,12 @@ void db_close_database(Database *db)
             table_def->root_page_num = db->active_table->root_page_num;
         }
 
-        // Close active table
-        db_close(db->active_table);
+        table_cache_release(db->active_table);
     }
 
+    // Flush and close every table and index this database had open
+    table_cache_close_all();
+
     // Save catalog before closing
     catalog_save(&db->catalog, db->name);
 
@@ -481,7 +498,7 @@ void close_open_indexes(OpenIndexes *indexes)
     {
         if (indexes->tables[i])
         {
-            db_close(indexes->tables[i]);
+            table_cache_release(indexes->tables[i]);
             indexes->tables[i] = NULL;
         }
     }
@@ -515,7 +532,7 @@ bool open_table_indexes(Database *db, int table_idx)
                index_def->name, index_def->filename);
 
         // Open the index file
-        Table *index_table = db_open(index_def->filename);
+        Table *index_table = table_cache_acquire(index_def->filename);
         if (!index_table)
         {
             printf("Warning: Failed to open index '%s' on table '%s'\n",
@@ -523,6 +540,29 @@ bool open_table_indexes(Database *db, int table_idx)
             continue;
         }
 
+        // A hash index has no root; its header page says what it holds
+        if (index_def->type == INDEX_TYPE_HASH && !hash_index_valid(index_table))
+        {
+            printf("Warning: Index '%s' on table '%s' is not a valid hash index\n",
+                   index_def->name, table_def->name);
+            table_cache_release(index_table);
+            continue;
+        }
+        if (index_def->type == INDEX_TYPE_BITMAP && !bitmap_index_get(index_table))
+        {
+            printf("Warning: Index '%s' on table '%s' is not a valid bitmap index\n",
+                   index_def->name, table_def->name);
+            table_cache_release(index_table);
+            continue;
+        }
+        if (index_def->type == INDEX_TYPE_FULLTEXT && !fulltext_index_get(index_table))
+        {
+            printf("Warning: Index '%s' on table '%s' is not a valid full-text index\n",
+                   index_def->name, table_def->name);
+            table_cache_release(index_table);
+            continue;
+        }
+
         // Set the root page number from the catalog
         index_table->root_page_num = index_def->root_page_num;
 
@@ -535,7 +575,7 @@ bool open_table_indexes(Database *db, int table_idx)
         else
         {
             printf("Warning: Maximum number of open indexes reached\n");
-            db_close(index_table);
+            table_cache_release(index_table);
             break;
         }
     }
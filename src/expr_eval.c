@@ -0,0 +1,541 @@
+#include "../include/expr_eval.h"
+#include "../include/catalog.h"
+#include "../include/column_func.h"
+#include "../include/data_utils.h"
+#include "../include/fulltext_index.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+// Same tolerance the original single-column float filter used
+#define FLOAT_EQ_EPSILON 0.0001
+
+static int32_t read_int32(const CompiledExpr *expr, const uint8_t *row)
+{
+  int32_t value;
+  memcpy(&value, row + expr->offset, sizeof(int32_t));
+  return value;
+}
+
+static int64_t read_int64(const CompiledExpr *expr, const uint8_t *row)
+{
+  int64_t value;
+  memcpy(&value, row + expr->offset, sizeof(int64_t));
+  return value;
+}
+
+static float read_float(const CompiledExpr *expr, const uint8_t *row)
+{
+  float value;
+  memcpy(&value, row + expr->offset, sizeof(float));
+  return value;
+}
+
+// One evaluator per (type, operator) pair
+#define DEFINE_COMPARE(name, type_reader, op)                          \
+  static bool name(const CompiledExpr *expr, const uint8_t *row)       \
+  {                                                                    \
+    return type_reader(expr, row) op expr->int_value;                  \
+  }
+
+DEFINE_COMPARE(int32_eq, read_int32, ==)
+DEFINE_COMPARE(int32_ne, read_int32, !=)
+DEFINE_COMPARE(int32_lt, read_int32, <)
+DEFINE_COMPARE(int32_le, read_int32, <=)
+DEFINE_COMPARE(int32_gt, read_int32, >)
+DEFINE_COMPARE(int32_ge, read_int32, >=)
+DEFINE_COMPARE(int64_eq, read_int64, ==)
+DEFINE_COMPARE(int64_ne, read_int64, !=)
+DEFINE_COMPARE(int64_lt, read_int64, <)
+DEFINE_COMPARE(int64_le, read_int64, <=)
+DEFINE_COMPARE(int64_gt, read_int64, >)
+DEFINE_COMPARE(int64_ge, read_int64, >=)
+#undef DEFINE_COMPARE
+
+static bool float_eq(const CompiledExpr *expr, const uint8_t *row)
+{
+  float diff = read_float(expr, row) - expr->float_value;
+  return diff < FLOAT_EQ_EPSILON && diff > -FLOAT_EQ_EPSILON;
+}
+
+static bool float_ne(const CompiledExpr *expr, const uint8_t *row)
+{
+  return !float_eq(expr, row);
+}
+
+static bool float_lt(const CompiledExpr *expr, const uint8_t *row)
+{
+  return read_float(expr, row) < expr->float_value;
+}
+
+static bool float_le(const CompiledExpr *expr, const uint8_t *row)
+{
+  return read_float(expr, row) <= expr->float_value;
+}
+
+static bool float_gt(const CompiledExpr *expr, const uint8_t *row)
+{
+  return read_float(expr, row) > expr->float_value;
+}
+
+static bool float_ge(const CompiledExpr *expr, const uint8_t *row)
+{
+  return read_float(expr, row) >= expr->float_value;
+}
+
+static bool bool_eq(const CompiledExpr *expr, const uint8_t *row)
+{
+  return (row[expr->offset] != 0) == (expr->int_value != 0);
+}
+
+static bool bool_ne(const CompiledExpr *expr, const uint8_t *row)
+{
+  return !bool_eq(expr, row);
+}
+
+// Strings compare case-insensitively, like the original filter did
+static bool string_eq(const CompiledExpr *expr, const uint8_t *row)
+{
+  const char *value = (const char *)row + expr->offset;
+  for (uint32_t i = 0; i < expr->text_length; i++)
+  {
+    if (tolower((unsigned char)value[i]) != (unsigned char)expr->text[i])
+    {
+      return false;
+    }
+  }
+  return value[expr->text_length] == '\0';
+}
+
+static bool string_ne(const CompiledExpr *expr, const uint8_t *row)
+{
+  return !string_eq(expr, row);
+}
+
+static int string_compare(const CompiledExpr *expr, const uint8_t *row)
+{
+  return strcasecmp((const char *)row + expr->offset, expr->text);
+}
+
+static bool string_lt(const CompiledExpr *expr, const uint8_t *row)
+{
+  return string_compare(expr, row) < 0;
+}
+
+static bool string_le(const CompiledExpr *expr, const uint8_t *row)
+{
+  return string_compare(expr, row) <= 0;
+}
+
+static bool string_gt(const CompiledExpr *expr, const uint8_t *row)
+{
+  return string_compare(expr, row) > 0;
+}
+
+static bool string_ge(const CompiledExpr *expr, const uint8_t *row)
+{
+  return string_compare(expr, row) >= 0;
+}
+
+// LIKE patterns with a single leading and/or trailing % compile to prefix,
+// suffix or substring checks; anything else uses the general matcher
+static bool has_prefix_lowered(const char *value, const char *prefix,
+                               uint32_t length)
+{
+  for (uint32_t i = 0; i < length; i++)
+  {
+    if (value[i] == '\0' ||
+        tolower((unsigned char)value[i]) != (unsigned char)prefix[i])
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+static bool like_prefix(const CompiledExpr *expr, const uint8_t *row)
+{
+  return has_prefix_lowered((const char *)row + expr->offset, expr->text,
+                            expr->text_length);
+}
+
+static bool like_suffix(const CompiledExpr *expr, const uint8_t *row)
+{
+  const char *value = (const char *)row + expr->offset;
+  size_t length = strlen(value);
+  if (length < expr->text_length)
+  {
+    return false;
+  }
+  return has_prefix_lowered(value + length - expr->text_length, expr->text,
+                            expr->text_length);
+}
+
+static bool like_contains(const CompiledExpr *expr, const uint8_t *row)
+{
+  for (const char *value = (const char *)row + expr->offset; *value; value++)
+  {
+    if (has_prefix_lowered(value, expr->text, expr->text_length))
+    {
+      return true;
+    }
+  }
+  return expr->text_length == 0;
+}
+
+static bool like_match(const char *value, const char *pattern)
+{
+  while (*pattern)
+  {
+    if (*pattern == '%')
+    {
+      while (*pattern == '%')
+      {
+        pattern++;
+      }
+      if (!*pattern)
+      {
+        return true;
+      }
+      for (; *value; value++)
+      {
+        if (like_match(value, pattern))
+        {
+          return true;
+        }
+      }
+      return false;
+    }
+    if (!*value ||
+        (*pattern != '_' && tolower((unsigned char)*value) != (unsigned char)*pattern))
+    {
+      return false;
+    }
+    value++;
+    pattern++;
+  }
+  return *value == '\0';
+}
+
+static bool like_general(const CompiledExpr *expr, const uint8_t *row)
+{
+  return like_match((const char *)row + expr->offset, expr->text);
+}
+
+// MATCH without the index: the row's words against the query. int_value
+// holds the column's size, as the text need not be terminated within it.
+static bool text_match(const CompiledExpr *expr, const uint8_t *row)
+{
+  return fulltext_query_matches(expr->query, (const char *)row + expr->offset,
+                                expr->int_value);
+}
+
+static bool eval_and(const CompiledExpr *expr, const uint8_t *row)
+{
+  return expr->left->eval(expr->left, row) && expr->right->eval(expr->right, row);
+}
+
+static bool eval_or(const CompiledExpr *expr, const uint8_t *row)
+{
+  return expr->left->eval(expr->left, row) || expr->right->eval(expr->right, row);
+}
+
+static bool eval_false(const CompiledExpr *expr, const uint8_t *row)
+{
+  (void)expr;
+  (void)row;
+  return false;
+}
+
+static void set_lowered_text(CompiledExpr *compiled, const char *text,
+                             uint32_t length)
+{
+  compiled->text = malloc(length + 1);
+  for (uint32_t i = 0; i < length; i++)
+  {
+    compiled->text[i] = (char)tolower((unsigned char)text[i]);
+  }
+  compiled->text[length] = '\0';
+  compiled->text_length = length;
+}
+
+// func(column) against the literal, which is kept as the function's kind
+// of value: lowered text or an integer
+static int func_order(const CompiledExpr *expr, const uint8_t *row)
+{
+  ColumnFuncValue value;
+  column_func_eval(&expr->func, expr->column_type, row + expr->offset, &value);
+  if (value.is_text)
+  {
+    return strcmp(value.text, expr->text);
+  }
+  return (value.number > expr->int_value) - (value.number < expr->int_value);
+}
+
+#define DEFINE_FUNC_COMPARE(name, op)                                  \
+  static bool name(const CompiledExpr *expr, const uint8_t *row)       \
+  {                                                                    \
+    return func_order(expr, row) op 0;                                 \
+  }
+
+DEFINE_FUNC_COMPARE(func_eq, ==)
+DEFINE_FUNC_COMPARE(func_ne, !=)
+DEFINE_FUNC_COMPARE(func_lt, <)
+DEFINE_FUNC_COMPARE(func_le, <=)
+DEFINE_FUNC_COMPARE(func_gt, >)
+DEFINE_FUNC_COMPARE(func_ge, >=)
+#undef DEFINE_FUNC_COMPARE
+
+static ExprEvalFn compile_like(CompiledExpr *compiled, const char *pattern)
+{
+  uint32_t length = strlen(pattern);
+  bool leading = length > 0 && pattern[0] == '%';
+  bool trailing = length > 1 && pattern[length - 1] == '%';
+  const char *body = pattern + (leading ? 1 : 0);
+  uint32_t body_length = length - (leading ? 1 : 0) - (trailing ? 1 : 0);
+
+  bool body_has_wildcards = false;
+  for (uint32_t i = 0; i < body_length; i++)
+  {
+    if (body[i] == '%' || body[i] == '_')
+    {
+      body_has_wildcards = true;
+    }
+  }
+
+  if (body_has_wildcards)
+  {
+    set_lowered_text(compiled, pattern, length);
+    return like_general;
+  }
+
+  set_lowered_text(compiled, body, body_length);
+  if (leading && trailing)
+  {
+    return like_contains;
+  }
+  if (leading)
+  {
+    return like_suffix;
+  }
+  if (trailing)
+  {
+    return like_prefix;
+  }
+  return string_eq;
+}
+
+static ExprEvalFn pick_compare(SqlCompareOp op, ExprEvalFn eq, ExprEvalFn ne,
+                               ExprEvalFn lt, ExprEvalFn le, ExprEvalFn gt,
+                               ExprEvalFn ge)
+{
+  switch (op)
+  {
+    case SQL_OP_EQ:
+      return eq;
+    case SQL_OP_NE:
+      return ne;
+    case SQL_OP_LT:
+      return lt;
+    case SQL_OP_LE:
+      return le;
+    case SQL_OP_GT:
+      return gt;
+    case SQL_OP_GE:
+      return ge;
+    default:
+      return NULL;
+  }
+}
+
+static CompiledExpr *compile_compare(SqlExpr *expr, TableDef *table_def,
+                                     char *error, size_t error_size)
+{
+  int column_idx = table_def_find_column(table_def, expr->column);
+  if (column_idx == -1)
+  {
+    snprintf(error, error_size, "Column '%s' not found in table", expr->column);
+    return NULL;
+  }
+
+  CompiledExpr *compiled = calloc(1, sizeof(CompiledExpr));
+  compiled->offset = get_column_offset(table_def, column_idx);
+  const char *literal = expr->value.text;
+  ColumnType type = table_def->columns[column_idx].type;
+
+  if (expr->func.type != COLUMN_FUNC_NONE)
+  {
+    if (!column_func_supports(&expr->func, type) || expr->op == SQL_OP_LIKE ||
+        expr->op == SQL_OP_MATCH)
+    {
+      char name[MAX_COLUMN_NAME + 32];
+      column_func_format(&expr->func, expr->column, name, sizeof(name));
+      snprintf(error, error_size, "Unsupported comparison on %s", name);
+      free(compiled);
+      return NULL;
+    }
+    ColumnFuncValue value;
+    column_func_literal(&expr->func, literal, &value);
+    set_lowered_text(compiled, value.text, value.length);
+    compiled->int_value = value.number;
+    compiled->func = expr->func;
+    compiled->column_type = type;
+    compiled->eval = pick_compare(expr->op, func_eq, func_ne, func_lt, func_le,
+                                  func_gt, func_ge);
+    return compiled;
+  }
+
+  if (expr->op == SQL_OP_LIKE)
+  {
+    if (type != COLUMN_TYPE_STRING)
+    {
+      snprintf(error, error_size, "LIKE requires a string column, '%s' is not",
+               expr->column);
+      free(compiled);
+      return NULL;
+    }
+    compiled->eval = compile_like(compiled, literal);
+    return compiled;
+  }
+
+  if (expr->op == SQL_OP_MATCH)
+  {
+    if (type != COLUMN_TYPE_STRING)
+    {
+      snprintf(error, error_size, "MATCH requires a string column, '%s' is not",
+               expr->column);
+      free(compiled);
+      return NULL;
+    }
+    compiled->query = fulltext_query_parse(literal, error, error_size);
+    if (!compiled->query)
+    {
+      free(compiled);
+      return NULL;
+    }
+    compiled->int_value = table_def->columns[column_idx].size;
+    compiled->eval = text_match;
+    return compiled;
+  }
+
+  switch (type)
+  {
+    case COLUMN_TYPE_INT:
+    case COLUMN_TYPE_DATE:
+    case COLUMN_TYPE_TIME:
+      compiled->int_value = (int32_t)integer_literal_value(type, literal);
+      compiled->eval = pick_compare(expr->op, int32_eq, int32_ne, int32_lt,
+                                    int32_le, int32_gt, int32_ge);
+      break;
+    case COLUMN_TYPE_BIGINT:
+    case COLUMN_TYPE_TIMESTAMP:
+      compiled->int_value = integer_literal_value(type, literal);
+      compiled->eval = pick_compare(expr->op, int64_eq, int64_ne, int64_lt,
+                                    int64_le, int64_gt, int64_ge);
+      break;
+    case COLUMN_TYPE_FLOAT:
+      compiled->float_value = atof(literal);
+      compiled->eval = pick_compare(expr->op, float_eq, float_ne, float_lt,
+                                    float_le, float_gt, float_ge);
+      break;
+    case COLUMN_TYPE_BOOLEAN:
+      compiled->int_value = (strcasecmp(literal, "true") == 0 ||
+                             strcmp(literal, "1") == 0);
+      compiled->eval = pick_compare(expr->op, bool_eq, bool_ne, NULL, NULL,
+                                    NULL, NULL);
+      break;
+    case COLUMN_TYPE_STRING:
+      set_lowered_text(compiled, literal, strlen(literal));
+      compiled->eval = pick_compare(expr->op, string_eq, string_ne, string_lt,
+                                    string_le, string_gt, string_ge);
+      break;
+    default:
+      // No comparisons on blobs, matching the old filter
+      compiled->eval = eval_false;
+      break;
+  }
+
+  if (!compiled->eval)
+  {
+    snprintf(error, error_size, "Unsupported comparison on column '%s'",
+             expr->column);
+    expr_free(compiled);
+    return NULL;
+  }
+  return compiled;
+}
+
+CompiledExpr *expr_compile(SqlExpr *expr, TableDef *table_def, char *error,
+                           size_t error_size)
+{
+  if (expr->type == SQL_EXPR_COMPARE)
+  {
+    return compile_compare(expr, table_def, error, error_size);
+  }
+
+  CompiledExpr *left = expr_compile(expr->left, table_def, error, error_size);
+  if (!left)
+  {
+    return NULL;
+  }
+  CompiledExpr *right = expr_compile(expr->right, table_def, error, error_size);
+  if (!right)
+  {
+    expr_free(left);
+    return NULL;
+  }
+
+  CompiledExpr *compiled = calloc(1, sizeof(CompiledExpr));
+  compiled->eval = expr->type == SQL_EXPR_AND ? eval_and : eval_or;
+  compiled->left = left;
+  compiled->right = right;
+  return compiled;
+}
+
+CompiledExpr *expr_compile_conjuncts(SqlExpr **conjuncts, uint32_t count,
+                                     TableDef *table_def, char *error,
+                                     size_t error_size)
+{
+  CompiledExpr *result = NULL;
+  for (uint32_t i = 0; i < count; i++)
+  {
+    CompiledExpr *term = expr_compile(conjuncts[i], table_def, error, error_size);
+    if (!term)
+    {
+      expr_free(result);
+      return NULL;
+    }
+    if (!result)
+    {
+      result = term;
+      continue;
+    }
+    CompiledExpr *node = calloc(1, sizeof(CompiledExpr));
+    node->eval = eval_and;
+    node->left = result;
+    node->right = term;
+    result = node;
+  }
+  return result;
+}
+
+bool expr_scan_predicate(DynamicRow *row, TableDef *table_def, void *ctx)
+{
+  (void)table_def;
+  return expr_eval((CompiledExpr *)ctx, row);
+}
+
+void expr_free(CompiledExpr *expr)
+{
+  if (!expr)
+  {
+    return;
+  }
+  expr_free(expr->left);
+  expr_free(expr->right);
+  free(expr->text);
+  fulltext_query_free(expr->query);
+  free(expr);
+}
@@ -0,0 +1,1173 @@
+#include "../include/fulltext_index.h"
+#include "../include/catalog.h"
+#include "../include/cursor.h"
+#include "../include/expr_eval.h"
+#include "../include/page_stream.h"
+#include "../include/secondary_index.h"
+#include "../include/table_cache.h"
+#include <ctype.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// The file's page stream (see page_stream.h) holds the header, the rows
+// (row id gap and length, as varints), then each term's length, bytes,
+// row count, posting list size and posting list.
+#define FULLTEXT_PAGE_HEADER 0x46
+#define FULLTEXT_PAGE_DATA 0x44
+
+#define FULLTEXT_INDEX_MAGIC 0x58544649 // "IFTX"
+
+// A varint of a uint32_t takes at most 5 bytes
+#define VARINT_MAX_BYTES 5
+
+typedef struct
+{
+  uint32_t magic;
+  uint32_t num_terms;
+  uint32_t num_rows;
+  uint32_t stream_bytes; // Header included
+} FullTextIndexHeader;
+
+// A word of a row and the times it occurs there
+typedef struct
+{
+  char term[FULLTEXT_MAX_TERM + 1];
+  uint32_t count;
+} TermCount;
+
+// Words a row of MAX_COLUMN_SIZE bytes can hold, one letter and one
+// separator each
+#define MAX_ROW_TERMS (MAX_COLUMN_SIZE / 2 + 1)
+
+typedef struct
+{
+  uint32_t row_id;
+  uint32_t count;
+} Posting;
+
+static bool is_word_byte(unsigned char c)
+{
+  return isalnum(c) || c >= 0x80;
+}
+
+uint32_t fulltext_next_token(const char *text, size_t length, size_t *position,
+                             char *term)
+{
+  size_t at = *position;
+  while (at < length && text[at] && !is_word_byte(text[at]))
+  {
+    at++;
+  }
+  uint32_t term_length = 0;
+  while (at < length && text[at] && is_word_byte(text[at]))
+  {
+    if (term_length < FULLTEXT_MAX_TERM)
+    {
+      term[term_length++] = tolower((unsigned char)text[at]);
+    }
+    at++;
+  }
+  term[term_length] = '\0';
+  *position = at;
+  return term_length;
+}
+
+static int compare_term_counts(const void *a, const void *b)
+{
+  return strcmp(((const TermCount *)a)->term, ((const TermCount *)b)->term);
+}
+
+// The distinct words of text, sorted, with their counts. Returns how many
+// there are; *num_words gets the words counted with repeats.
+static uint32_t count_terms(const char *text, size_t length, TermCount *terms,
+                            uint32_t *num_words)
+{
+  uint32_t count = 0;
+  size_t position = 0;
+  while (count < MAX_ROW_TERMS &&
+         fulltext_next_token(text, length, &position, terms[count].term))
+  {
+    terms[count++].count = 1;
+  }
+  *num_words = count;
+  qsort(terms, count, sizeof(TermCount), compare_term_counts);
+
+  uint32_t distinct = 0;
+  for (uint32_t i = 0; i < count; i++)
+  {
+    if (distinct > 0 && strcmp(terms[distinct - 1].term, terms[i].term) == 0)
+    {
+      terms[distinct - 1].count++;
+    }
+    else
+    {
+      terms[distinct++] = terms[i];
+    }
+  }
+  return distinct;
+}
+
+// Varints: 7 bits a byte, low bits first, the top bit set on every byte
+// but the last
+static uint32_t put_varint(uint8_t *at, uint32_t value)
+{
+  uint32_t written = 0;
+  while (value >= 0x80)
+  {
+    at[written++] = (uint8_t)(value | 0x80);
+    value >>= 7;
+  }
+  at[written++] = (uint8_t)value;
+  return written;
+}
+
+static bool get_varint(const uint8_t **at, const uint8_t *end, uint32_t *value)
+{
+  uint32_t result = 0;
+  for (uint32_t shift = 0; shift < 7 * VARINT_MAX_BYTES; shift += 7)
+  {
+    if (*at == end)
+    {
+      return false;
+    }
+    uint8_t byte = *(*at)++;
+    result |= (uint32_t)(byte & 0x7F) << shift;
+    if (!(byte & 0x80))
+    {
+      *value = result;
+      return true;
+    }
+  }
+  return false;
+}
+
+// Query parsing: words, brackets, and AND and OR in capitals
+
+typedef struct
+{
+  const char *text;
+  size_t position;
+  char *error;
+  size_t error_size;
+  bool failed;
+} QueryParser;
+
+typedef enum
+{
+  QUERY_WORD,
+  QUERY_AND,
+  QUERY_OR,
+  QUERY_LPAREN,
+  QUERY_RPAREN,
+  QUERY_END
+} QueryToken;
+
+// The next token, without consuming it; a word's span goes to *start and
+// *length
+static QueryToken peek_token(QueryParser *parser, size_t *start, size_t *length)
+{
+  const char *text = parser->text;
+  size_t at = parser->position;
+  while (text[at] == ' ' || text[at] == '\t')
+  {
+    at++;
+  }
+  *start = at;
+  *length = 1;
+  switch (text[at])
+  {
+  case '\0':
+    *length = 0;
+    return QUERY_END;
+  case '(':
+    return QUERY_LPAREN;
+  case ')':
+    return QUERY_RPAREN;
+  default:
+    break;
+  }
+  size_t end = at;
+  while (text[end] && text[end] != ' ' && text[end] != '\t' &&
+         text[end] != '(' && text[end] != ')')
+  {
+    end++;
+  }
+  *length = end - at;
+  if (*length == 3 && strncmp(text + at, "AND", 3) == 0)
+  {
+    return QUERY_AND;
+  }
+  if (*length == 2 && strncmp(text + at, "OR", 2) == 0)
+  {
+    return QUERY_OR;
+  }
+  return QUERY_WORD;
+}
+
+static void consume_token(QueryParser *parser, size_t start, size_t length)
+{
+  parser->position = start + length;
+}
+
+static void query_error(QueryParser *parser, const char *message)
+{
+  if (!parser->failed)
+  {
+    snprintf(parser->error, parser->error_size, "MATCH query: %s", message);
+    parser->failed = true;
+  }
+}
+
+static FullTextQuery *new_node(FullTextQueryType type, FullTextQuery *left,
+                               FullTextQuery *right)
+{
+  FullTextQuery *node = calloc(1, sizeof(FullTextQuery));
+  node->type = type;
+  node->left = left;
+  node->right = right;
+  return node;
+}
+
+static FullTextQuery *parse_query_or(QueryParser *parser);
+
+// A word as its terms ANDed ("e-mail" is e AND mail), or NULL if it has
+// none
+static FullTextQuery *word_query(const char *word, size_t length)
+{
+  FullTextQuery *query = NULL;
+  char term[FULLTEXT_MAX_TERM + 1];
+  size_t position = 0;
+  while (fulltext_next_token(word, length, &position, term))
+  {
+    FullTextQuery *node = new_node(FULLTEXT_QUERY_TERM, NULL, NULL);
+    memcpy(node->term, term, sizeof(term));
+    query = query ? new_node(FULLTEXT_QUERY_AND, query, node) : node;
+  }
+  return query;
+}
+
+static FullTextQuery *parse_query_primary(QueryParser *parser)
+{
+  for (;;)
+  {
+    size_t start, length;
+    QueryToken token = peek_token(parser, &start, &length);
+    if (token == QUERY_LPAREN)
+    {
+      consume_token(parser, start, length);
+      FullTextQuery *inner = parse_query_or(parser);
+      if (!inner)
+      {
+        return NULL;
+      }
+      if (peek_token(parser, &start, &length) != QUERY_RPAREN)
+      {
+        query_error(parser, "missing ')'");
+        fulltext_query_free(inner);
+        return NULL;
+      }
+      consume_token(parser, start, length);
+      return inner;
+    }
+    if (token != QUERY_WORD)
+    {
+      query_error(parser, "expected a word");
+      return NULL;
+    }
+    consume_token(parser, start, length);
+    // Punctuation alone holds no word; the next token stands in for it
+    FullTextQuery *query = word_query(parser->text + start, length);
+    if (query)
+    {
+      return query;
+    }
+  }
+}
+
+static FullTextQuery *parse_query_and(QueryParser *parser)
+{
+  FullTextQuery *left = parse_query_primary(parser);
+  while (left)
+  {
+    size_t start, length;
+    QueryToken token = peek_token(parser, &start, &length);
+    if (token == QUERY_AND)
+    {
+      consume_token(parser, start, length);
+    }
+    else if (token != QUERY_WORD && token != QUERY_LPAREN)
+    {
+      break;
+    }
+    FullTextQuery *right = parse_query_primary(parser);
+    if (!right)
+    {
+      fulltext_query_free(left);
+      return NULL;
+    }
+    left = new_node(FULLTEXT_QUERY_AND, left, right);
+  }
+  return left;
+}
+
+static FullTextQuery *parse_query_or(QueryParser *parser)
+{
+  FullTextQuery *left = parse_query_and(parser);
+  while (left)
+  {
+    size_t start, length;
+    if (peek_token(parser, &start, &length) != QUERY_OR)
+    {
+      break;
+    }
+    consume_token(parser, start, length);
+    FullTextQuery *right = parse_query_and(parser);
+    if (!right)
+    {
+      fulltext_query_free(left);
+      return NULL;
+    }
+    left = new_node(FULLTEXT_QUERY_OR, left, right);
+  }
+  return left;
+}
+
+FullTextQuery *fulltext_query_parse(const char *text, char *error,
+                                    size_t error_size)
+{
+  QueryParser parser = {text, 0, error, error_size, false};
+  FullTextQuery *query = parse_query_or(&parser);
+  size_t start, length;
+  if (query && peek_token(&parser, &start, &length) != QUERY_END)
+  {
+    query_error(&parser, "unmatched ')'");
+    fulltext_query_free(query);
+    return NULL;
+  }
+  return query;
+}
+
+static bool row_has_term(const TermCount *terms, uint32_t count,
+                         const char *term)
+{
+  uint32_t low = 0, high = count;
+  while (low < high)
+  {
+    uint32_t mid = (low + high) / 2;
+    int cmp = strcmp(terms[mid].term, term);
+    if (cmp == 0)
+    {
+      return true;
+    }
+    if (cmp < 0)
+    {
+      low = mid + 1;
+    }
+    else
+    {
+      high = mid;
+    }
+  }
+  return false;
+}
+
+static bool query_holds(const FullTextQuery *query, const TermCount *terms,
+                        uint32_t count)
+{
+  switch (query->type)
+  {
+  case FULLTEXT_QUERY_TERM:
+    return row_has_term(terms, count, query->term);
+  case FULLTEXT_QUERY_AND:
+    return query_holds(query->left, terms, count) &&
+           query_holds(query->right, terms, count);
+  case FULLTEXT_QUERY_OR:
+    return query_holds(query->left, terms, count) ||
+           query_holds(query->right, terms, count);
+  }
+  return false;
+}
+
+bool fulltext_query_matches(const FullTextQuery *query, const char *text,
+                            size_t length)
+{
+  TermCount terms[MAX_ROW_TERMS];
+  uint32_t num_words;
+  uint32_t count = count_terms(text, length, terms, &num_words);
+  return query_holds(query, terms, count);
+}
+
+uint32_t fulltext_query_terms(const FullTextQuery *query)
+{
+  if (query->type == FULLTEXT_QUERY_TERM)
+  {
+    return 1;
+  }
+  return fulltext_query_terms(query->left) + fulltext_query_terms(query->right);
+}
+
+void fulltext_query_format(const FullTextQuery *query, char *buffer,
+                           size_t size)
+{
+  if (query->type == FULLTEXT_QUERY_TERM)
+  {
+    snprintf(buffer, size, "%s", query->term);
+    return;
+  }
+
+  char left[256], right[256];
+  fulltext_query_format(query->left, left, sizeof(left));
+  fulltext_query_format(query->right, right, sizeof(right));
+  // OR binds looser than AND, so it is bracketed under an AND
+  bool bracket = query->type == FULLTEXT_QUERY_AND;
+  bool left_or = bracket && query->left->type == FULLTEXT_QUERY_OR;
+  bool right_or = bracket && query->right->type == FULLTEXT_QUERY_OR;
+  snprintf(buffer, size, "%s%s%s %s %s%s%s", left_or ? "(" : "", left,
+           left_or ? ")" : "", bracket ? "AND" : "OR", right_or ? "(" : "",
+           right, right_or ? ")" : "");
+}
+
+void fulltext_query_free(FullTextQuery *query)
+{
+  if (!query)
+  {
+    return;
+  }
+  fulltext_query_free(query->left);
+  fulltext_query_free(query->right);
+  free(query);
+}
+
+// Posting lists
+
+static void reserve_postings(FullTextTerm *term, uint32_t extra)
+{
+  if (term->size + extra > term->capacity)
+  {
+    term->capacity = term->capacity ? term->capacity * 2 : 16;
+    if (term->capacity < term->size + extra)
+    {
+      term->capacity = term->size + extra;
+    }
+    term->postings = realloc(term->postings, term->capacity);
+  }
+}
+
+// Add a row with a larger id than any in the list
+static void append_posting(FullTextTerm *term, uint32_t row_id, uint32_t count)
+{
+  reserve_postings(term, 2 * VARINT_MAX_BYTES);
+  uint32_t gap = term->num_rows > 0 ? row_id - term->last_row : row_id;
+  term->size += put_varint(term->postings + term->size, gap);
+  term->size += put_varint(term->postings + term->size, count);
+  term->last_row = row_id;
+  term->num_rows++;
+}
+
+// The list's postings, malloc'd. NULL if it does not decode.
+static Posting *decode_postings(const FullTextTerm *term)
+{
+  Posting *postings = malloc((term->num_rows ? term->num_rows : 1) *
+                             sizeof(Posting));
+  const uint8_t *at = term->postings;
+  const uint8_t *end = term->postings + term->size;
+  uint32_t row_id = 0;
+  for (uint32_t i = 0; i < term->num_rows; i++)
+  {
+    uint32_t gap, count;
+    if (!get_varint(&at, end, &gap) || !get_varint(&at, end, &count))
+    {
+      free(postings);
+      return NULL;
+    }
+    row_id = i == 0 ? gap : row_id + gap;
+    postings[i].row_id = row_id;
+    postings[i].count = count;
+  }
+  return postings;
+}
+
+static void encode_postings(FullTextTerm *term, const Posting *postings,
+                            uint32_t count)
+{
+  term->size = 0;
+  term->num_rows = 0;
+  term->last_row = 0;
+  for (uint32_t i = 0; i < count; i++)
+  {
+    append_posting(term, postings[i].row_id, postings[i].count);
+  }
+}
+
+// Position of row_id in the postings, or where it would go
+static uint32_t find_posting(const Posting *postings, uint32_t count,
+                             uint32_t row_id, bool *found)
+{
+  uint32_t low = 0, high = count;
+  while (low < high)
+  {
+    uint32_t mid = (low + high) / 2;
+    if (postings[mid].row_id < row_id)
+    {
+      low = mid + 1;
+    }
+    else
+    {
+      high = mid;
+    }
+  }
+  *found = low < count && postings[low].row_id == row_id;
+  return low;
+}
+
+// Set the row's count in the list. New row ids past the end, which is
+// where inserts land, are appended without decoding the list.
+static void put_posting(FullTextTerm *term, uint32_t row_id, uint32_t count)
+{
+  if (term->num_rows == 0 || row_id > term->last_row)
+  {
+    append_posting(term, row_id, count);
+    return;
+  }
+  Posting *postings = decode_postings(term);
+  if (!postings)
+  {
+    return;
+  }
+  bool found;
+  uint32_t at = find_posting(postings, term->num_rows, row_id, &found);
+  uint32_t num_postings = term->num_rows;
+  if (found)
+  {
+    postings[at].count = count;
+  }
+  else
+  {
+    postings = realloc(postings, (num_postings + 1) * sizeof(Posting));
+    memmove(&postings[at + 1], &postings[at],
+            (num_postings - at) * sizeof(Posting));
+    postings[at].row_id = row_id;
+    postings[at].count = count;
+    num_postings++;
+  }
+  encode_postings(term, postings, num_postings);
+  free(postings);
+}
+
+static void remove_posting(FullTextTerm *term, uint32_t row_id)
+{
+  if (term->num_rows == 0 || row_id > term->last_row)
+  {
+    return;
+  }
+  Posting *postings = decode_postings(term);
+  if (!postings)
+  {
+    return;
+  }
+  bool found;
+  uint32_t at = find_posting(postings, term->num_rows, row_id, &found);
+  if (found)
+  {
+    uint32_t num_postings = term->num_rows - 1;
+    memmove(&postings[at], &postings[at + 1],
+            (num_postings - at) * sizeof(Posting));
+    encode_postings(term, postings, num_postings);
+  }
+  free(postings);
+}
+
+// Terms and rows of the decoded index
+
+static uint32_t find_term(const FullTextIndex *index, const char *term,
+                          bool *found)
+{
+  uint32_t low = 0, high = index->num_terms;
+  while (low < high)
+  {
+    uint32_t mid = (low + high) / 2;
+    if (strcmp(index->terms[mid].term, term) < 0)
+    {
+      low = mid + 1;
+    }
+    else
+    {
+      high = mid;
+    }
+  }
+  *found = low < index->num_terms && strcmp(index->terms[low].term, term) == 0;
+  return low;
+}
+
+static FullTextTerm *add_term(FullTextIndex *index, uint32_t at,
+                              const char *term)
+{
+  if (index->num_terms == index->term_capacity)
+  {
+    index->term_capacity = index->term_capacity ? index->term_capacity * 2 : 64;
+    index->terms =
+        realloc(index->terms, index->term_capacity * sizeof(FullTextTerm));
+  }
+  memmove(&index->terms[at + 1], &index->terms[at],
+          (index->num_terms - at) * sizeof(FullTextTerm));
+  index->num_terms++;
+  FullTextTerm *added = &index->terms[at];
+  memset(added, 0, sizeof(FullTextTerm));
+  strncpy(added->term, term, FULLTEXT_MAX_TERM);
+  return added;
+}
+
+static void remove_term(FullTextIndex *index, uint32_t at)
+{
+  free(index->terms[at].postings);
+  index->num_terms--;
+  memmove(&index->terms[at], &index->terms[at + 1],
+          (index->num_terms - at) * sizeof(FullTextTerm));
+}
+
+static uint32_t find_row(const FullTextIndex *index, uint32_t row_id,
+                         bool *found)
+{
+  uint32_t low = 0, high = index->num_rows;
+  while (low < high)
+  {
+    uint32_t mid = (low + high) / 2;
+    if (index->rows[mid].row_id < row_id)
+    {
+      low = mid + 1;
+    }
+    else
+    {
+      high = mid;
+    }
+  }
+  *found = low < index->num_rows && index->rows[low].row_id == row_id;
+  return low;
+}
+
+static void put_row(FullTextIndex *index, uint32_t row_id, uint32_t length)
+{
+  bool found;
+  uint32_t at = find_row(index, row_id, &found);
+  if (found)
+  {
+    index->total_length -= index->rows[at].length;
+  }
+  else
+  {
+    if (index->num_rows == index->row_capacity)
+    {
+      index->row_capacity = index->row_capacity ? index->row_capacity * 2 : 64;
+      index->rows =
+          realloc(index->rows, index->row_capacity * sizeof(FullTextRow));
+    }
+    memmove(&index->rows[at + 1], &index->rows[at],
+            (index->num_rows - at) * sizeof(FullTextRow));
+    index->num_rows++;
+    index->rows[at].row_id = row_id;
+  }
+  index->rows[at].length = length;
+  index->total_length += length;
+}
+
+static void remove_row(FullTextIndex *index, uint32_t row_id)
+{
+  bool found;
+  uint32_t at = find_row(index, row_id, &found);
+  if (found)
+  {
+    index->total_length -= index->rows[at].length;
+    index->num_rows--;
+    memmove(&index->rows[at], &index->rows[at + 1],
+            (index->num_rows - at) * sizeof(FullTextRow));
+  }
+}
+
+// Postings for the words of text under row_id. Adding a row the index
+// already has sets its counts again, so replaying a write is harmless.
+static void add_text(FullTextIndex *index, uint32_t row_id, const char *text,
+                     size_t length)
+{
+  TermCount terms[MAX_ROW_TERMS];
+  uint32_t num_words;
+  uint32_t count = count_terms(text, length, terms, &num_words);
+  for (uint32_t i = 0; i < count; i++)
+  {
+    bool found;
+    uint32_t at = find_term(index, terms[i].term, &found);
+    FullTextTerm *term = found ? &index->terms[at]
+                               : add_term(index, at, terms[i].term);
+    put_posting(term, row_id, terms[i].count);
+  }
+  put_row(index, row_id, num_words);
+}
+
+static void remove_text(FullTextIndex *index, uint32_t row_id, const char *text,
+                        size_t length)
+{
+  TermCount terms[MAX_ROW_TERMS];
+  uint32_t num_words;
+  uint32_t count = count_terms(text, length, terms, &num_words);
+  for (uint32_t i = 0; i < count; i++)
+  {
+    bool found;
+    uint32_t at = find_term(index, terms[i].term, &found);
+    if (found)
+    {
+      remove_posting(&index->terms[at], row_id);
+      if (index->terms[at].num_rows == 0)
+      {
+        remove_term(index, at);
+      }
+    }
+  }
+  remove_row(index, row_id);
+}
+
+static void free_index(FullTextIndex *index)
+{
+  for (uint32_t i = 0; i < index->num_terms; i++)
+  {
+    free(index->terms[i].postings);
+  }
+  free(index->terms);
+  free(index->rows);
+  free(index);
+}
+
+// The file's pages
+
+bool fulltext_index_save(Table *index_table)
+{
+  FullTextIndex *index = index_table->fulltext_index;
+  size_t size = sizeof(FullTextIndexHeader) +
+                (size_t)index->num_rows * 2 * VARINT_MAX_BYTES;
+  for (uint32_t i = 0; i < index->num_terms; i++)
+  {
+    size += 1 + strlen(index->terms[i].term) + 2 * VARINT_MAX_BYTES +
+            index->terms[i].size;
+  }
+
+  uint8_t *stream = calloc(1, size);
+  uint8_t *at = stream + sizeof(FullTextIndexHeader);
+  uint32_t previous = 0;
+  for (uint32_t i = 0; i < index->num_rows; i++)
+  {
+    FullTextRow *row = &index->rows[i];
+    at += put_varint(at, i == 0 ? row->row_id : row->row_id - previous);
+    at += put_varint(at, row->length);
+    previous = row->row_id;
+  }
+  for (uint32_t i = 0; i < index->num_terms; i++)
+  {
+    FullTextTerm *term = &index->terms[i];
+    uint8_t term_length = (uint8_t)strlen(term->term);
+    *at++ = term_length;
+    memcpy(at, term->term, term_length);
+    at += term_length;
+    at += put_varint(at, term->num_rows);
+    at += put_varint(at, term->size);
+    memcpy(at, term->postings, term->size);
+    at += term->size;
+  }
+  size = at - stream;
+
+  FullTextIndexHeader header = {FULLTEXT_INDEX_MAGIC, index->num_terms,
+                                index->num_rows, (uint32_t)size};
+  bool fits = size <= page_stream_capacity();
+  if (!fits)
+  {
+    printf("Error: Full-text index no longer fits in its file; rebuild it "
+           "on fewer rows.\n");
+    header.magic = 0;
+    size = sizeof(header);
+  }
+  memcpy(stream, &header, sizeof(header));
+  index->dirty = false;
+  page_stream_write(index_table->pager, FULLTEXT_PAGE_HEADER,
+                    FULLTEXT_PAGE_DATA, stream, size);
+  free(stream);
+  return fits;
+}
+
+static bool load_terms(FullTextIndex *index, uint32_t num_terms,
+                       const uint8_t *at, const uint8_t *end)
+{
+  for (uint32_t i = 0; i < num_terms; i++)
+  {
+    if (at == end)
+    {
+      return false;
+    }
+    uint8_t term_length = *at++;
+    char term[FULLTEXT_MAX_TERM + 1];
+    uint32_t num_rows, size;
+    if (term_length == 0 || term_length > FULLTEXT_MAX_TERM ||
+        end - at < term_length)
+    {
+      return false;
+    }
+    memcpy(term, at, term_length);
+    term[term_length] = '\0';
+    at += term_length;
+    if (!get_varint(&at, end, &num_rows) || !get_varint(&at, end, &size) ||
+        (uint32_t)(end - at) < size || num_rows == 0)
+    {
+      return false;
+    }
+    // Terms were written in order, so each one goes on the end
+    FullTextTerm *added = add_term(index, index->num_terms, term);
+    added->postings = malloc(size);
+    memcpy(added->postings, at, size);
+    added->size = added->capacity = size;
+    added->num_rows = num_rows;
+    at += size;
+
+    Posting *postings = decode_postings(added);
+    if (!postings)
+    {
+      return false;
+    }
+    added->last_row = postings[num_rows - 1].row_id;
+    free(postings);
+  }
+  return true;
+}
+
+static FullTextIndex *load_index(Table *index_table)
+{
+  const uint8_t *start =
+      page_stream_start(index_table->pager, FULLTEXT_PAGE_HEADER);
+  FullTextIndexHeader header;
+  if (!start)
+  {
+    return NULL;
+  }
+  memcpy(&header, start, sizeof(header));
+  if (header.magic != FULLTEXT_INDEX_MAGIC || header.stream_bytes < sizeof(header) ||
+      header.stream_bytes > page_stream_capacity())
+  {
+    return NULL;
+  }
+
+  uint8_t *stream = page_stream_read(index_table->pager, header.stream_bytes);
+
+  FullTextIndex *index = calloc(1, sizeof(FullTextIndex));
+  const uint8_t *at = stream + sizeof(header);
+  const uint8_t *end = stream + header.stream_bytes;
+  bool valid = true;
+  uint32_t row_id = 0;
+  for (uint32_t i = 0; i < header.num_rows && valid; i++)
+  {
+    uint32_t gap, length;
+    valid = get_varint(&at, end, &gap) && get_varint(&at, end, &length);
+    row_id = i == 0 ? gap : row_id + gap;
+    if (valid)
+    {
+      put_row(index, row_id, length);
+    }
+  }
+  valid = valid && load_terms(index, header.num_terms, at, end);
+  free(stream);
+  if (!valid)
+  {
+    free_index(index);
+    return NULL;
+  }
+  return index;
+}
+
+void fulltext_index_reset(Table *index_table)
+{
+  fulltext_index_unload(index_table);
+  index_table->fulltext_index = calloc(1, sizeof(FullTextIndex));
+}
+
+FullTextIndex *fulltext_index_get(Table *index_table)
+{
+  if (!index_table->fulltext_index)
+  {
+    index_table->fulltext_index = load_index(index_table);
+  }
+  return index_table->fulltext_index;
+}
+
+void fulltext_index_flush(Table *index_table)
+{
+  if (index_table->fulltext_index && index_table->fulltext_index->dirty)
+  {
+    fulltext_index_save(index_table);
+  }
+}
+
+void fulltext_index_unload(Table *index_table)
+{
+  if (index_table->fulltext_index)
+  {
+    free_index(index_table->fulltext_index);
+    index_table->fulltext_index = NULL;
+  }
+}
+
+// The indexed column's text in a row, and its length within the column
+static const char *row_text(TableDef *table_def, uint32_t column_idx,
+                            DynamicRow *row, size_t *length)
+{
+  const char *text =
+      (const char *)row->data + get_column_offset(table_def, column_idx);
+  *length = strnlen(text, table_def->columns[column_idx].size);
+  return text;
+}
+
+bool fulltext_index_build(Table *table, TableDef *table_def, IndexDef *index_def,
+                          Table *index_table)
+{
+  int column_idx = table_def_find_column(table_def, index_def->column_name);
+  uint32_t id_column = table_def->key_columns[0];
+
+  const CompiledExpr *predicate;
+  if (!index_predicate_get(index_table, table_def, index_def, &predicate))
+  {
+    return false;
+  }
+  fulltext_index_reset(index_table);
+  FullTextIndex *index = index_table->fulltext_index;
+
+  Cursor *cursor = table_start(table);
+  DynamicRow row;
+  dynamic_row_init(&row, table_def);
+  uint32_t records_indexed = 0;
+  while (!cursor->end_of_table)
+  {
+    deserialize_dynamic_row(cursor_value(cursor), table_def, &row);
+    if (index_predicate_holds(predicate, &row))
+    {
+      size_t length;
+      const char *text = row_text(table_def, column_idx, &row, &length);
+      add_text(index, dynamic_row_get_int(&row, table_def, id_column), text,
+               length);
+      records_indexed++;
+    }
+    cursor_advance(cursor);
+  }
+  dynamic_row_free(&row);
+  cursor_close(cursor);
+
+  if (!fulltext_index_save(index_table))
+  {
+    fulltext_index_unload(index_table);
+    return false;
+  }
+  printf("Index created with %u records and %u distinct words.\n",
+         records_indexed, index->num_terms);
+  return true;
+}
+
+// True if the write leaves the row's words as they were
+static bool same_text(TableDef *table_def, uint32_t column_idx,
+                      DynamicRow *old_row, DynamicRow *new_row)
+{
+  if (!old_row || !new_row)
+  {
+    return false;
+  }
+  uint32_t id_column = table_def->key_columns[0];
+  size_t old_length, new_length;
+  const char *old_text = row_text(table_def, column_idx, old_row, &old_length);
+  const char *new_text = row_text(table_def, column_idx, new_row, &new_length);
+  return old_length == new_length &&
+         memcmp(old_text, new_text, old_length) == 0 &&
+         dynamic_row_get_int(old_row, table_def, id_column) ==
+             dynamic_row_get_int(new_row, table_def, id_column);
+}
+
+static void replace_row(FullTextIndex *index, TableDef *table_def,
+                        uint32_t column_idx, DynamicRow *old_row,
+                        DynamicRow *new_row)
+{
+  uint32_t id_column = table_def->key_columns[0];
+  size_t length;
+  index->dirty = true;
+  if (old_row)
+  {
+    const char *text = row_text(table_def, column_idx, old_row, &length);
+    remove_text(index, dynamic_row_get_int(old_row, table_def, id_column), text,
+                length);
+  }
+  if (new_row)
+  {
+    const char *text = row_text(table_def, column_idx, new_row, &length);
+    add_text(index, dynamic_row_get_int(new_row, table_def, id_column), text,
+             length);
+  }
+}
+
+bool fulltext_index_apply(TableDef *table_def, IndexDef *index_def,
+                          Table *index_table, DynamicRow *old_row,
+                          DynamicRow *new_row)
+{
+  int column_idx = table_def_find_column(table_def, index_def->column_name);
+  FullTextIndex *index = fulltext_index_get(index_table);
+  if (column_idx == -1 || !index)
+  {
+    return false;
+  }
+  if (index_predicate_filter(index_table, table_def, index_def, &old_row,
+                             &new_row) &&
+      !same_text(table_def, column_idx, old_row, new_row))
+  {
+    replace_row(index, table_def, column_idx, old_row, new_row);
+  }
+  return true;
+}
+
+// Searching
+
+// The matches of one term, each scored by its BM25 weight in the row:
+//   idf * count * (k1 + 1) / (count + k1 * (1 - b + b * length / average))
+// with idf = ln(1 + (rows - rows with the term + 0.5) / (rows with it + 0.5))
+static void search_term(const FullTextIndex *index, const char *text,
+                        FullTextMatches *out)
+{
+  out->matches = NULL;
+  out->count = 0;
+  bool found;
+  uint32_t at = find_term(index, text, &found);
+  if (!found)
+  {
+    return;
+  }
+  const FullTextTerm *term = &index->terms[at];
+  Posting *postings = decode_postings(term);
+  if (!postings)
+  {
+    return;
+  }
+
+  double rows = index->num_rows;
+  double average = rows > 0 ? (double)index->total_length / rows : 1.0;
+  average = average > 0 ? average : 1.0;
+  double idf = log(1.0 + (rows - term->num_rows + 0.5) / (term->num_rows + 0.5));
+  out->matches = malloc(term->num_rows * sizeof(FullTextMatch));
+  for (uint32_t i = 0; i < term->num_rows; i++)
+  {
+    bool row_found;
+    uint32_t row_at = find_row(index, postings[i].row_id, &row_found);
+    double length = row_found ? index->rows[row_at].length : average;
+    double count = postings[i].count;
+    out->matches[i].row_id = postings[i].row_id;
+    out->matches[i].score =
+        idf * count * (FULLTEXT_BM25_K1 + 1) /
+        (count + FULLTEXT_BM25_K1 * (1 - FULLTEXT_BM25_B +
+                                     FULLTEXT_BM25_B * length / average));
+  }
+  out->count = term->num_rows;
+  free(postings);
+}
+
+// Merge two ascending match lists, adding the scores of rows in both: the
+// rows in both for AND, in either for OR
+static void merge_matches(const FullTextMatches *left,
+                          const FullTextMatches *right, bool intersect,
+                          FullTextMatches *out)
+{
+  out->matches =
+      malloc((left->count + right->count + 1) * sizeof(FullTextMatch));
+  out->count = 0;
+  uint32_t i = 0, j = 0;
+  while (i < left->count || j < right->count)
+  {
+    const FullTextMatch *a = i < left->count ? &left->matches[i] : NULL;
+    const FullTextMatch *b = j < right->count ? &right->matches[j] : NULL;
+    if (a && b && a->row_id == b->row_id)
+    {
+      out->matches[out->count].row_id = a->row_id;
+      out->matches[out->count++].score = a->score + b->score;
+      i++;
+      j++;
+    }
+    else if (a && (!b || a->row_id < b->row_id))
+    {
+      if (!intersect)
+      {
+        out->matches[out->count++] = *a;
+      }
+      i++;
+    }
+    else
+    {
+      if (!intersect)
+      {
+        out->matches[out->count++] = *b;
+      }
+      j++;
+    }
+    if (intersect && (i == left->count || j == right->count))
+    {
+      break;
+    }
+  }
+}
+
+static void search(const FullTextIndex *index, const FullTextQuery *query,
+                   FullTextMatches *out)
+{
+  if (query->type == FULLTEXT_QUERY_TERM)
+  {
+    search_term(index, query->term, out);
+    return;
+  }
+  FullTextMatches left, right;
+  search(index, query->left, &left);
+  if (query->type == FULLTEXT_QUERY_AND && left.count == 0)
+  {
+    *out = left;
+    return;
+  }
+  search(index, query->right, &right);
+  merge_matches(&left, &right, query->type == FULLTEXT_QUERY_AND, out);
+  fulltext_matches_free(&left);
+  fulltext_matches_free(&right);
+}
+
+bool fulltext_index_search(const IndexDef *index_def, const FullTextQuery *query,
+                           FullTextMatches *out)
+{
+  Table *index_table = table_cache_acquire(index_def->filename);
+  FullTextIndex *index = index_table ? fulltext_index_get(index_table) : NULL;
+  if (!index)
+  {
+    if (index_table)
+    {
+      table_cache_release(index_table);
+    }
+    return false;
+  }
+  search(index, query, out);
+  table_cache_release(index_table);
+  return true;
+}
+
+static int compare_rank(const void *a, const void *b)
+{
+  const FullTextMatch *x = a, *y = b;
+  if (x->score != y->score)
+  {
+    return x->score < y->score ? 1 : -1;
+  }
+  return (x->row_id > y->row_id) - (x->row_id < y->row_id);
+}
+
+void fulltext_matches_rank(FullTextMatches *matches)
+{
+  qsort(matches->matches, matches->count, sizeof(FullTextMatch), compare_rank);
+}
+
+void fulltext_matches_free(FullTextMatches *matches)
+{
+  free(matches->matches);
+  matches->matches = NULL;
+  matches->count = 0;
+}
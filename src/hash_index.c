@@ -0,0 +1,343 @@
+#include "../include/hash_index.h"
+#include "../include/pager.h"
+#include "../include/query_profile.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// First byte of each page, where a B-tree node keeps its type
+#define HASH_PAGE_HEADER 0x48
+#define HASH_PAGE_BUCKET 0x42
+
+#define HASH_INDEX_MAGIC 0x58444948 // "HIDX"
+
+typedef struct
+{
+  uint8_t page_type;
+  uint8_t reserved[3];
+  uint32_t magic;
+  uint32_t level; // Buckets at the start of this round: INITIAL << level
+  uint32_t split; // Next bucket to split; those below it are split already
+  uint32_t num_buckets;
+  uint32_t num_entries;
+  uint32_t entry_bytes; // Bytes of entries over all buckets, for the fill
+  uint32_t bucket_pages[];
+} HashIndexHeader;
+
+typedef struct
+{
+  uint8_t page_type;
+  uint8_t reserved[3];
+  uint32_t next_page; // Overflow page, or 0 (the header) for none
+  uint32_t num_entries;
+  uint32_t used_bytes;
+  uint8_t data[];
+} HashBucketPage;
+
+// An entry is these, then the key bytes and the INCLUDE values padded to 4
+typedef struct
+{
+  uint32_t hash;
+  uint32_t row_id;
+  uint16_t key_size;
+  uint16_t include_size;
+  uint8_t key_data[];
+} HashIndexEntry;
+
+static uint32_t bucket_capacity(void)
+{
+  return PAGE_SIZE - sizeof(HashBucketPage);
+}
+
+static uint32_t max_buckets(void)
+{
+  return (PAGE_SIZE - sizeof(HashIndexHeader)) / sizeof(uint32_t);
+}
+
+static uint32_t entry_size(uint32_t payload_size)
+{
+  return (sizeof(HashIndexEntry) + payload_size + 3) & ~3u;
+}
+
+static uint32_t stored_size(const HashIndexEntry *entry)
+{
+  return entry_size(entry->key_size + entry->include_size);
+}
+
+static HashIndexHeader *header_of(Table *index_table)
+{
+  return get_page(index_table->pager, 0);
+}
+
+static HashBucketPage *bucket_page(Table *index_table, uint32_t page_num)
+{
+  return get_page(index_table->pager, page_num);
+}
+
+// A fresh, empty bucket page, or 0 if the file has no room for one
+static uint32_t new_bucket_page(Table *index_table)
+{
+  uint32_t page_num = pager_allocate_page(index_table->pager);
+  if (page_num >= TABLE_MAX_PAGES)
+  {
+    return 0;
+  }
+  HashBucketPage *page = bucket_page(index_table, page_num);
+  memset(page, 0, PAGE_SIZE);
+  page->page_type = HASH_PAGE_BUCKET;
+  return page_num;
+}
+
+static uint32_t bucket_for(const HashIndexHeader *header, uint32_t hash)
+{
+  uint32_t mask = ((uint32_t)HASH_INDEX_INITIAL_BUCKETS << header->level) - 1;
+  uint32_t bucket = hash & mask;
+  if (bucket < header->split)
+  {
+    // Split this round: the next round's mask picks the half
+    bucket = hash & ((mask << 1) | 1);
+  }
+  return bucket;
+}
+
+// Add an entry at the end of a bucket's chain, growing the chain if the
+// last page is full
+static bool append_entry(Table *index_table, uint32_t page_num,
+                         const HashIndexEntry *entry)
+{
+  uint32_t size = stored_size(entry);
+  HashBucketPage *page = bucket_page(index_table, page_num);
+  while (page->next_page != 0)
+  {
+    page = bucket_page(index_table, page->next_page);
+  }
+  if (page->used_bytes + size > bucket_capacity())
+  {
+    uint32_t overflow = new_bucket_page(index_table);
+    if (overflow == 0)
+    {
+      printf("Error: Hash index file is full.\n");
+      return false;
+    }
+    page->next_page = overflow;
+    page = bucket_page(index_table, overflow);
+  }
+  memcpy(page->data + page->used_bytes, entry,
+         sizeof(HashIndexEntry) + entry->key_size + entry->include_size);
+  page->used_bytes += size;
+  page->num_entries++;
+  return true;
+}
+
+// Split the bucket at the split pointer into itself and a new bucket at
+// the end, moving the entries whose next hash bit is set
+static void split_bucket(Table *index_table)
+{
+  HashIndexHeader *header = header_of(index_table);
+  if (header->num_buckets >= max_buckets())
+  {
+    return;
+  }
+  uint32_t new_page = new_bucket_page(index_table);
+  if (new_page == 0)
+  {
+    // Out of pages: the buckets keep their overflow chains
+    return;
+  }
+
+  // Take the old chain's entries out and empty it, keeping its first page
+  uint32_t first_page = header->bucket_pages[header->split];
+  uint32_t total = 0;
+  for (uint32_t p = first_page; p != 0; p = bucket_page(index_table, p)->next_page)
+  {
+    total += bucket_page(index_table, p)->used_bytes;
+  }
+  uint8_t *entries = malloc(total ? total : 1);
+  uint32_t copied = 0;
+  uint32_t p = first_page;
+  while (p != 0)
+  {
+    HashBucketPage *page = bucket_page(index_table, p);
+    uint32_t next = page->next_page;
+    memcpy(entries + copied, page->data, page->used_bytes);
+    copied += page->used_bytes;
+    if (p == first_page)
+    {
+      page->next_page = 0;
+      page->num_entries = 0;
+      page->used_bytes = 0;
+    }
+    else
+    {
+      pager_free_page(index_table->pager, p);
+    }
+    p = next;
+  }
+
+  header->bucket_pages[header->num_buckets++] = new_page;
+  if (++header->split == (uint32_t)HASH_INDEX_INITIAL_BUCKETS << header->level)
+  {
+    header->level++;
+    header->split = 0;
+  }
+
+  for (uint32_t offset = 0; offset < total;)
+  {
+    HashIndexEntry *entry = (HashIndexEntry *)(entries + offset);
+    uint32_t bucket = bucket_for(header, entry->hash);
+    if (!append_entry(index_table, header->bucket_pages[bucket], entry))
+    {
+      header->num_entries--;
+      header->entry_bytes -= stored_size(entry);
+    }
+    offset += stored_size(entry);
+  }
+  free(entries);
+}
+
+bool hash_index_init(Table *index_table)
+{
+  Pager *pager = index_table->pager;
+
+  // Release every page past the header, whatever the file held before
+  uint32_t num_pages = pager->num_pages;
+  for (uint32_t i = 1; i < num_pages; i++)
+  {
+    uint8_t *page = get_page(pager, i);
+    if (*page != PAGE_FREE_MARKER)
+    {
+      pager_free_page(pager, i);
+    }
+  }
+
+  HashIndexHeader *header = header_of(index_table);
+  memset(header, 0, PAGE_SIZE);
+  header->page_type = HASH_PAGE_HEADER;
+  header->magic = HASH_INDEX_MAGIC;
+  for (uint32_t i = 0; i < HASH_INDEX_INITIAL_BUCKETS; i++)
+  {
+    uint32_t page_num = new_bucket_page(index_table);
+    if (page_num == 0)
+    {
+      printf("Error: Hash index file is full.\n");
+      header->magic = 0;
+      return false;
+    }
+    header->bucket_pages[header->num_buckets++] = page_num;
+  }
+  return true;
+}
+
+bool hash_index_valid(Table *index_table)
+{
+  HashIndexHeader *header = header_of(index_table);
+  return header->page_type == HASH_PAGE_HEADER &&
+         header->magic == HASH_INDEX_MAGIC &&
+         header->num_buckets >= HASH_INDEX_INITIAL_BUCKETS &&
+         header->num_buckets <= max_buckets();
+}
+
+bool hash_index_insert(Table *index_table, uint32_t hash, uint32_t row_id,
+                       const void *key_data, uint32_t key_size,
+                       const uint8_t *include, uint32_t include_size)
+{
+  if (!hash_index_valid(index_table))
+  {
+    printf("Error: Index file is not a hash index.\n");
+    return false;
+  }
+  uint32_t size = entry_size(key_size + include_size);
+  if (size > bucket_capacity())
+  {
+    printf("Error: Key too large for a hash index.\n");
+    return false;
+  }
+
+  HashIndexEntry *entry = malloc(sizeof(HashIndexEntry) + key_size + include_size);
+  entry->hash = hash;
+  entry->row_id = row_id;
+  entry->key_size = key_size;
+  entry->include_size = include_size;
+  memcpy(entry->key_data, key_data, key_size);
+  memcpy(entry->key_data + key_size, include, include_size);
+
+  HashIndexHeader *header = header_of(index_table);
+  uint32_t bucket = bucket_for(header, hash);
+  bool inserted = append_entry(index_table, header->bucket_pages[bucket], entry);
+  free(entry);
+  if (!inserted)
+  {
+    return false;
+  }
+  header->num_entries++;
+  header->entry_bytes += size;
+
+  if (header->entry_bytes >
+      HASH_INDEX_MAX_FILL * header->num_buckets * bucket_capacity())
+  {
+    split_bucket(index_table);
+  }
+  return true;
+}
+
+void hash_index_probe(Table *index_table, uint32_t hash, const void *key_data,
+                      uint32_t key_size, IndexMatches *matches)
+{
+  HashIndexHeader *header = header_of(index_table);
+  uint32_t bucket = bucket_for(header, hash);
+  for (uint32_t p = header->bucket_pages[bucket]; p != 0;)
+  {
+    HashBucketPage *page = bucket_page(index_table, p);
+    for (uint32_t offset = 0; offset < page->used_bytes;)
+    {
+      HashIndexEntry *entry = (HashIndexEntry *)(page->data + offset);
+      offset += stored_size(entry);
+      if (entry->hash != hash)
+      {
+        continue;
+      }
+      PROFILE_COUNT(PROFILE_ROWS_SCANNED, 1);
+      if (entry->key_size == key_size &&
+          memcmp(entry->key_data, key_data, key_size) == 0)
+      {
+        index_matches_add(matches, entry->row_id, entry->key_data + key_size,
+                          entry->include_size);
+      }
+    }
+    p = page->next_page;
+  }
+}
+
+bool hash_index_delete(Table *index_table, uint32_t hash, uint32_t row_id)
+{
+  if (!hash_index_valid(index_table))
+  {
+    return false;
+  }
+  HashIndexHeader *header = header_of(index_table);
+  uint32_t bucket = bucket_for(header, hash);
+  for (uint32_t p = header->bucket_pages[bucket]; p != 0;)
+  {
+    HashBucketPage *page = bucket_page(index_table, p);
+    for (uint32_t offset = 0; offset < page->used_bytes;)
+    {
+      HashIndexEntry *entry = (HashIndexEntry *)(page->data + offset);
+      uint32_t size = stored_size(entry);
+      if (entry->hash == hash && entry->row_id == row_id)
+      {
+        // Slide the rest of the page down over it; an emptied overflow
+        // page stays in the chain for later entries
+        memmove(page->data + offset, page->data + offset + size,
+                page->used_bytes - offset - size);
+        page->used_bytes -= size;
+        page->num_entries--;
+        header->num_entries--;
+        header->entry_bytes -= size;
+        return true;
+      }
+      offset += size;
+    }
+    p = page->next_page;
+  }
+  return false;
+}
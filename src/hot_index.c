@@ -0,0 +1,546 @@
+#include "../include/hot_index.h"
+#include "../include/btree.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Inner nodes grow through four sizes as children are added. Each child
+// slot holds another inner node or a leaf; leaves are tagged in the low
+// bit of the pointer, which the arena's alignment leaves clear.
+typedef enum
+{
+  ART_NODE4,
+  ART_NODE16,
+  ART_NODE48,
+  ART_NODE256
+} ArtNodeType;
+
+typedef struct
+{
+  uint8_t type;
+  uint16_t num_children;
+  uint32_t prefix_len; // Bytes every key below shares at this depth
+  uint8_t prefix[HOT_INDEX_MAX_PREFIX];
+} ArtNode;
+
+typedef struct
+{
+  ArtNode header;
+  uint8_t keys[4];
+  void *children[4];
+} ArtNode4;
+
+typedef struct
+{
+  ArtNode header;
+  uint8_t keys[16];
+  void *children[16];
+} ArtNode16;
+
+typedef struct
+{
+  ArtNode header;
+  uint8_t child_index[256]; // Slot + 1 of each byte's child, 0 for none
+  void *children[48];
+} ArtNode48;
+
+typedef struct
+{
+  ArtNode header;
+  void *children[256];
+} ArtNode256;
+
+typedef struct
+{
+  uint32_t page_num; // INVALID_PAGE_NUM once the key is known to be gone
+  uint32_t cell_num;
+  uint8_t key[];
+} ArtLeaf;
+
+#define IS_LEAF(pointer) (((uintptr_t)(pointer)) & 1)
+#define TO_LEAF(pointer) ((ArtLeaf *)((uintptr_t)(pointer) & ~(uintptr_t)1))
+#define FROM_LEAF(leaf) ((void *)((uintptr_t)(leaf) | 1))
+
+static ArtLeaf *art_leaf_new(HotIndex *hot, const uint8_t *key,
+                             uint32_t page_num, uint32_t cell_num)
+{
+  ArtLeaf *leaf = arena_alloc(&hot->arena, sizeof(ArtLeaf) + hot->key_size);
+  leaf->page_num = page_num;
+  leaf->cell_num = cell_num;
+  memcpy(leaf->key, key, hot->key_size);
+  hot->entries++;
+  return leaf;
+}
+
+static ArtNode *art_node_new(HotIndex *hot, ArtNodeType type)
+{
+  static const size_t sizes[] = {sizeof(ArtNode4), sizeof(ArtNode16),
+                                 sizeof(ArtNode48), sizeof(ArtNode256)};
+  ArtNode *node = arena_alloc(&hot->arena, sizes[type]);
+  node->type = type;
+  return node;
+}
+
+static void **art_find_child(ArtNode *node, uint8_t byte)
+{
+  switch (node->type)
+  {
+  case ART_NODE4:
+  {
+    ArtNode4 *n = (ArtNode4 *)node;
+    for (uint32_t i = 0; i < node->num_children; i++)
+    {
+      if (n->keys[i] == byte)
+      {
+        return &n->children[i];
+      }
+    }
+    return NULL;
+  }
+  case ART_NODE16:
+  {
+    ArtNode16 *n = (ArtNode16 *)node;
+#if defined(__SSE2__)
+    // All 16 key bytes against the search byte in one compare
+    __m128i matches = _mm_cmpeq_epi8(_mm_set1_epi8((char)byte),
+                                     _mm_loadu_si128((const __m128i *)n->keys));
+    uint32_t mask = (uint32_t)_mm_movemask_epi8(matches) &
+                    ((1u << node->num_children) - 1);
+    return mask ? &n->children[__builtin_ctz(mask)] : NULL;
+#else
+    for (uint32_t i = 0; i < node->num_children; i++)
+    {
+      if (n->keys[i] == byte)
+      {
+        return &n->children[i];
+      }
+    }
+    return NULL;
+#endif
+  }
+  case ART_NODE48:
+  {
+    ArtNode48 *n = (ArtNode48 *)node;
+    return n->child_index[byte] ? &n->children[n->child_index[byte] - 1] : NULL;
+  }
+  default:
+  {
+    ArtNode256 *n = (ArtNode256 *)node;
+    return n->children[byte] ? &n->children[byte] : NULL;
+  }
+  }
+}
+
+// Add a child for byte, moving the node to the next size up if it is full
+static void art_add_child(HotIndex *hot, void **ref, ArtNode *node,
+                          uint8_t byte, void *child)
+{
+  switch (node->type)
+  {
+  case ART_NODE4:
+  {
+    ArtNode4 *n = (ArtNode4 *)node;
+    if (node->num_children < 4)
+    {
+      n->keys[node->num_children] = byte;
+      n->children[node->num_children++] = child;
+      return;
+    }
+    ArtNode16 *grown = (ArtNode16 *)art_node_new(hot, ART_NODE16);
+    grown->header = *node;
+    grown->header.type = ART_NODE16;
+    memcpy(grown->keys, n->keys, sizeof(n->keys));
+    memcpy(grown->children, n->children, sizeof(n->children));
+    *ref = grown;
+    art_add_child(hot, ref, &grown->header, byte, child);
+    return;
+  }
+  case ART_NODE16:
+  {
+    ArtNode16 *n = (ArtNode16 *)node;
+    if (node->num_children < 16)
+    {
+      n->keys[node->num_children] = byte;
+      n->children[node->num_children++] = child;
+      return;
+    }
+    ArtNode48 *grown = (ArtNode48 *)art_node_new(hot, ART_NODE48);
+    grown->header = *node;
+    grown->header.type = ART_NODE48;
+    for (uint32_t i = 0; i < 16; i++)
+    {
+      grown->children[i] = n->children[i];
+      grown->child_index[n->keys[i]] = i + 1;
+    }
+    *ref = grown;
+    art_add_child(hot, ref, &grown->header, byte, child);
+    return;
+  }
+  case ART_NODE48:
+  {
+    ArtNode48 *n = (ArtNode48 *)node;
+    if (node->num_children < 48)
+    {
+      n->children[node->num_children] = child;
+      n->child_index[byte] = ++node->num_children;
+      return;
+    }
+    ArtNode256 *grown = (ArtNode256 *)art_node_new(hot, ART_NODE256);
+    grown->header = *node;
+    grown->header.type = ART_NODE256;
+    for (uint32_t i = 0; i < 256; i++)
+    {
+      if (n->child_index[i])
+      {
+        grown->children[i] = n->children[n->child_index[i] - 1];
+      }
+    }
+    *ref = grown;
+    art_add_child(hot, ref, &grown->header, byte, child);
+    return;
+  }
+  default:
+  {
+    ArtNode256 *n = (ArtNode256 *)node;
+    n->children[byte] = child;
+    node->num_children++;
+    return;
+  }
+  }
+}
+
+// Any leaf below node, for the prefix bytes the node does not keep
+static ArtLeaf *art_any_leaf(void *pointer)
+{
+  while (!IS_LEAF(pointer))
+  {
+    ArtNode *node = pointer;
+    switch (node->type)
+    {
+    case ART_NODE4:
+      pointer = ((ArtNode4 *)node)->children[0];
+      break;
+    case ART_NODE16:
+      pointer = ((ArtNode16 *)node)->children[0];
+      break;
+    case ART_NODE48:
+      pointer = ((ArtNode48 *)node)->children[0];
+      break;
+    default:
+    {
+      ArtNode256 *n = (ArtNode256 *)node;
+      uint32_t i = 0;
+      while (!n->children[i])
+      {
+        i++;
+      }
+      pointer = n->children[i];
+      break;
+    }
+    }
+  }
+  return TO_LEAF(pointer);
+}
+
+// How many of the node's prefix bytes key matches from depth
+static uint32_t art_prefix_mismatch(HotIndex *hot, ArtNode *node,
+                                    const uint8_t *key, uint32_t depth)
+{
+  uint32_t limit = node->prefix_len < hot->key_size - depth
+                       ? node->prefix_len
+                       : hot->key_size - depth;
+  uint32_t i = 0;
+  for (; i < limit && i < HOT_INDEX_MAX_PREFIX; i++)
+  {
+    if (node->prefix[i] != key[depth + i])
+    {
+      return i;
+    }
+  }
+  if (i < limit)
+  {
+    ArtLeaf *leaf = art_any_leaf(node);
+    for (; i < limit; i++)
+    {
+      if (leaf->key[depth + i] != key[depth + i])
+      {
+        return i;
+      }
+    }
+  }
+  return i;
+}
+
+static void art_insert(HotIndex *hot, void **ref, const uint8_t *key,
+                       uint32_t depth, uint32_t page_num, uint32_t cell_num)
+{
+  void *pointer = *ref;
+  if (!pointer)
+  {
+    *ref = FROM_LEAF(art_leaf_new(hot, key, page_num, cell_num));
+    return;
+  }
+
+  if (IS_LEAF(pointer))
+  {
+    ArtLeaf *leaf = TO_LEAF(pointer);
+    if (memcmp(leaf->key, key, hot->key_size) == 0)
+    {
+      leaf->page_num = page_num;
+      leaf->cell_num = cell_num;
+      return;
+    }
+    // Two keys where there was one: a node for the bytes they share, then
+    // a child for each. Keys all have the same length, so they differ
+    // somewhere before the end.
+    uint32_t common = 0;
+    while (leaf->key[depth + common] == key[depth + common])
+    {
+      common++;
+    }
+    ArtNode *node = art_node_new(hot, ART_NODE4);
+    node->prefix_len = common;
+    memcpy(node->prefix, key + depth,
+           common < HOT_INDEX_MAX_PREFIX ? common : HOT_INDEX_MAX_PREFIX);
+    *ref = node;
+    art_add_child(hot, ref, node, leaf->key[depth + common], pointer);
+    art_add_child(hot, ref, node, key[depth + common],
+                  FROM_LEAF(art_leaf_new(hot, key, page_num, cell_num)));
+    return;
+  }
+
+  ArtNode *node = pointer;
+  if (node->prefix_len)
+  {
+    uint32_t mismatch = art_prefix_mismatch(hot, node, key, depth);
+    if (mismatch < node->prefix_len)
+    {
+      // The key leaves the prefix part way: split it at the mismatch
+      ArtNode *parent = art_node_new(hot, ART_NODE4);
+      parent->prefix_len = mismatch;
+      memcpy(parent->prefix, node->prefix,
+             mismatch < HOT_INDEX_MAX_PREFIX ? mismatch : HOT_INDEX_MAX_PREFIX);
+      *ref = parent;
+
+      uint8_t node_byte;
+      uint32_t rest = node->prefix_len - mismatch - 1;
+      if (node->prefix_len <= HOT_INDEX_MAX_PREFIX)
+      {
+        node_byte = node->prefix[mismatch];
+        memmove(node->prefix, node->prefix + mismatch + 1,
+                rest < HOT_INDEX_MAX_PREFIX ? rest : HOT_INDEX_MAX_PREFIX);
+      }
+      else
+      {
+        ArtLeaf *leaf = art_any_leaf(node);
+        node_byte = leaf->key[depth + mismatch];
+        memcpy(node->prefix, leaf->key + depth + mismatch + 1,
+               rest < HOT_INDEX_MAX_PREFIX ? rest : HOT_INDEX_MAX_PREFIX);
+      }
+      node->prefix_len = rest;
+
+      art_add_child(hot, ref, parent, node_byte, node);
+      art_add_child(hot, ref, parent, key[depth + mismatch],
+                    FROM_LEAF(art_leaf_new(hot, key, page_num, cell_num)));
+      return;
+    }
+    depth += node->prefix_len;
+  }
+
+  void **child = art_find_child(node, key[depth]);
+  if (child)
+  {
+    art_insert(hot, child, key, depth + 1, page_num, cell_num);
+    return;
+  }
+  art_add_child(hot, ref, node, key[depth],
+                FROM_LEAF(art_leaf_new(hot, key, page_num, cell_num)));
+}
+
+static ArtLeaf *art_lookup(HotIndex *hot, const uint8_t *key)
+{
+  void *pointer = hot->root;
+  uint32_t depth = 0;
+  while (pointer)
+  {
+    if (IS_LEAF(pointer))
+    {
+      ArtLeaf *leaf = TO_LEAF(pointer);
+      return memcmp(leaf->key, key, hot->key_size) == 0 ? leaf : NULL;
+    }
+    ArtNode *node = pointer;
+    // Only the kept prefix bytes are compared; the leaf compare catches a
+    // mismatch in the rest
+    uint32_t kept = node->prefix_len < HOT_INDEX_MAX_PREFIX
+                        ? node->prefix_len
+                        : HOT_INDEX_MAX_PREFIX;
+    if (memcmp(node->prefix, key + depth, kept) != 0)
+    {
+      return NULL;
+    }
+    depth += node->prefix_len;
+    if (depth >= hot->key_size)
+    {
+      return NULL;
+    }
+    void **child = art_find_child(node, key[depth]);
+    pointer = child ? *child : NULL;
+    depth++;
+  }
+  return NULL;
+}
+
+static void hot_index_put(HotIndex *hot, const void *key, uint32_t page_num,
+                          uint32_t cell_num)
+{
+  art_insert(hot, &hot->root, key, 0, page_num, cell_num);
+}
+
+static void hot_index_clear(HotIndex *hot)
+{
+  arena_free(&hot->arena);
+  hot->root = NULL;
+  hot->built = false;
+  hot->entries = 0;
+}
+
+void hot_index_enable(Table *table)
+{
+  if (table->hot_index)
+  {
+    return;
+  }
+  HotIndex *hot = calloc(1, sizeof(HotIndex));
+  arena_init(&hot->arena);
+  hot->key_size = table->key.size;
+  table->hot_index = hot;
+}
+
+void hot_index_disable(Table *table)
+{
+  if (!table->hot_index)
+  {
+    return;
+  }
+  arena_free(&table->hot_index->arena);
+  free(table->hot_index);
+  table->hot_index = NULL;
+}
+
+void hot_index_note_leaf(Table *table, uint32_t page_num)
+{
+  HotIndex *hot = table->hot_index;
+  if (!hot || !hot->built || table->pager->latching)
+  {
+    return;
+  }
+  void *node = get_page(table->pager, page_num);
+  uint32_t num_cells = *leaf_node_num_cells(node);
+  for (uint32_t i = 0; i < num_cells; i++)
+  {
+    hot_index_put(hot, leaf_node_key(node, i), page_num, i);
+  }
+}
+
+// Register every row, walking down the left edge and along the leaves
+static void hot_index_build(Table *table)
+{
+  HotIndex *hot = table->hot_index;
+  hot_index_clear(hot);
+  hot->key_size = table->key.size;
+  hot->built = true;
+  hot->builds++;
+
+  uint32_t page_num = table->root_page_num;
+  void *node = get_page(table->pager, page_num);
+  while (get_node_type(node) == NODE_INTERNAL)
+  {
+    page_num = *internal_node_child(node, 0);
+    node = get_page(table->pager, page_num);
+  }
+  while (page_num != 0)
+  {
+    hot_index_note_leaf(table, page_num);
+    page_num = *leaf_node_next_leaf(get_page(table->pager, page_num));
+  }
+}
+
+Cursor *hot_index_find(Table *table, const void *key)
+{
+  HotIndex *hot = table->hot_index;
+  if (!hot || table->pager->latching)
+  {
+    return NULL;
+  }
+  if (!hot->built || hot->key_size != table->key.size)
+  {
+    hot_index_build(table);
+  }
+
+  ArtLeaf *leaf = art_lookup(hot, key);
+  if (!leaf || leaf->page_num == INVALID_PAGE_NUM ||
+      leaf->page_num >= table->pager->num_pages)
+  {
+    hot->misses++;
+    return NULL;
+  }
+  // Freed pages are zeroed with a marker in the type byte, so a page still
+  // holding a leaf is part of the tree, and a matching key in it is the row
+  void *node = get_page(table->pager, leaf->page_num);
+  if (get_node_type(node) != NODE_LEAF ||
+      leaf->cell_num >= *leaf_node_num_cells(node) ||
+      key_compare(&table->key, leaf_node_key(node, leaf->cell_num), key) != 0)
+  {
+    hot->misses++;
+    return NULL;
+  }
+
+  hot->hits++;
+  Cursor *cursor = malloc(sizeof(Cursor));
+  cursor->table = table;
+  cursor->page_num = leaf->page_num;
+  cursor->cell_num = leaf->cell_num;
+  cursor->end_of_table = false;
+  cursor->latch = LATCH_NONE;
+  return cursor;
+}
+
+void hot_index_found(Table *table, const void *key, const Cursor *cursor,
+                     bool present)
+{
+  HotIndex *hot = table->hot_index;
+  if (!hot || !hot->built || table->pager->latching)
+  {
+    return;
+  }
+  if (present)
+  {
+    hot_index_put(hot, key, cursor->page_num, cursor->cell_num);
+    return;
+  }
+  ArtLeaf *leaf = art_lookup(hot, key);
+  if (leaf)
+  {
+    leaf->page_num = INVALID_PAGE_NUM;
+  }
+}
+
+void hot_index_print(Table *table, const char *name)
+{
+  HotIndex *hot = table->hot_index;
+  if (!hot)
+  {
+    printf("Hot index is off for '%s'\n", name);
+    return;
+  }
+  printf("Hot index on '%s': %s, %llu keys, %zu KB\n", name,
+         hot->built ? "built" : "not built yet",
+         (unsigned long long)hot->entries, hot->arena.allocated / 1024);
+  printf("  hits: %llu  misses: %llu  builds: %llu\n",
+         (unsigned long long)hot->hits, (unsigned long long)hot->misses,
+         (unsigned long long)hot->builds);
+}
@@ -0,0 +1,1081 @@
+#include "../include/join.h"
+#include "../include/btree.h"
+#include "../include/cursor.h"
+#include "../include/parallel_scan.h"
+#include "../include/table_cache.h"
+#include "../include/table_stats.h"
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#define MAX_JOIN_CONJUNCTS 64
+
+static uint32_t table_row_size(TableDef *table_def)
+{
+  SortKey last;
+  sort_key_init(&last, table_def, table_def->num_columns - 1, false);
+  return last.offset + last.width;
+}
+
+static bool open_join_table(JoinSide *side, Database *db, Table *table,
+                            TableDef *table_def, const char *name,
+                            char *error, size_t error_size)
+{
+  if (strcasecmp(name, table_def->name) == 0)
+  {
+    side->table = table;
+    side->table_def = table_def;
+    return true;
+  }
+
+  int table_idx = catalog_find_table(&db->catalog, name);
+  if (table_idx == -1)
+  {
+    snprintf(error, error_size, "table '%s' not found", name);
+    return false;
+  }
+  side->table_def = &db->catalog.tables[table_idx];
+  side->table = table_cache_acquire(side->table_def->filename);
+  if (!side->table)
+  {
+    snprintf(error, error_size, "could not open table '%s'", name);
+    return false;
+  }
+  side->table->root_page_num = side->table_def->root_page_num;
+  table_set_key(side->table, &side->table_def->key);
+  side->owns_table = true;
+  return true;
+}
+
+// Append a side's columns to the joined schema as alias.column
+static bool add_side_columns(JoinPlan *plan, JoinSide *side, char *error,
+                             size_t error_size)
+{
+  TableDef *joined = &plan->joined;
+  TableDef *table_def = side->table_def;
+  if (joined->num_columns + table_def->num_columns > MAX_COLUMNS)
+  {
+    snprintf(error, error_size, "a join can produce at most %d columns",
+             MAX_COLUMNS);
+    return false;
+  }
+
+  side->first_column = joined->num_columns;
+  side->offset = plan->row_size;
+  side->row_size = table_row_size(table_def);
+  for (uint32_t i = 0; i < table_def->num_columns; i++)
+  {
+    ColumnDef *column = &joined->columns[joined->num_columns];
+    *column = table_def->columns[i];
+    if (strlen(side->name) + strlen(table_def->columns[i].name) + 1 >=
+        MAX_COLUMN_NAME)
+    {
+      snprintf(error, error_size, "column name %s.%s is too long", side->name,
+               table_def->columns[i].name);
+      return false;
+    }
+    strcpy(column->name, side->name);
+    strcat(column->name, ".");
+    strcat(column->name, table_def->columns[i].name);
+    joined->stats.columns[joined->num_columns] = table_def->stats.columns[i];
+    joined->num_columns++;
+  }
+  plan->row_size += side->row_size;
+  return true;
+}
+
+static uint32_t side_of_column(const JoinPlan *plan, int column_idx)
+{
+  return (uint32_t)column_idx >= plan->sides[1].first_column ? 1 : 0;
+}
+
+bool join_open(JoinPlan *plan, Database *db, Table *table, TableDef *table_def,
+               const char *alias, const SqlJoin *join, char *error,
+               size_t error_size)
+{
+  memset(plan, 0, sizeof(JoinPlan));
+  JoinSide *left = &plan->sides[0];
+  JoinSide *right = &plan->sides[1];
+  left->table = table;
+  left->table_def = table_def;
+  if (!open_join_table(right, db, table, table_def, join->table, error,
+                       error_size))
+  {
+    return false;
+  }
+  strcpy(left->name, alias[0] ? alias : table_def->name);
+  strcpy(right->name, join->alias[0] ? join->alias : right->table_def->name);
+  if (strcasecmp(left->name, right->name) == 0)
+  {
+    snprintf(error, error_size,
+             "table '%s' is joined with itself; give each side an alias",
+             left->name);
+    return false;
+  }
+
+  strcpy(plan->joined.name, "join");
+  if (!add_side_columns(plan, left, error, error_size) ||
+      !add_side_columns(plan, right, error, error_size))
+  {
+    return false;
+  }
+  plan->joined.stats.analyzed = table_def->stats.analyzed &&
+                                right->table_def->stats.analyzed;
+
+  // ON a.x = b.y, with the columns in either order
+  int first = join_find_column(plan, join->left_column, error, error_size);
+  int second = first == -1 ? -1
+                           : join_find_column(plan, join->right_column, error,
+                                              error_size);
+  if (second == -1)
+  {
+    return false;
+  }
+  if (side_of_column(plan, first) == side_of_column(plan, second))
+  {
+    snprintf(error, error_size, "ON must compare a column of each table");
+    return false;
+  }
+  ColumnDef *a = &plan->joined.columns[first];
+  ColumnDef *b = &plan->joined.columns[second];
+  if (a->type != b->type || a->type == COLUMN_TYPE_BLOB)
+  {
+    snprintf(error, error_size, "cannot join %s with %s: %s", a->name,
+             b->name,
+             a->type == COLUMN_TYPE_BLOB ? "BLOB columns are not comparable"
+                                         : "the types differ");
+    return false;
+  }
+
+  int columns[2];
+  columns[side_of_column(plan, first)] = first;
+  columns[side_of_column(plan, second)] = second;
+  for (uint32_t s = 0; s < 2; s++)
+  {
+    JoinSide *side = &plan->sides[s];
+    side->key_column = columns[s] - side->first_column;
+    sort_key_init(&side->key, side->table_def, side->key_column, false);
+  }
+  // Strings of different declared sizes compare up to the longer one;
+  // strncasecmp stops at the shorter one's terminator
+  plan->compare = left->key;
+  plan->compare.offset = 0;
+  if (right->key.width > plan->compare.width)
+  {
+    plan->compare.width = right->key.width;
+  }
+  return true;
+}
+
+int join_find_column(const JoinPlan *plan, const char *column, char *error,
+                     size_t error_size)
+{
+  const char *dot = strchr(column, '.');
+  int found = -1;
+  for (uint32_t s = 0; s < 2; s++)
+  {
+    const JoinSide *side = &plan->sides[s];
+    const char *name = column;
+    if (dot)
+    {
+      size_t length = dot - column;
+      if (strlen(side->name) != length ||
+          strncasecmp(side->name, column, length) != 0)
+      {
+        continue;
+      }
+      name = dot + 1;
+    }
+    int column_idx = table_def_find_column(side->table_def, name);
+    if (column_idx == -1)
+    {
+      continue;
+    }
+    if (found != -1)
+    {
+      snprintf(error, error_size, "column '%s' is ambiguous", column);
+      return -1;
+    }
+    found = side->first_column + column_idx;
+  }
+  if (found == -1)
+  {
+    snprintf(error, error_size, "unknown column '%s'", column);
+  }
+  return found;
+}
+
+// Rewrite every column of a WHERE tree to its joined name
+static bool qualify_expr(const JoinPlan *plan, SqlExpr *expr, char *error,
+                         size_t error_size)
+{
+  if (expr->type != SQL_EXPR_COMPARE)
+  {
+    return qualify_expr(plan, expr->left, error, error_size) &&
+           qualify_expr(plan, expr->right, error, error_size);
+  }
+  int column_idx = join_find_column(plan, expr->column, error, error_size);
+  if (column_idx == -1)
+  {
+    return false;
+  }
+  strcpy(expr->column, plan->joined.columns[column_idx].name);
+  return true;
+}
+
+// The side every column of a qualified WHERE tree is on, or -1 if it
+// looks at both
+static int expr_side(const JoinPlan *plan, SqlExpr *expr)
+{
+  if (expr->type != SQL_EXPR_COMPARE)
+  {
+    int left = expr_side(plan, expr->left);
+    int right = expr_side(plan, expr->right);
+    return left == right ? left : -1;
+  }
+  int column_idx =
+      table_def_find_column((TableDef *)&plan->joined, expr->column);
+  return (int)side_of_column(plan, column_idx);
+}
+
+// Back from joined names to the side's own column names
+static void localize_expr(const JoinPlan *plan, const JoinSide *side,
+                          SqlExpr *expr)
+{
+  if (expr->type != SQL_EXPR_COMPARE)
+  {
+    localize_expr(plan, side, expr->left);
+    localize_expr(plan, side, expr->right);
+    return;
+  }
+  int column_idx =
+      table_def_find_column((TableDef *)&plan->joined, expr->column);
+  strcpy(expr->column,
+         side->table_def->columns[column_idx - side->first_column].name);
+}
+
+static void collect_conjuncts(SqlExpr *expr, SqlExpr **conjuncts,
+                              uint32_t *count)
+{
+  if (expr->type == SQL_EXPR_AND && *count < MAX_JOIN_CONJUNCTS - 1)
+  {
+    collect_conjuncts(expr->left, conjuncts, count);
+    collect_conjuncts(expr->right, conjuncts, count);
+    return;
+  }
+  conjuncts[(*count)++] = expr;
+}
+
+// AND together copies of a side's conjuncts; NULL if it has none
+static SqlExpr *side_where(const JoinPlan *plan, const JoinSide *side,
+                           SqlExpr **conjuncts, uint32_t count)
+{
+  SqlExpr *where = NULL;
+  for (uint32_t i = 0; i < count; i++)
+  {
+    SqlExpr *copy = sql_expr_bind(conjuncts[i], NULL, 0);
+    localize_expr(plan, side, copy);
+    if (!where)
+    {
+      where = copy;
+      continue;
+    }
+    SqlExpr *both = calloc(1, sizeof(SqlExpr));
+    both->type = SQL_EXPR_AND;
+    both->left = where;
+    both->right = copy;
+    where = both;
+  }
+  return where;
+}
+
+// Distinct values of a side's ON column
+static double key_distinct(const JoinSide *side, const TableShape *shape)
+{
+  double distinct =
+      1.0 / stats_eq_selectivity(&side->table_def->stats, side->key_column);
+  distinct = distinct > shape->rows ? shape->rows : distinct;
+  return distinct < 1.0 ? 1.0 : distinct;
+}
+
+static void add_join_candidate(JoinPlan *plan, JoinMethod method,
+                               uint32_t inner, double cost)
+{
+  JoinCandidate *candidate = &plan->candidates[plan->num_candidates++];
+  candidate->method = method;
+  candidate->inner = inner;
+  candidate->cost = cost;
+}
+
+static void choose_method(JoinPlan *plan)
+{
+  TableShape shapes[2];
+  double rows[2], cost[2], distinct[2], bytes = 0;
+  for (uint32_t s = 0; s < 2; s++)
+  {
+    JoinSide *side = &plan->sides[s];
+    query_plan_table_shape(side->table, side->table_def, &shapes[s]);
+    rows[s] = side->plan.rows;
+    cost[s] = side->plan.cost;
+    distinct[s] = key_distinct(side, &shapes[s]);
+    bytes += rows[s] * side->row_size;
+  }
+  // Every row on one side meets rows / distinct rows on the other
+  plan->rows = rows[0] * rows[1] /
+               (distinct[0] > distinct[1] ? distinct[0] : distinct[1]);
+
+  // Hash join: both sides scanned once, and inserting a row costs more than
+  // probing with one. Past the work memory both are written out to
+  // partitions and read back.
+  for (uint32_t build = 0; build < 2; build++)
+  {
+    double table_bytes = rows[build] * (plan->sides[build].row_size +
+                                        sizeof(JoinEntry) +
+                                        sizeof(JoinEntry *));
+    double hash_cost = cost[0] + cost[1] +
+                       (2 * rows[build] + rows[1 - build]) * CPU_ROW_COST;
+    if (table_bytes > plan->output.work_memory)
+    {
+      hash_cost += 2 * bytes / PAGE_SIZE * PAGE_COST;
+    }
+    add_join_candidate(plan, JOIN_HASH, build, hash_cost);
+  }
+
+  // Nested loop: one descent into the inner side per outer row, through
+  // its primary key or an index on its ON column. Not a partial index: it
+  // would miss inner rows outside its condition that the ON column matches.
+  for (uint32_t inner = 0; inner < 2; inner++)
+  {
+    uint32_t outer = 1 - inner;
+    JoinSide *side = &plan->sides[inner];
+    double depth = shapes[inner].depth;
+    TableDef *def = side->table_def;
+    IndexDef *index = query_plan_find_index(def, side->key_column, NULL);
+    if (def->key.type != KEY_BYTES && side->key_column == (int)def->key_columns[0])
+    {
+      add_join_candidate(plan, JOIN_NESTED_PRIMARY_KEY, inner,
+                         cost[outer] +
+                             rows[outer] * (depth * PAGE_COST + CPU_ROW_COST));
+    }
+    else if (index)
+    {
+      double matches = shapes[inner].rows / distinct[inner];
+      add_join_candidate(plan, JOIN_NESTED_INDEX, inner,
+                         cost[outer] +
+                             rows[outer] *
+                                 (query_plan_index_probe_cost(index, depth) +
+                                  matches * (depth * PAGE_COST + CPU_ROW_COST)));
+    }
+  }
+
+  uint32_t best = 0;
+  for (uint32_t i = 1; i < plan->num_candidates; i++)
+  {
+    if (plan->candidates[i].cost < plan->candidates[best].cost)
+    {
+      best = i;
+    }
+  }
+  plan->method = plan->candidates[best].method;
+  plan->inner = plan->candidates[best].inner;
+  plan->cost = plan->candidates[best].cost;
+  if (plan->method == JOIN_NESTED_INDEX)
+  {
+    JoinSide *side = &plan->sides[plan->inner];
+    plan->index = query_plan_find_index(side->table_def, side->key_column, NULL);
+  }
+}
+
+bool join_plan_build(JoinPlan *plan, SqlExpr *where,
+                     const SelectOptions *options, char *error,
+                     size_t error_size)
+{
+  if (!query_plan_build_operators(options, &plan->joined, &plan->output,
+                                  error, error_size))
+  {
+    return false;
+  }
+
+  SqlExpr *conjuncts[MAX_JOIN_CONJUNCTS];
+  uint32_t count = 0;
+  if (where)
+  {
+    if (!qualify_expr(plan, where, error, error_size))
+    {
+      return false;
+    }
+    collect_conjuncts(where, conjuncts, &count);
+  }
+
+  // Conjuncts on one table go to that table's access method; the rest are
+  // checked on the joined rows
+  SqlExpr *pushed[2][MAX_JOIN_CONJUNCTS];
+  uint32_t num_pushed[2] = {0, 0};
+  SqlExpr *rest[MAX_JOIN_CONJUNCTS];
+  uint32_t num_rest = 0;
+  for (uint32_t i = 0; i < count; i++)
+  {
+    int side = expr_side(plan, conjuncts[i]);
+    if (side == -1)
+    {
+      rest[num_rest++] = conjuncts[i];
+    }
+    else
+    {
+      pushed[side][num_pushed[side]++] = conjuncts[i];
+    }
+  }
+
+  for (uint32_t s = 0; s < 2; s++)
+  {
+    JoinSide *side = &plan->sides[s];
+    SqlExpr *local = side_where(plan, side, pushed[s], num_pushed[s]);
+    SelectOptions side_options = {0};
+    side_options.work_memory = options->work_memory;
+    bool planned = query_plan_build(local, &side_options, side->table,
+                                    side->table_def, &side->plan, error,
+                                    error_size);
+    if (planned && local)
+    {
+      side->filter = expr_compile(local, side->table_def, error, error_size);
+    }
+    sql_expr_free(local);
+    if (!planned)
+    {
+      return false;
+    }
+  }
+
+  if (num_rest > 0)
+  {
+    plan->residual = expr_compile_conjuncts(rest, num_rest, &plan->joined,
+                                            error, error_size);
+    if (!plan->residual)
+    {
+      return false;
+    }
+  }
+
+  choose_method(plan);
+  plan->output.rows = plan->rows;
+  plan->output.cost = plan->cost;
+  return true;
+}
+
+static const char *method_name(JoinMethod method)
+{
+  switch (method)
+  {
+  case JOIN_HASH:
+    return "Hash join";
+  case JOIN_NESTED_PRIMARY_KEY:
+  case JOIN_NESTED_INDEX:
+    return "Nested loop join";
+  }
+  return "Unknown";
+}
+
+static void describe_candidate(const JoinPlan *plan,
+                               const JoinCandidate *candidate, char *text,
+                               size_t size)
+{
+  const JoinSide *inner = &plan->sides[candidate->inner];
+  const JoinSide *outer = &plan->sides[1 - candidate->inner];
+  switch (candidate->method)
+  {
+  case JOIN_HASH:
+    snprintf(text, size, "Hash join, build %.24s", inner->name);
+    break;
+  case JOIN_NESTED_PRIMARY_KEY:
+    snprintf(text, size, "Nested loop, %.16s into %.16s by primary key",
+             outer->name, inner->name);
+    break;
+  case JOIN_NESTED_INDEX:
+    snprintf(text, size, "Nested loop, %.16s into %.16s by index",
+             outer->name, inner->name);
+    break;
+  }
+}
+
+void join_plan_explain(const JoinPlan *plan)
+{
+  const JoinSide *inner = &plan->sides[plan->inner];
+  const JoinSide *outer = &plan->sides[1 - plan->inner];
+  const TableDef *joined = &plan->joined;
+
+  printf("QUERY PLAN\n");
+  printf("  %s on %s = %s  (cost=%.2f rows=%.0f)\n", method_name(plan->method),
+         joined->columns[plan->sides[0].first_column +
+                         plan->sides[0].key_column]
+             .name,
+         joined->columns[plan->sides[1].first_column +
+                         plan->sides[1].key_column]
+             .name,
+         plan->cost, plan->rows);
+  if (plan->method == JOIN_HASH)
+  {
+    double bytes = inner->plan.rows * (inner->row_size + sizeof(JoinEntry) +
+                                       sizeof(JoinEntry *));
+    printf("    Build: %s (~%.0f rows, %s)\n", inner->name, inner->plan.rows,
+           bytes > plan->output.work_memory ? "grace partitions on disk"
+                                            : "in memory");
+    printf("    Probe: %s\n", outer->name);
+  }
+  else
+  {
+    printf("    Outer: %s\n", outer->name);
+    if (plan->method == JOIN_NESTED_INDEX)
+    {
+      printf("    Inner: %s through %sindex %s\n", inner->name,
+             plan->index->type == INDEX_TYPE_HASH ? "hash " : "",
+             plan->index->name);
+    }
+    else
+    {
+      printf("    Inner: %s by primary key lookup\n", inner->name);
+    }
+  }
+  if (plan->residual)
+  {
+    printf("    Filter: remaining WHERE conditions\n");
+  }
+  query_plan_explain_operators(&plan->output, (TableDef *)joined, false);
+
+  for (uint32_t s = 0; s < 2; s++)
+  {
+    const JoinSide *side = &plan->sides[s];
+    printf("  %s:\n", side->name);
+    if (plan->method != JOIN_HASH && side == inner)
+    {
+      printf("    Fetched per outer row%s\n",
+             side->filter ? ", then filtered" : "");
+      continue;
+    }
+    query_plan_explain_access(&side->plan, side->table_def, "    ");
+  }
+
+  printf("  Candidates:\n");
+  for (uint32_t i = 0; i < plan->num_candidates; i++)
+  {
+    char text[80];
+    describe_candidate(plan, &plan->candidates[i], text, sizeof(text));
+    printf("    %-48s cost=%.2f\n", text, plan->candidates[i].cost);
+  }
+}
+
+// Execution state shared by the scan workers feeding the join
+typedef struct
+{
+  JoinPlan *plan;
+  QueryResult *result;
+  pthread_mutex_t lock;
+  uint8_t *joined; // Scratch joined row
+  // LIMIT is met and nothing downstream needs the remaining rows
+  bool done;
+  uint64_t rows_out;
+
+  JoinHashTable table;
+  uint64_t rows_built;
+  bool spilled;
+  bool spill_failed;
+  FILE *build_files[JOIN_PARTITIONS];
+  FILE *probe_files[JOIN_PARTITIONS];
+} JoinRun;
+
+typedef void (*JoinSink)(JoinRun *run, const uint8_t *row);
+
+// Same value, same hash, for every type the ON columns can have
+static uint64_t hash_key(const SortKey *key, const uint8_t *row)
+{
+  const uint8_t *value = row + key->offset;
+  uint64_t hash = 14695981039346656037ULL;
+  if (key->type == COLUMN_TYPE_STRING)
+  {
+    // Equality folds case and ends at the terminator
+    for (uint32_t i = 0; i < key->width && value[i]; i++)
+    {
+      hash = (hash ^ (uint8_t)tolower(value[i])) * 1099511628211ULL;
+    }
+  }
+  else
+  {
+    uint8_t bytes[sizeof(int64_t)];
+    memcpy(bytes, value, key->width);
+    if (key->type == COLUMN_TYPE_FLOAT)
+    {
+      float number;
+      memcpy(&number, bytes, sizeof(number));
+      number = number == 0.0f ? 0.0f : number; // -0 equals 0
+      memcpy(bytes, &number, sizeof(number));
+    }
+    for (uint32_t i = 0; i < key->width; i++)
+    {
+      hash = (hash ^ bytes[i]) * 1099511628211ULL;
+    }
+  }
+  hash ^= hash >> 33;
+  hash *= 0xff51afd7ed558ccdULL;
+  hash ^= hash >> 33;
+  hash *= 0xc4ceb9fe1a85ec53ULL;
+  hash ^= hash >> 33;
+  return hash;
+}
+
+static bool keys_equal(const JoinPlan *plan, const JoinSide *a_side,
+                       const uint8_t *a, const JoinSide *b_side,
+                       const uint8_t *b)
+{
+  return sort_compare_key(&plan->compare, a + a_side->key.offset,
+                          b + b_side->key.offset) == 0;
+}
+
+static void hash_table_init(JoinHashTable *table)
+{
+  arena_init(&table->arena);
+  table->num_buckets = JOIN_INITIAL_BUCKETS;
+  table->buckets = calloc(table->num_buckets, sizeof(JoinEntry *));
+  table->num_entries = 0;
+}
+
+static void hash_table_free(JoinHashTable *table)
+{
+  arena_free(&table->arena);
+  free(table->buckets);
+  table->buckets = NULL;
+}
+
+static size_t hash_table_bytes(const JoinHashTable *table)
+{
+  return table->arena.allocated + table->num_buckets * sizeof(JoinEntry *);
+}
+
+static void hash_table_insert(JoinHashTable *table, uint64_t hash,
+                              const uint8_t *row, uint32_t size)
+{
+  if (table->num_entries >= table->num_buckets)
+  {
+    uint32_t num_buckets = table->num_buckets * 2;
+    JoinEntry **buckets = calloc(num_buckets, sizeof(JoinEntry *));
+    for (uint32_t i = 0; i < table->num_buckets; i++)
+    {
+      JoinEntry *entry = table->buckets[i];
+      while (entry)
+      {
+        JoinEntry *next = entry->next;
+        uint32_t bucket = entry->hash & (num_buckets - 1);
+        entry->next = buckets[bucket];
+        buckets[bucket] = entry;
+        entry = next;
+      }
+    }
+    free(table->buckets);
+    table->buckets = buckets;
+    table->num_buckets = num_buckets;
+  }
+
+  JoinEntry *entry = arena_alloc(&table->arena, sizeof(JoinEntry) + size);
+  entry->hash = hash;
+  memcpy(entry->row, row, size);
+  uint32_t bucket = hash & (table->num_buckets - 1);
+  entry->next = table->buckets[bucket];
+  table->buckets[bucket] = entry;
+  table->num_entries++;
+}
+
+static void emit(JoinRun *run, uint32_t side, const uint8_t *row,
+                 const uint8_t *other)
+{
+  JoinPlan *plan = run->plan;
+  const JoinSide *a = &plan->sides[side];
+  const JoinSide *b = &plan->sides[1 - side];
+  memcpy(run->joined + a->offset, row, a->row_size);
+  memcpy(run->joined + b->offset, other, b->row_size);
+  DynamicRow joined = {run->joined, plan->row_size};
+  if (plan->residual && !expr_eval(plan->residual, &joined))
+  {
+    return;
+  }
+
+  QueryResult *result = run->result;
+  query_result_add(result, run->joined, plan->row_size);
+  run->rows_out++;
+  if (!result->sorter && !result->aggregator && result->has_limit &&
+      result->rows.num_rows >= (uint64_t)result->limit + result->offset)
+  {
+    run->done = true;
+  }
+}
+
+static uint32_t partition_of(uint64_t hash)
+{
+  // The bucket index uses the low bits
+  return (uint32_t)(hash >> 32) % JOIN_PARTITIONS;
+}
+
+static void write_partition(FILE **files, uint64_t hash, const uint8_t *row,
+                            uint32_t size)
+{
+  fwrite(row, size, 1, files[partition_of(hash)]);
+}
+
+static bool open_partitions(FILE **files)
+{
+  for (uint32_t p = 0; p < JOIN_PARTITIONS; p++)
+  {
+    files[p] = tmpfile();
+    if (!files[p])
+    {
+      for (uint32_t i = 0; i < p; i++)
+      {
+        fclose(files[i]);
+        files[i] = NULL;
+      }
+      return false;
+    }
+  }
+  return true;
+}
+
+// Move the build side's rows from the hash table out to partition files
+static void spill_build(JoinRun *run)
+{
+  if (!open_partitions(run->build_files) ||
+      !open_partitions(run->probe_files))
+  {
+    // Keep going in memory rather than fail the query
+    printf("Warning: Could not create join partition files, joining in "
+           "memory.\n");
+    for (uint32_t p = 0; p < JOIN_PARTITIONS; p++)
+    {
+      if (run->build_files[p])
+      {
+        fclose(run->build_files[p]);
+        run->build_files[p] = NULL;
+      }
+    }
+    run->spill_failed = true;
+    return;
+  }
+
+  uint32_t size = run->plan->sides[run->plan->inner].row_size;
+  JoinHashTable *table = &run->table;
+  for (uint32_t i = 0; i < table->num_buckets; i++)
+  {
+    for (JoinEntry *entry = table->buckets[i]; entry; entry = entry->next)
+    {
+      write_partition(run->build_files, entry->hash, entry->row, size);
+    }
+  }
+  hash_table_free(table);
+  hash_table_init(table);
+  run->spilled = true;
+}
+
+static void build_row(JoinRun *run, const uint8_t *row)
+{
+  JoinPlan *plan = run->plan;
+  JoinSide *side = &plan->sides[plan->inner];
+  uint64_t hash = hash_key(&side->key, row);
+  run->rows_built++;
+  if (run->spilled)
+  {
+    write_partition(run->build_files, hash, row, side->row_size);
+    return;
+  }
+  hash_table_insert(&run->table, hash, row, side->row_size);
+  if (!run->spill_failed &&
+      hash_table_bytes(&run->table) > plan->output.work_memory)
+  {
+    spill_build(run);
+  }
+}
+
+static void probe(JoinRun *run, uint64_t hash, const uint8_t *row)
+{
+  JoinPlan *plan = run->plan;
+  JoinSide *inner = &plan->sides[plan->inner];
+  JoinSide *outer = &plan->sides[1 - plan->inner];
+  JoinHashTable *table = &run->table;
+  for (JoinEntry *entry = table->buckets[hash & (table->num_buckets - 1)];
+       entry && !run->done; entry = entry->next)
+  {
+    if (entry->hash == hash && keys_equal(plan, inner, entry->row, outer, row))
+    {
+      emit(run, plan->inner, entry->row, row);
+    }
+  }
+}
+
+static void probe_row(JoinRun *run, const uint8_t *row)
+{
+  JoinPlan *plan = run->plan;
+  JoinSide *outer = &plan->sides[1 - plan->inner];
+  uint64_t hash = hash_key(&outer->key, row);
+  if (run->spilled)
+  {
+    write_partition(run->probe_files, hash, row, outer->row_size);
+    return;
+  }
+  probe(run, hash, row);
+}
+
+// Join each pair of partitions in turn. A partition whose build side still
+// does not fit the work memory is joined in memory anyway.
+static void join_partitions(JoinRun *run)
+{
+  JoinPlan *plan = run->plan;
+  JoinSide *inner = &plan->sides[plan->inner];
+  JoinSide *outer = &plan->sides[1 - plan->inner];
+  uint8_t *row = malloc(inner->row_size > outer->row_size ? inner->row_size
+                                                          : outer->row_size);
+  for (uint32_t p = 0; p < JOIN_PARTITIONS; p++)
+  {
+    hash_table_free(&run->table);
+    hash_table_init(&run->table);
+    rewind(run->build_files[p]);
+    while (fread(row, inner->row_size, 1, run->build_files[p]) == 1)
+    {
+      hash_table_insert(&run->table, hash_key(&inner->key, row), row,
+                        inner->row_size);
+    }
+    rewind(run->probe_files[p]);
+    while (!run->done &&
+           fread(row, outer->row_size, 1, run->probe_files[p]) == 1)
+    {
+      probe(run, hash_key(&outer->key, row), row);
+    }
+  }
+  free(row);
+}
+
+typedef struct
+{
+  JoinRun *run;
+  JoinSide *side;
+  JoinSink sink;
+} SideFeed;
+
+static bool feed_side(DynamicRow *row, TableDef *table_def, void *ctx)
+{
+  (void)table_def;
+  SideFeed *feed = ctx;
+  CompiledExpr *residual = feed->side->plan.residual;
+  if (!residual || expr_eval(residual, row))
+  {
+    pthread_mutex_lock(&feed->run->lock);
+    if (!feed->run->done)
+    {
+      feed->sink(feed->run, row->data);
+    }
+    pthread_mutex_unlock(&feed->run->lock);
+  }
+  return false;
+}
+
+// Every row of a side that passes its own WHERE conjuncts. Full scans
+// stream from the scan workers; the other access methods are selective,
+// so their rows are collected first.
+static void scan_side(JoinRun *run, JoinSide *side, JoinSink sink,
+                      uint32_t num_threads)
+{
+  QueryPlan *plan = &side->plan;
+  if (plan->access == ACCESS_FULL_SCAN && !plan->use_batch)
+  {
+    SideFeed feed = {run, side, sink};
+    ScanResult unused = {0};
+    parallel_scan(side->table, side->table_def, feed_side, &feed, num_threads,
+                  &unused);
+    scan_result_free(&unused);
+    return;
+  }
+
+  QueryResult rows;
+  query_plan_execute(plan, side->table, side->table_def, num_threads, &rows,
+                     NULL);
+  DynamicRow *row;
+  while (!run->done && (row = query_result_next(&rows)))
+  {
+    sink(run, row->data);
+  }
+  query_result_free(&rows);
+}
+
+// Fetch the inner row with primary key key and join it to the outer row
+static void fetch_inner(JoinRun *run, int64_t key, const uint8_t *outer_row)
+{
+  JoinPlan *plan = run->plan;
+  JoinSide *inner = &plan->sides[plan->inner];
+  JoinSide *outer = &plan->sides[1 - plan->inner];
+  const KeyDesc *desc = &inner->table->key;
+  uint8_t encoded[BTREE_MAX_KEY_SIZE];
+  key_from_int(desc, key, encoded);
+  Cursor *cursor = table_find_key(inner->table, encoded);
+  void *node = get_page(inner->table->pager, cursor->page_num);
+  if (cursor->cell_num < *leaf_node_num_cells(node) &&
+      key_compare(desc, leaf_node_key(node, cursor->cell_num), encoded) == 0)
+  {
+    PROFILE_COUNT(PROFILE_ROWS_SCANNED, 1);
+    DynamicRow row;
+    deserialize_dynamic_row(cursor_value(cursor), inner->table_def, &row);
+    // A wide outer key was cut to the inner key's width for the lookup, so
+    // the join key is checked again
+    if (keys_equal(plan, inner, row.data, outer, outer_row) &&
+        (!inner->filter || expr_eval(inner->filter, &row)))
+    {
+      emit(run, plan->inner, row.data, outer_row);
+    }
+    dynamic_row_free(&row);
+  }
+  cursor_close(cursor);
+}
+
+static void nested_loop(JoinRun *run, Table *index_table,
+                        uint32_t num_threads, QueryProfile *profile)
+{
+  JoinPlan *plan = run->plan;
+  JoinSide *outer = &plan->sides[1 - plan->inner];
+  JoinSide *inner = &plan->sides[plan->inner];
+
+  // The outer side is the small one
+  QueryResult outer_rows;
+  query_plan_execute(&outer->plan, outer->table, outer->table_def,
+                     num_threads, &outer_rows, NULL);
+  char name[64];
+  if (profile)
+  {
+    snprintf(name, sizeof(name), "Outer scan of %.40s", outer->name);
+    query_profile_end(profile, name, outer_rows.rows.num_rows);
+  }
+
+  DynamicRow *row;
+  while (!run->done && (row = query_result_next(&outer_rows)))
+  {
+    int32_t value;
+    memcpy(&value, (uint8_t *)row->data + outer->key.offset, sizeof(value));
+    if (!index_table && outer->key.width == sizeof(int64_t))
+    {
+      int64_t wide;
+      memcpy(&wide, (uint8_t *)row->data + outer->key.offset, sizeof(wide));
+      fetch_inner(run, wide, row->data);
+      continue;
+    }
+    if (!index_table)
+    {
+      // INT primary keys are never negative
+      if (value >= 0)
+      {
+        fetch_inner(run, value, row->data);
+      }
+      continue;
+    }
+    uint32_t num_ids;
+    uint32_t *ids =
+        query_plan_probe_index(plan->index, index_table, &value, sizeof(value),
+                               &num_ids);
+    for (uint32_t i = 0; i < num_ids && !run->done; i++)
+    {
+      fetch_inner(run, ids[i], row->data);
+    }
+    free(ids);
+  }
+  query_result_free(&outer_rows);
+
+  if (profile)
+  {
+    snprintf(name, sizeof(name), "Nested loop into %.40s", inner->name);
+    query_profile_end(profile, name, run->rows_out);
+  }
+}
+
+void join_execute(JoinPlan *plan, uint32_t num_threads, QueryResult *result,
+                  QueryProfile *profile)
+{
+  query_result_begin(result, &plan->output);
+  JoinRun run;
+  memset(&run, 0, sizeof(JoinRun));
+  run.plan = plan;
+  run.result = result;
+  pthread_mutex_init(&run.lock, NULL);
+  run.joined = calloc(1, plan->row_size);
+
+  Table *index_table = NULL;
+  if (plan->method == JOIN_NESTED_INDEX)
+  {
+    index_table = query_plan_open_index(plan->index);
+    if (!index_table)
+    {
+      printf("Warning: Could not open index '%s', using a hash join "
+             "instead.\n",
+             plan->index->name);
+      plan->method = JOIN_HASH;
+    }
+  }
+
+  if (plan->method == JOIN_HASH)
+  {
+    JoinSide *inner = &plan->sides[plan->inner];
+    JoinSide *outer = &plan->sides[1 - plan->inner];
+    char name[64];
+    hash_table_init(&run.table);
+    scan_side(&run, inner, build_row, num_threads);
+    if (profile)
+    {
+      snprintf(name, sizeof(name), "Hash build on %.40s", inner->name);
+      query_profile_end(profile, name, run.rows_built);
+    }
+    scan_side(&run, outer, probe_row, num_threads);
+    if (profile)
+    {
+      snprintf(name, sizeof(name), "Hash probe from %.40s", outer->name);
+      query_profile_end(profile, name, run.rows_out);
+    }
+    if (run.spilled)
+    {
+      join_partitions(&run);
+      for (uint32_t p = 0; p < JOIN_PARTITIONS; p++)
+      {
+        fclose(run.build_files[p]);
+        fclose(run.probe_files[p]);
+      }
+      if (profile)
+      {
+        snprintf(name, sizeof(name), "Grace join (%d partitions)",
+                 JOIN_PARTITIONS);
+        query_profile_end(profile, name, run.rows_out);
+      }
+    }
+    hash_table_free(&run.table);
+  }
+  else
+  {
+    nested_loop(&run, index_table, num_threads, profile);
+  }
+
+  if (index_table)
+  {
+    table_cache_release(index_table);
+  }
+  free(run.joined);
+  pthread_mutex_destroy(&run.lock);
+  query_result_end(result, profile);
+}
+
+void join_plan_free(JoinPlan *plan)
+{
+  for (uint32_t s = 0; s < 2; s++)
+  {
+    JoinSide *side = &plan->sides[s];
+    query_plan_free(&side->plan);
+    expr_free(side->filter);
+    side->filter = NULL;
+    if (side->owns_table)
+    {
+      table_cache_release(side->table);
+      side->owns_table = false;
+    }
+  }
+  expr_free(plan->residual);
+  plan->residual = NULL;
+  query_plan_free(&plan->output);
+}
@@ -120,6 +120,10 @@ void format_column_value_as_json(DynamicRow* row, TableDef* table_def, uint32_t
         case COLUMN_TYPE_TIMESTAMP:
             printf("\"%lld\"", (long long)dynamic_row_get_timestamp(row, table_def, col_idx));
             break;
+
+        case COLUMN_TYPE_BIGINT:
+            printf("%lld", (long long)dynamic_row_get_bigint(row, table_def, col_idx));
+            break;
             
         case COLUMN_TYPE_STRING: {
             char* str = dynamic_row_get_string(row, table_def, col_idx);
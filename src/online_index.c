@@ -0,0 +1,552 @@
+#include "../include/online_index.h"
+#include "../include/bitmap_index.h"
+#include "../include/btree.h"
+#include "../include/btree_key.h"
+#include "../include/column_func.h"
+#include "../include/fulltext_index.h"
+#include "../include/cursor.h"
+#include "../include/secondary_index.h"
+#include "../include/table_cache.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+typedef enum
+{
+  BUILD_SCANNING,
+  BUILD_CATCHING_UP, // Scan done, replaying the side log
+  BUILD_READY,       // Waiting for a statement to publish it
+  BUILD_FAILED
+} BuildState;
+
+// One write made while the build ran, with its own copies of the rows
+typedef struct
+{
+  DynamicRow old_row;
+  DynamicRow new_row;
+  bool has_old;
+  bool has_new;
+} SideLogEntry;
+
+typedef struct
+{
+  SideLogEntry *entries;
+  uint32_t count;
+  uint32_t capacity;
+} SideLog;
+
+typedef struct
+{
+  Catalog *catalog;
+  char db_name[256];
+  TableDef table_def; // As it was when the build started
+  IndexDef index_def; // Goes into the catalog when the build is published
+  Table *table;
+  Table *index_table;
+  pthread_t thread;
+  struct timespec started;
+
+  // Guarded by the write lock
+  BuildState state;
+  SideLog log;
+  uint32_t rows_total; // Rows when the build started
+  uint32_t rows_scanned;
+  uint32_t changes_logged;
+  uint32_t changes_replayed;
+} OnlineIndexBuild;
+
+// One lock for every build: writes hold it for a whole statement, a
+// builder for one leaf copy or one side log hand-over
+static struct
+{
+  pthread_mutex_t lock;
+  OnlineIndexBuild *builds[ONLINE_INDEX_MAX_BUILDS];
+  uint32_t num_builds;
+} online = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+static double seconds_since(const struct timespec *start)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static void copy_row(DynamicRow *destination, DynamicRow *source)
+{
+  destination->data = malloc(source->data_size);
+  memcpy(destination->data, source->data, source->data_size);
+  destination->data_size = source->data_size;
+}
+
+static void side_log_free(SideLog *log)
+{
+  for (uint32_t i = 0; i < log->count; i++)
+  {
+    if (log->entries[i].has_old)
+    {
+      free(log->entries[i].old_row.data);
+    }
+    if (log->entries[i].has_new)
+    {
+      free(log->entries[i].new_row.data);
+    }
+  }
+  free(log->entries);
+  memset(log, 0, sizeof(SideLog));
+}
+
+// Apply logged writes to the new index in the order they were made
+static bool side_log_replay(OnlineIndexBuild *build, SideLog *log)
+{
+  for (uint32_t i = 0; i < log->count; i++)
+  {
+    SideLogEntry *entry = &log->entries[i];
+    if (!secondary_index_apply(&build->table_def, &build->index_def,
+                               build->index_table,
+                               entry->has_old ? &entry->old_row : NULL,
+                               entry->has_new ? &entry->new_row : NULL))
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Copy the rows after last_key, up to the end of the leaf they start in.
+// Called with the write lock held, so no write moves them meanwhile. The
+// session's SELECTs use the table's hot index without that lock, so the
+// seek goes down the tree instead.
+static uint32_t copy_batch(OnlineIndexBuild *build, DynamicRow *rows,
+                           uint8_t *last_key, bool first, bool *done)
+{
+  Table *table = build->table;
+  Cursor *cursor = first ? table_start(table) : table_seek_key_direct(table, last_key);
+  if (!first && !cursor->end_of_table &&
+      key_compare(&table->key,
+                  leaf_node_key(get_page(table->pager, cursor->page_num),
+                                cursor->cell_num),
+                  last_key) == 0)
+  {
+    cursor_advance(cursor);
+  }
+
+  uint32_t count = 0;
+  uint32_t leaf = cursor->page_num;
+  while (!cursor->end_of_table && cursor->page_num == leaf &&
+         count < ONLINE_INDEX_BATCH_ROWS)
+  {
+    deserialize_dynamic_row(cursor_value(cursor), &build->table_def,
+                            &rows[count++]);
+    memcpy(last_key,
+           leaf_node_key(get_page(table->pager, cursor->page_num),
+                         cursor->cell_num),
+           table->key.size);
+    cursor_advance(cursor);
+  }
+  *done = cursor->end_of_table;
+  cursor_close(cursor);
+  return count;
+}
+
+static void build_fail(OnlineIndexBuild *build)
+{
+  pthread_mutex_lock(&online.lock);
+  build->state = BUILD_FAILED;
+  pthread_mutex_unlock(&online.lock);
+}
+
+static void *build_main(void *arg)
+{
+  OnlineIndexBuild *build = arg;
+  DynamicRow rows[ONLINE_INDEX_BATCH_ROWS];
+  for (uint32_t i = 0; i < ONLINE_INDEX_BATCH_ROWS; i++)
+  {
+    dynamic_row_init(&rows[i], &build->table_def);
+  }
+
+  // Scan: the write lock is held only while a leaf is copied, and the
+  // entries are built after it is released
+  uint8_t last_key[BTREE_MAX_KEY_SIZE];
+  uint32_t scanned = 0;
+  bool done = false;
+  bool ok = true;
+  while (!done && ok)
+  {
+    pthread_mutex_lock(&online.lock);
+    build->rows_scanned = scanned;
+    uint32_t count = copy_batch(build, rows, last_key, scanned == 0, &done);
+    pthread_mutex_unlock(&online.lock);
+
+    for (uint32_t i = 0; i < count && ok; i++)
+    {
+      ok = secondary_index_apply(&build->table_def, &build->index_def,
+                                 build->index_table, NULL, &rows[i]);
+    }
+    scanned += count;
+    if (count == 0)
+    {
+      done = true;
+    }
+  }
+  for (uint32_t i = 0; i < ONLINE_INDEX_BATCH_ROWS; i++)
+  {
+    dynamic_row_free(&rows[i]);
+  }
+  if (!ok)
+  {
+    build_fail(build);
+    return NULL;
+  }
+
+  // Catch up: take the side log as it stands and replay it outside the
+  // lock, until what is left is short enough to replay while publishing
+  for (;;)
+  {
+    pthread_mutex_lock(&online.lock);
+    build->rows_scanned = scanned;
+    if (build->log.count < ONLINE_INDEX_HANDOFF_CHANGES)
+    {
+      build->state = BUILD_READY;
+      pthread_mutex_unlock(&online.lock);
+      return NULL;
+    }
+    SideLog pending = build->log;
+    memset(&build->log, 0, sizeof(SideLog));
+    build->state = BUILD_CATCHING_UP;
+    pthread_mutex_unlock(&online.lock);
+
+    ok = side_log_replay(build, &pending);
+    uint32_t replayed = pending.count;
+    side_log_free(&pending);
+    if (!ok)
+    {
+      build_fail(build);
+      return NULL;
+    }
+    pthread_mutex_lock(&online.lock);
+    build->changes_replayed += replayed;
+    pthread_mutex_unlock(&online.lock);
+  }
+}
+
+static void build_free(OnlineIndexBuild *build)
+{
+  if (build->index_table)
+  {
+    table_cache_release(build->index_table);
+  }
+  if (build->table)
+  {
+    table_cache_release(build->table);
+  }
+  side_log_free(&build->log);
+  free(build);
+}
+
+bool online_index_start(Catalog *catalog, const char *db_name,
+                        TableDef *table_def, IndexDef *index_def)
+{
+  if (online.num_builds == ONLINE_INDEX_MAX_BUILDS)
+  {
+    printf("Error: %d online index builds are already running.\n",
+           ONLINE_INDEX_MAX_BUILDS);
+    return false;
+  }
+
+  OnlineIndexBuild *build = calloc(1, sizeof(OnlineIndexBuild));
+  build->catalog = catalog;
+  strncpy(build->db_name, db_name, sizeof(build->db_name) - 1);
+  build->table_def = *table_def;
+  build->index_def = *index_def;
+
+  // Its own references, so the files stay open however the session
+  // switches tables
+  build->table = table_cache_acquire(table_def->filename);
+  build->index_table = table_cache_acquire(index_def->filename);
+  if (!build->table || !build->index_table)
+  {
+    printf("Error: Failed to open the files for index '%s'.\n", index_def->name);
+    build_free(build);
+    return false;
+  }
+  build->table->root_page_num = table_def->root_page_num;
+  table_set_key(build->table, &table_def->key);
+  if (!secondary_index_prepare(&build->index_def, build->index_table))
+  {
+    build_free(build);
+    return false;
+  }
+
+  // No write runs during this statement, so logging starts from the
+  // table as it is now
+  build->rows_total = table_count_rows(build->table);
+  build->state = BUILD_SCANNING;
+  clock_gettime(CLOCK_MONOTONIC, &build->started);
+
+  pthread_mutex_lock(&online.lock);
+  online.builds[online.num_builds++] = build;
+  pthread_mutex_unlock(&online.lock);
+
+  // Session statements read the table while the builder does, and either
+  // may load a page the other is loading; publish() undoes this after the
+  // join. Writes change pages only under the write lock, which holds the
+  // builder off.
+  pager_share_frames(build->table->pager);
+  if (pthread_create(&build->thread, NULL, build_main, build) != 0)
+  {
+    printf("Error: Failed to start the build of index '%s'.\n", index_def->name);
+    pager_unshare_frames(build->table->pager);
+    pthread_mutex_lock(&online.lock);
+    online.builds[--online.num_builds] = NULL;
+    pthread_mutex_unlock(&online.lock);
+    build_free(build);
+    return false;
+  }
+  return true;
+}
+
+void online_index_write_begin(void)
+{
+  pthread_mutex_lock(&online.lock);
+}
+
+void online_index_write_end(void)
+{
+  pthread_mutex_unlock(&online.lock);
+}
+
+void online_index_note_row(TableDef *table_def, DynamicRow *old_row,
+                           DynamicRow *new_row)
+{
+  for (uint32_t i = 0; i < online.num_builds; i++)
+  {
+    OnlineIndexBuild *build = online.builds[i];
+    if (strcmp(build->table_def.name, table_def->name) != 0 ||
+        build->state == BUILD_FAILED)
+    {
+      continue;
+    }
+
+    SideLog *log = &build->log;
+    if (log->count == log->capacity)
+    {
+      log->capacity = log->capacity ? log->capacity * 2 : 64;
+      log->entries = realloc(log->entries, log->capacity * sizeof(SideLogEntry));
+      if (!log->entries)
+      {
+        printf("Error: Out of memory logging a write for an index build\n");
+        exit(EXIT_FAILURE);
+      }
+    }
+    SideLogEntry *entry = &log->entries[log->count++];
+    entry->has_old = old_row != NULL;
+    entry->has_new = new_row != NULL;
+    if (old_row)
+    {
+      copy_row(&entry->old_row, old_row);
+    }
+    if (new_row)
+    {
+      copy_row(&entry->new_row, new_row);
+    }
+    build->changes_logged++;
+  }
+}
+
+// Replay the rest of the side log and put the index in the catalog. The
+// build is off the list and the builder has stopped, and no write runs
+// between statements, so nothing races this.
+static void publish(OnlineIndexBuild *build)
+{
+  pthread_join(build->thread, NULL);
+  pager_unshare_frames(build->table->pager);
+  IndexDef *index_def = &build->index_def;
+  const char *table_name = build->table_def.name;
+
+  bool ok = build->state == BUILD_READY;
+  uint32_t replayed = build->changes_replayed + build->log.count;
+  if (ok)
+  {
+    ok = side_log_replay(build, &build->log);
+  }
+  if (ok && index_def->type == INDEX_TYPE_BITMAP)
+  {
+    ok = bitmap_index_save(build->index_table);
+  }
+  if (ok && index_def->type == INDEX_TYPE_FULLTEXT)
+  {
+    ok = fulltext_index_save(build->index_table);
+  }
+  index_def->root_page_num = build->index_table->root_page_num;
+  if (!ok)
+  {
+    printf("Error: Online build of index '%s' on table '%s' failed.\n",
+           index_def->name, table_name);
+    build_free(build);
+    return;
+  }
+
+  int table_idx = catalog_find_table(build->catalog, table_name);
+  TableDef *table_def = table_idx == -1 ? NULL : &build->catalog->tables[table_idx];
+  if (!table_def || table_def->num_indexes >= MAX_INDEXES_PER_TABLE)
+  {
+    printf("Error: No room left in the catalog for index '%s' on table '%s'.\n",
+           index_def->name, table_name);
+    build_free(build);
+    return;
+  }
+  table_def->indexes[table_def->num_indexes++] = *index_def;
+  catalog_save(build->catalog, build->db_name);
+
+  printf("Index '%s' on table '%s' is ready: %u rows scanned, %u concurrent "
+         "changes replayed, %.2fs.\n",
+         index_def->name, table_name, build->rows_scanned, replayed,
+         seconds_since(&build->started));
+  build_free(build);
+}
+
+// Take the builds of the catalog off the list, all of them or only those
+// whose builder is done
+static uint32_t detach_builds(Catalog *catalog, bool finished_only,
+                              OnlineIndexBuild **detached)
+{
+  uint32_t count = 0;
+  pthread_mutex_lock(&online.lock);
+  for (uint32_t i = 0; i < online.num_builds;)
+  {
+    OnlineIndexBuild *build = online.builds[i];
+    bool finished = build->state == BUILD_READY || build->state == BUILD_FAILED;
+    if (build->catalog == catalog && (finished || !finished_only))
+    {
+      detached[count++] = build;
+      online.builds[i] = online.builds[--online.num_builds];
+    }
+    else
+    {
+      i++;
+    }
+  }
+  pthread_mutex_unlock(&online.lock);
+  return count;
+}
+
+void online_index_publish_ready(Catalog *catalog)
+{
+  OnlineIndexBuild *detached[ONLINE_INDEX_MAX_BUILDS];
+  uint32_t count = detach_builds(catalog, true, detached);
+  for (uint32_t i = 0; i < count; i++)
+  {
+    publish(detached[i]);
+  }
+}
+
+void online_index_finish_all(Catalog *catalog)
+{
+  OnlineIndexBuild *detached[ONLINE_INDEX_MAX_BUILDS];
+  uint32_t count = detach_builds(catalog, false, detached);
+  for (uint32_t i = 0; i < count; i++)
+  {
+    printf("Waiting for the build of index '%s' to finish...\n",
+           detached[i]->index_def.name);
+    publish(detached[i]);
+  }
+}
+
+// Only the session thread adds builds to the list or takes them off, so it
+// can read the list without the lock, as it must while a write holds it
+
+bool online_index_building(const char *table_name, const char *index_name)
+{
+  for (uint32_t i = 0; i < online.num_builds; i++)
+  {
+    if (strcmp(online.builds[i]->table_def.name, table_name) == 0 &&
+        strcmp(online.builds[i]->index_def.name, index_name) == 0)
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+uint32_t online_index_pending(const char *table_name)
+{
+  uint32_t count = 0;
+  for (uint32_t i = 0; i < online.num_builds; i++)
+  {
+    if (strcmp(online.builds[i]->table_def.name, table_name) == 0)
+    {
+      count++;
+    }
+  }
+  return count;
+}
+
+void online_index_print(const char *table_name)
+{
+  bool header = false;
+  pthread_mutex_lock(&online.lock);
+  for (uint32_t i = 0; i < online.num_builds; i++)
+  {
+    OnlineIndexBuild *build = online.builds[i];
+    if (strcmp(build->table_def.name, table_name) != 0)
+    {
+      continue;
+    }
+    if (!header)
+    {
+      printf("Building online:\n");
+      header = true;
+    }
+
+    char progress[160];
+    uint32_t total = build->rows_total > build->rows_scanned ? build->rows_total
+                                                             : build->rows_scanned;
+    switch (build->state)
+    {
+    case BUILD_SCANNING:
+    {
+      // Time left at the rate rows have been scanned so far
+      int length = snprintf(progress, sizeof(progress),
+                            "%u of %u rows scanned (%u%%), %u changes logged",
+                            build->rows_scanned, total,
+                            total ? (uint32_t)(100ull * build->rows_scanned / total)
+                                  : 100,
+                            build->changes_logged);
+      if (build->rows_scanned > 0)
+      {
+        double elapsed = seconds_since(&build->started);
+        snprintf(progress + length, sizeof(progress) - length, ", ETA %.1fs",
+                 elapsed * (total - build->rows_scanned) / build->rows_scanned);
+      }
+      break;
+    }
+    case BUILD_CATCHING_UP:
+      snprintf(progress, sizeof(progress),
+               "%u rows scanned, replaying changes (%u of %u done)",
+               build->rows_scanned, build->changes_replayed,
+               build->changes_logged);
+      break;
+    case BUILD_READY:
+      snprintf(progress, sizeof(progress),
+               "%u rows scanned, published by the next statement",
+               build->rows_scanned);
+      break;
+    case BUILD_FAILED:
+      snprintf(progress, sizeof(progress), "failed");
+      break;
+    }
+    IndexDef *index = &build->index_def;
+    char indexed[MAX_COLUMN_NAME + 32];
+    column_func_format(&index->expr, index->column_name, indexed,
+                       sizeof(indexed));
+    printf("  %-20s | %-20s | %-8s | %s\n", index->name, indexed,
+           index->type == INDEX_TYPE_HASH       ? "HASH"
+           : index->type == INDEX_TYPE_BITMAP   ? "BITMAP"
+           : index->type == INDEX_TYPE_FULLTEXT ? "FULLTEXT"
+                                                : "BTREE",
+           progress);
+  }
+  pthread_mutex_unlock(&online.lock);
+}
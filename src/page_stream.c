@@ -0,0 +1,66 @@
+#include "../include/page_stream.h"
+#include "../include/table.h"
+#include <stdlib.h>
+#include <string.h>
+
+static size_t page_payload(void)
+{
+  return PAGE_SIZE - PAGE_STREAM_PREFIX;
+}
+
+size_t page_stream_capacity(void)
+{
+  return page_payload() * TABLE_MAX_PAGES;
+}
+
+const uint8_t *page_stream_start(Pager *pager, uint8_t header_type)
+{
+  uint8_t *page = get_page(pager, 0);
+  if (page[0] != header_type)
+  {
+    return NULL;
+  }
+  pager->stream_file = true;
+  return page + PAGE_STREAM_PREFIX;
+}
+
+uint8_t *page_stream_read(Pager *pager, size_t size)
+{
+  uint8_t *stream = malloc(size);
+  for (uint32_t page_num = 0; (size_t)page_num * page_payload() < size;
+       page_num++)
+  {
+    size_t offset = (size_t)page_num * page_payload();
+    size_t remaining = size - offset;
+    memcpy(stream + offset,
+           (uint8_t *)get_page(pager, page_num) + PAGE_STREAM_PREFIX,
+           remaining < page_payload() ? remaining : page_payload());
+  }
+  return stream;
+}
+
+void page_stream_write(Pager *pager, uint8_t header_type, uint8_t data_type,
+                       const uint8_t *stream, size_t size)
+{
+  uint8_t *image = malloc(PAGE_SIZE);
+  pager->stream_file = true;
+  for (uint32_t page_num = 0; (size_t)page_num * page_payload() < size;
+       page_num++)
+  {
+    size_t offset = (size_t)page_num * page_payload();
+    size_t chunk = size - offset < page_payload() ? size - offset : page_payload();
+    memset(image, 0, PAGE_SIZE);
+    image[0] = page_num == 0 ? header_type : data_type;
+    memcpy(image + PAGE_STREAM_PREFIX, stream + offset, chunk);
+
+    // A page past the end of the file is written even if it looks the same
+    uint8_t *page = get_page(pager, page_num);
+    if (memcmp(page, image, PAGE_SIZE) != 0 ||
+        (uint64_t)(page_num + 1) * PAGE_SIZE > pager->file_length)
+    {
+      memcpy(page, image, PAGE_SIZE);
+      pager->page_dirty[page_num] = true;
+    }
+  }
+  free(image);
+}
@@ -0,0 +1,257 @@
+#include "../include/parallel_scan.h"
+#include "../include/btree.h"
+#include "../include/pager.h"
+#include "../include/query_profile.h"
+#include "../include/vector_filter.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+typedef struct
+{
+  Table *table;
+  TableDef *table_def;
+  ScanPredicate predicate;
+  void *ctx;
+  const CompiledPredicate *compiled;
+  uint32_t *leaves;
+  uint32_t first_leaf;
+  uint32_t end_leaf;
+  ScanResult result;
+} ScanWorker;
+
+uint32_t parallel_scan_default_threads()
+{
+  long cores = sysconf(_SC_NPROCESSORS_ONLN);
+  if (cores < 1)
+  {
+    return 1;
+  }
+  if (cores > SCAN_MAX_THREADS)
+  {
+    return SCAN_MAX_THREADS;
+  }
+  return (uint32_t)cores;
+}
+
+void scan_result_append(ScanResult *result, DynamicRow *row)
+{
+  if (result->num_rows == result->capacity)
+  {
+    result->capacity = result->capacity ? result->capacity * 2 : 64;
+    result->rows = realloc(result->rows, result->capacity * sizeof(DynamicRow));
+    if (!result->rows)
+    {
+      printf("Error: Out of memory during scan\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+  result->rows[result->num_rows++] = *row;
+}
+
+void scan_result_free(ScanResult *result)
+{
+  for (uint32_t i = 0; i < result->num_rows; i++)
+  {
+    dynamic_row_free(&result->rows[i]);
+  }
+  free(result->rows);
+  result->rows = NULL;
+  result->num_rows = 0;
+  result->capacity = 0;
+}
+
+static void collect_leaves(Pager *pager, uint32_t page_num, uint32_t **leaves,
+                           uint32_t *num_leaves, uint32_t *capacity)
+{
+  void *node = get_page(pager, page_num);
+  if (get_node_type(node) == NODE_LEAF)
+  {
+    if (*num_leaves == *capacity)
+    {
+      *capacity *= 2;
+      *leaves = realloc(*leaves, *capacity * sizeof(uint32_t));
+    }
+    (*leaves)[(*num_leaves)++] = page_num;
+    return;
+  }
+
+  uint32_t num_keys = *internal_node_num_keys(node);
+  for (uint32_t i = 0; i < num_keys; i++)
+  {
+    collect_leaves(pager, *internal_node_child(node, i), leaves, num_leaves,
+                   capacity);
+  }
+  collect_leaves(pager, *internal_node_right_child(node), leaves, num_leaves,
+                 capacity);
+}
+
+uint32_t *scan_collect_leaves(Table *table, uint32_t *num_leaves)
+{
+  uint32_t capacity = 16;
+  uint32_t *leaves = malloc(capacity * sizeof(uint32_t));
+  *num_leaves = 0;
+  collect_leaves(table->pager, table->root_page_num, &leaves, num_leaves,
+                 &capacity);
+  return leaves;
+}
+
+// Evaluate a compiled predicate a whole leaf at a time and deserialize only
+// the rows that were selected
+static void scan_leaf_batch(ScanWorker *worker, void *node)
+{
+  void *values[VECTOR_BATCH_MAX];
+  SelectionBitmap selection;
+  uint32_t num_cells = predicate_eval_leaf(node, worker->compiled, values,
+                                           &selection);
+
+  for (uint32_t w = 0; w * 64 < num_cells; w++)
+  {
+    uint64_t word = selection.words[w];
+    while (word)
+    {
+      uint32_t c = w * 64 + __builtin_ctzll(word);
+      word &= word - 1;
+
+      DynamicRow row;
+      deserialize_dynamic_row(values[c], worker->table_def, &row);
+      scan_result_append(&worker->result, &row);
+    }
+  }
+}
+
+static void scan_leaf_range(ScanWorker *worker)
+{
+  Pager *pager = worker->table->pager;
+  for (uint32_t l = worker->first_leaf; l < worker->end_leaf; l++)
+  {
+    uint32_t page_num = worker->leaves[l];
+    pager_latch(pager, page_num, LATCH_SHARED);
+    void *node = get_page(pager, page_num);
+    PROFILE_COUNT(PROFILE_ROWS_SCANNED, *leaf_node_num_cells(node));
+    if (worker->compiled)
+    {
+      scan_leaf_batch(worker, node);
+      pager_unlatch(pager, page_num);
+      continue;
+    }
+    uint32_t num_cells = *leaf_node_num_cells(node);
+
+    // Walk the cells directly rather than through leaf_node_cell, which
+    // would rescan the variable-size cells from the start of the node
+    uint8_t *cell = (uint8_t *)leaf_node_cell(node, 0);
+    uint32_t key_size = node_key_size(node);
+    uint32_t header_size = leaf_node_cell_header_size(node);
+    for (uint32_t c = 0; c < num_cells; c++)
+    {
+      uint32_t value_size = *(uint32_t *)(cell + key_size);
+      void *value = cell + header_size;
+
+      DynamicRow row;
+      deserialize_dynamic_row(value, worker->table_def, &row);
+      if (!worker->predicate ||
+          worker->predicate(&row, worker->table_def, worker->ctx))
+      {
+        scan_result_append(&worker->result, &row);
+      }
+      else
+      {
+        dynamic_row_free(&row);
+      }
+      cell += header_size + value_size;
+    }
+    pager_unlatch(pager, page_num);
+  }
+}
+
+static void *scan_worker_main(void *arg)
+{
+  scan_leaf_range((ScanWorker *)arg);
+  return NULL;
+}
+
+static void run_scan(Table *table, TableDef *table_def, ScanPredicate predicate,
+                     void *ctx, const CompiledPredicate *compiled,
+                     uint32_t num_threads, ScanResult *result)
+{
+  memset(result, 0, sizeof(ScanResult));
+
+  uint32_t num_leaves = 0;
+  uint32_t *leaves = scan_collect_leaves(table, &num_leaves);
+
+  if (num_threads < 1)
+  {
+    num_threads = 1;
+  }
+  if (num_threads > SCAN_MAX_THREADS)
+  {
+    num_threads = SCAN_MAX_THREADS;
+  }
+  uint32_t max_useful = num_leaves / SCAN_MIN_LEAVES_PER_THREAD;
+  if (num_threads > max_useful)
+  {
+    num_threads = max_useful > 0 ? max_useful : 1;
+  }
+
+  ScanWorker workers[SCAN_MAX_THREADS];
+  pthread_t threads[SCAN_MAX_THREADS];
+  uint32_t per_worker = num_leaves / num_threads;
+  uint32_t remainder = num_leaves % num_threads;
+  uint32_t next_leaf = 0;
+
+  for (uint32_t t = 0; t < num_threads; t++)
+  {
+    uint32_t count = per_worker + (t < remainder ? 1 : 0);
+    workers[t] = (ScanWorker){table, table_def, predicate, ctx, compiled,
+                              leaves, next_leaf, next_leaf + count, {0}};
+    next_leaf += count;
+  }
+
+  if (num_threads == 1)
+  {
+    scan_leaf_range(&workers[0]);
+  }
+  else
+  {
+    // The calling thread takes the first range itself
+    for (uint32_t t = 1; t < num_threads; t++)
+    {
+      pthread_create(&threads[t], NULL, scan_worker_main, &workers[t]);
+    }
+    scan_leaf_range(&workers[0]);
+    for (uint32_t t = 1; t < num_threads; t++)
+    {
+      pthread_join(threads[t], NULL);
+    }
+  }
+
+  // Ranges are contiguous and in leaf order, so concatenating them in worker
+  // order yields the rows in primary key order
+  *result = workers[0].result;
+  for (uint32_t t = 1; t < num_threads; t++)
+  {
+    ScanResult *part = &workers[t].result;
+    for (uint32_t i = 0; i < part->num_rows; i++)
+    {
+      scan_result_append(result, &part->rows[i]);
+    }
+    free(part->rows);
+  }
+
+  free(leaves);
+}
+
+void parallel_scan(Table *table, TableDef *table_def, ScanPredicate predicate,
+                   void *ctx, uint32_t num_threads, ScanResult *result)
+{
+  run_scan(table, table_def, predicate, ctx, NULL, num_threads, result);
+}
+
+void parallel_scan_compiled(Table *table, TableDef *table_def,
+                            const CompiledPredicate *predicate,
+                            uint32_t num_threads, ScanResult *result)
+{
+  run_scan(table, table_def, NULL, NULL, predicate, num_threads, result);
+}
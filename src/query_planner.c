@@ -0,0 +1,2241 @@
+#include "../include/query_planner.h"
+#include "../include/btree.h"
+#include "../include/column_func.h"
+#include "../include/data_utils.h"
+#include "../include/cursor.h"
+#include "../include/hash_index.h"
+#include "../include/secondary_index.h"
+#include "../include/table_cache.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#define MAX_CONJUNCTS 64
+
+// Split the top-level ANDs of a WHERE clause into its conjuncts
+static void collect_conjuncts(SqlExpr *expr, SqlExpr **conjuncts,
+                              uint32_t *count)
+{
+  if (expr->type == SQL_EXPR_AND && *count < MAX_CONJUNCTS - 1)
+  {
+    collect_conjuncts(expr->left, conjuncts, count);
+    collect_conjuncts(expr->right, conjuncts, count);
+    return;
+  }
+  conjuncts[(*count)++] = expr;
+}
+
+// An integer literal as the filter converts it for the column, or false
+// if the column's values are not integers
+static bool integer_literal(ColumnType type, const char *text, int64_t *value)
+{
+  switch (type)
+  {
+  case COLUMN_TYPE_INT:
+  case COLUMN_TYPE_DATE:
+  case COLUMN_TYPE_TIME:
+    *value = (int32_t)integer_literal_value(type, text);
+    return true;
+  case COLUMN_TYPE_BIGINT:
+  case COLUMN_TYPE_TIMESTAMP:
+    *value = integer_literal_value(type, text);
+    return true;
+  default:
+    return false;
+  }
+}
+
+// True if every row that satisfies the comparison expr also satisfies
+// implied. Integer columns are compared on their literals' values, so
+// x = 5 implies x > 3 and x >= 10 implies x != 2. Other columns only
+// imply the same comparison, or != a value other than the one x = names.
+static bool compare_implies(const SqlExpr *expr, const SqlExpr *implied,
+                            TableDef *table_def)
+{
+  if (expr->type != SQL_EXPR_COMPARE || implied->type != SQL_EXPR_COMPARE ||
+      strcasecmp(expr->column, implied->column) != 0 ||
+      !column_func_equal(&expr->func, &implied->func))
+  {
+    return false;
+  }
+  if (expr->op == SQL_OP_MATCH || implied->op == SQL_OP_MATCH)
+  {
+    // AND and OR in a MATCH query are only operators in capitals, so
+    // texts equal but for case can differ in meaning
+    return expr->op == implied->op &&
+           strcmp(expr->value.text, implied->value.text) == 0;
+  }
+  if (expr->func.type != COLUMN_FUNC_NONE)
+  {
+    // Functions of a column only imply the same comparison
+    return expr->op == implied->op &&
+           strcasecmp(expr->value.text, implied->value.text) == 0;
+  }
+  int column_idx = table_def_find_column(table_def, expr->column);
+  if (column_idx == -1)
+  {
+    return false;
+  }
+  ColumnType type = table_def->columns[column_idx].type;
+  SqlCompareOp op = expr->op;
+  int64_t value, bound;
+  if (op != SQL_OP_LIKE && implied->op != SQL_OP_LIKE &&
+      integer_literal(type, expr->value.text, &value) &&
+      integer_literal(type, implied->value.text, &bound))
+  {
+    switch (implied->op)
+    {
+    case SQL_OP_EQ:
+      return op == SQL_OP_EQ && value == bound;
+    case SQL_OP_NE:
+      return (op == SQL_OP_EQ && value != bound) ||
+             (op == SQL_OP_NE && value == bound) ||
+             ((op == SQL_OP_LT || op == SQL_OP_LE) && value < bound) ||
+             (op == SQL_OP_LT && value == bound) ||
+             ((op == SQL_OP_GT || op == SQL_OP_GE) && value > bound) ||
+             (op == SQL_OP_GT && value == bound);
+    case SQL_OP_LT:
+      return (op == SQL_OP_EQ || op == SQL_OP_LE) ? value < bound
+                                                  : op == SQL_OP_LT && value <= bound;
+    case SQL_OP_LE:
+      return (op == SQL_OP_EQ || op == SQL_OP_LE || op == SQL_OP_LT) &&
+             value <= bound;
+    case SQL_OP_GT:
+      return (op == SQL_OP_EQ || op == SQL_OP_GE) ? value > bound
+                                                  : op == SQL_OP_GT && value >= bound;
+    case SQL_OP_GE:
+      return (op == SQL_OP_EQ || op == SQL_OP_GE || op == SQL_OP_GT) &&
+             value >= bound;
+    default:
+      return false;
+    }
+  }
+
+  // Strings and LIKE patterns compare ignoring case, booleans by truth and
+  // floats by value
+  bool same;
+  switch (type)
+  {
+  case COLUMN_TYPE_BOOLEAN:
+    same = (strcasecmp(expr->value.text, "true") == 0 ||
+            strcmp(expr->value.text, "1") == 0) ==
+           (strcasecmp(implied->value.text, "true") == 0 ||
+            strcmp(implied->value.text, "1") == 0);
+    break;
+  case COLUMN_TYPE_FLOAT:
+    same = atof(expr->value.text) == atof(implied->value.text);
+    break;
+  default:
+    same = strcasecmp(expr->value.text, implied->value.text) == 0;
+    break;
+  }
+  if (op == implied->op)
+  {
+    return same;
+  }
+  // Float equality has a tolerance, so x = 1.0 may hold where x != 1.0001
+  return op == SQL_OP_EQ && implied->op == SQL_OP_NE && !same &&
+         (type == COLUMN_TYPE_STRING || type == COLUMN_TYPE_BOOLEAN);
+}
+
+// True if every row that satisfies expr also satisfies implied. Sound but
+// not complete: it looks through AND and OR on either side down to single
+// comparisons, which is how partial index conditions are written.
+static bool expr_implies(const SqlExpr *expr, const SqlExpr *implied,
+                         TableDef *table_def)
+{
+  if (implied->type == SQL_EXPR_AND)
+  {
+    return expr_implies(expr, implied->left, table_def) &&
+           expr_implies(expr, implied->right, table_def);
+  }
+  if (expr->type == SQL_EXPR_AND)
+  {
+    return expr_implies(expr->left, implied, table_def) ||
+           expr_implies(expr->right, implied, table_def);
+  }
+  if (expr->type == SQL_EXPR_OR)
+  {
+    return expr_implies(expr->left, implied, table_def) &&
+           expr_implies(expr->right, implied, table_def);
+  }
+  if (implied->type == SQL_EXPR_OR)
+  {
+    return expr_implies(expr, implied->left, table_def) ||
+           expr_implies(expr, implied->right, table_def);
+  }
+  return compare_implies(expr, implied, table_def);
+}
+
+bool query_plan_index_usable(const IndexDef *index, const SqlExpr *where,
+                             TableDef *table_def)
+{
+  if (index->predicate[0] == '\0')
+  {
+    return true;
+  }
+  if (!where)
+  {
+    return false;
+  }
+  // Writes skip an index whose condition no longer compiles
+  Table *index_table = query_plan_open_index(index);
+  const CompiledExpr *compiled;
+  bool maintained =
+      index_table && index_predicate_get(index_table, table_def, index, &compiled);
+  if (index_table)
+  {
+    table_cache_release(index_table);
+  }
+  if (!maintained)
+  {
+    return false;
+  }
+  char error[SQL_MAX_ERROR];
+  SqlExpr *predicate = sql_parse_expr(index->predicate, error, sizeof(error));
+  bool usable = predicate && expr_implies(where, predicate, table_def);
+  sql_expr_free(predicate);
+  return usable;
+}
+
+// True if every write keeps the index file current. A file that does not
+// open as its type, such as a B-tree file from when entries were keyed on
+// the hash alone, would miss the rows written since, so it is never planned.
+static bool index_maintained(const IndexDef *index)
+{
+  Table *index_table = query_plan_open_index(index);
+  if (!index_table)
+  {
+    return false;
+  }
+  table_cache_release(index_table);
+  return true;
+}
+
+IndexDef *query_plan_find_index(TableDef *table_def, int column_idx,
+                                const SqlExpr *where)
+{
+  if (table_def->columns[column_idx].type != COLUMN_TYPE_INT)
+  {
+    return NULL;
+  }
+
+  IndexDef *best = NULL;
+  for (uint32_t i = 0; i < table_def->num_indexes; i++)
+  {
+    IndexDef *index = &table_def->indexes[i];
+    if (index->type == INDEX_TYPE_BITMAP || index->type == INDEX_TYPE_FULLTEXT ||
+        index->expr.type != COLUMN_FUNC_NONE ||
+        strcasecmp(index->column_name, table_def->columns[column_idx].name) != 0 ||
+        !query_plan_index_usable(index, where, table_def) ||
+        !index_maintained(index))
+    {
+      continue;
+    }
+    // A unique index bounds the matches; between equals a hash probe
+    // reads fewer pages than a descent
+    if (!best || (index->is_unique && !best->is_unique) ||
+        (index->is_unique == best->is_unique &&
+         index->type == INDEX_TYPE_HASH && best->type != INDEX_TYPE_HASH))
+    {
+      best = index;
+    }
+  }
+  return best;
+}
+
+// The expression index that answers expr, an equality on a function of a
+// column or on a STRING column, or NULL. Equality on a string ignores
+// case, so lower(c), upper(c) and c itself all find an index on either.
+static IndexDef *find_expression_index(TableDef *table_def, const SqlExpr *expr,
+                                       int column_idx, const SqlExpr *where)
+{
+  ColumnType type = table_def->columns[column_idx].type;
+  IndexDef *best = NULL;
+  for (uint32_t i = 0; i < table_def->num_indexes; i++)
+  {
+    IndexDef *index = &table_def->indexes[i];
+    if (index->type == INDEX_TYPE_BITMAP || index->expr.type == COLUMN_FUNC_NONE ||
+        strcasecmp(index->column_name, table_def->columns[column_idx].name) != 0 ||
+        !(column_func_equal(&index->expr, &expr->func) ||
+          (column_func_case_only(&index->expr, type) &&
+           column_func_case_only(&expr->func, type))) ||
+        !query_plan_index_usable(index, where, table_def) ||
+        !index_maintained(index))
+    {
+      continue;
+    }
+    if (!best || (index->is_unique && !best->is_unique) ||
+        (index->is_unique == best->is_unique &&
+         index->type == INDEX_TYPE_HASH && best->type != INDEX_TYPE_HASH))
+    {
+      best = index;
+    }
+  }
+  return best;
+}
+
+// The key a probe of the index looks up for the conjunct's literal
+static void probe_key(TableDef *table_def, const IndexDef *index,
+                      const SqlExpr *expr, QueryPlan *plan)
+{
+  if (index->expr.type == COLUMN_FUNC_NONE)
+  {
+    int column = table_def_find_column(table_def, index->column_name);
+    ColumnType type =
+        column >= 0 ? table_def->columns[column].type : COLUMN_TYPE_INT;
+    int32_t value = (int32_t)integer_literal_value(type, expr->value.text);
+    memcpy(plan->probe_key, &value, sizeof(value));
+    plan->probe_key_size = sizeof(value);
+    return;
+  }
+  ColumnFuncValue value;
+  column_func_literal(&index->expr, expr->value.text, &value);
+  plan->probe_key_size = column_func_key(&value, plan->probe_key);
+}
+
+Table *query_plan_open_index(const IndexDef *index)
+{
+  Table *index_table = table_cache_acquire(index->filename);
+  if (index_table && index->type == INDEX_TYPE_HASH &&
+      !hash_index_valid(index_table))
+  {
+    table_cache_release(index_table);
+    return NULL;
+  }
+  if (index_table && index->type == INDEX_TYPE_BTREE &&
+      !secondary_index_set_key(index_table))
+  {
+    table_cache_release(index_table);
+    return NULL;
+  }
+  return index_table;
+}
+
+double query_plan_index_probe_cost(const IndexDef *index, double depth)
+{
+  if (index->type == INDEX_TYPE_HASH)
+  {
+    return HASH_INDEX_PROBE_PAGES * PAGE_COST;
+  }
+  return depth * PAGE_COST;
+}
+
+// The full-text index that answers a MATCH on the column, or NULL
+static IndexDef *find_fulltext_index(TableDef *table_def, int column_idx,
+                                     const SqlExpr *where)
+{
+  for (uint32_t i = 0; i < table_def->num_indexes; i++)
+  {
+    IndexDef *index = &table_def->indexes[i];
+    if (index->type == INDEX_TYPE_FULLTEXT &&
+        strcasecmp(index->column_name, table_def->columns[column_idx].name) == 0 &&
+        query_plan_index_usable(index, where, table_def))
+    {
+      return index;
+    }
+  }
+  return NULL;
+}
+
+// Lookups and ranges are planned on a key of one integer column. A
+// composite key's leading column could bound a range too, but its encoded
+// bounds would need every other key column padded out; those tables scan.
+static bool is_primary_key_compare(SqlExpr *expr, TableDef *table_def)
+{
+  return expr->type == SQL_EXPR_COMPARE && expr->func.type == COLUMN_FUNC_NONE &&
+         table_def->key.type != KEY_BYTES &&
+         table_def_find_column(table_def, expr->column) ==
+             (int)table_def->key_columns[0];
+}
+
+// Same literal conversion as the compiled comparison uses
+static int64_t key_literal(SqlExpr *expr, TableDef *table_def)
+{
+  ColumnType type = table_def->columns[table_def->key_columns[0]].type;
+  int64_t value = integer_literal_value(type, expr->value.text);
+  return table_def->key.type == KEY_INT64 ? value : (int32_t)value;
+}
+
+static int64_t key_max_value(TableDef *table_def)
+{
+  return table_def->key.type == KEY_INT64 ? INT64_MAX : UINT32_MAX;
+}
+
+static bool is_range_op(SqlCompareOp op)
+{
+  return op == SQL_OP_LT || op == SQL_OP_LE || op == SQL_OP_GT ||
+         op == SQL_OP_GE;
+}
+
+static bool batch_supported(SqlExpr *expr, TableDef *table_def)
+{
+  if (expr->type != SQL_EXPR_COMPARE || expr->op != SQL_OP_EQ ||
+      expr->func.type != COLUMN_FUNC_NONE)
+  {
+    return false;
+  }
+  int column_idx = table_def_find_column(table_def, expr->column);
+  if (column_idx == -1)
+  {
+    return false;
+  }
+  switch (table_def->columns[column_idx].type)
+  {
+  case COLUMN_TYPE_INT:
+  case COLUMN_TYPE_FLOAT:
+  case COLUMN_TYPE_STRING:
+  case COLUMN_TYPE_BOOLEAN:
+    return true;
+  default:
+    return false;
+  }
+}
+
+// Fraction of rows expected to satisfy expr
+static double expr_selectivity(SqlExpr *expr, TableDef *table_def)
+{
+  if (expr->type == SQL_EXPR_AND)
+  {
+    return expr_selectivity(expr->left, table_def) *
+           expr_selectivity(expr->right, table_def);
+  }
+  if (expr->type == SQL_EXPR_OR)
+  {
+    double left = expr_selectivity(expr->left, table_def);
+    double right = expr_selectivity(expr->right, table_def);
+    return left + right - left * right;
+  }
+
+  int column_idx = table_def_find_column(table_def, expr->column);
+  if (column_idx == -1)
+  {
+    return 1.0;
+  }
+  // Statistics describe the column's values, not a function of them,
+  // unless the function only changes case
+  if (expr->func.type != COLUMN_FUNC_NONE &&
+      !column_func_case_only(&expr->func, table_def->columns[column_idx].type))
+  {
+    switch (expr->op)
+    {
+    case SQL_OP_EQ:
+      return STATS_DEFAULT_EQ_SELECTIVITY;
+    case SQL_OP_NE:
+      return 1.0 - STATS_DEFAULT_EQ_SELECTIVITY;
+    default:
+      return STATS_DEFAULT_RANGE_SELECTIVITY;
+    }
+  }
+  TableStats *stats = &table_def->stats;
+  double value = atof(expr->value.text);
+  switch (expr->op)
+  {
+  case SQL_OP_EQ:
+    return stats_eq_selectivity(stats, column_idx);
+  case SQL_OP_NE:
+    return 1.0 - stats_eq_selectivity(stats, column_idx);
+  case SQL_OP_LT:
+    return stats_less_selectivity(stats, column_idx, value, false);
+  case SQL_OP_LE:
+    return stats_less_selectivity(stats, column_idx, value, true);
+  case SQL_OP_GT:
+    return 1.0 - stats_less_selectivity(stats, column_idx, value, true);
+  case SQL_OP_GE:
+    return 1.0 - stats_less_selectivity(stats, column_idx, value, false);
+  case SQL_OP_LIKE:
+  case SQL_OP_MATCH:
+    return STATS_DEFAULT_LIKE_SELECTIVITY;
+  }
+  return 1.0;
+}
+
+static void add_candidate(QueryPlan *plan, AccessMethod access, IndexDef *index,
+                          double cost, double rows)
+{
+  PlanCandidate *candidate = &plan->candidates[plan->num_candidates++];
+  candidate->access = access;
+  candidate->index = index;
+  candidate->cost = cost;
+  candidate->rows = rows;
+  candidate->index_only = false;
+}
+
+// Mark the columns a condition reads; false if it names one the table
+// does not have
+static bool mark_expr_columns(const SqlExpr *expr, TableDef *table_def,
+                              bool *read)
+{
+  if (expr->type != SQL_EXPR_COMPARE)
+  {
+    return mark_expr_columns(expr->left, table_def, read) &&
+           mark_expr_columns(expr->right, table_def, read);
+  }
+  int column_idx = table_def_find_column(table_def, expr->column);
+  if (column_idx == -1)
+  {
+    return false;
+  }
+  read[column_idx] = true;
+  return true;
+}
+
+// The columns a query reads anywhere: select list, WHERE, ORDER BY,
+// aggregates and GROUP BY. False if it reads every column.
+static bool query_columns_read(const SelectOptions *options, SqlExpr **conjuncts,
+                               uint32_t count, TableDef *table_def, bool *read)
+{
+  memset(read, 0, MAX_COLUMNS * sizeof(bool));
+  if (options->aggregate)
+  {
+    const AggregateSpec *spec = options->aggregate;
+    for (uint32_t i = 0; i < spec->num_outputs; i++)
+    {
+      if (spec->outputs[i].column >= 0)
+      {
+        read[spec->outputs[i].column] = true;
+      }
+    }
+    for (uint32_t i = 0; i < spec->num_group_keys; i++)
+    {
+      read[spec->group_keys[i].column] = true;
+    }
+  }
+  else
+  {
+    if (options->num_select_columns == 0)
+    {
+      return false;
+    }
+    for (uint32_t i = 0; i < options->num_select_columns; i++)
+    {
+      int column_idx = table_def_find_column(table_def, options->select_columns[i]);
+      if (column_idx == -1)
+      {
+        return false;
+      }
+      read[column_idx] = true;
+    }
+  }
+  for (uint32_t i = 0; i < options->num_order_by; i++)
+  {
+    int column_idx = table_def_find_column(table_def, options->order_by[i].column);
+    if (column_idx == -1)
+    {
+      return false;
+    }
+    read[column_idx] = true;
+  }
+  for (uint32_t i = 0; i < count; i++)
+  {
+    if (!mark_expr_columns(conjuncts[i], table_def, read))
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+// An index entry holds the row's primary key, the indexed column (not if
+// it is keyed on a function of it) and the INCLUDE columns
+static bool index_covers(const IndexDef *index, int column_idx,
+                         TableDef *table_def, const bool *read)
+{
+  for (uint32_t i = 0; i < table_def->num_columns; i++)
+  {
+    bool held = i == table_def->key_columns[0] ||
+                ((int)i == column_idx && index->expr.type == COLUMN_FUNC_NONE);
+    for (uint32_t j = 0; !held && j < index->num_include; j++)
+    {
+      held = index->include_columns[j] == i;
+    }
+    if (read[i] && !held)
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+// The indexes an equality conjunct can probe: the preferred one, and one
+// on the same column that covers the query if the preferred one does not.
+// Index keys are hashes of the raw column bytes, so only types whose
+// equality is bytewise can be probed. String equality ignores case and
+// float equality has a tolerance, but an expression index keys strings
+// lowered, so it serves them.
+static void index_options(TableDef *table_def, const SqlExpr *expr,
+                          int column_idx, const SqlExpr *where,
+                          bool knows_columns, const bool *read,
+                          IndexDef *options[2])
+{
+  IndexDef *index = expr->func.type == COLUMN_FUNC_NONE
+                        ? query_plan_find_index(table_def, column_idx, where)
+                        : NULL;
+  if (!index)
+  {
+    index = find_expression_index(table_def, expr, column_idx, where);
+  }
+  if (!index)
+  {
+    return;
+  }
+  options[0] = index;
+  if (knows_columns && !index_covers(index, column_idx, table_def, read))
+  {
+    for (uint32_t j = 0; j < table_def->num_indexes; j++)
+    {
+      IndexDef *other = &table_def->indexes[j];
+      if (other->type != INDEX_TYPE_BITMAP &&
+          other->type != INDEX_TYPE_FULLTEXT &&
+          other->expr.type == COLUMN_FUNC_NONE &&
+          strcasecmp(other->column_name, index->column_name) == 0 &&
+          index_covers(other, column_idx, table_def, read) &&
+          query_plan_index_usable(other, where, table_def) &&
+          index_maintained(other))
+      {
+        options[1] = other;
+        return;
+      }
+    }
+  }
+}
+
+// Everything but the access method: ORDER BY, aggregation and LIMIT/OFFSET.
+// key_ordered says rows will arrive in primary key order.
+static bool build_operators(const SelectOptions *options, TableDef *table_def,
+                            bool key_ordered, QueryPlan *plan, char *error,
+                            size_t error_size)
+{
+  memset(plan, 0, sizeof(QueryPlan));
+  plan->access = ACCESS_FULL_SCAN;
+  plan->has_limit = options->has_limit;
+  plan->limit = options->limit;
+  plan->offset = options->offset;
+  plan->work_memory = options->work_memory;
+  plan->aggregate = options->aggregate;
+
+  if (plan->aggregate && options->num_order_by > 0)
+  {
+    snprintf(error, error_size, "ORDER BY is not supported with aggregates");
+    return false;
+  }
+
+  // Every access method produces rows in key order, so ordering by the key
+  // alone is free in either direction. The table B-tree is the only
+  // order-preserving index: secondary index files are keyed by value hashes.
+  const SqlOrderBy *order_by = options->order_by;
+  if (key_ordered && options->num_order_by == 1 &&
+      table_def->key.type != KEY_BYTES &&
+      table_def_find_column(table_def, order_by[0].column) ==
+          (int)table_def->key_columns[0])
+  {
+    plan->descending = order_by[0].descending;
+  }
+  else if (options->num_order_by > 0)
+  {
+    if (!sort_spec_build(table_def, order_by, options->num_order_by,
+                         &plan->sort_spec, error, error_size))
+    {
+      return false;
+    }
+    plan->sort = true;
+  }
+  return true;
+}
+
+bool query_plan_build_operators(const SelectOptions *options,
+                                TableDef *table_def, QueryPlan *plan,
+                                char *error, size_t error_size)
+{
+  return build_operators(options, table_def, false, plan, error, error_size);
+}
+
+void query_plan_table_shape(Table *table, TableDef *table_def,
+                            TableShape *shape)
+{
+  TableStats *stats = &table_def->stats;
+  if (stats->analyzed)
+  {
+    shape->rows = stats->row_count;
+    shape->pages = stats->leaf_pages ? stats->leaf_pages : 1;
+    shape->depth = stats->depth ? stats->depth : 1;
+  }
+  else
+  {
+    shape->pages = table->pager->num_pages ? table->pager->num_pages : 1;
+    shape->rows = shape->pages * PLANNER_DEFAULT_ROWS_PER_PAGE;
+    shape->depth = shape->pages > 1 ? 2 : 1;
+  }
+}
+
+// Plans as query_plan_build does, or, given forced, plans only the access
+// path it names. What was picked goes into picked unless it is NULL.
+static bool build_plan(SqlExpr *where, const SelectOptions *options,
+                       Table *table, TableDef *table_def,
+                       const PlanChoice *forced, PlanChoice *picked,
+                       QueryPlan *plan, char *error, size_t error_size)
+{
+  if (!build_operators(options, table_def, true, plan, error, error_size))
+  {
+    return false;
+  }
+
+  TableStats *stats = &table_def->stats;
+  TableShape shape;
+  query_plan_table_shape(table, table_def, &shape);
+  double rows = shape.rows, pages = shape.pages, depth = shape.depth;
+
+  double full_scan_cost = pages * PAGE_COST + rows * CPU_ROW_COST;
+
+  SqlExpr *conjuncts[MAX_CONJUNCTS];
+  uint32_t count = 0;
+  if (where)
+  {
+    collect_conjuncts(where, conjuncts, &count);
+  }
+
+  // Candidates are added cheapest-to-run first so ties go to the more
+  // selective access method
+  int point = -1;
+  bool has_range = false;
+  bool range_empty = false;
+  int64_t low = table_def->key.type == KEY_INT64 ? INT64_MIN : 0;
+  int64_t high = key_max_value(table_def);
+  for (uint32_t i = 0; i < count; i++)
+  {
+    SqlExpr *expr = conjuncts[i];
+    if (!is_primary_key_compare(expr, table_def))
+    {
+      continue;
+    }
+    int64_t value = key_literal(expr, table_def);
+    switch (expr->op)
+    {
+    case SQL_OP_EQ:
+      if (point == -1)
+      {
+        point = i;
+      }
+      break;
+    case SQL_OP_GT:
+      if (value == INT64_MAX)
+      {
+        range_empty = true;
+      }
+      else
+      {
+        low = value + 1 > low ? value + 1 : low;
+      }
+      has_range = true;
+      break;
+    case SQL_OP_GE:
+      low = value > low ? value : low;
+      has_range = true;
+      break;
+    case SQL_OP_LT:
+      if (value == INT64_MIN)
+      {
+        range_empty = true;
+      }
+      else
+      {
+        high = value - 1 < high ? value - 1 : high;
+      }
+      has_range = true;
+      break;
+    case SQL_OP_LE:
+      high = value < high ? value : high;
+      has_range = true;
+      break;
+    default:
+      break;
+    }
+  }
+
+  if (point != -1)
+  {
+    add_candidate(plan, ACCESS_PRIMARY_KEY, NULL,
+                  depth * PAGE_COST + CPU_ROW_COST, 1);
+  }
+  if (has_range)
+  {
+    double fraction = 0;
+    range_empty = range_empty || low > high;
+    if (!range_empty)
+    {
+      uint32_t key_column = table_def->key_columns[0];
+      double below_high = stats_less_selectivity(stats, key_column, high, true);
+      double below_low = stats_less_selectivity(stats, key_column, low, false);
+      fraction = below_high - below_low;
+      if (!stats->analyzed)
+      {
+        fraction = STATS_DEFAULT_RANGE_SELECTIVITY;
+      }
+      fraction = fraction < 0 ? 0 : fraction;
+    }
+    add_candidate(plan, ACCESS_PRIMARY_KEY_RANGE, NULL,
+                  depth * PAGE_COST + fraction * full_scan_cost,
+                  fraction * rows);
+  }
+
+  IndexDef *probe_index_def[MAX_PLAN_CANDIDATES] = {0};
+  int probe_conjunct[MAX_PLAN_CANDIDATES];
+  bool read[MAX_COLUMNS];
+  bool knows_columns =
+      query_columns_read(options, conjuncts, count, table_def, read);
+  for (uint32_t i = 0; i < count; i++)
+  {
+    SqlExpr *expr = conjuncts[i];
+    if (expr->type != SQL_EXPR_COMPARE || expr->op != SQL_OP_EQ)
+    {
+      continue;
+    }
+    // An equality the table's own key answers is planned as a lookup above
+    int column_idx = table_def_find_column(table_def, expr->column);
+    if (column_idx < 0 || is_primary_key_compare(expr, table_def) ||
+        (forced && (forced->access != ACCESS_SECONDARY_INDEX ||
+                    (int)i != forced->conjunct)))
+    {
+      continue;
+    }
+    IndexDef *options_for_column[2] = {NULL, NULL};
+    if (!forced)
+    {
+      index_options(table_def, expr, column_idx, where, knows_columns, read,
+                    options_for_column);
+    }
+    else if (query_plan_index_usable(forced->index, where, table_def))
+    {
+      // A partial index must still hold every row these values match
+      options_for_column[0] = forced->index;
+    }
+    for (uint32_t k = 0; k < 2 && options_for_column[k]; k++)
+    {
+      IndexDef *index = options_for_column[k];
+      if (plan->num_candidates == MAX_PLAN_CANDIDATES - 3)
+      {
+        break;
+      }
+      double matches = rows * expr_selectivity(expr, table_def);
+      if (index->is_unique && matches > 1)
+      {
+        matches = 1;
+      }
+      // Opening and probing the index file, then one primary key lookup
+      // per match, or just the entries' share of index pages when they
+      // hold every column the query reads
+      bool index_only = knows_columns &&
+                        index_covers(index, column_idx, table_def, read);
+      double per_match = depth * PAGE_COST;
+      if (index_only)
+      {
+        double entry_bytes = sizeof(SecondaryIndexEntry) + sizeof(int32_t) +
+                             index_include_size(table_def, index);
+        per_match = entry_bytes / PAGE_SIZE * PAGE_COST;
+      }
+      double cost = query_plan_index_probe_cost(index, depth) +
+                    matches * (per_match + CPU_ROW_COST);
+      probe_index_def[plan->num_candidates] = index;
+      probe_conjunct[plan->num_candidates] = i;
+      add_candidate(plan, ACCESS_SECONDARY_INDEX, index, cost, matches);
+      plan->candidates[plan->num_candidates - 1].index_only = index_only;
+    }
+  }
+
+  // Every conjunct bitmap indexes can answer, ANDed into one bitmap
+  BitmapExpr *bitmap = NULL;
+  bool bitmap_answers[MAX_CONJUNCTS] = {false};
+  uint32_t num_bitmap_answers = 0;
+  double bitmap_fraction = 1.0;
+  for (uint32_t i = 0;
+       i < count && (!forced || forced->access == ACCESS_BITMAP_INDEX); i++)
+  {
+    BitmapExpr *expr = bitmap_expr_compile(conjuncts[i], table_def, where);
+    if (expr)
+    {
+      bitmap = bitmap ? bitmap_expr_and(bitmap, expr) : expr;
+      bitmap_answers[i] = true;
+      num_bitmap_answers++;
+      bitmap_fraction *= expr_selectivity(conjuncts[i], table_def);
+    }
+  }
+  if (bitmap)
+  {
+    // One page or so per bitmap read, then a primary key lookup per match
+    // unless the bitmap's cardinality is all COUNT(*) needs
+    double matches = rows * bitmap_fraction;
+    double cost = bitmap_expr_lookups(bitmap) * PAGE_COST;
+    if (!plan->aggregate || !plan->aggregate->count_only ||
+        num_bitmap_answers < count)
+    {
+      cost += matches * (depth * PAGE_COST + CPU_ROW_COST);
+    }
+    add_candidate(plan, ACCESS_BITMAP_INDEX, NULL, cost, matches);
+  }
+
+  // The first MATCH a full-text index answers
+  FullTextQuery *fulltext = NULL;
+  IndexDef *fulltext_index = NULL;
+  int match_conjunct = -1;
+  uint32_t fulltext_candidate = 0;
+  for (uint32_t i = 0;
+       i < count && !fulltext &&
+       (!forced || forced->access == ACCESS_FULLTEXT_INDEX);
+       i++)
+  {
+    SqlExpr *expr = conjuncts[i];
+    int column_idx = expr->type == SQL_EXPR_COMPARE && expr->op == SQL_OP_MATCH &&
+                             expr->func.type == COLUMN_FUNC_NONE
+                         ? table_def_find_column(table_def, expr->column)
+                         : -1;
+    fulltext_index = column_idx != -1
+                         ? find_fulltext_index(table_def, column_idx, where)
+                         : NULL;
+    if (fulltext_index)
+    {
+      // A query that does not parse fails with its error when the
+      // residual compiles
+      fulltext = fulltext_query_parse(expr->value.text, error, error_size);
+      match_conjunct = i;
+    }
+  }
+  if (fulltext)
+  {
+    // A read of each word's posting list, then a primary key lookup per
+    // match
+    double matches = rows * expr_selectivity(conjuncts[match_conjunct], table_def);
+    double cost = fulltext_query_terms(fulltext) * PAGE_COST +
+                  matches * (depth * PAGE_COST + CPU_ROW_COST);
+    fulltext_candidate = plan->num_candidates;
+    add_candidate(plan, ACCESS_FULLTEXT_INDEX, fulltext_index, cost, matches);
+  }
+
+  add_candidate(plan, ACCESS_FULL_SCAN, NULL, full_scan_cost, rows);
+
+  uint32_t best = 0;
+  for (uint32_t i = 1; i < plan->num_candidates; i++)
+  {
+    if (plan->candidates[i].cost < plan->candidates[best].cost)
+    {
+      best = i;
+    }
+  }
+  // Only the index knows the word statistics BM25 ranks by, so a MATCH it
+  // answers goes through it whatever the costs when rows come back as
+  // they are produced
+  plan->ranked = fulltext && options->num_order_by == 0 && !plan->aggregate;
+  if (plan->ranked)
+  {
+    best = fulltext_candidate;
+  }
+  if (forced)
+  {
+    // Only the reused path was costed besides the key lookups and the scan.
+    // If these values rule it out, search again.
+    best = plan->num_candidates;
+    for (uint32_t i = 0; i < plan->num_candidates && best == plan->num_candidates;
+         i++)
+    {
+      if (plan->candidates[i].access == forced->access)
+      {
+        best = i;
+      }
+    }
+    if (best == plan->num_candidates)
+    {
+      bitmap_expr_free(bitmap);
+      fulltext_query_free(fulltext);
+      query_plan_free(plan);
+      return build_plan(where, options, table, table_def, NULL, picked, plan,
+                        error, error_size);
+    }
+  }
+  plan->access = plan->candidates[best].access;
+  plan->cost = plan->candidates[best].cost;
+
+  switch (plan->access)
+  {
+  case ACCESS_PRIMARY_KEY:
+    plan->key = key_literal(conjuncts[point], table_def);
+    // The lookup answers this conjunct exactly
+    conjuncts[point] = conjuncts[--count];
+    break;
+
+  case ACCESS_PRIMARY_KEY_RANGE:
+  {
+    plan->range_empty = range_empty;
+    plan->range_low = low;
+    plan->range_high = high;
+    // The bounds answer every range conjunct on the key exactly
+    uint32_t kept = 0;
+    for (uint32_t i = 0; i < count; i++)
+    {
+      if (!is_primary_key_compare(conjuncts[i], table_def) ||
+          !is_range_op(conjuncts[i]->op))
+      {
+        conjuncts[kept++] = conjuncts[i];
+      }
+    }
+    count = kept;
+    break;
+  }
+
+  case ACCESS_SECONDARY_INDEX:
+  {
+    // Kept in the residual, which also serves the scan a plan falls back
+    // to when the index file cannot be opened
+    SqlExpr *probe = conjuncts[probe_conjunct[best]];
+    plan->index = probe_index_def[best];
+    plan->index_only = plan->candidates[best].index_only;
+    probe_key(table_def, plan->index, probe, plan);
+    snprintf(plan->probe_column, sizeof plan->probe_column, "%s",
+             plan->index->column_name);
+    break;
+  }
+
+  case ACCESS_BITMAP_INDEX:
+  {
+    // Bitmaps are kept current by every write and hold values as the
+    // filter compares them, so they answer their conjuncts exactly
+    plan->bitmap = bitmap;
+    bitmap = NULL;
+    plan->bitmap_fallback = expr_compile_conjuncts(conjuncts, count, table_def,
+                                                   error, error_size);
+    if (!plan->bitmap_fallback)
+    {
+      fulltext_query_free(fulltext);
+      query_plan_free(plan);
+      return false;
+    }
+    uint32_t kept = 0;
+    for (uint32_t i = 0; i < count; i++)
+    {
+      if (!bitmap_answers[i])
+      {
+        conjuncts[kept++] = conjuncts[i];
+      }
+    }
+    count = kept;
+    break;
+  }
+
+  case ACCESS_FULLTEXT_INDEX:
+  {
+    // The index is kept current by every write and splits words as the
+    // filter does, so it answers its MATCH exactly
+    plan->index = fulltext_index;
+    plan->fulltext = fulltext;
+    fulltext = NULL;
+    plan->fulltext_fallback = expr_compile_conjuncts(conjuncts, count, table_def,
+                                                     error, error_size);
+    if (!plan->fulltext_fallback)
+    {
+      bitmap_expr_free(bitmap);
+      query_plan_free(plan);
+      return false;
+    }
+    conjuncts[match_conjunct] = conjuncts[--count];
+    break;
+  }
+
+  case ACCESS_FULL_SCAN:
+    break;
+  }
+  bitmap_expr_free(bitmap);
+  fulltext_query_free(fulltext);
+
+  // Rows out: what the access method produces, thinned by the residual.
+  // The probed conjunct is already reflected in an index probe's estimate.
+  plan->rows = plan->candidates[best].rows;
+  for (uint32_t i = 0; i < count; i++)
+  {
+    if (plan->access != ACCESS_SECONDARY_INDEX ||
+        (int)i != probe_conjunct[best])
+    {
+      plan->rows *= expr_selectivity(conjuncts[i], table_def);
+    }
+  }
+
+  // Compiling validates every column even when the batch path is used
+  if (count > 0)
+  {
+    plan->residual = expr_compile_conjuncts(conjuncts, count, table_def, error,
+                                            error_size);
+    if (!plan->residual)
+    {
+      query_plan_free(plan);
+      return false;
+    }
+  }
+
+  // COUNT(*) over the whole table never looks at a row
+  plan->count_from_leaves = plan->aggregate && plan->aggregate->count_only &&
+                            count == 0 && plan->access == ACCESS_FULL_SCAN;
+  if (plan->count_from_leaves)
+  {
+    plan->cost = pages * PAGE_COST;
+  }
+  plan->count_from_bitmap = plan->aggregate && plan->aggregate->count_only &&
+                            count == 0 && plan->access == ACCESS_BITMAP_INDEX;
+
+  // Sorted, aggregated and LIMIT/OFFSET scans handle rows one at a time,
+  // which needs the row-at-a-time residual
+  bool windowed = plan->has_limit || plan->offset > 0;
+  if (plan->access == ACCESS_FULL_SCAN && count == 1 && !plan->sort &&
+      !plan->aggregate && !windowed &&
+      batch_supported(conjuncts[0], table_def))
+  {
+    predicate_compile(table_def,
+                      table_def_find_column(table_def, conjuncts[0]->column),
+                      conjuncts[0]->value.text, &plan->batch);
+    plan->use_batch = true;
+    expr_free(plan->residual);
+    plan->residual = NULL;
+  }
+
+  if (picked)
+  {
+    picked->valid = true;
+    picked->access = plan->access;
+    picked->index = plan->index;
+    picked->conjunct =
+        plan->access == ACCESS_SECONDARY_INDEX ? probe_conjunct[best] : -1;
+  }
+  return true;
+}
+
+bool query_plan_build(SqlExpr *where, const SelectOptions *options,
+                      Table *table, TableDef *table_def, QueryPlan *plan,
+                      char *error, size_t error_size)
+{
+  return build_plan(where, options, table, table_def, NULL, NULL, plan, error,
+                    error_size);
+}
+
+bool query_plan_build_cached(SqlExpr *where, const SelectOptions *options,
+                             Table *table, TableDef *table_def,
+                             PlanChoice *choice, uint32_t catalog_version,
+                             QueryPlan *plan, char *error, size_t error_size)
+{
+  bool reuse = choice->valid && choice->catalog_version == catalog_version &&
+               choice->table_def == table_def;
+  choice->valid = false;
+  if (!build_plan(where, options, table, table_def, reuse ? choice : NULL,
+                  choice, plan, error, error_size))
+  {
+    return false;
+  }
+  choice->catalog_version = catalog_version;
+  choice->table_def = table_def;
+  return true;
+}
+
+static const char *access_name(AccessMethod access)
+{
+  switch (access)
+  {
+  case ACCESS_PRIMARY_KEY:
+    return "Primary key lookup";
+  case ACCESS_PRIMARY_KEY_RANGE:
+    return "Primary key range scan";
+  case ACCESS_SECONDARY_INDEX:
+    return "Secondary index probe";
+  case ACCESS_BITMAP_INDEX:
+    return "Bitmap index scan";
+  case ACCESS_FULLTEXT_INDEX:
+    return "Full-text index search";
+  case ACCESS_FULL_SCAN:
+    return "Full table scan";
+  }
+  return "Unknown";
+}
+
+const char *query_plan_access_name(AccessMethod access)
+{
+  return access_name(access);
+}
+
+// A secondary index probe that never reads the table is named apart
+static const char *candidate_name(AccessMethod access, bool index_only)
+{
+  return index_only ? "Index-only probe" : access_name(access);
+}
+
+void query_plan_print(const QueryPlan *plan, TableDef *table_def)
+{
+  switch (plan->access)
+  {
+  case ACCESS_PRIMARY_KEY:
+    printf("QUERY PLAN: Using primary key B-tree index on column '%s'\n",
+           table_def->columns[table_def->key_columns[0]].name);
+    break;
+  case ACCESS_PRIMARY_KEY_RANGE:
+    printf("QUERY PLAN: Using primary key range scan on column '%s'\n",
+           table_def->columns[table_def->key_columns[0]].name);
+    break;
+  case ACCESS_SECONDARY_INDEX:
+  {
+    char probed[MAX_COLUMN_NAME + 32];
+    column_func_format(&plan->index->expr, plan->probe_column, probed,
+                       sizeof(probed));
+    printf("QUERY PLAN: Using %s index '%s' on %s '%s'%s%s\n",
+           plan->index_only ? "covering" : "secondary", plan->index->name,
+           plan->index->expr.type == COLUMN_FUNC_NONE ? "column" : "expression",
+           probed,
+           plan->index->predicate[0] ? " for rows where " : "",
+           plan->index->predicate);
+    break;
+  }
+  case ACCESS_BITMAP_INDEX:
+  {
+    char text[512];
+    bitmap_expr_format(plan->bitmap, text, sizeof(text));
+    printf("QUERY PLAN: Using bitmap indexes for %s\n", text);
+    break;
+  }
+  case ACCESS_FULLTEXT_INDEX:
+  {
+    char text[512];
+    fulltext_query_format(plan->fulltext, text, sizeof(text));
+    printf("QUERY PLAN: Using full-text index '%s' on column '%s' for '%s'%s\n",
+           plan->index->name, plan->index->column_name, text,
+           plan->ranked ? ", ranked by BM25" : "");
+    break;
+  }
+  case ACCESS_FULL_SCAN:
+    break;
+  }
+}
+
+void query_plan_explain_access(const QueryPlan *plan, TableDef *table_def,
+                               const char *indent)
+{
+  printf("%s%s on %s", indent, candidate_name(plan->access, plan->index_only),
+         table_def->name);
+  switch (plan->access)
+  {
+  case ACCESS_PRIMARY_KEY:
+    printf(" (%s = %lld)", table_def->columns[table_def->key_columns[0]].name,
+           (long long)plan->key);
+    break;
+  case ACCESS_PRIMARY_KEY_RANGE:
+    if (plan->range_empty)
+    {
+      printf(" (empty range)");
+    }
+    else if (plan->range_high == key_max_value(table_def))
+    {
+      printf(" (%s >= %lld)", table_def->columns[table_def->key_columns[0]].name,
+             (long long)plan->range_low);
+    }
+    else
+    {
+      printf(" (%lld <= %s <= %lld)", (long long)plan->range_low,
+             table_def->columns[table_def->key_columns[0]].name,
+             (long long)plan->range_high);
+    }
+    break;
+  case ACCESS_SECONDARY_INDEX:
+  {
+    char probed[MAX_COLUMN_NAME + 32];
+    column_func_format(&plan->index->expr, plan->probe_column, probed,
+                       sizeof(probed));
+    printf(" using %s%s (%s = ",
+           plan->index->type == INDEX_TYPE_HASH ? "hash index " : "",
+           plan->index->name, probed);
+    if (plan->probe_key_size == sizeof(int32_t) &&
+        (plan->index->expr.type == COLUMN_FUNC_NONE ||
+         plan->index->expr.type == COLUMN_FUNC_DATE ||
+         plan->index->expr.type == COLUMN_FUNC_INT))
+    {
+      int32_t value;
+      memcpy(&value, plan->probe_key, sizeof(value));
+      printf("%d)", value);
+    }
+    else
+    {
+      printf("'%.*s')", (int)plan->probe_key_size, (const char *)plan->probe_key);
+    }
+    break;
+  }
+  case ACCESS_BITMAP_INDEX:
+  {
+    char text[512];
+    bitmap_expr_format(plan->bitmap, text, sizeof(text));
+    printf(" (%s)", text);
+    break;
+  }
+  case ACCESS_FULLTEXT_INDEX:
+  {
+    char text[512];
+    fulltext_query_format(plan->fulltext, text, sizeof(text));
+    printf(" using %s (%s MATCH '%s')", plan->index->name,
+           plan->index->column_name, text);
+    break;
+  }
+  case ACCESS_FULL_SCAN:
+    if (plan->use_batch)
+    {
+      printf(" with batched filter");
+    }
+    break;
+  }
+  printf("  (cost=%.2f rows=%.0f)\n", plan->cost, plan->rows);
+  if (plan->residual)
+  {
+    printf("%s  Filter: remaining WHERE conditions\n", indent);
+  }
+  if (plan->ranked)
+  {
+    printf("%s  Order: BM25 score descending\n", indent);
+  }
+  if (plan->descending)
+  {
+    printf("%s  Order: %s descending%s\n", indent,
+           table_def->columns[table_def->key_columns[0]].name,
+           plan->access == ACCESS_PRIMARY_KEY_RANGE ? " (backward leaf walk)"
+                                                    : "");
+  }
+}
+
+void query_plan_explain_operators(const QueryPlan *plan, TableDef *table_def,
+                                  bool stops_early)
+{
+  if (plan->sort)
+  {
+    const SortSpec *spec = &plan->sort_spec;
+    printf("    Sort:");
+    for (uint32_t i = 0; i < spec->num_order_by; i++)
+    {
+      printf("%s %s%s", i ? "," : "", table_def->columns[spec->keys[i].column].name,
+             spec->keys[i].descending ? " desc" : "");
+    }
+    double bytes = plan->rows * spec->row_size;
+    if (plan->has_limit &&
+        sort_fits_top_n(spec, plan->work_memory,
+                        (uint64_t)plan->limit + plan->offset))
+    {
+      printf(" (top-N heap of %llu rows)\n",
+             (unsigned long long)plan->limit + plan->offset);
+    }
+    else if (bytes <= plan->work_memory)
+    {
+      printf(" (in memory)\n");
+    }
+    else
+    {
+      printf(" (external merge, ~%.0f runs of %zu KB)\n",
+             bytes / plan->work_memory + 1, plan->work_memory / 1024);
+    }
+  }
+  if (plan->aggregate)
+  {
+    const AggregateSpec *spec = plan->aggregate;
+    if (plan->count_from_leaves)
+    {
+      printf("    Aggregate: count(*) from leaf cell counts\n");
+    }
+    else if (plan->count_from_bitmap)
+    {
+      printf("    Aggregate: count(*) from bitmap cardinality\n");
+    }
+    else if (spec->num_group_keys == 0)
+    {
+      printf("    Aggregate: single group\n");
+    }
+    else
+    {
+      printf("    Hash aggregate:");
+      double groups = 1.0;
+      for (uint32_t i = 0; i < spec->num_group_keys; i++)
+      {
+        uint32_t column = spec->group_keys[i].column;
+        printf("%s %s", i ? "," : "", table_def->columns[column].name);
+        groups /= stats_eq_selectivity(&table_def->stats, column);
+      }
+      groups = groups > plan->rows ? plan->rows : groups;
+      groups = groups < 1.0 ? 1.0 : groups;
+      // A slot array at half load next to each group's state
+      double bytes = groups * (spec->group_size + 2 * sizeof(AggregateSlot));
+      printf(" (~%.0f groups%s)\n", groups,
+             bytes > plan->work_memory ? ", spills to partitions" : "");
+    }
+  }
+  if (plan->has_limit || plan->offset > 0)
+  {
+    printf("    Limit:");
+    if (plan->has_limit)
+    {
+      printf(" %u", plan->limit);
+    }
+    if (plan->offset > 0)
+    {
+      printf(" offset %u", plan->offset);
+    }
+    bool early = stops_early && !plan->sort && !plan->aggregate;
+    printf("%s\n", early ? " (scan stops early)" : "");
+  }
+}
+
+void query_plan_explain(const QueryPlan *plan, TableDef *table_def)
+{
+  printf("QUERY PLAN\n");
+  query_plan_explain_access(plan, table_def, "  ");
+  query_plan_explain_operators(plan, table_def,
+                               plan->access == ACCESS_FULL_SCAN ||
+                                   plan->access == ACCESS_PRIMARY_KEY_RANGE);
+
+  printf("  Candidates:\n");
+  for (uint32_t i = 0; i < plan->num_candidates; i++)
+  {
+    const PlanCandidate *candidate = &plan->candidates[i];
+    printf("    %-24s%-16s cost=%.2f rows=%.0f\n",
+           candidate_name(candidate->access, candidate->index_only),
+           candidate->index ? candidate->index->name : "", candidate->cost,
+           candidate->rows);
+  }
+
+  const TableStats *stats = &table_def->stats;
+  if (stats->analyzed)
+  {
+    printf("  Statistics: %u rows, %u leaf pages\n", stats->row_count,
+           stats->leaf_pages);
+  }
+  else
+  {
+    printf("  Statistics: none, run ANALYZE for better estimates\n");
+  }
+}
+
+// Fetch one row by primary key and keep it if it passes the residual
+static void fetch_by_key(QueryPlan *plan, Table *table, TableDef *table_def,
+                         int64_t key, ScanResult *result)
+{
+  uint8_t encoded[BTREE_MAX_KEY_SIZE];
+  key_from_int(&table->key, key, encoded);
+  Cursor *cursor = table_find_key(table, encoded);
+  void *node = get_page(table->pager, cursor->page_num);
+  if (cursor->cell_num < *leaf_node_num_cells(node) &&
+      key_compare(&table->key, leaf_node_key(node, cursor->cell_num), encoded) == 0)
+  {
+    PROFILE_COUNT(PROFILE_ROWS_SCANNED, 1);
+    DynamicRow row;
+    deserialize_dynamic_row(cursor_value(cursor), table_def, &row);
+    if (!plan->residual || expr_eval(plan->residual, &row))
+    {
+      scan_result_append(result, &row);
+    }
+    else
+    {
+      dynamic_row_free(&row);
+    }
+  }
+  cursor_close(cursor);
+}
+
+// OFFSET and LIMIT applied while walking the leaves, so the walk can skip
+// rows without reading them and stop as soon as it has enough
+typedef struct
+{
+  uint32_t skip;
+  bool limited;
+  uint32_t remaining;
+} RowWindow;
+
+static bool window_full(const RowWindow *window)
+{
+  return window->limited && window->remaining == 0;
+}
+
+static void window_emit(RowWindow *window, ScanResult *result, DynamicRow *row)
+{
+  if (window->skip > 0)
+  {
+    window->skip--;
+    dynamic_row_free(row);
+    return;
+  }
+  scan_result_append(result, row);
+  if (window->limited)
+  {
+    window->remaining--;
+  }
+}
+
+// Without a residual every row in range counts toward OFFSET, so skipped
+// rows are passed over by cell counts: the rest of a leaf in one step when
+// its last skipped key is still in range. Returns false if the range runs
+// out first.
+static bool skip_forward(Cursor *cursor, const void *high, RowWindow *window)
+{
+  while (window->skip > 0 && !cursor->end_of_table)
+  {
+    void *node = get_page(cursor->table->pager, cursor->page_num);
+    uint32_t left = *leaf_node_num_cells(node) - cursor->cell_num;
+    uint32_t step = window->skip < left ? window->skip : left;
+    if (step == 0)
+    {
+      break;
+    }
+    if (key_compare(&cursor->table->key,
+                    leaf_node_key(node, cursor->cell_num + step - 1), high) > 0)
+    {
+      return false;
+    }
+    window->skip -= step;
+    cursor->cell_num += step - 1;
+    cursor_advance(cursor);
+  }
+  return true;
+}
+
+// Same as skip_forward, towards the start of the table
+static bool skip_backward(Cursor *cursor, const void *low, RowWindow *window)
+{
+  while (window->skip > 0 && !cursor->end_of_table)
+  {
+    void *node = get_page(cursor->table->pager, cursor->page_num);
+    uint32_t left = cursor->cell_num + 1;
+    uint32_t step = window->skip < left ? window->skip : left;
+    if (key_compare(&cursor->table->key,
+                    leaf_node_key(node, cursor->cell_num + 1 - step), low) < 0)
+    {
+      return false;
+    }
+    window->skip -= step;
+    cursor->cell_num -= step - 1;
+    cursor_retreat(cursor);
+  }
+  return true;
+}
+
+// Walk the leaves from low until a key passes high
+static void scan_key_range(QueryPlan *plan, Table *table, TableDef *table_def,
+                           int64_t low, int64_t high, RowWindow *window,
+                           ScanResult *result)
+{
+  uint8_t low_key[BTREE_MAX_KEY_SIZE], high_key[BTREE_MAX_KEY_SIZE];
+  key_from_int(&table->key, low, low_key);
+  key_from_int(&table->key, high, high_key);
+  Cursor *cursor = table_seek_key(table, low_key);
+  if (!plan->residual && !skip_forward(cursor, high_key, window))
+  {
+    cursor->end_of_table = true;
+  }
+  while (!cursor->end_of_table && !window_full(window))
+  {
+    void *node = get_page(table->pager, cursor->page_num);
+    if (key_compare(&table->key, leaf_node_key(node, cursor->cell_num),
+                    high_key) > 0)
+    {
+      break;
+    }
+    PROFILE_COUNT(PROFILE_ROWS_SCANNED, 1);
+    DynamicRow row;
+    deserialize_dynamic_row(cursor_value(cursor), table_def, &row);
+    if (!plan->residual || expr_eval(plan->residual, &row))
+    {
+      window_emit(window, result, &row);
+    }
+    else
+    {
+      dynamic_row_free(&row);
+    }
+    cursor_advance(cursor);
+  }
+  cursor_close(cursor);
+}
+
+// Same as scan_key_range, walking backwards from high
+static void scan_key_range_reverse(QueryPlan *plan, Table *table,
+                                   TableDef *table_def, int64_t low,
+                                   int64_t high, RowWindow *window,
+                                   ScanResult *result)
+{
+  uint8_t low_key[BTREE_MAX_KEY_SIZE], high_key[BTREE_MAX_KEY_SIZE];
+  key_from_int(&table->key, low, low_key);
+  key_from_int(&table->key, high, high_key);
+  Cursor *cursor = table_seek_last_key(table, high_key);
+  if (!plan->residual && !skip_backward(cursor, low_key, window))
+  {
+    cursor->end_of_table = true;
+  }
+  while (!cursor->end_of_table && !window_full(window))
+  {
+    void *node = get_page(table->pager, cursor->page_num);
+    if (key_compare(&table->key, leaf_node_key(node, cursor->cell_num),
+                    low_key) < 0)
+    {
+      break;
+    }
+    PROFILE_COUNT(PROFILE_ROWS_SCANNED, 1);
+    DynamicRow row;
+    deserialize_dynamic_row(cursor_value(cursor), table_def, &row);
+    if (!plan->residual || expr_eval(plan->residual, &row))
+    {
+      window_emit(window, result, &row);
+    }
+    else
+    {
+      dynamic_row_free(&row);
+    }
+    cursor_retreat(cursor);
+  }
+  cursor_close(cursor);
+}
+
+static void reverse_rows(ScanResult *result)
+{
+  for (uint32_t i = 0, j = result->num_rows; i + 1 < j; i++, j--)
+  {
+    DynamicRow row = result->rows[i];
+    result->rows[i] = result->rows[j - 1];
+    result->rows[j - 1] = row;
+  }
+}
+
+// Collect the entries stored under the probe value, sorted and unique so
+// rows come back in primary key order like every other access method
+void query_plan_probe_index_entries(const IndexDef *index, Table *index_table,
+                                    const void *key_data, uint32_t key_size,
+                                    uint32_t include_size,
+                                    IndexMatches *matches)
+{
+  uint32_t hash = hash_key_for_value((void *)key_data, key_size);
+  index_matches_init(matches, include_size);
+
+  if (index->type == INDEX_TYPE_HASH)
+  {
+    hash_index_probe(index_table, hash, key_data, key_size, matches);
+  }
+  else
+  {
+    // Entries are keyed on (hash, row id): the value's entries are a run
+    // starting at (hash, 0)
+    uint8_t prefix[SECONDARY_INDEX_KEY_SIZE];
+    secondary_index_key(hash, 0, prefix);
+    Cursor *cursor = secondary_index_find(index_table, hash);
+    while (!cursor->end_of_table)
+    {
+      void *node = get_page(index_table->pager, cursor->page_num);
+      void *key = leaf_node_key(node, cursor->cell_num);
+      if (memcmp(key, prefix, sizeof(uint32_t)) != 0)
+      {
+        break;
+      }
+      PROFILE_COUNT(PROFILE_ROWS_SCANNED, 1);
+      SecondaryIndexEntry *entry = cursor_value(cursor);
+      if (entry->key_size == key_size &&
+          memcmp(entry->key_data, key_data, key_size) == 0)
+      {
+        index_matches_add(matches, entry->row_id,
+                          entry->key_data + entry->key_size,
+                          entry->include_size);
+      }
+      cursor_advance(cursor);
+    }
+    cursor_close(cursor);
+  }
+
+  index_matches_finish(matches);
+}
+
+uint32_t *query_plan_probe_index(const IndexDef *index, Table *index_table,
+                                 const void *key_data, uint32_t key_size,
+                                 uint32_t *num_ids)
+{
+  IndexMatches matches;
+  query_plan_probe_index_entries(index, index_table, key_data, key_size, 0,
+                                 &matches);
+  *num_ids = matches.count;
+  return (uint32_t *)matches.entries;
+}
+
+// Full scans feed the sort or the aggregation from the scan workers so the
+// matching rows are never all held at once
+typedef struct
+{
+  CompiledExpr *residual;
+  Sorter *sorter;
+  Aggregator *aggregator;
+} OperatorFeed;
+
+static void feed_row(OperatorFeed *feed, const uint8_t *data)
+{
+  if (feed->sorter)
+  {
+    sorter_add(feed->sorter, data);
+  }
+  else
+  {
+    aggregator_add(feed->aggregator, data);
+  }
+}
+
+static bool feed_operator(DynamicRow *row, TableDef *table_def, void *ctx)
+{
+  (void)table_def;
+  OperatorFeed *feed = ctx;
+  if (!feed->residual || expr_eval(feed->residual, row))
+  {
+    feed_row(feed, row->data);
+  }
+  return false;
+}
+
+static OperatorProfile *profile_aggregator(QueryProfile *profile,
+                                           Aggregator *aggregator,
+                                           uint64_t groups)
+{
+  char name[64];
+  if (aggregator->partitions_spilled > 0)
+  {
+    snprintf(name, sizeof(name), "Hash aggregate (%u partitions)",
+             aggregator->partitions_spilled);
+  }
+  else
+  {
+    snprintf(name, sizeof(name), "Hash aggregate");
+  }
+  OperatorProfile *op = query_profile_end(profile, name, groups);
+  op->rows_in = aggregator->rows_in;
+  return op;
+}
+
+void query_result_begin(QueryResult *result, const QueryPlan *plan)
+{
+  memset(result, 0, sizeof(QueryResult));
+  if (plan->sort)
+  {
+    // The top-N heap has to keep the skipped rows too
+    result->sorter = malloc(sizeof(Sorter));
+    sorter_init(result->sorter, &plan->sort_spec, plan->work_memory,
+                plan->has_limit, (uint64_t)plan->limit + plan->offset);
+  }
+  if (plan->aggregate)
+  {
+    // LIMIT/OFFSET then count groups, not rows
+    result->aggregator = malloc(sizeof(Aggregator));
+    aggregator_init(result->aggregator, plan->aggregate, plan->work_memory);
+  }
+  result->has_limit = plan->has_limit;
+  result->limit = plan->limit;
+  result->offset = plan->offset;
+}
+
+void query_result_add(QueryResult *result, const uint8_t *data, uint32_t size)
+{
+  if (result->sorter)
+  {
+    sorter_add(result->sorter, data);
+  }
+  else if (result->aggregator)
+  {
+    aggregator_add(result->aggregator, data);
+  }
+  else
+  {
+    DynamicRow row;
+    row.data = malloc(size);
+    row.data_size = size;
+    memcpy(row.data, data, size);
+    scan_result_append(&result->rows, &row);
+  }
+}
+
+void query_result_end(QueryResult *result, QueryProfile *profile)
+{
+  Sorter *sorter = result->sorter;
+  Aggregator *aggregator = result->aggregator;
+  if (!sorter && !aggregator)
+  {
+    return;
+  }
+
+  // Access methods other than the full scan are selective, so their rows
+  // were collected first
+  ScanResult *rows = &result->rows;
+  OperatorFeed feed = {NULL, sorter, aggregator};
+  for (uint32_t i = 0; i < rows->num_rows; i++)
+  {
+    feed_row(&feed, rows->rows[i].data);
+  }
+  scan_result_free(rows);
+
+  if (aggregator)
+  {
+    aggregator_finish(aggregator);
+    if (profile && aggregator->partitions_spilled > 0)
+    {
+      // Spilled groups are only formed as their partitions are read back
+      result->aggregate_profile = profile_aggregator(profile, aggregator, 0);
+    }
+    else if (profile)
+    {
+      profile_aggregator(profile, aggregator, aggregator->num_groups);
+    }
+    return;
+  }
+
+  sorter_finish(sorter);
+  if (profile)
+  {
+    char name[64];
+    if (sorter->top_n)
+    {
+      snprintf(name, sizeof(name), "Top-N sort");
+    }
+    else if (sorter->runs_spilled > 0)
+    {
+      snprintf(name, sizeof(name), "External sort (%llu runs)",
+               (unsigned long long)sorter->runs_spilled);
+    }
+    else
+    {
+      snprintf(name, sizeof(name), "Sort");
+    }
+    OperatorProfile *op = query_profile_end(
+        profile, name, sorter->top_n ? sorter->num_rows : sorter->rows_in);
+    op->rows_in = sorter->rows_in;
+  }
+}
+
+// A bitmap plan whose index cannot be read scans instead, with every
+// conjunct back in the residual
+static void bitmap_fall_back(QueryPlan *plan)
+{
+  printf("Warning: Could not read a bitmap index, scanning instead.\n");
+  expr_free(plan->residual);
+  plan->residual = plan->bitmap_fallback;
+  plan->bitmap_fallback = NULL;
+  plan->access = ACCESS_FULL_SCAN;
+  plan->count_from_bitmap = false;
+}
+
+// Same for a full-text plan
+static void fulltext_fall_back(QueryPlan *plan)
+{
+  printf("Warning: Could not read full-text index '%s', scanning instead.\n",
+         plan->index->name);
+  expr_free(plan->residual);
+  plan->residual = plan->fulltext_fallback;
+  plan->fulltext_fallback = NULL;
+  plan->access = ACCESS_FULL_SCAN;
+  plan->ranked = false;
+}
+
+// Rows of a covering index plan, rebuilt from the index entries in primary
+// key order: the key, the probed value and the INCLUDE columns, with every
+// other column left zero since the query never reads it. False if the
+// index cannot be opened.
+static bool scan_index_only(QueryPlan *plan, TableDef *table_def,
+                            ScanResult *result)
+{
+  Table *index_table = query_plan_open_index(plan->index);
+  if (!index_table)
+  {
+    return false;
+  }
+  IndexMatches matches;
+  query_plan_probe_index_entries(plan->index, index_table, plan->probe_key,
+                                 plan->probe_key_size,
+                                 index_include_size(table_def, plan->index),
+                                 &matches);
+  table_cache_release(index_table);
+
+  int column_idx = table_def_find_column(table_def, plan->probe_column);
+  for (uint32_t i = 0; i < matches.count; i++)
+  {
+    const uint8_t *entry = matches.entries + i * matches.stride;
+    uint32_t row_id;
+    memcpy(&row_id, entry, sizeof(uint32_t));
+    DynamicRow row;
+    dynamic_row_init(&row, table_def);
+    dynamic_row_set_int(&row, table_def, table_def->key_columns[0], row_id);
+    int32_t value;
+    memcpy(&value, plan->probe_key, sizeof(value));
+    dynamic_row_set_int(&row, table_def, column_idx, value);
+    index_include_to_row(table_def, plan->index, entry + sizeof(uint32_t), &row);
+    if (!plan->residual || expr_eval(plan->residual, &row))
+    {
+      scan_result_append(result, &row);
+    }
+    else
+    {
+      dynamic_row_free(&row);
+    }
+  }
+  free(matches.entries);
+  return true;
+}
+
+// Primary keys of the rows an index plan reads, ascending, or best first
+// for a ranked full-text search. NULL if the index cannot be read, leaving
+// a plan that scans correctly instead.
+static uint32_t *index_row_ids(QueryPlan *plan, uint32_t *num_ids)
+{
+  if (plan->access == ACCESS_FULLTEXT_INDEX)
+  {
+    FullTextMatches matches;
+    if (!fulltext_index_search(plan->index, plan->fulltext, &matches))
+    {
+      fulltext_fall_back(plan);
+      return NULL;
+    }
+    if (plan->ranked)
+    {
+      fulltext_matches_rank(&matches);
+    }
+    uint32_t *ids = malloc((matches.count ? matches.count : 1) * sizeof(uint32_t));
+    for (uint32_t i = 0; i < matches.count; i++)
+    {
+      ids[i] = matches.matches[i].row_id;
+    }
+    *num_ids = matches.count;
+    fulltext_matches_free(&matches);
+    return ids;
+  }
+
+  if (plan->access == ACCESS_BITMAP_INDEX)
+  {
+    RoaringBitmap matches;
+    if (!bitmap_expr_eval(plan->bitmap, &matches))
+    {
+      bitmap_fall_back(plan);
+      return NULL;
+    }
+    uint32_t *ids = roaring_to_array(&matches, num_ids);
+    roaring_free(&matches);
+    return ids;
+  }
+
+  Table *index_table = query_plan_open_index(plan->index);
+  if (!index_table)
+  {
+    // The residual still holds the probed conjunct, so a scan is correct
+    printf("Warning: Could not open index '%s', scanning instead.\n",
+           plan->index->name);
+    return NULL;
+  }
+  uint32_t *ids = query_plan_probe_index(plan->index, index_table,
+                                         plan->probe_key,
+                                         plan->probe_key_size, num_ids);
+  table_cache_release(index_table);
+  return ids;
+}
+
+void query_plan_execute(QueryPlan *plan, Table *table, TableDef *table_def,
+                        uint32_t num_threads, QueryResult *result,
+                        QueryProfile *profile)
+{
+  query_result_begin(result, plan);
+  ScanResult *rows = &result->rows;
+  const char *step = candidate_name(plan->access, plan->index_only);
+  Sorter *sorter = result->sorter;
+  Aggregator *aggregator = result->aggregator;
+
+  if (plan->count_from_leaves)
+  {
+    aggregator_add_count(aggregator, table_count_rows(table));
+    aggregator_finish(aggregator);
+    if (profile)
+    {
+      OperatorProfile *op = query_profile_end(profile, "Count leaf cells", 1);
+      op->rows_in = aggregator->rows_in;
+    }
+    return;
+  }
+  if (plan->count_from_bitmap)
+  {
+    RoaringBitmap matches;
+    if (bitmap_expr_eval(plan->bitmap, &matches))
+    {
+      aggregator_add_count(aggregator, roaring_cardinality(&matches));
+      roaring_free(&matches);
+      aggregator_finish(aggregator);
+      if (profile)
+      {
+        OperatorProfile *op =
+            query_profile_end(profile, "Count bitmap cardinality", 1);
+        op->rows_in = aggregator->rows_in;
+      }
+      return;
+    }
+    bitmap_fall_back(plan);
+    step = access_name(ACCESS_FULL_SCAN);
+  }
+
+  // Key-ordered leaf walks apply LIMIT/OFFSET themselves; anything else
+  // leaves it to query_result_next
+  RowWindow window = {0, false, 0};
+  bool windowed =
+      !sorter && !aggregator && (plan->has_limit || plan->offset > 0);
+  bool window_applied = false;
+  if (windowed)
+  {
+    window.skip = plan->offset;
+    window.limited = plan->has_limit;
+    window.remaining = plan->limit;
+  }
+
+  switch (plan->access)
+  {
+  case ACCESS_PRIMARY_KEY:
+    fetch_by_key(plan, table, table_def, plan->key, rows);
+    break;
+
+  case ACCESS_PRIMARY_KEY_RANGE:
+    if (plan->range_empty)
+    {
+      break;
+    }
+    if (plan->descending)
+    {
+      scan_key_range_reverse(plan, table, table_def, plan->range_low,
+                             plan->range_high, &window, rows);
+    }
+    else
+    {
+      scan_key_range(plan, table, table_def, plan->range_low,
+                     plan->range_high, &window, rows);
+    }
+    window_applied = windowed;
+    break;
+
+  case ACCESS_SECONDARY_INDEX:
+  case ACCESS_BITMAP_INDEX:
+  case ACCESS_FULLTEXT_INDEX:
+  {
+    if (plan->index_only && scan_index_only(plan, table_def, rows))
+    {
+      break;
+    }
+    uint32_t num_ids;
+    uint32_t *ids = index_row_ids(plan, &num_ids);
+    if (ids)
+    {
+      if (profile)
+      {
+        query_profile_end(profile, step, num_ids);
+        step = "Primary key fetch";
+      }
+      for (uint32_t i = 0; i < num_ids; i++)
+      {
+        fetch_by_key(plan, table, table_def, ids[i], rows);
+      }
+      free(ids);
+      break;
+    }
+    step = access_name(ACCESS_FULL_SCAN);
+  }
+    // fall through
+
+  case ACCESS_FULL_SCAN:
+    if (windowed)
+    {
+      // Walking the whole key range in order lets the scan stop early,
+      // which the parallel scan cannot
+      if (plan->descending)
+      {
+        scan_key_range_reverse(plan, table, table_def, 0, UINT32_MAX,
+                               &window, rows);
+      }
+      else
+      {
+        scan_key_range(plan, table, table_def, 0, UINT32_MAX, &window, rows);
+      }
+      window_applied = true;
+    }
+    else if (sorter || aggregator)
+    {
+      OperatorFeed feed = {plan->residual, sorter, aggregator};
+      parallel_scan(table, table_def, feed_operator, &feed, num_threads, rows);
+    }
+    else if (plan->use_batch)
+    {
+      parallel_scan_compiled(table, table_def, &plan->batch, num_threads,
+                             rows);
+    }
+    else
+    {
+      parallel_scan(table, table_def,
+                    plan->residual ? expr_scan_predicate : NULL,
+                    plan->residual, num_threads, rows);
+    }
+    break;
+  }
+
+  // The other access methods produce ascending order; flipping the
+  // materialized result keeps the parallel scan for DESC
+  if (plan->descending && plan->access != ACCESS_PRIMARY_KEY_RANGE &&
+      !window_applied)
+  {
+    reverse_rows(rows);
+  }
+  if (window_applied)
+  {
+    result->has_limit = false;
+    result->offset = 0;
+  }
+
+  if (profile)
+  {
+    query_profile_end(profile, step,
+                      rows->num_rows + (sorter ? sorter->rows_in : 0) +
+                          (aggregator ? aggregator->rows_in : 0));
+  }
+
+  query_result_end(result, profile);
+}
+
+// The next row or group before LIMIT/OFFSET
+static const void *next_item(QueryResult *result)
+{
+  if (result->aggregator)
+  {
+    const uint8_t *group = aggregator_next(result->aggregator);
+    if (group && result->aggregate_profile)
+    {
+      result->aggregate_profile->rows_out++;
+    }
+    return group;
+  }
+  if (result->sorter)
+  {
+    const uint8_t *data = sorter_next(result->sorter);
+    if (!data)
+    {
+      return NULL;
+    }
+    result->current.data = (void *)data;
+    result->current.data_size = result->sorter->spec.row_size;
+    return &result->current;
+  }
+  if (result->position < result->rows.num_rows)
+  {
+    return &result->rows.rows[result->position++];
+  }
+  return NULL;
+}
+
+static const void *next_windowed(QueryResult *result)
+{
+  if (result->has_limit && result->returned >= result->limit)
+  {
+    return NULL;
+  }
+  for (; result->offset > 0; result->offset--)
+  {
+    if (!next_item(result))
+    {
+      return NULL;
+    }
+  }
+
+  const void *item = next_item(result);
+  if (item)
+  {
+    result->returned++;
+  }
+  return item;
+}
+
+DynamicRow *query_result_next(QueryResult *result)
+{
+  return (DynamicRow *)next_windowed(result);
+}
+
+const uint8_t *query_result_next_group(QueryResult *result)
+{
+  return next_windowed(result);
+}
+
+void query_result_free(QueryResult *result)
+{
+  scan_result_free(&result->rows);
+  if (result->sorter)
+  {
+    sorter_free(result->sorter);
+    free(result->sorter);
+    result->sorter = NULL;
+  }
+  if (result->aggregator)
+  {
+    aggregator_free(result->aggregator);
+    free(result->aggregator);
+    result->aggregator = NULL;
+  }
+}
+
+void query_profile_begin(QueryProfile *profile)
+{
+  memset(profile, 0, sizeof(QueryProfile));
+  profile_start();
+  profile_snapshot(&profile->start);
+  profile->mark = profile->start;
+}
+
+OperatorProfile *query_profile_end(QueryProfile *profile, const char *name,
+                                   uint64_t rows_out)
+{
+  ProfileSnapshot now;
+  profile_snapshot(&now);
+
+  OperatorProfile *op = &profile->operators[profile->num_operators];
+  if (profile->num_operators < MAX_PROFILE_OPERATORS - 1)
+  {
+    profile->num_operators++;
+  }
+  memset(op, 0, sizeof(OperatorProfile));
+  strncpy(op->name, name, sizeof(op->name) - 1);
+  op->rows_in = profile_delta(&profile->mark, &now, PROFILE_ROWS_SCANNED);
+  op->rows_out = rows_out;
+  op->seconds = now.time - profile->mark.time;
+  op->page_hits = profile_delta(&profile->mark, &now, PROFILE_PAGE_HITS);
+  op->page_reads = profile_delta(&profile->mark, &now, PROFILE_PAGE_READS);
+  op->bytes_deserialized =
+      profile_delta(&profile->mark, &now, PROFILE_BYTES_DESERIALIZED);
+
+  profile->mark = now;
+  return op;
+}
+
+void query_profile_finish(QueryProfile *profile)
+{
+  ProfileSnapshot end;
+  profile_snapshot(&end);
+  profile_stop();
+
+  printf("%-24s %10s %10s %10s %10s %10s %12s\n", "Operator", "Rows in",
+         "Rows out", "Time ms", "Page hits", "Page reads", "Bytes deser.");
+  for (uint32_t i = 0; i < profile->num_operators; i++)
+  {
+    OperatorProfile *op = &profile->operators[i];
+    printf("%-24s %10llu %10llu %10.3f %10llu %10llu %12llu\n", op->name,
+           (unsigned long long)op->rows_in, (unsigned long long)op->rows_out,
+           op->seconds * 1000.0, (unsigned long long)op->page_hits,
+           (unsigned long long)op->page_reads,
+           (unsigned long long)op->bytes_deserialized);
+  }
+  printf("Total: %.3f ms, %llu rows deserialized, %llu cursor advances\n",
+         (end.time - profile->start.time) * 1000.0,
+         (unsigned long long)profile_delta(&profile->start, &end,
+                                           PROFILE_ROWS_DESERIALIZED),
+         (unsigned long long)profile_delta(&profile->start, &end,
+                                           PROFILE_CURSOR_ADVANCES));
+}
+
+void query_plan_free(QueryPlan *plan)
+{
+  expr_free(plan->residual);
+  plan->residual = NULL;
+  expr_free(plan->bitmap_fallback);
+  plan->bitmap_fallback = NULL;
+  bitmap_expr_free(plan->bitmap);
+  plan->bitmap = NULL;
+  expr_free(plan->fulltext_fallback);
+  plan->fulltext_fallback = NULL;
+  fulltext_query_free(plan->fulltext);
+  plan->fulltext = NULL;
+}
@@ -0,0 +1,31 @@
+#include "../include/query_profile.h"
+#include <time.h>
+
+bool profile_enabled = false;
+uint64_t profile_counters[PROFILE_NUM_COUNTERS];
+
+void profile_start()
+{
+  for (int i = 0; i < PROFILE_NUM_COUNTERS; i++)
+  {
+    __atomic_store_n(&profile_counters[i], 0, __ATOMIC_RELAXED);
+  }
+  profile_enabled = true;
+}
+
+void profile_stop()
+{
+  profile_enabled = false;
+}
+
+void profile_snapshot(ProfileSnapshot *snapshot)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  snapshot->time = ts.tv_sec + ts.tv_nsec / 1e9;
+  for (int i = 0; i < PROFILE_NUM_COUNTERS; i++)
+  {
+    snapshot->counters[i] = __atomic_load_n(&profile_counters[i],
+                                            __ATOMIC_RELAXED);
+  }
+}
@@ -0,0 +1,585 @@
+#include "../include/roaring.h"
+#include <stdlib.h>
+#include <string.h>
+
+typedef enum
+{
+  ROARING_AND,
+  ROARING_OR,
+  ROARING_ANDNOT
+} RoaringOp;
+
+void roaring_init(RoaringBitmap *bitmap)
+{
+  bitmap->containers = NULL;
+  bitmap->num_containers = 0;
+  bitmap->capacity = 0;
+}
+
+static void container_free(RoaringContainer *container)
+{
+  free(container->values);
+  free(container->words);
+  container->values = NULL;
+  container->words = NULL;
+}
+
+void roaring_free(RoaringBitmap *bitmap)
+{
+  for (uint32_t i = 0; i < bitmap->num_containers; i++)
+  {
+    container_free(&bitmap->containers[i]);
+  }
+  free(bitmap->containers);
+  roaring_init(bitmap);
+}
+
+// Index of the container for key, or where it would go
+static uint32_t find_container(const RoaringBitmap *bitmap, uint16_t key,
+                               bool *found)
+{
+  uint32_t low = 0, high = bitmap->num_containers;
+  while (low < high)
+  {
+    uint32_t mid = (low + high) / 2;
+    if (bitmap->containers[mid].key < key)
+    {
+      low = mid + 1;
+    }
+    else
+    {
+      high = mid;
+    }
+  }
+  *found = low < bitmap->num_containers && bitmap->containers[low].key == key;
+  return low;
+}
+
+static RoaringContainer *insert_container(RoaringBitmap *bitmap,
+                                          uint32_t position, uint16_t key)
+{
+  if (bitmap->num_containers == bitmap->capacity)
+  {
+    bitmap->capacity = bitmap->capacity ? bitmap->capacity * 2 : 4;
+    bitmap->containers = realloc(bitmap->containers,
+                                 bitmap->capacity * sizeof(RoaringContainer));
+  }
+  memmove(&bitmap->containers[position + 1], &bitmap->containers[position],
+          (bitmap->num_containers - position) * sizeof(RoaringContainer));
+  bitmap->num_containers++;
+  RoaringContainer *container = &bitmap->containers[position];
+  memset(container, 0, sizeof(RoaringContainer));
+  container->key = key;
+  return container;
+}
+
+// Add a finished container after the last one
+static void push_container(RoaringBitmap *bitmap, RoaringContainer *container)
+{
+  if (container->cardinality == 0)
+  {
+    container_free(container);
+    return;
+  }
+  *insert_container(bitmap, bitmap->num_containers, container->key) =
+      *container;
+}
+
+static uint32_t array_position(const RoaringContainer *container,
+                               uint16_t value, bool *found)
+{
+  uint32_t low = 0, high = container->cardinality;
+  while (low < high)
+  {
+    uint32_t mid = (low + high) / 2;
+    if (container->values[mid] < value)
+    {
+      low = mid + 1;
+    }
+    else
+    {
+      high = mid;
+    }
+  }
+  *found = low < container->cardinality && container->values[low] == value;
+  return low;
+}
+
+static bool bit_test(const uint64_t *words, uint16_t value)
+{
+  return (words[value >> 6] >> (value & 63)) & 1;
+}
+
+static void container_to_bitmap(RoaringContainer *container)
+{
+  uint64_t *words = calloc(ROARING_BITMAP_WORDS, sizeof(uint64_t));
+  for (uint32_t i = 0; i < container->cardinality; i++)
+  {
+    uint16_t value = container->values[i];
+    words[value >> 6] |= (uint64_t)1 << (value & 63);
+  }
+  free(container->values);
+  container->values = NULL;
+  container->capacity = 0;
+  container->words = words;
+  container->is_bitmap = true;
+}
+
+static void container_to_array(RoaringContainer *container)
+{
+  uint16_t *values = malloc((container->cardinality ? container->cardinality : 1) *
+                            sizeof(uint16_t));
+  uint32_t count = 0;
+  for (uint32_t i = 0; i < ROARING_BITMAP_WORDS; i++)
+  {
+    uint64_t word = container->words[i];
+    while (word)
+    {
+      values[count++] = (uint16_t)(i * 64 + __builtin_ctzll(word));
+      word &= word - 1;
+    }
+  }
+  free(container->words);
+  container->words = NULL;
+  container->values = values;
+  container->capacity = container->cardinality;
+  container->is_bitmap = false;
+}
+
+void roaring_add(RoaringBitmap *bitmap, uint32_t value)
+{
+  bool found;
+  uint32_t position = find_container(bitmap, value >> 16, &found);
+  RoaringContainer *container =
+      found ? &bitmap->containers[position]
+            : insert_container(bitmap, position, value >> 16);
+  uint16_t low = value & 0xFFFF;
+
+  if (!container->is_bitmap)
+  {
+    uint32_t at = array_position(container, low, &found);
+    if (found)
+    {
+      return;
+    }
+    if (container->cardinality < ROARING_ARRAY_MAX)
+    {
+      if (container->cardinality == container->capacity)
+      {
+        container->capacity = container->capacity ? container->capacity * 2 : 4;
+        container->values = realloc(container->values,
+                                    container->capacity * sizeof(uint16_t));
+      }
+      memmove(&container->values[at + 1], &container->values[at],
+              (container->cardinality - at) * sizeof(uint16_t));
+      container->values[at] = low;
+      container->cardinality++;
+      return;
+    }
+    container_to_bitmap(container);
+  }
+  if (!bit_test(container->words, low))
+  {
+    container->words[low >> 6] |= (uint64_t)1 << (low & 63);
+    container->cardinality++;
+  }
+}
+
+void roaring_remove(RoaringBitmap *bitmap, uint32_t value)
+{
+  bool found;
+  uint32_t position = find_container(bitmap, value >> 16, &found);
+  if (!found)
+  {
+    return;
+  }
+  RoaringContainer *container = &bitmap->containers[position];
+  uint16_t low = value & 0xFFFF;
+
+  if (container->is_bitmap)
+  {
+    if (!bit_test(container->words, low))
+    {
+      return;
+    }
+    container->words[low >> 6] &= ~((uint64_t)1 << (low & 63));
+    if (--container->cardinality <= ROARING_ARRAY_MAX)
+    {
+      container_to_array(container);
+    }
+  }
+  else
+  {
+    uint32_t at = array_position(container, low, &found);
+    if (!found)
+    {
+      return;
+    }
+    memmove(&container->values[at], &container->values[at + 1],
+            (container->cardinality - at - 1) * sizeof(uint16_t));
+    container->cardinality--;
+  }
+
+  if (container->cardinality == 0)
+  {
+    container_free(container);
+    memmove(&bitmap->containers[position], &bitmap->containers[position + 1],
+            (bitmap->num_containers - position - 1) * sizeof(RoaringContainer));
+    bitmap->num_containers--;
+  }
+}
+
+bool roaring_contains(const RoaringBitmap *bitmap, uint32_t value)
+{
+  bool found;
+  uint32_t position = find_container(bitmap, value >> 16, &found);
+  if (!found)
+  {
+    return false;
+  }
+  const RoaringContainer *container = &bitmap->containers[position];
+  if (container->is_bitmap)
+  {
+    return bit_test(container->words, value & 0xFFFF);
+  }
+  array_position(container, value & 0xFFFF, &found);
+  return found;
+}
+
+uint64_t roaring_cardinality(const RoaringBitmap *bitmap)
+{
+  uint64_t total = 0;
+  for (uint32_t i = 0; i < bitmap->num_containers; i++)
+  {
+    total += bitmap->containers[i].cardinality;
+  }
+  return total;
+}
+
+static void copy_container(RoaringContainer *out, const RoaringContainer *in)
+{
+  *out = *in;
+  if (in->is_bitmap)
+  {
+    out->words = malloc(ROARING_BITMAP_WORDS * sizeof(uint64_t));
+    memcpy(out->words, in->words, ROARING_BITMAP_WORDS * sizeof(uint64_t));
+  }
+  else
+  {
+    out->capacity = in->cardinality;
+    out->values = malloc((in->cardinality ? in->cardinality : 1) *
+                         sizeof(uint16_t));
+    memcpy(out->values, in->values, in->cardinality * sizeof(uint16_t));
+  }
+}
+
+// Keep the array values for which the bitmap bit equals keep
+static void filter_array(RoaringContainer *out, const RoaringContainer *array,
+                         const uint64_t *words, bool keep)
+{
+  out->values = malloc((array->cardinality ? array->cardinality : 1) *
+                       sizeof(uint16_t));
+  for (uint32_t i = 0; i < array->cardinality; i++)
+  {
+    uint16_t value = array->values[i];
+    if (bit_test(words, value) == keep)
+    {
+      out->values[out->cardinality++] = value;
+    }
+  }
+  out->capacity = array->cardinality;
+}
+
+// Two sorted arrays merged; the result becomes a bitmap if it is too big
+static void merge_arrays(RoaringContainer *out, const RoaringContainer *a,
+                         const RoaringContainer *b, RoaringOp op)
+{
+  uint32_t size = a->cardinality + b->cardinality;
+  out->values = malloc((size ? size : 1) * sizeof(uint16_t));
+  out->capacity = size;
+  uint32_t i = 0, j = 0;
+  while (i < a->cardinality || j < b->cardinality)
+  {
+    bool take_a = j == b->cardinality ||
+                  (i < a->cardinality && a->values[i] < b->values[j]);
+    bool take_b = i == a->cardinality ||
+                  (j < b->cardinality && b->values[j] < a->values[i]);
+    if (take_a)
+    {
+      if (op != ROARING_AND)
+      {
+        out->values[out->cardinality++] = a->values[i];
+      }
+      i++;
+    }
+    else if (take_b)
+    {
+      if (op == ROARING_OR)
+      {
+        out->values[out->cardinality++] = b->values[j];
+      }
+      j++;
+    }
+    else
+    {
+      if (op != ROARING_ANDNOT)
+      {
+        out->values[out->cardinality++] = a->values[i];
+      }
+      i++;
+      j++;
+    }
+  }
+  if (out->cardinality > ROARING_ARRAY_MAX)
+  {
+    container_to_bitmap(out);
+  }
+}
+
+static const uint64_t *words_of(const RoaringContainer *container,
+                                uint64_t *scratch)
+{
+  if (container->is_bitmap)
+  {
+    return container->words;
+  }
+  memset(scratch, 0, ROARING_BITMAP_WORDS * sizeof(uint64_t));
+  for (uint32_t i = 0; i < container->cardinality; i++)
+  {
+    uint16_t value = container->values[i];
+    scratch[value >> 6] |= (uint64_t)1 << (value & 63);
+  }
+  return scratch;
+}
+
+static void combine_containers(RoaringContainer *out, const RoaringContainer *a,
+                               const RoaringContainer *b, RoaringOp op)
+{
+  memset(out, 0, sizeof(RoaringContainer));
+  out->key = a->key;
+
+  if (!a->is_bitmap && !b->is_bitmap)
+  {
+    merge_arrays(out, a, b, op);
+    return;
+  }
+  // An array against a bitmap needs only the array's values tested
+  if (!a->is_bitmap && op != ROARING_OR)
+  {
+    filter_array(out, a, b->words, op == ROARING_AND);
+    return;
+  }
+  if (!b->is_bitmap && op == ROARING_AND)
+  {
+    filter_array(out, b, a->words, true);
+    return;
+  }
+
+  uint64_t scratch[ROARING_BITMAP_WORDS];
+  const uint64_t *wa = words_of(a, scratch);
+  const uint64_t *wb = words_of(b, scratch);
+  out->words = malloc(ROARING_BITMAP_WORDS * sizeof(uint64_t));
+  out->is_bitmap = true;
+  for (uint32_t i = 0; i < ROARING_BITMAP_WORDS; i++)
+  {
+    uint64_t word = op == ROARING_AND ? wa[i] & wb[i]
+                    : op == ROARING_OR ? wa[i] | wb[i]
+                                       : wa[i] & ~wb[i];
+    out->words[i] = word;
+    out->cardinality += __builtin_popcountll(word);
+  }
+  if (out->cardinality <= ROARING_ARRAY_MAX)
+  {
+    container_to_array(out);
+  }
+}
+
+static void combine(RoaringBitmap *out, const RoaringBitmap *a,
+                    const RoaringBitmap *b, RoaringOp op)
+{
+  roaring_init(out);
+  uint32_t i = 0, j = 0;
+  while (i < a->num_containers || j < b->num_containers)
+  {
+    const RoaringContainer *ca = i < a->num_containers ? &a->containers[i] : NULL;
+    const RoaringContainer *cb = j < b->num_containers ? &b->containers[j] : NULL;
+    RoaringContainer result;
+    if (ca && (!cb || ca->key < cb->key))
+    {
+      if (op != ROARING_AND)
+      {
+        copy_container(&result, ca);
+        push_container(out, &result);
+      }
+      i++;
+    }
+    else if (cb && (!ca || cb->key < ca->key))
+    {
+      if (op == ROARING_OR)
+      {
+        copy_container(&result, cb);
+        push_container(out, &result);
+      }
+      j++;
+    }
+    else
+    {
+      combine_containers(&result, ca, cb, op);
+      push_container(out, &result);
+      i++;
+      j++;
+    }
+  }
+}
+
+void roaring_and(RoaringBitmap *out, const RoaringBitmap *a,
+                 const RoaringBitmap *b)
+{
+  combine(out, a, b, ROARING_AND);
+}
+
+void roaring_or(RoaringBitmap *out, const RoaringBitmap *a,
+                const RoaringBitmap *b)
+{
+  combine(out, a, b, ROARING_OR);
+}
+
+void roaring_andnot(RoaringBitmap *out, const RoaringBitmap *a,
+                    const RoaringBitmap *b)
+{
+  combine(out, a, b, ROARING_ANDNOT);
+}
+
+uint32_t *roaring_to_array(const RoaringBitmap *bitmap, uint32_t *count)
+{
+  uint64_t total = roaring_cardinality(bitmap);
+  uint32_t *ids = malloc((total ? total : 1) * sizeof(uint32_t));
+  *count = 0;
+  for (uint32_t c = 0; c < bitmap->num_containers; c++)
+  {
+    const RoaringContainer *container = &bitmap->containers[c];
+    uint32_t high = (uint32_t)container->key << 16;
+    if (!container->is_bitmap)
+    {
+      for (uint32_t i = 0; i < container->cardinality; i++)
+      {
+        ids[(*count)++] = high | container->values[i];
+      }
+      continue;
+    }
+    for (uint32_t i = 0; i < ROARING_BITMAP_WORDS; i++)
+    {
+      uint64_t word = container->words[i];
+      while (word)
+      {
+        ids[(*count)++] = high | (i * 64 + __builtin_ctzll(word));
+        word &= word - 1;
+      }
+    }
+  }
+  return ids;
+}
+
+static size_t container_bytes(const RoaringContainer *container)
+{
+  if (container->is_bitmap)
+  {
+    return ROARING_BITMAP_WORDS * sizeof(uint64_t);
+  }
+  return (container->cardinality * sizeof(uint16_t) + 3) & ~(size_t)3;
+}
+
+size_t roaring_serialized_size(const RoaringBitmap *bitmap)
+{
+  size_t size = sizeof(uint32_t);
+  for (uint32_t i = 0; i < bitmap->num_containers; i++)
+  {
+    size += 2 * sizeof(uint32_t) + container_bytes(&bitmap->containers[i]);
+  }
+  return size;
+}
+
+size_t roaring_serialize(const RoaringBitmap *bitmap, uint8_t *buffer)
+{
+  uint8_t *at = buffer;
+  memcpy(at, &bitmap->num_containers, sizeof(uint32_t));
+  at += sizeof(uint32_t);
+  for (uint32_t i = 0; i < bitmap->num_containers; i++)
+  {
+    const RoaringContainer *container = &bitmap->containers[i];
+    uint16_t header[2] = {container->key, container->is_bitmap};
+    memcpy(at, header, sizeof(header));
+    memcpy(at + sizeof(header), &container->cardinality, sizeof(uint32_t));
+    at += 2 * sizeof(uint32_t);
+
+    size_t bytes = container_bytes(container);
+    memset(at, 0, bytes);
+    if (container->is_bitmap)
+    {
+      memcpy(at, container->words, bytes);
+    }
+    else
+    {
+      memcpy(at, container->values, container->cardinality * sizeof(uint16_t));
+    }
+    at += bytes;
+  }
+  return at - buffer;
+}
+
+size_t roaring_deserialize(RoaringBitmap *bitmap, const uint8_t *buffer,
+                           size_t size)
+{
+  roaring_init(bitmap);
+  const uint8_t *at = buffer;
+  const uint8_t *end = buffer + size;
+  uint32_t num_containers;
+  if (size < sizeof(uint32_t))
+  {
+    return 0;
+  }
+  memcpy(&num_containers, at, sizeof(uint32_t));
+  at += sizeof(uint32_t);
+
+  for (uint32_t i = 0; i < num_containers; i++)
+  {
+    if (end - at < (ptrdiff_t)(2 * sizeof(uint32_t)))
+    {
+      roaring_free(bitmap);
+      return 0;
+    }
+    uint16_t header[2];
+    RoaringContainer container;
+    memset(&container, 0, sizeof(container));
+    memcpy(header, at, sizeof(header));
+    memcpy(&container.cardinality, at + sizeof(header), sizeof(uint32_t));
+    at += 2 * sizeof(uint32_t);
+    container.key = header[0];
+    container.is_bitmap = header[1] != 0;
+
+    size_t bytes = container_bytes(&container);
+    if (container.cardinality == 0 ||
+        (!container.is_bitmap && container.cardinality > ROARING_ARRAY_MAX) ||
+        (bitmap->num_containers > 0 &&
+         bitmap->containers[bitmap->num_containers - 1].key >= container.key) ||
+        (size_t)(end - at) < bytes)
+    {
+      roaring_free(bitmap);
+      return 0;
+    }
+    if (container.is_bitmap)
+    {
+      container.words = malloc(bytes);
+      memcpy(container.words, at, bytes);
+    }
+    else
+    {
+      container.capacity = container.cardinality;
+      container.values = malloc(container.cardinality * sizeof(uint16_t));
+      memcpy(container.values, at, container.cardinality * sizeof(uint16_t));
+    }
+    at += bytes;
+    push_container(bitmap, &container);
+  }
+  return at - buffer;
+}
@@ -6,6 +6,14 @@
 #include "../include/btree.h"
 #include "../include/cursor.h"
 #include "../include/pager.h"
+#include "../include/table_cache.h"
+#include "../include/hash_index.h"
+#include "../include/bitmap_index.h"
+#include "../include/fulltext_index.h"
+#include "../include/online_index.h"
+#include "../include/sort.h"
+#include "../include/expr_eval.h"
+#include "../include/column_func.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -13,7 +21,7 @@
 // Add index to catalog
 bool catalog_add_index(Catalog *catalog, const char *table_name,
                        const char *index_name, const char *column_name,
-                       bool is_unique)
+                       bool is_unique, IndexType type)
 {
     // Find the table
     int table_idx = catalog_find_table(catalog, table_name);
@@ -52,7 +60,7 @@ bool catalog_add_index(Catalog *catalog, const char *table_name,
     strncpy(index->column_name, column_name, MAX_COLUMN_NAME - 1);
     index->column_name[MAX_COLUMN_NAME - 1] = '\0';
 
-    index->type = INDEX_TYPE_BTREE; // Use the enum value
+    index->type = type;
     index->is_unique = is_unique;
 
     // Create the index filename using a temporary buffer
@@ -115,6 +123,25 @@ int catalog_find_index_by_column(Catalog *catalog, const char *table_name, const
     return -1; // Index not found
 }
 
+// The bytes an index keys a row on: the column's value, or the result of
+// the index's expression in buffer (MAX_COLUMN_SIZE bytes). NULL if the
+// row has no entry for the column's type.
+static void *index_key_from_row(TableDef *table_def, const IndexDef *index_def,
+                                uint32_t column_idx, DynamicRow *row,
+                                uint8_t *buffer, uint32_t *size)
+{
+    if (index_def->expr.type == COLUMN_FUNC_NONE)
+    {
+        return get_column_value(row, table_def, column_idx, size);
+    }
+    ColumnFuncValue value;
+    column_func_eval(&index_def->expr, table_def->columns[column_idx].type,
+                     (uint8_t *)row->data + get_column_offset(table_def, column_idx),
+                     &value);
+    *size = column_func_key(&value, buffer);
+    return buffer;
+}
+
 // Create a secondary index by scanning the table
 bool create_secondary_index(Table *table, TableDef *table_def, IndexDef *index_def)
 {
@@ -136,43 +163,93 @@ bool create_secondary_index(Table *table, TableDef *table_def, IndexDef *index_d
     }
 
     // Open or create the index file
-    Table *index_table = db_open(index_def->filename);
+    Table *index_table = table_cache_acquire(index_def->filename);
     if (!index_table)
     {
         printf("Error: Failed to create index file '%s'.\n", index_def->filename);
         return false;
     }
 
+    if (index_def->type == INDEX_TYPE_BITMAP)
+    {
+        printf("Building bitmap index '%s' on column '%s'...\n",
+               index_def->name, index_def->column_name);
+        bool built = bitmap_index_build(table, table_def, index_def, index_table);
+        table_cache_release(index_table);
+        return built;
+    }
+    if (index_def->type == INDEX_TYPE_FULLTEXT)
+    {
+        printf("Building full-text index '%s' on column '%s'...\n",
+               index_def->name, index_def->column_name);
+        bool built = fulltext_index_build(table, table_def, index_def, index_table);
+        table_cache_release(index_table);
+        return built;
+    }
+
+    bool hashed = index_def->type == INDEX_TYPE_HASH;
+    const CompiledExpr *predicate;
+    if (!index_predicate_get(index_table, table_def, index_def, &predicate) ||
+        !secondary_index_prepare(index_def, index_table))
+    {
+        table_cache_release(index_table);
+        return false;
+    }
+
     // Scan the table and build the index
     Cursor *cursor = table_start(table);
     DynamicRow row;
     dynamic_row_init(&row, table_def);
 
-    printf("Building index '%s' on column '%s'...\n",
-           index_def->name, index_def->column_name);
+    char indexed[MAX_COLUMN_NAME + 32];
+    column_func_format(&index_def->expr, index_def->column_name, indexed,
+                       sizeof(indexed));
+    printf("Building %sindex '%s' on %s '%s'...\n", hashed ? "hash " : "",
+           index_def->name,
+           index_def->expr.type == COLUMN_FUNC_NONE ? "column" : "expression",
+           indexed);
 
     uint32_t records_indexed = 0;
+    uint8_t include[SECONDARY_INDEX_MAX_INCLUDE];
+    uint8_t key_buffer[MAX_COLUMN_SIZE];
 
     while (!cursor->end_of_table)
     {
         void *row_data = cursor_value(cursor);
         deserialize_dynamic_row(row_data, table_def, &row);
+        if (!index_predicate_holds(predicate, &row))
+        {
+            cursor_advance(cursor);
+            continue;
+        }
 
         // Get the primary key (row ID)
-        uint32_t row_id = dynamic_row_get_int(&row, table_def, 0);
+        uint32_t row_id = dynamic_row_get_int(&row, table_def, table_def->key_columns[0]);
 
         // Get the column value and its size
         uint32_t key_size;
-        void *key_data = get_column_value(&row, table_def, column_idx, &key_size);
+        void *key_data = index_key_from_row(table_def, index_def, column_idx, &row,
+                                            key_buffer, &key_size);
 
         if (key_data)
         {
             // Hash the key to get a numeric index key
             uint32_t hash_key = hash_key_for_value(key_data, key_size);
+            uint32_t include_size = index_include_from_row(table_def, index_def,
+                                                           &row, include);
 
             // Insert into the index
-            secondary_index_insert(index_table, hash_key, row_id, key_data, key_size);
-            records_indexed++;
+            bool inserted = hashed
+                                ? hash_index_insert(index_table, hash_key, row_id,
+                                                    key_data, key_size,
+                                                    include, include_size)
+                                : secondary_index_insert(index_table, hash_key, row_id,
+                                                         key_data, key_size,
+                                                         include, include_size);
+            if (inserted)
+            {
+                records_indexed++;
+            }
         }
 
         cursor_advance(cursor);
@@ -181,23 +258,47 @@ bool create_secondary_index(Table *table, TableDef *table_def, IndexDef *index_d
     // Save the root page number
     index_def->root_page_num = index_table->root_page_num;
 
-    // Close the index
-    db_close(index_table);
+    // Release the index; it stays open for the queries that probe it
+    table_cache_release(index_table);
 
     dynamic_row_free(&row);
-    free(cursor);
+    cursor_close(cursor);
 
     printf("Index created with %u records.\n", records_indexed);
 
     return true;
 }
 
+bool secondary_index_set_key(Table *index_table)
+{
+    void *root = get_page(index_table->pager, index_table->root_page_num);
+    bool empty = get_node_type(root) == NODE_LEAF && *leaf_node_num_cells(root) == 0;
+    if (!empty && node_key_size(root) != SECONDARY_INDEX_KEY_SIZE)
+    {
+        index_table->key = KEY_DESC_DEFAULT;
+        return false;
+    }
+    KeyDesc key = {KEY_BYTES, SECONDARY_INDEX_KEY_SIZE};
+    table_set_key(index_table, &key);
+    return true;
+}
+
+void secondary_index_key(uint32_t hash_key, uint32_t row_id, uint8_t *key)
+{
+    for (int i = 0; i < 4; i++)
+    {
+        key[i] = (uint8_t)(hash_key >> (24 - 8 * i));
+        key[4 + i] = (uint8_t)(row_id >> (24 - 8 * i));
+    }
+}
+
 // Insert a value into a secondary index
 bool secondary_index_insert(Table *index_table, uint32_t hash_key, uint32_t row_id,
-                            void *key_data, uint32_t key_size)
+                            void *key_data, uint32_t key_size,
+                            const uint8_t *include, uint32_t include_size)
 {
     // Create the secondary index entry
-    uint32_t entry_size = sizeof(SecondaryIndexEntry) + key_size;
+    uint32_t entry_size = sizeof(SecondaryIndexEntry) + key_size + include_size;
     SecondaryIndexEntry *entry = malloc(entry_size);
     if (!entry)
     {
@@ -206,7 +307,9 @@ bool secondary_index_insert(Table *index_table, uint32_t hash_key, uint32_t row_
 
     entry->row_id = row_id;
     entry->key_size = key_size;
+    entry->include_size = include_size;
     memcpy(entry->key_data, key_data, key_size);
+    memcpy(entry->key_data + key_size, include, include_size);
 
     // Create a dynamic row for the B-tree
     DynamicRow index_row;
@@ -217,77 +320,407 @@ bool secondary_index_insert(Table *index_table, uint32_t hash_key, uint32_t row_
     TableDef dummy_table_def;
     memset(&dummy_table_def, 0, sizeof(TableDef));
 
-    // Find insertion point in the B-tree
-    Cursor *cursor = table_find(index_table, hash_key);
-
-    // Insert the entry
-    leaf_node_insert(cursor, hash_key, &index_row, &dummy_table_def);
-
-    free(cursor);
+    uint8_t key[SECONDARY_INDEX_KEY_SIZE];
+    secondary_index_key(hash_key, row_id, key);
+    BtreeInsertResult result = table_insert_key(index_table, key, &index_row,
+                                                &dummy_table_def);
     free(entry);
 
-    return true;
+    return result == BTREE_INSERT_SUCCESS;
 }
 
 // Find rows using a secondary index
 Cursor *secondary_index_find(Table *index_table, uint32_t hash_key)
 {
-    return table_find(index_table, hash_key);
+    uint8_t key[SECONDARY_INDEX_KEY_SIZE];
+    secondary_index_key(hash_key, 0, key);
+    return table_seek_key(index_table, key);
 }
 
-// Delete a value from a secondary index
+// Delete a row's entry from a secondary index; the tree merges or refills
+// the leaf like any other delete
 bool secondary_index_delete(Table *index_table, uint32_t hash_key, uint32_t row_id)
 {
-    Cursor *cursor = table_find(index_table, hash_key);
+    uint8_t key[SECONDARY_INDEX_KEY_SIZE];
+    secondary_index_key(hash_key, row_id, key);
+    return table_delete_keys(index_table, key, 1) == 1;
+}
 
-    if (cursor->end_of_table)
+// An index's entry values for a row, copied out of get_column_value's
+// static buffers so an old and a new row can be compared
+typedef struct
+{
+    bool present;
+    uint32_t row_id;
+    uint32_t key_size;
+    uint8_t key[MAX_COLUMN_SIZE];
+    uint32_t include_size;
+    uint8_t include[SECONDARY_INDEX_MAX_INCLUDE];
+} IndexRowEntry;
+
+static void entry_from_row(TableDef *table_def, IndexDef *index_def,
+                           uint32_t column_idx, const CompiledExpr *predicate,
+                           DynamicRow *row, IndexRowEntry *entry)
+{
+    entry->present = false;
+    if (!row || !index_predicate_holds(predicate, row))
     {
-        free(cursor);
-        return false;
+        return;
     }
+    uint32_t key_size;
+    uint8_t key_buffer[MAX_COLUMN_SIZE];
+    void *key_data = index_key_from_row(table_def, index_def, column_idx, row,
+                                        key_buffer, &key_size);
+    if (!key_data || key_size > sizeof(entry->key))
+    {
+        return;
+    }
+    entry->present = true;
+    entry->row_id = dynamic_row_get_int(row, table_def, table_def->key_columns[0]);
+    entry->key_size = key_size;
+    memcpy(entry->key, key_data, key_size);
+    entry->include_size = index_include_from_row(table_def, index_def, row,
+                                                 entry->include);
+}
 
-    // Check if the row_id matches
-    void *node = get_page(index_table->pager, cursor->page_num);
-    void *value = leaf_node_value(node, cursor->cell_num);
-
-    // Cast the value to our secondary index entry
-    SecondaryIndexEntry *entry = (SecondaryIndexEntry *)value;
+static bool same_entry(const IndexRowEntry *a, const IndexRowEntry *b)
+{
+    return a->present == b->present &&
+           (!a->present ||
+            (a->row_id == b->row_id && a->key_size == b->key_size &&
+             a->include_size == b->include_size &&
+             memcmp(a->key, b->key, a->key_size) == 0 &&
+             memcmp(a->include, b->include, a->include_size) == 0));
+}
 
-    // If this is the correct entry, delete it
-    if (entry->row_id == row_id)
+// Move a row's entry in an open B-tree or hash index file. An entry the
+// row already has under the new key is replaced, so replaying a write the
+// file has already seen changes nothing.
+static void move_entry(IndexDef *index_def, Table *index_table,
+                       const IndexRowEntry *old_entry,
+                       const IndexRowEntry *new_entry)
+{
+    bool hashed = index_def->type == INDEX_TYPE_HASH;
+    if (old_entry->present)
     {
-        // We need to use the existing delete mechanism
-        // This is similar to execute_delete in command_processor.c
+        uint32_t hash_key = hash_key_for_value((void *)old_entry->key, old_entry->key_size);
+        if (hashed)
+        {
+            hash_index_delete(index_table, hash_key, old_entry->row_id);
+        }
+        else
+        {
+            secondary_index_delete(index_table, hash_key, old_entry->row_id);
+        }
+    }
+    if (new_entry->present)
+    {
+        uint32_t hash_key = hash_key_for_value((void *)new_entry->key, new_entry->key_size);
+        if (hashed)
+        {
+            hash_index_delete(index_table, hash_key, new_entry->row_id);
+            hash_index_insert(index_table, hash_key, new_entry->row_id,
+                              new_entry->key, new_entry->key_size,
+                              new_entry->include, new_entry->include_size);
+        }
+        else if (!secondary_index_insert(index_table, hash_key, new_entry->row_id,
+                                         (void *)new_entry->key, new_entry->key_size,
+                                         new_entry->include, new_entry->include_size))
+        {
+            secondary_index_delete(index_table, hash_key, new_entry->row_id);
+            secondary_index_insert(index_table, hash_key, new_entry->row_id,
+                                   (void *)new_entry->key, new_entry->key_size,
+                                   new_entry->include, new_entry->include_size);
+        }
+    }
+}
 
-        uint32_t num_cells = *leaf_node_num_cells(node);
+void secondary_indexes_note_row(TableDef *table_def, DynamicRow *old_row,
+                                DynamicRow *new_row)
+{
+    IndexRowEntry old_entry, new_entry;
+    for (uint32_t i = 0; i < table_def->num_indexes; i++)
+    {
+        IndexDef *index_def = &table_def->indexes[i];
+        int column_idx = table_def_find_column(table_def, index_def->column_name);
+        if (column_idx == -1)
+        {
+            continue;
+        }
 
-        // Shift cells to overwrite the one being deleted
-        if (cursor->cell_num < num_cells - 1)
+        Table *index_table = table_cache_acquire(index_def->filename);
+        if (!index_table)
+        {
+            continue;
+        }
+        if (index_def->type == INDEX_TYPE_BITMAP ||
+            index_def->type == INDEX_TYPE_FULLTEXT)
         {
-            void *cell_to_delete = leaf_node_cell(node, cursor->cell_num);
-            void *next_cell = leaf_node_next_cell(node, cursor->cell_num);
+            // Changes the decoded index, which is saved when the file
+            // closes. An invalid file is left alone: queries scan instead
+            // until it is rebuilt.
+            secondary_index_apply(table_def, index_def, index_table, old_row, new_row);
+            table_cache_release(index_table);
+            continue;
+        }
+        bool hashed = index_def->type == INDEX_TYPE_HASH;
+        const CompiledExpr *predicate;
+        if ((hashed ? !hash_index_valid(index_table) : !secondary_index_set_key(index_table)) ||
+            !index_predicate_get(index_table, table_def, index_def, &predicate))
+        {
+            // Queries scan past an unreadable file and never trust an old
+            // one by itself
+            table_cache_release(index_table);
+            continue;
+        }
+        entry_from_row(table_def, index_def, column_idx, predicate, old_row, &old_entry);
+        entry_from_row(table_def, index_def, column_idx, predicate, new_row, &new_entry);
+        if (!same_entry(&old_entry, &new_entry))
+        {
+            move_entry(index_def, index_table, &old_entry, &new_entry);
+        }
+        table_cache_release(index_table);
+    }
 
-            uint32_t bytes_to_move = 0;
-            for (uint32_t i = cursor->cell_num + 1; i < num_cells; i++)
-            {
-                bytes_to_move += leaf_node_cell_size(node, i);
-            }
+    online_index_note_row(table_def, old_row, new_row);
+}
 
-            if (bytes_to_move > 0)
-            {
-                memmove(cell_to_delete, next_cell, bytes_to_move);
-            }
+// Free every page of a B-tree index file but its root, which becomes an
+// empty leaf again
+static void clear_tree(Table *index_table)
+{
+    Pager *pager = index_table->pager;
+    uint32_t num_pages = pager->num_pages;
+    for (uint32_t i = 0; i < num_pages; i++)
+    {
+        uint8_t *page = get_page(pager, i);
+        if (i != index_table->root_page_num && *page != PAGE_FREE_MARKER)
+        {
+            pager_free_page(pager, i);
         }
+    }
+    void *root = get_page(pager, index_table->root_page_num);
+    initialize_leaf_node(root);
+    set_node_root(root, true);
+}
 
-        // Decrement the number of cells
-        (*leaf_node_num_cells(node))--;
+bool secondary_index_prepare(IndexDef *index_def, Table *index_table)
+{
+    switch (index_def->type)
+    {
+    case INDEX_TYPE_HASH:
+        return hash_index_init(index_table);
+    case INDEX_TYPE_BITMAP:
+        bitmap_index_reset(index_table);
+        return true;
+    case INDEX_TYPE_FULLTEXT:
+        fulltext_index_reset(index_table);
+        return true;
+    default:
+        if (!secondary_index_set_key(index_table))
+        {
+            // Written in the older layout: start over
+            clear_tree(index_table);
+            return secondary_index_set_key(index_table);
+        }
+        return true;
+    }
+}
 
-        free(cursor);
+bool secondary_index_apply(TableDef *table_def, IndexDef *index_def,
+                           Table *index_table, DynamicRow *old_row,
+                           DynamicRow *new_row)
+{
+    if (index_def->type == INDEX_TYPE_BITMAP)
+    {
+        return bitmap_index_apply(table_def, index_def, index_table, old_row, new_row);
+    }
+    if (index_def->type == INDEX_TYPE_FULLTEXT)
+    {
+        return fulltext_index_apply(table_def, index_def, index_table, old_row, new_row);
+    }
+    int column_idx = table_def_find_column(table_def, index_def->column_name);
+    if (column_idx == -1)
+    {
+        return false;
+    }
+
+    IndexRowEntry old_entry, new_entry;
+    const CompiledExpr *predicate;
+    if (!index_predicate_get(index_table, table_def, index_def, &predicate))
+    {
+        return false;
+    }
+    entry_from_row(table_def, index_def, column_idx, predicate, old_row, &old_entry);
+    entry_from_row(table_def, index_def, column_idx, predicate, new_row, &new_entry);
+    if (!same_entry(&old_entry, &new_entry))
+    {
+        move_entry(index_def, index_table, &old_entry, &new_entry);
+    }
+    return true;
+}
+
+// A partial index's condition as compiled for its open file, with the
+// text it was compiled from
+struct IndexPredicate
+{
+    char text[MAX_INDEX_PREDICATE];
+    CompiledExpr *compiled; // NULL if it did not compile
+};
+
+bool index_predicate_get(Table *index_table, TableDef *table_def,
+                         const IndexDef *index_def,
+                         const CompiledExpr **predicate)
+{
+    *predicate = NULL;
+    if (index_def->predicate[0] == '\0')
+    {
         return true;
     }
+    IndexPredicate *cached = index_table->index_predicate;
+    if (!cached || strcmp(cached->text, index_def->predicate) != 0)
+    {
+        index_predicate_unload(index_table);
+        cached = calloc(1, sizeof(IndexPredicate));
+        memcpy(cached->text, index_def->predicate, sizeof(cached->text));
+        char error[SQL_MAX_ERROR];
+        SqlExpr *expr = sql_parse_expr(index_def->predicate, error, sizeof(error));
+        cached->compiled = expr ? expr_compile(expr, table_def, error, sizeof(error)) : NULL;
+        sql_expr_free(expr);
+        if (!cached->compiled)
+        {
+            printf("Error: Condition of index '%s' no longer compiles: %s. "
+                   "The index is not used.\n", index_def->name, error);
+        }
+        index_table->index_predicate = cached;
+    }
+    *predicate = cached->compiled;
+    return cached->compiled != NULL;
+}
+
+void index_predicate_unload(Table *index_table)
+{
+    if (index_table->index_predicate)
+    {
+        expr_free(index_table->index_predicate->compiled);
+        free(index_table->index_predicate);
+        index_table->index_predicate = NULL;
+    }
+}
+
+bool index_predicate_holds(const CompiledExpr *predicate, DynamicRow *row)
+{
+    return !predicate || expr_eval(predicate, row);
+}
+
+bool index_predicate_filter(Table *index_table, TableDef *table_def,
+                            const IndexDef *index_def, DynamicRow **old_row,
+                            DynamicRow **new_row)
+{
+    const CompiledExpr *predicate;
+    if (!index_predicate_get(index_table, table_def, index_def, &predicate))
+    {
+        return false;
+    }
+    if (*old_row && !index_predicate_holds(predicate, *old_row))
+    {
+        *old_row = NULL;
+    }
+    if (*new_row && !index_predicate_holds(predicate, *new_row))
+    {
+        *new_row = NULL;
+    }
+    return *old_row || *new_row;
+}
 
-    free(cursor);
-    return false;
+uint32_t index_include_size(TableDef *table_def, const IndexDef *index_def)
+{
+    uint32_t size = 0;
+    for (uint32_t i = 0; i < index_def->num_include; i++)
+    {
+        SortKey column;
+        sort_key_init(&column, table_def, index_def->include_columns[i], false);
+        size += column.width;
+    }
+    return size;
+}
+
+uint32_t index_include_from_row(TableDef *table_def, const IndexDef *index_def,
+                                DynamicRow *row, uint8_t *include)
+{
+    uint32_t size = 0;
+    for (uint32_t i = 0; i < index_def->num_include; i++)
+    {
+        SortKey column;
+        sort_key_init(&column, table_def, index_def->include_columns[i], false);
+        memcpy(include + size, (uint8_t *)row->data + column.offset, column.width);
+        size += column.width;
+    }
+    return size;
+}
+
+void index_include_to_row(TableDef *table_def, const IndexDef *index_def,
+                          const uint8_t *include, DynamicRow *row)
+{
+    uint32_t size = 0;
+    for (uint32_t i = 0; i < index_def->num_include; i++)
+    {
+        SortKey column;
+        sort_key_init(&column, table_def, index_def->include_columns[i], false);
+        memcpy((uint8_t *)row->data + column.offset, include + size, column.width);
+        size += column.width;
+    }
+}
+
+void index_matches_init(IndexMatches *matches, uint32_t include_size)
+{
+    matches->stride = (sizeof(uint32_t) + include_size + 3) & ~3u;
+    matches->count = 0;
+    matches->capacity = 16;
+    matches->entries = malloc(matches->capacity * matches->stride);
+}
+
+void index_matches_add(IndexMatches *matches, uint32_t row_id,
+                       const uint8_t *include, uint32_t include_size)
+{
+    if (matches->count == matches->capacity)
+    {
+        matches->capacity *= 2;
+        matches->entries = realloc(matches->entries,
+                                   matches->capacity * matches->stride);
+    }
+    uint8_t *slot = matches->entries + matches->count++ * matches->stride;
+    memset(slot, 0, matches->stride);
+    memcpy(slot, &row_id, sizeof(uint32_t));
+    // Entries written before the index had INCLUDE columns carry fewer bytes
+    uint32_t room = matches->stride - sizeof(uint32_t);
+    memcpy(slot + sizeof(uint32_t), include, include_size < room ? include_size : room);
+}
+
+static int compare_match_ids(const void *a, const void *b)
+{
+    uint32_t x, y;
+    memcpy(&x, a, sizeof(uint32_t));
+    memcpy(&y, b, sizeof(uint32_t));
+    return (x > y) - (x < y);
+}
+
+void index_matches_finish(IndexMatches *matches)
+{
+    uint32_t stride = matches->stride;
+    qsort(matches->entries, matches->count, stride, compare_match_ids);
+    uint32_t unique = 0;
+    for (uint32_t i = 0; i < matches->count; i++)
+    {
+        uint8_t *entry = matches->entries + i * stride;
+        if (unique == 0 ||
+            compare_match_ids(matches->entries + (unique - 1) * stride, entry) != 0)
+        {
+            memmove(matches->entries + unique * stride, entry, stride);
+            unique++;
+        }
+    }
+    matches->count = unique;
 }
 
 // Hash function for creating numeric keys from any data type
@@ -307,8 +740,9 @@ uint32_t hash_key_for_value(void *key, uint32_t key_size)
 // Get a column value and its size based on the column type
 void *get_column_value(DynamicRow *row, TableDef *table_def, uint32_t column_idx, uint32_t *size)
 {
-    static int32_t int_value;
-    static float float_value;
+    // Per thread, so an online index build can hash rows alongside queries
+    static _Thread_local int32_t int_value;
+    static _Thread_local float float_value;
 
     ColumnType type = table_def->columns[column_idx].type;
 
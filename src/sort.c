@@ -0,0 +1,550 @@
+#include "../include/sort.h"
+#include "../include/catalog.h"
+#include "../include/table.h"
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+static uint32_t key_width(ColumnDef *column)
+{
+  switch (column->type)
+  {
+  case COLUMN_TYPE_STRING:
+    return column->size + 1;
+  case COLUMN_TYPE_BLOB:
+    return column->size + sizeof(uint32_t);
+  case COLUMN_TYPE_BOOLEAN:
+    return sizeof(uint8_t);
+  case COLUMN_TYPE_BIGINT:
+  case COLUMN_TYPE_TIMESTAMP:
+    return sizeof(int64_t);
+  default:
+    return sizeof(int32_t);
+  }
+}
+
+void sort_key_init(SortKey *key, TableDef *table_def, uint32_t column_idx,
+                   bool descending)
+{
+  key->column = column_idx;
+  key->offset = get_column_offset(table_def, column_idx);
+  key->width = key_width(&table_def->columns[column_idx]);
+  key->type = table_def->columns[column_idx].type;
+  key->descending = descending;
+}
+
+static void add_key(SortSpec *spec, TableDef *table_def, uint32_t column_idx,
+                    bool descending)
+{
+  sort_key_init(&spec->keys[spec->num_keys++], table_def, column_idx,
+                descending);
+}
+
+bool sort_spec_build(TableDef *table_def, const SqlOrderBy *order_by,
+                     uint32_t num_order_by, SortSpec *spec, char *error,
+                     size_t error_size)
+{
+  memset(spec, 0, sizeof(SortSpec));
+  bool has_primary_key = false;
+  for (uint32_t i = 0; i < num_order_by && spec->num_keys < MAX_COLUMNS; i++)
+  {
+    int column_idx = table_def_find_column(table_def, order_by[i].column);
+    if (column_idx == -1)
+    {
+      snprintf(error, error_size, "unknown column '%s' in ORDER BY",
+               order_by[i].column);
+      return false;
+    }
+    has_primary_key |= column_idx == 0;
+    add_key(spec, table_def, column_idx, order_by[i].descending);
+  }
+  spec->num_order_by = spec->num_keys;
+  if (!has_primary_key)
+  {
+    add_key(spec, table_def, 0, false);
+  }
+
+  uint32_t last = table_def->num_columns - 1;
+  spec->row_size = get_column_offset(table_def, last) +
+                   key_width(&table_def->columns[last]);
+  return true;
+}
+
+int sort_compare_key(const SortKey *key, const uint8_t *a, const uint8_t *b)
+{
+  a += key->offset;
+  b += key->offset;
+  switch (key->type)
+  {
+  case COLUMN_TYPE_STRING:
+    // Same case folding as string equality in WHERE
+    return strncasecmp((const char *)a, (const char *)b, key->width);
+  case COLUMN_TYPE_FLOAT:
+  {
+    float x, y;
+    memcpy(&x, a, sizeof(x));
+    memcpy(&y, b, sizeof(y));
+    return (x > y) - (x < y);
+  }
+  case COLUMN_TYPE_BOOLEAN:
+    return (a[0] > b[0]) - (a[0] < b[0]);
+  case COLUMN_TYPE_BIGINT:
+  case COLUMN_TYPE_TIMESTAMP:
+  {
+    int64_t x, y;
+    memcpy(&x, a, sizeof(x));
+    memcpy(&y, b, sizeof(y));
+    return (x > y) - (x < y);
+  }
+  case COLUMN_TYPE_BLOB:
+    return memcmp(a, b, key->width);
+  default:
+  {
+    int32_t x, y;
+    memcpy(&x, a, sizeof(x));
+    memcpy(&y, b, sizeof(y));
+    return (x > y) - (x < y);
+  }
+  }
+}
+
+int sort_compare_rows(const SortSpec *spec, const uint8_t *a, const uint8_t *b)
+{
+  for (uint32_t i = 0; i < spec->num_keys; i++)
+  {
+    int cmp = sort_compare_key(&spec->keys[i], a, b);
+    if (cmp != 0)
+    {
+      return spec->keys[i].descending ? -cmp : cmp;
+    }
+  }
+  return 0;
+}
+
+bool sort_fits_top_n(const SortSpec *spec, size_t memory_budget,
+                     uint64_t limit)
+{
+  return limit <= memory_budget / (spec->row_size + sizeof(uint8_t *));
+}
+
+// Merge sort of row pointers; qsort has no way to pass the spec along
+static void sort_pointers(const SortSpec *spec, uint8_t **rows,
+                          uint8_t **scratch, uint32_t count)
+{
+  if (count < 2)
+  {
+    return;
+  }
+  uint32_t half = count / 2;
+  sort_pointers(spec, rows, scratch, half);
+  sort_pointers(spec, rows + half, scratch, count - half);
+  if (sort_compare_rows(spec, rows[half - 1], rows[half]) <= 0)
+  {
+    return; // Already in order, common for input that arrives in key order
+  }
+
+  memcpy(scratch, rows, half * sizeof(uint8_t *));
+  uint32_t i = 0, j = half, k = 0;
+  while (i < half && j < count)
+  {
+    rows[k++] = sort_compare_rows(spec, rows[j], scratch[i]) < 0
+                    ? rows[j++]
+                    : scratch[i++];
+  }
+  while (i < half)
+  {
+    rows[k++] = scratch[i++];
+  }
+}
+
+static void sort_in_memory(Sorter *sorter)
+{
+  uint8_t **scratch = malloc((sorter->num_rows / 2 + 1) * sizeof(uint8_t *));
+  sort_pointers(&sorter->spec, sorter->order, scratch, sorter->num_rows);
+  free(scratch);
+}
+
+void sorter_init(Sorter *sorter, const SortSpec *spec, size_t memory_budget,
+                 bool has_limit, uint64_t limit)
+{
+  memset(sorter, 0, sizeof(Sorter));
+  sorter->spec = *spec;
+  sorter->memory_budget = memory_budget < SORT_MIN_MEMORY_BUDGET
+                              ? SORT_MIN_MEMORY_BUDGET
+                              : memory_budget;
+  pthread_mutex_init(&sorter->lock, NULL);
+
+  uint32_t row_size = spec->row_size;
+  if (has_limit && sort_fits_top_n(spec, sorter->memory_budget, limit))
+  {
+    sorter->top_n = true;
+    sorter->limit = limit;
+    sorter->capacity = limit;
+  }
+  else
+  {
+    // Room for a whole run and its pointers
+    sorter->capacity = sorter->memory_budget / (row_size + sizeof(uint8_t *));
+    if (sorter->capacity < 2)
+    {
+      sorter->capacity = 2;
+    }
+  }
+}
+
+// Make sure row slot num_rows exists. The buffers grow as rows arrive so a
+// small sort does not allocate the whole budget.
+static void reserve_slot(Sorter *sorter)
+{
+  if (sorter->num_rows < sorter->allocated)
+  {
+    return;
+  }
+  uint32_t grown = sorter->allocated ? sorter->allocated * 2 : 64;
+  if (grown > sorter->capacity)
+  {
+    grown = sorter->capacity;
+  }
+  // The pointers move with the buffer
+  uintptr_t old_base = (uintptr_t)sorter->rows;
+  sorter->rows = realloc(sorter->rows, (size_t)grown * sorter->spec.row_size);
+  sorter->order = realloc(sorter->order, grown * sizeof(uint8_t *));
+  for (uint32_t i = 0; i < sorter->num_rows; i++)
+  {
+    sorter->order[i] = sorter->rows + ((uintptr_t)sorter->order[i] - old_base);
+  }
+  sorter->allocated = grown;
+}
+
+// Write the in-memory rows out as one sorted run
+static void spill_run(Sorter *sorter)
+{
+  FILE *file = tmpfile();
+  if (!file)
+  {
+    // Keep going in memory rather than fail the query
+    printf("Warning: Could not create a sort run file, sorting in memory.\n");
+    sorter->capacity *= 2;
+    return;
+  }
+
+  sort_in_memory(sorter);
+  uint32_t row_size = sorter->spec.row_size;
+  for (uint32_t i = 0; i < sorter->num_rows; i++)
+  {
+    fwrite(sorter->order[i], row_size, 1, file);
+  }
+
+  sorter->runs = realloc(sorter->runs, (sorter->num_runs + 1) * sizeof(SortRun));
+  SortRun *run = &sorter->runs[sorter->num_runs++];
+  memset(run, 0, sizeof(SortRun));
+  run->file = file;
+  run->num_rows = sorter->num_rows;
+
+  sorter->runs_spilled++;
+  sorter->bytes_spilled += (uint64_t)sorter->num_rows * row_size;
+  sorter->num_rows = 0;
+}
+
+static void heap_swap(uint8_t **order, uint32_t i, uint32_t j)
+{
+  uint8_t *row = order[i];
+  order[i] = order[j];
+  order[j] = row;
+}
+
+// Top-N max-heap over the order array: the root sorts last
+static void top_n_sift_down(Sorter *sorter, uint32_t i)
+{
+  uint8_t **order = sorter->order;
+  for (;;)
+  {
+    uint32_t largest = i;
+    uint32_t left = 2 * i + 1;
+    uint32_t right = left + 1;
+    if (left < sorter->num_rows &&
+        sort_compare_rows(&sorter->spec, order[left], order[largest]) > 0)
+    {
+      largest = left;
+    }
+    if (right < sorter->num_rows &&
+        sort_compare_rows(&sorter->spec, order[right], order[largest]) > 0)
+    {
+      largest = right;
+    }
+    if (largest == i)
+    {
+      return;
+    }
+    heap_swap(order, i, largest);
+    i = largest;
+  }
+}
+
+static void top_n_add(Sorter *sorter, const uint8_t *row)
+{
+  uint32_t row_size = sorter->spec.row_size;
+  if (sorter->num_rows < sorter->limit)
+  {
+    reserve_slot(sorter);
+    uint32_t i = sorter->num_rows++;
+    sorter->order[i] = sorter->rows + (size_t)i * row_size;
+    memcpy(sorter->order[i], row, row_size);
+    while (i > 0)
+    {
+      uint32_t parent = (i - 1) / 2;
+      if (sort_compare_rows(&sorter->spec, sorter->order[i],
+                            sorter->order[parent]) <= 0)
+      {
+        break;
+      }
+      heap_swap(sorter->order, i, parent);
+      i = parent;
+    }
+    return;
+  }
+  // Only a row that sorts before the current worst gets in
+  if (sorter->num_rows > 0 &&
+      sort_compare_rows(&sorter->spec, row, sorter->order[0]) < 0)
+  {
+    memcpy(sorter->order[0], row, row_size);
+    top_n_sift_down(sorter, 0);
+  }
+}
+
+void sorter_add(Sorter *sorter, const uint8_t *row)
+{
+  pthread_mutex_lock(&sorter->lock);
+  sorter->rows_in++;
+  if (sorter->top_n)
+  {
+    top_n_add(sorter, row);
+    pthread_mutex_unlock(&sorter->lock);
+    return;
+  }
+
+  if (sorter->num_rows == sorter->capacity)
+  {
+    spill_run(sorter);
+  }
+  reserve_slot(sorter);
+  uint32_t i = sorter->num_rows++;
+  sorter->order[i] = sorter->rows + (size_t)i * sorter->spec.row_size;
+  memcpy(sorter->order[i], row, sorter->spec.row_size);
+  pthread_mutex_unlock(&sorter->lock);
+}
+
+// Current row of a run, reading ahead when the buffer is used up
+static const uint8_t *run_peek(SortRun *run, uint32_t row_size)
+{
+  if (run->position == run->buffered)
+  {
+    uint64_t remaining = run->num_rows - run->rows_read;
+    uint32_t want = remaining < run->buffer_rows ? remaining : run->buffer_rows;
+    run->buffered = want ? fread(run->buffer, row_size, want, run->file) : 0;
+    run->rows_read += run->buffered;
+    run->position = 0;
+    if (run->buffered == 0)
+    {
+      return NULL;
+    }
+  }
+  return run->buffer + (size_t)run->position * row_size;
+}
+
+static void run_open_for_merge(SortRun *run, uint32_t buffer_rows,
+                               uint32_t row_size)
+{
+  rewind(run->file);
+  run->rows_read = 0;
+  run->buffered = 0;
+  run->position = 0;
+  run->buffer_rows = buffer_rows ? buffer_rows : 1;
+  run->buffer = malloc((size_t)run->buffer_rows * row_size);
+}
+
+static void run_close(SortRun *run)
+{
+  fclose(run->file);
+  free(run->buffer);
+}
+
+// Min-heap of run indexes ordered by each run's current row
+static bool merge_less(Sorter *sorter, SortRun *runs, uint32_t a, uint32_t b)
+{
+  uint32_t row_size = sorter->spec.row_size;
+  return sort_compare_rows(&sorter->spec, run_peek(&runs[a], row_size),
+                           run_peek(&runs[b], row_size)) < 0;
+}
+
+static void merge_sift_down(Sorter *sorter, SortRun *runs, uint32_t *heap,
+                            uint32_t size, uint32_t i)
+{
+  for (;;)
+  {
+    uint32_t smallest = i;
+    uint32_t left = 2 * i + 1;
+    uint32_t right = left + 1;
+    if (left < size && merge_less(sorter, runs, heap[left], heap[smallest]))
+    {
+      smallest = left;
+    }
+    if (right < size && merge_less(sorter, runs, heap[right], heap[smallest]))
+    {
+      smallest = right;
+    }
+    if (smallest == i)
+    {
+      return;
+    }
+    uint32_t run = heap[i];
+    heap[i] = heap[smallest];
+    heap[smallest] = run;
+    i = smallest;
+  }
+}
+
+// Fill heap with the runs that have rows and order it
+static uint32_t merge_start(Sorter *sorter, SortRun *runs, uint32_t num_runs,
+                            uint32_t *heap)
+{
+  uint32_t row_size = sorter->spec.row_size;
+  uint32_t buffer_rows = sorter->memory_budget / row_size / (num_runs + 1);
+  uint32_t size = 0;
+  for (uint32_t r = 0; r < num_runs; r++)
+  {
+    run_open_for_merge(&runs[r], buffer_rows, row_size);
+    if (run_peek(&runs[r], row_size))
+    {
+      heap[size++] = r;
+    }
+  }
+  for (uint32_t i = size / 2; i-- > 0;)
+  {
+    merge_sift_down(sorter, runs, heap, size, i);
+  }
+  return size;
+}
+
+// Copy the smallest row into out and step its run forward. Returns false
+// once every run is used up.
+static bool merge_pop(Sorter *sorter, SortRun *runs, uint32_t *heap,
+                      uint32_t *size, uint8_t *out)
+{
+  if (*size == 0)
+  {
+    return false;
+  }
+  uint32_t row_size = sorter->spec.row_size;
+  SortRun *run = &runs[heap[0]];
+  memcpy(out, run_peek(run, row_size), row_size);
+  run->position++;
+  if (!run_peek(run, row_size))
+  {
+    heap[0] = heap[--(*size)];
+  }
+  merge_sift_down(sorter, runs, heap, *size, 0);
+  return true;
+}
+
+// Merge the first SORT_MERGE_FAN_IN runs into one new run at the end
+static void merge_pass(Sorter *sorter)
+{
+  FILE *file = tmpfile();
+  if (!file)
+  {
+    return; // The final merge takes every run at once instead
+  }
+  uint32_t fan_in = SORT_MERGE_FAN_IN;
+  uint32_t heap[SORT_MERGE_FAN_IN];
+  uint32_t size = merge_start(sorter, sorter->runs, fan_in, heap);
+  uint8_t *row = malloc(sorter->spec.row_size);
+  uint64_t num_rows = 0;
+  while (merge_pop(sorter, sorter->runs, heap, &size, row))
+  {
+    fwrite(row, sorter->spec.row_size, 1, file);
+    num_rows++;
+  }
+  free(row);
+
+  for (uint32_t r = 0; r < fan_in; r++)
+  {
+    run_close(&sorter->runs[r]);
+  }
+  memmove(sorter->runs, sorter->runs + fan_in,
+          (sorter->num_runs - fan_in) * sizeof(SortRun));
+  sorter->num_runs -= fan_in - 1;
+  SortRun *merged = &sorter->runs[sorter->num_runs - 1];
+  memset(merged, 0, sizeof(SortRun));
+  merged->file = file;
+  merged->num_rows = num_rows;
+
+  sorter->merge_passes++;
+  sorter->bytes_spilled += num_rows * sorter->spec.row_size;
+}
+
+void sorter_finish(Sorter *sorter)
+{
+  sorter->next = 0;
+  if (sorter->num_runs == 0)
+  {
+    sort_in_memory(sorter);
+    return;
+  }
+
+  if (sorter->num_rows > 0)
+  {
+    spill_run(sorter);
+  }
+  // The runs hold everything now; their read buffers take over the budget
+  free(sorter->rows);
+  free(sorter->order);
+  sorter->rows = NULL;
+  sorter->order = NULL;
+  sorter->num_rows = 0;
+  sorter->allocated = 0;
+
+  while (sorter->num_runs > SORT_MERGE_FAN_IN)
+  {
+    uint32_t before = sorter->num_runs;
+    merge_pass(sorter);
+    if (sorter->num_runs == before)
+    {
+      break;
+    }
+  }
+
+  sorter->heap = malloc(sorter->num_runs * sizeof(uint32_t));
+  sorter->heap_size = merge_start(sorter, sorter->runs, sorter->num_runs,
+                                  sorter->heap);
+  sorter->current = malloc(sorter->spec.row_size);
+  sorter->merge_passes++;
+}
+
+const uint8_t *sorter_next(Sorter *sorter)
+{
+  if (sorter->num_runs == 0)
+  {
+    return sorter->next < sorter->num_rows ? sorter->order[sorter->next++]
+                                           : NULL;
+  }
+  return merge_pop(sorter, sorter->runs, sorter->heap, &sorter->heap_size,
+                   sorter->current)
+             ? sorter->current
+             : NULL;
+}
+
+void sorter_free(Sorter *sorter)
+{
+  for (uint32_t r = 0; r < sorter->num_runs; r++)
+  {
+    run_close(&sorter->runs[r]);
+  }
+  free(sorter->runs);
+  free(sorter->rows);
+  free(sorter->order);
+  free(sorter->heap);
+  free(sorter->current);
+  pthread_mutex_destroy(&sorter->lock);
+  memset(sorter, 0, sizeof(Sorter));
+}
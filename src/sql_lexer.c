@@ -0,0 +1,176 @@
+#include "../include/sql_parser.h"
+#include <ctype.h>
+#include <stdlib.h>
+
+void sql_lexer_init(SqlLexer *lexer, const char *source)
+{
+  lexer->source = source;
+  lexer->current = source;
+  lexer->next_param = 0;
+}
+
+static SqlToken make_token(SqlLexer *lexer, SqlTokenType type,
+                           const char *start)
+{
+  SqlToken token;
+  token.type = type;
+  token.start = start;
+  token.length = (uint32_t)(lexer->current - start);
+  token.param_index = 0;
+  return token;
+}
+
+static bool is_identifier_char(char c)
+{
+  return isalnum((unsigned char)c) || c == '_';
+}
+
+SqlToken sql_lexer_next(SqlLexer *lexer)
+{
+  while (isspace((unsigned char)*lexer->current))
+  {
+    lexer->current++;
+  }
+
+  const char *start = lexer->current;
+  char c = *lexer->current;
+
+  if (c == '\0')
+  {
+    return make_token(lexer, SQL_TOKEN_END, start);
+  }
+
+  if (isalpha((unsigned char)c) || c == '_')
+  {
+    while (is_identifier_char(*lexer->current))
+    {
+      lexer->current++;
+    }
+    return make_token(lexer, SQL_TOKEN_IDENTIFIER, start);
+  }
+
+  // Numbers, with an optional sign and fractional part
+  if (isdigit((unsigned char)c) ||
+      ((c == '-' || c == '+') && (isdigit((unsigned char)lexer->current[1]) ||
+                                  lexer->current[1] == '.')) ||
+      (c == '.' && isdigit((unsigned char)lexer->current[1])))
+  {
+    if (c == '-' || c == '+')
+    {
+      lexer->current++;
+    }
+    while (isdigit((unsigned char)*lexer->current))
+    {
+      lexer->current++;
+    }
+    if (*lexer->current == '.')
+    {
+      lexer->current++;
+      while (isdigit((unsigned char)*lexer->current))
+      {
+        lexer->current++;
+      }
+    }
+    return make_token(lexer, SQL_TOKEN_NUMBER, start);
+  }
+
+  // Quoted strings. The token covers the quotes; a doubled quote
+  // character inside the string stands for a single one.
+  if (c == '\'' || c == '"')
+  {
+    lexer->current++;
+    while (*lexer->current)
+    {
+      if (*lexer->current == c)
+      {
+        if (lexer->current[1] == c)
+        {
+          lexer->current += 2;
+          continue;
+        }
+        break;
+      }
+      lexer->current++;
+    }
+    if (*lexer->current != c)
+    {
+      return make_token(lexer, SQL_TOKEN_ERROR, start);
+    }
+    lexer->current++;
+    return make_token(lexer, SQL_TOKEN_STRING, start);
+  }
+
+  // Placeholders: ? takes the next position, $N names one explicitly
+  if (c == '?')
+  {
+    lexer->current++;
+    SqlToken token = make_token(lexer, SQL_TOKEN_PARAM, start);
+    token.param_index = lexer->next_param++;
+    return token;
+  }
+  if (c == '$' && isdigit((unsigned char)lexer->current[1]))
+  {
+    lexer->current++;
+    uint32_t number = 0;
+    while (isdigit((unsigned char)*lexer->current))
+    {
+      number = number * 10 + (*lexer->current - '0');
+      lexer->current++;
+    }
+    SqlToken token = make_token(lexer, number > 0 ? SQL_TOKEN_PARAM : SQL_TOKEN_ERROR,
+                                start);
+    token.param_index = number > 0 ? number - 1 : 0;
+    return token;
+  }
+
+  lexer->current++;
+  switch (c)
+  {
+    case '*':
+      return make_token(lexer, SQL_TOKEN_STAR, start);
+    case ',':
+      return make_token(lexer, SQL_TOKEN_COMMA, start);
+    case '.':
+      return make_token(lexer, SQL_TOKEN_DOT, start);
+    case '(':
+      return make_token(lexer, SQL_TOKEN_LPAREN, start);
+    case ')':
+      return make_token(lexer, SQL_TOKEN_RPAREN, start);
+    case ';':
+      return make_token(lexer, SQL_TOKEN_SEMICOLON, start);
+    case '=':
+      if (*lexer->current == '=')
+      {
+        lexer->current++;
+      }
+      return make_token(lexer, SQL_TOKEN_EQ, start);
+    case '!':
+      if (*lexer->current == '=')
+      {
+        lexer->current++;
+        return make_token(lexer, SQL_TOKEN_NE, start);
+      }
+      break;
+    case '<':
+      if (*lexer->current == '=')
+      {
+        lexer->current++;
+        return make_token(lexer, SQL_TOKEN_LE, start);
+      }
+      if (*lexer->current == '>')
+      {
+        lexer->current++;
+        return make_token(lexer, SQL_TOKEN_NE, start);
+      }
+      return make_token(lexer, SQL_TOKEN_LT, start);
+    case '>':
+      if (*lexer->current == '=')
+      {
+        lexer->current++;
+        return make_token(lexer, SQL_TOKEN_GE, start);
+      }
+      return make_token(lexer, SQL_TOKEN_GT, start);
+  }
+
+  return make_token(lexer, SQL_TOKEN_ERROR, start);
+}
@@ -0,0 +1,1103 @@
+#include "../include/sql_parser.h"
+#include "../include/column_func.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+// Recursive-descent parser over the token stream from sql_lexer.c.
+//
+//   statement  := select | insert | update | delete
+//               | PREPARE name AS statement
+//               | EXECUTE name [ '(' value { ',' value } ')' ]
+//               | DEALLOCATE [PREPARE] name
+//   select     := SELECT ( '*' | item { ',' item } ) FROM table
+//                 [ [INNER] JOIN table ON column '=' column ] [ WHERE expr ]
+//                 [ GROUP BY column { ',' column } ] [ ORDER BY ... ]
+//                 [ LIMIT n ] [ OFFSET m ]
+//   table      := ident [ [AS] ident ]
+//   column     := ident [ '.' ident ]
+//   insert     := INSERT INTO ident [ VALUES ] '(' value { ',' value } ')'
+//   update     := UPDATE ident SET assignment { ',' assignment }
+//                 [ WHERE expr ]
+//   assignment := ident '=' value
+//   delete     := DELETE FROM ident [ WHERE expr ]
+//   expr       := and_expr { OR and_expr }
+//   and_expr   := primary { AND primary }
+//   primary    := '(' expr ')' | operand ( compare_op | LIKE | MATCH ) value
+//               | operand BETWEEN value AND value
+//   operand    := column | ( LOWER | UPPER | DATE ) '(' column ')'
+//               | SUBSTR '(' column ',' n [ ',' n ] ')'
+//               | CAST '(' column AS INT ')'
+//   value      := number | string | ident | '?' | '$'N
+
+typedef struct
+{
+  SqlLexer lexer;
+  SqlToken current;
+  SqlToken previous;
+  char *error;
+  size_t error_size;
+  bool failed;
+  uint32_t num_params;
+} SqlParser;
+
+// Words that cannot be used as bare table or column names
+static const char *reserved_words[] = {
+    "select", "from", "where", "insert", "into", "values", "update",
+    "set", "delete", "and", "or", "as", "like", "prepare", "execute",
+    "deallocate", "explain", "analyze", "between", "order", "by", "asc",
+    "desc", "limit", "offset", "group", "join", "inner", "on", "match",
+    NULL};
+
+static void advance(SqlParser *parser)
+{
+  parser->previous = parser->current;
+  parser->current = sql_lexer_next(&parser->lexer);
+}
+
+static void parse_error(SqlParser *parser, const char *expected)
+{
+  if (parser->failed)
+  {
+    return;
+  }
+  parser->failed = true;
+
+  SqlToken *token = &parser->current;
+  if (token->type == SQL_TOKEN_END)
+  {
+    snprintf(parser->error, parser->error_size, "expected %s at end of input",
+             expected);
+  }
+  else
+  {
+    snprintf(parser->error, parser->error_size, "expected %s near '%.*s'",
+             expected, (int)token->length, token->start);
+  }
+}
+
+static bool token_is_word(SqlToken *token, const char *word)
+{
+  return token->type == SQL_TOKEN_IDENTIFIER &&
+         token->length == strlen(word) &&
+         strncasecmp(token->start, word, token->length) == 0;
+}
+
+static bool token_is_reserved(SqlToken *token)
+{
+  for (int i = 0; reserved_words[i]; i++)
+  {
+    if (token_is_word(token, reserved_words[i]))
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+static bool match_keyword(SqlParser *parser, const char *keyword)
+{
+  if (token_is_word(&parser->current, keyword))
+  {
+    advance(parser);
+    return true;
+  }
+  return false;
+}
+
+static bool expect_keyword(SqlParser *parser, const char *keyword)
+{
+  if (match_keyword(parser, keyword))
+  {
+    return true;
+  }
+  char expected[32];
+  snprintf(expected, sizeof(expected), "%s", keyword);
+  for (char *c = expected; *c; c++)
+  {
+    *c = (char)toupper((unsigned char)*c);
+  }
+  parse_error(parser, expected);
+  return false;
+}
+
+static bool match(SqlParser *parser, SqlTokenType type)
+{
+  if (parser->current.type == type)
+  {
+    advance(parser);
+    return true;
+  }
+  return false;
+}
+
+static bool expect(SqlParser *parser, SqlTokenType type, const char *expected)
+{
+  if (match(parser, type))
+  {
+    return true;
+  }
+  parse_error(parser, expected);
+  return false;
+}
+
+// Copy an identifier (table, column or statement name) into dest
+static bool parse_name(SqlParser *parser, char *dest, size_t size,
+                       const char *expected)
+{
+  SqlToken *token = &parser->current;
+  if (token->type != SQL_TOKEN_IDENTIFIER || token_is_reserved(token) ||
+      token->length >= size)
+  {
+    parse_error(parser, expected);
+    return false;
+  }
+  memcpy(dest, token->start, token->length);
+  dest[token->length] = '\0';
+  advance(parser);
+  return true;
+}
+
+// A column name, optionally qualified by a table name or alias as in a.x
+static bool parse_column(SqlParser *parser, char *dest, size_t size,
+                         const char *expected)
+{
+  if (!parse_name(parser, dest, size, expected))
+  {
+    return false;
+  }
+  if (!match(parser, SQL_TOKEN_DOT))
+  {
+    return true;
+  }
+  size_t length = strlen(dest);
+  dest[length] = '.';
+  return parse_name(parser, dest + length + 1, size - length - 1,
+                    "a column name");
+}
+
+// An optional alias after a table name, with or without AS
+static bool parse_alias(SqlParser *parser, char *dest)
+{
+  if (match_keyword(parser, "as"))
+  {
+    return parse_name(parser, dest, MAX_TABLE_NAME, "an alias");
+  }
+  if (parser->current.type == SQL_TOKEN_IDENTIFIER &&
+      !token_is_reserved(&parser->current))
+  {
+    return parse_name(parser, dest, MAX_TABLE_NAME, "an alias");
+  }
+  return true;
+}
+
+static bool parse_value(SqlParser *parser, SqlValue *value)
+{
+  SqlToken *token = &parser->current;
+  memset(value, 0, sizeof(SqlValue));
+
+  switch (token->type)
+  {
+    case SQL_TOKEN_PARAM:
+      value->kind = SQL_VALUE_PARAM;
+      value->param_index = token->param_index;
+      if (token->param_index + 1 > parser->num_params)
+      {
+        parser->num_params = token->param_index + 1;
+      }
+      break;
+
+    case SQL_TOKEN_NUMBER:
+    case SQL_TOKEN_IDENTIFIER:
+      if (token->length >= SQL_MAX_TOKEN_TEXT)
+      {
+        parse_error(parser, "a shorter value");
+        return false;
+      }
+      value->kind = SQL_VALUE_LITERAL;
+      memcpy(value->text, token->start, token->length);
+      value->text[token->length] = '\0';
+      break;
+
+    case SQL_TOKEN_STRING:
+    {
+      // Strip the quotes and collapse doubled quote characters
+      char quote = token->start[0];
+      uint32_t length = 0;
+      for (uint32_t i = 1; i + 1 < token->length; i++)
+      {
+        if (length + 1 >= SQL_MAX_TOKEN_TEXT)
+        {
+          parse_error(parser, "a shorter string");
+          return false;
+        }
+        value->text[length++] = token->start[i];
+        if (token->start[i] == quote)
+        {
+          i++;
+        }
+      }
+      value->text[length] = '\0';
+      value->kind = SQL_VALUE_LITERAL;
+      value->quoted = true;
+      break;
+    }
+
+    default:
+      parse_error(parser, "a value");
+      return false;
+  }
+
+  advance(parser);
+  return true;
+}
+
+static bool parse_value_list(SqlParser *parser, SqlStatement *statement)
+{
+  if (!expect(parser, SQL_TOKEN_LPAREN, "'('"))
+  {
+    return false;
+  }
+  if (match(parser, SQL_TOKEN_RPAREN))
+  {
+    return true;
+  }
+
+  uint32_t capacity = 0;
+  do
+  {
+    if (statement->num_values == capacity)
+    {
+      capacity = capacity ? capacity * 2 : 8;
+      statement->values = realloc(statement->values, capacity * sizeof(SqlValue));
+    }
+    if (!parse_value(parser, &statement->values[statement->num_values]))
+    {
+      return false;
+    }
+    statement->num_values++;
+  } while (match(parser, SQL_TOKEN_COMMA));
+
+  return expect(parser, SQL_TOKEN_RPAREN, "')' or ','");
+}
+
+void sql_expr_free(SqlExpr *expr)
+{
+  if (!expr)
+  {
+    return;
+  }
+  sql_expr_free(expr->left);
+  sql_expr_free(expr->right);
+  free(expr);
+}
+
+static SqlExpr *parse_or(SqlParser *parser);
+static bool parse_count(SqlParser *parser, uint32_t *count);
+
+// A column, or one of the functions in column_func.h applied to a column
+static bool parse_operand(SqlParser *parser, char *column, ColumnFunc *func)
+{
+  memset(func, 0, sizeof(ColumnFunc));
+  if (!parse_column(parser, column, MAX_COLUMN_NAME, "a column name"))
+  {
+    return false;
+  }
+  if (parser->current.type != SQL_TOKEN_LPAREN)
+  {
+    return true;
+  }
+  if (!column_func_lookup(column, &func->type))
+  {
+    parse_error(parser, "a comparison operator");
+    return false;
+  }
+  advance(parser);
+  if (!parse_column(parser, column, MAX_COLUMN_NAME, "a column name"))
+  {
+    return false;
+  }
+
+  if (func->type == COLUMN_FUNC_INT)
+  {
+    if (!expect_keyword(parser, "as"))
+    {
+      return false;
+    }
+    if (!token_is_word(&parser->current, "int") &&
+        !token_is_word(&parser->current, "integer"))
+    {
+      parse_error(parser, "INT");
+      return false;
+    }
+    advance(parser);
+  }
+  else if (func->type == COLUMN_FUNC_SUBSTR)
+  {
+    uint32_t start, length;
+    if (!expect(parser, SQL_TOKEN_COMMA, "','") || !parse_count(parser, &start))
+    {
+      return false;
+    }
+    func->start = start;
+    func->length = -1;
+    if (match(parser, SQL_TOKEN_COMMA))
+    {
+      if (!parse_count(parser, &length))
+      {
+        return false;
+      }
+      func->length = length;
+    }
+  }
+  return expect(parser, SQL_TOKEN_RPAREN, "')'");
+}
+
+// column BETWEEN low AND high becomes column >= low AND column <= high
+static SqlExpr *parse_between(SqlParser *parser, SqlExpr *low)
+{
+  SqlExpr *high = calloc(1, sizeof(SqlExpr));
+  high->type = SQL_EXPR_COMPARE;
+  memcpy(high->column, low->column, sizeof(high->column));
+  high->func = low->func;
+  low->op = SQL_OP_GE;
+  high->op = SQL_OP_LE;
+
+  if (!parse_value(parser, &low->value) || !expect_keyword(parser, "and") ||
+      !parse_value(parser, &high->value))
+  {
+    free(low);
+    free(high);
+    return NULL;
+  }
+
+  SqlExpr *both = calloc(1, sizeof(SqlExpr));
+  both->type = SQL_EXPR_AND;
+  both->left = low;
+  both->right = high;
+  return both;
+}
+
+static SqlExpr *parse_primary(SqlParser *parser)
+{
+  if (match(parser, SQL_TOKEN_LPAREN))
+  {
+    SqlExpr *inner = parse_or(parser);
+    if (!inner || !expect(parser, SQL_TOKEN_RPAREN, "')'"))
+    {
+      sql_expr_free(inner);
+      return NULL;
+    }
+    return inner;
+  }
+
+  SqlExpr *expr = calloc(1, sizeof(SqlExpr));
+  expr->type = SQL_EXPR_COMPARE;
+  if (!parse_operand(parser, expr->column, &expr->func))
+  {
+    free(expr);
+    return NULL;
+  }
+
+  switch (parser->current.type)
+  {
+    case SQL_TOKEN_EQ:
+      expr->op = SQL_OP_EQ;
+      break;
+    case SQL_TOKEN_NE:
+      expr->op = SQL_OP_NE;
+      break;
+    case SQL_TOKEN_LT:
+      expr->op = SQL_OP_LT;
+      break;
+    case SQL_TOKEN_LE:
+      expr->op = SQL_OP_LE;
+      break;
+    case SQL_TOKEN_GT:
+      expr->op = SQL_OP_GT;
+      break;
+    case SQL_TOKEN_GE:
+      expr->op = SQL_OP_GE;
+      break;
+    case SQL_TOKEN_IDENTIFIER:
+      if (token_is_word(&parser->current, "like"))
+      {
+        expr->op = SQL_OP_LIKE;
+        break;
+      }
+      if (token_is_word(&parser->current, "match"))
+      {
+        expr->op = SQL_OP_MATCH;
+        break;
+      }
+      if (token_is_word(&parser->current, "between"))
+      {
+        advance(parser);
+        return parse_between(parser, expr);
+      }
+      parse_error(parser, "a comparison operator");
+      free(expr);
+      return NULL;
+    default:
+      parse_error(parser, "a comparison operator");
+      free(expr);
+      return NULL;
+  }
+  advance(parser);
+
+  if (!parse_value(parser, &expr->value))
+  {
+    free(expr);
+    return NULL;
+  }
+  return expr;
+}
+
+static SqlExpr *parse_binary(SqlParser *parser, const char *keyword,
+                             SqlExprType type, SqlExpr *(*operand)(SqlParser *))
+{
+  SqlExpr *left = operand(parser);
+  while (left && match_keyword(parser, keyword))
+  {
+    SqlExpr *right = operand(parser);
+    if (!right)
+    {
+      sql_expr_free(left);
+      return NULL;
+    }
+    SqlExpr *node = calloc(1, sizeof(SqlExpr));
+    node->type = type;
+    node->left = left;
+    node->right = right;
+    left = node;
+  }
+  return left;
+}
+
+static SqlExpr *parse_and(SqlParser *parser)
+{
+  return parse_binary(parser, "and", SQL_EXPR_AND, parse_primary);
+}
+
+static SqlExpr *parse_or(SqlParser *parser)
+{
+  return parse_binary(parser, "or", SQL_EXPR_OR, parse_and);
+}
+
+static bool parse_where(SqlParser *parser, SqlStatement *statement)
+{
+  if (!match_keyword(parser, "where"))
+  {
+    return true;
+  }
+  statement->where = parse_or(parser);
+  return statement->where != NULL;
+}
+
+static bool parse_order_by(SqlParser *parser, SqlStatement *statement)
+{
+  if (!match_keyword(parser, "order"))
+  {
+    return true;
+  }
+  if (!expect_keyword(parser, "by"))
+  {
+    return false;
+  }
+
+  uint32_t capacity = 0;
+  do
+  {
+    if (statement->num_order_by == capacity)
+    {
+      capacity = capacity ? capacity * 2 : 4;
+      statement->order_by = realloc(statement->order_by,
+                                    capacity * sizeof(SqlOrderBy));
+    }
+    SqlOrderBy *key = &statement->order_by[statement->num_order_by];
+    if (!parse_column(parser, key->column, MAX_COLUMN_NAME, "a column name"))
+    {
+      return false;
+    }
+    key->descending = match_keyword(parser, "desc");
+    if (!key->descending)
+    {
+      match_keyword(parser, "asc");
+    }
+    statement->num_order_by++;
+  } while (match(parser, SQL_TOKEN_COMMA));
+  return true;
+}
+
+// A non-negative integer literal, for LIMIT and OFFSET
+static bool parse_count(SqlParser *parser, uint32_t *count)
+{
+  SqlToken *token = &parser->current;
+  char digits[16];
+  if (token->type != SQL_TOKEN_NUMBER || token->length >= sizeof(digits) ||
+      memchr(token->start, '.', token->length) || token->start[0] == '-')
+  {
+    parse_error(parser, "a row count");
+    return false;
+  }
+  memcpy(digits, token->start, token->length);
+  digits[token->length] = '\0';
+  unsigned long long value = strtoull(digits, NULL, 10);
+  *count = value > UINT32_MAX ? UINT32_MAX : (uint32_t)value;
+  advance(parser);
+  return true;
+}
+
+static bool parse_limit(SqlParser *parser, SqlStatement *statement)
+{
+  if (match_keyword(parser, "limit"))
+  {
+    if (!parse_count(parser, &statement->limit))
+    {
+      return false;
+    }
+    statement->has_limit = true;
+  }
+  if (match_keyword(parser, "offset"))
+  {
+    return parse_count(parser, &statement->offset);
+  }
+  return true;
+}
+
+static SqlAggregateFunc aggregate_function(const char *name)
+{
+  static const char *names[] = {"count", "sum", "avg", "min", "max"};
+  static const SqlAggregateFunc functions[] = {SQL_AGG_COUNT, SQL_AGG_SUM,
+                                               SQL_AGG_AVG, SQL_AGG_MIN,
+                                               SQL_AGG_MAX};
+  for (uint32_t i = 0; i < sizeof(names) / sizeof(names[0]); i++)
+  {
+    if (strcasecmp(name, names[i]) == 0)
+    {
+      return functions[i];
+    }
+  }
+  return SQL_AGG_NONE;
+}
+
+// A column, or an aggregate call such as COUNT(*) or SUM(age). The column
+// (or "*") goes into the column list and the function alongside it.
+static bool parse_select_item(SqlParser *parser, SqlStatement *statement)
+{
+  uint32_t n = statement->num_columns;
+  char *column = statement->columns[n];
+  statement->functions[n] = SQL_AGG_NONE;
+  if (!parse_column(parser, column, MAX_COLUMN_NAME, "a column name or '*'"))
+  {
+    return false;
+  }
+  if (!match(parser, SQL_TOKEN_LPAREN))
+  {
+    return true;
+  }
+
+  SqlAggregateFunc function = aggregate_function(column);
+  if (function == SQL_AGG_NONE)
+  {
+    parse_error(parser, "COUNT, SUM, AVG, MIN or MAX");
+    return false;
+  }
+  statement->functions[n] = function;
+  statement->has_aggregates = true;
+  if (function == SQL_AGG_COUNT && match(parser, SQL_TOKEN_STAR))
+  {
+    strcpy(column, "*");
+  }
+  else if (!parse_column(parser, column, MAX_COLUMN_NAME, "a column name"))
+  {
+    return false;
+  }
+  return expect(parser, SQL_TOKEN_RPAREN, "')'");
+}
+
+static bool parse_group_by(SqlParser *parser, SqlStatement *statement)
+{
+  if (!match_keyword(parser, "group"))
+  {
+    return true;
+  }
+  if (!expect_keyword(parser, "by"))
+  {
+    return false;
+  }
+
+  uint32_t capacity = 0;
+  do
+  {
+    if (statement->num_group_by == capacity)
+    {
+      capacity = capacity ? capacity * 2 : 4;
+      statement->group_by = realloc(statement->group_by,
+                                    capacity * sizeof(*statement->group_by));
+    }
+    if (!parse_column(parser, statement->group_by[statement->num_group_by],
+                      MAX_COLUMN_NAME, "a column name"))
+    {
+      return false;
+    }
+    statement->num_group_by++;
+  } while (match(parser, SQL_TOKEN_COMMA));
+  statement->has_aggregates = true;
+  return true;
+}
+
+static bool parse_join(SqlParser *parser, SqlStatement *statement)
+{
+  bool inner = match_keyword(parser, "inner");
+  if (!inner && !match_keyword(parser, "join"))
+  {
+    return true;
+  }
+  if (inner && !expect_keyword(parser, "join"))
+  {
+    return false;
+  }
+
+  SqlJoin *join = &statement->join;
+  statement->has_join = true;
+  return parse_name(parser, join->table, MAX_TABLE_NAME, "a table name") &&
+         parse_alias(parser, join->alias) && expect_keyword(parser, "on") &&
+         parse_column(parser, join->left_column, MAX_COLUMN_NAME,
+                      "a column name") &&
+         expect(parser, SQL_TOKEN_EQ, "'='") &&
+         parse_column(parser, join->right_column, MAX_COLUMN_NAME,
+                      "a column name");
+}
+
+static bool parse_select(SqlParser *parser, SqlStatement *statement)
+{
+  statement->type = SQL_SELECT;
+
+  if (!match(parser, SQL_TOKEN_STAR))
+  {
+    uint32_t capacity = 0;
+    do
+    {
+      if (statement->num_columns == capacity)
+      {
+        capacity = capacity ? capacity * 2 : 8;
+        statement->columns = realloc(statement->columns,
+                                     capacity * sizeof(*statement->columns));
+        statement->functions = realloc(statement->functions,
+                                       capacity * sizeof(SqlAggregateFunc));
+      }
+      if (!parse_select_item(parser, statement))
+      {
+        return false;
+      }
+      statement->num_columns++;
+    } while (match(parser, SQL_TOKEN_COMMA));
+  }
+
+  return expect_keyword(parser, "from") &&
+         parse_name(parser, statement->table_name, MAX_TABLE_NAME,
+                    "a table name") &&
+         parse_alias(parser, statement->table_alias) &&
+         parse_join(parser, statement) && parse_where(parser, statement) &&
+         parse_group_by(parser, statement) &&
+         parse_order_by(parser, statement) && parse_limit(parser, statement);
+}
+
+static bool parse_insert(SqlParser *parser, SqlStatement *statement)
+{
+  statement->type = SQL_INSERT;
+
+  if (!expect_keyword(parser, "into") ||
+      !parse_name(parser, statement->table_name, MAX_TABLE_NAME, "a table name"))
+  {
+    return false;
+  }
+
+  // VALUES is optional: INSERT INTO t (1, 'a') is accepted as well
+  match_keyword(parser, "values");
+  return parse_value_list(parser, statement);
+}
+
+static bool parse_update(SqlParser *parser, SqlStatement *statement)
+{
+  statement->type = SQL_UPDATE;
+
+  if (!parse_name(parser, statement->table_name, MAX_TABLE_NAME,
+                  "a table name") ||
+      !expect_keyword(parser, "set"))
+  {
+    return false;
+  }
+
+  uint32_t capacity = 0;
+  do
+  {
+    if (statement->num_assignments == capacity)
+    {
+      capacity = capacity ? capacity * 2 : 4;
+      statement->assignments =
+          realloc(statement->assignments,
+                  capacity * sizeof(*statement->assignments));
+    }
+    SqlAssignment *assignment =
+        &statement->assignments[statement->num_assignments];
+    if (!parse_name(parser, assignment->column, MAX_COLUMN_NAME,
+                    "a column name") ||
+        !expect(parser, SQL_TOKEN_EQ, "'='") ||
+        !parse_value(parser, &assignment->value))
+    {
+      return false;
+    }
+    statement->num_assignments++;
+  } while (match(parser, SQL_TOKEN_COMMA));
+
+  return parse_where(parser, statement);
+}
+
+static bool parse_delete(SqlParser *parser, SqlStatement *statement)
+{
+  statement->type = SQL_DELETE;
+
+  return expect_keyword(parser, "from") &&
+         parse_name(parser, statement->table_name, MAX_TABLE_NAME,
+                    "a table name") &&
+         parse_where(parser, statement);
+}
+
+static bool parse_statement_body(SqlParser *parser, SqlStatement *statement);
+
+static bool parse_prepare(SqlParser *parser, SqlStatement *statement)
+{
+  statement->type = SQL_PREPARE;
+
+  if (!parse_name(parser, statement->plan_name, MAX_PLAN_NAME,
+                  "a statement name") ||
+      !expect_keyword(parser, "as"))
+  {
+    return false;
+  }
+
+  statement->body = calloc(1, sizeof(SqlStatement));
+  if (!parse_statement_body(parser, statement->body))
+  {
+    return false;
+  }
+  if (statement->body->type == SQL_PREPARE ||
+      statement->body->type == SQL_EXECUTE ||
+      statement->body->type == SQL_DEALLOCATE ||
+      statement->body->type == SQL_ANALYZE)
+  {
+    parse_error(parser, "SELECT, INSERT, UPDATE or DELETE after AS");
+    return false;
+  }
+  statement->body->num_params = parser->num_params;
+  return true;
+}
+
+static bool parse_execute(SqlParser *parser, SqlStatement *statement)
+{
+  statement->type = SQL_EXECUTE;
+
+  if (!parse_name(parser, statement->plan_name, MAX_PLAN_NAME,
+                  "a statement name"))
+  {
+    return false;
+  }
+  if (parser->current.type == SQL_TOKEN_LPAREN &&
+      !parse_value_list(parser, statement))
+  {
+    return false;
+  }
+  if (parser->num_params > 0)
+  {
+    parse_error(parser, "literal arguments, not placeholders");
+    return false;
+  }
+  return true;
+}
+
+static bool parse_deallocate(SqlParser *parser, SqlStatement *statement)
+{
+  statement->type = SQL_DEALLOCATE;
+  match_keyword(parser, "prepare");
+  return parse_name(parser, statement->plan_name, MAX_PLAN_NAME,
+                    "a statement name");
+}
+
+static bool parse_analyze(SqlParser *parser, SqlStatement *statement)
+{
+  statement->type = SQL_ANALYZE;
+  // Without a name the active table is analyzed
+  if (parser->current.type == SQL_TOKEN_IDENTIFIER)
+  {
+    return parse_name(parser, statement->table_name, MAX_TABLE_NAME,
+                      "a table name");
+  }
+  return true;
+}
+
+static bool parse_statement_body(SqlParser *parser, SqlStatement *statement)
+{
+  if (match_keyword(parser, "explain"))
+  {
+    if (match_keyword(parser, "analyze"))
+    {
+      statement->explain_analyze = true;
+    }
+    else
+    {
+      statement->explain = true;
+    }
+    if (!expect_keyword(parser, "select"))
+    {
+      return false;
+    }
+    return parse_select(parser, statement);
+  }
+  if (match_keyword(parser, "analyze"))
+  {
+    return parse_analyze(parser, statement);
+  }
+  if (match_keyword(parser, "select"))
+  {
+    return parse_select(parser, statement);
+  }
+  if (match_keyword(parser, "insert"))
+  {
+    return parse_insert(parser, statement);
+  }
+  if (match_keyword(parser, "update"))
+  {
+    return parse_update(parser, statement);
+  }
+  if (match_keyword(parser, "delete"))
+  {
+    return parse_delete(parser, statement);
+  }
+  if (match_keyword(parser, "prepare"))
+  {
+    return parse_prepare(parser, statement);
+  }
+  if (match_keyword(parser, "execute"))
+  {
+    return parse_execute(parser, statement);
+  }
+  if (match_keyword(parser, "deallocate"))
+  {
+    return parse_deallocate(parser, statement);
+  }
+  parse_error(parser, "a statement");
+  return false;
+}
+
+SqlStatement *sql_parse(const char *source, char *error, size_t error_size)
+{
+  SqlParser parser;
+  memset(&parser, 0, sizeof(SqlParser));
+  parser.error = error;
+  parser.error_size = error_size;
+  sql_lexer_init(&parser.lexer, source);
+  advance(&parser);
+
+  SqlStatement *statement = calloc(1, sizeof(SqlStatement));
+  bool ok = parse_statement_body(&parser, statement);
+  if (ok)
+  {
+    match(&parser, SQL_TOKEN_SEMICOLON);
+    if (parser.current.type != SQL_TOKEN_END)
+    {
+      parse_error(&parser, "end of statement");
+      ok = false;
+    }
+  }
+
+  if (!ok || parser.failed)
+  {
+    sql_statement_free(statement);
+    return NULL;
+  }
+  if (statement->type != SQL_PREPARE)
+  {
+    statement->num_params = parser.num_params;
+  }
+  return statement;
+}
+
+SqlExpr *sql_parse_expr(const char *source, char *error, size_t error_size)
+{
+  SqlParser parser;
+  memset(&parser, 0, sizeof(SqlParser));
+  parser.error = error;
+  parser.error_size = error_size;
+  sql_lexer_init(&parser.lexer, source);
+  advance(&parser);
+
+  SqlExpr *expr = parse_or(&parser);
+  if (expr)
+  {
+    match(&parser, SQL_TOKEN_SEMICOLON);
+    if (parser.current.type != SQL_TOKEN_END)
+    {
+      parse_error(&parser, "end of condition");
+    }
+    else if (parser.num_params > 0)
+    {
+      snprintf(error, error_size, "placeholders are not allowed here");
+      parser.failed = true;
+    }
+  }
+
+  if (!expr || parser.failed)
+  {
+    sql_expr_free(expr);
+    return NULL;
+  }
+  return expr;
+}
+
+bool sql_parse_column_func(const char *source, char *column, ColumnFunc *func,
+                           char *error, size_t error_size)
+{
+  SqlParser parser;
+  memset(&parser, 0, sizeof(SqlParser));
+  parser.error = error;
+  parser.error_size = error_size;
+  sql_lexer_init(&parser.lexer, source);
+  advance(&parser);
+
+  if (parse_operand(&parser, column, func) &&
+      parser.current.type != SQL_TOKEN_END)
+  {
+    parse_error(&parser, "end of column");
+  }
+  return !parser.failed;
+}
+
+void sql_statement_free(SqlStatement *statement)
+{
+  if (!statement)
+  {
+    return;
+  }
+  free(statement->columns);
+  free(statement->functions);
+  free(statement->group_by);
+  free(statement->order_by);
+  free(statement->values);
+  free(statement->assignments);
+  sql_expr_free(statement->where);
+  sql_statement_free(statement->body);
+  free(statement);
+}
+
+SqlExpr *sql_expr_bind(const SqlExpr *expr, const SqlValue *args,
+                       uint32_t num_args)
+{
+  SqlExpr *bound = malloc(sizeof(SqlExpr));
+  *bound = *expr;
+  bound->left = NULL;
+  bound->right = NULL;
+
+  if (expr->type == SQL_EXPR_COMPARE)
+  {
+    if (expr->value.kind == SQL_VALUE_PARAM)
+    {
+      if (expr->value.param_index >= num_args)
+      {
+        free(bound);
+        return NULL;
+      }
+      bound->value = args[expr->value.param_index];
+    }
+    return bound;
+  }
+
+  bound->left = sql_expr_bind(expr->left, args, num_args);
+  bound->right = sql_expr_bind(expr->right, args, num_args);
+  if (!bound->left || !bound->right)
+  {
+    sql_expr_free(bound);
+    return NULL;
+  }
+  return bound;
+}
+
+bool sql_is_parsable(const char *source)
+{
+  static const char *statements[] = {"select", "insert", "update", "delete",
+                                     "prepare", "execute", "deallocate",
+                                     "explain", "analyze", NULL};
+  SqlLexer lexer;
+  sql_lexer_init(&lexer, source);
+  SqlToken first = sql_lexer_next(&lexer);
+  for (int i = 0; statements[i]; i++)
+  {
+    if (token_is_word(&first, statements[i]))
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool plan_cache_put(PlanCache *cache, const char *name, SqlStatement *statement)
+{
+  PreparedPlan *plan = plan_cache_get(cache, name);
+  if (!plan)
+  {
+    if (cache->num_plans == MAX_PREPARED_STATEMENTS)
+    {
+      return false;
+    }
+    plan = &cache->plans[cache->num_plans++];
+    strncpy(plan->name, name, MAX_PLAN_NAME - 1);
+    plan->name[MAX_PLAN_NAME - 1] = '\0';
+  }
+  else
+  {
+    sql_statement_free(plan->statement);
+    free(plan->choice);
+  }
+  plan->statement = statement;
+  plan->executions = 0;
+  plan->choice = NULL;
+  return true;
+}
+
+PreparedPlan *plan_cache_get(PlanCache *cache, const char *name)
+{
+  for (uint32_t i = 0; i < cache->num_plans; i++)
+  {
+    if (strcasecmp(cache->plans[i].name, name) == 0)
+    {
+      return &cache->plans[i];
+    }
+  }
+  return NULL;
+}
+
+bool plan_cache_remove(PlanCache *cache, const char *name)
+{
+  PreparedPlan *plan = plan_cache_get(cache, name);
+  if (!plan)
+  {
+    return false;
+  }
+  sql_statement_free(plan->statement);
+  free(plan->choice);
+  *plan = cache->plans[--cache->num_plans];
+  return true;
+}
+
+void plan_cache_clear(PlanCache *cache)
+{
+  for (uint32_t i = 0; i < cache->num_plans; i++)
+  {
+    sql_statement_free(cache->plans[i].statement);
+    free(cache->plans[i].choice);
+  }
+  cache->num_plans = 0;
+}
@@ -1,7 +1,12 @@
 #include "../include/table.h"
+#include "../include/bitmap_index.h"
 #include "../include/btree.h"
 #include "../include/cursor.h"
+#include "../include/fulltext_index.h"
+#include "../include/hot_index.h"
 #include "../include/pager.h"
+#include "../include/query_profile.h"
+#include "../include/secondary_index.h"
 #include <errno.h>
 #include <fcntl.h>
 #include <stdint.h>
@@ -72,6 +77,11 @@ Table *db_open(const char *file_name)
   Table *table = malloc(sizeof(Table));
   table->pager = pager;
   table->root_page_num = 0;
+  table->key = KEY_DESC_DEFAULT;
+  table->hot_index = NULL;
+  table->bitmap_index = NULL;
+  table->fulltext_index = NULL;
+  table->index_predicate = NULL;
   if (pager->num_pages == 0)
   {
     // New database file. Initialize page 0 as leaf node.
@@ -82,6 +92,22 @@ Table *db_open(const char *file_name)
   return table;
 }
 
+void table_set_key(Table *table, const KeyDesc *key)
+{
+  table->key = *key;
+  void *root = get_page(table->pager, table->root_page_num);
+  if (get_node_type(root) == NODE_LEAF && *leaf_node_num_cells(root) == 0)
+  {
+    // Nothing written yet: the tree takes the key width from here on
+    set_node_key_size(root, key->size);
+  }
+  else if (node_key_size(root) != key->size)
+  {
+    printf("Error: Table file has %u-byte keys, the table definition %u-byte keys.\n",
+           node_key_size(root), key->size);
+  }
+}
+
 // Function to create all directories in a file path
 static void create_path_for_file(const char* file_path) {
     char dir_path[512];
@@ -168,22 +194,48 @@ Pager *pager_open(const char *file_name)
   for (uint32_t i = 0; i < TABLE_MAX_PAGES; i++)
   {
     pager->pages[i] = NULL;
+    pager->page_dirty[i] = false;
+    pthread_rwlock_init(&pager->frame_latches[i], NULL);
   }
+  pager->num_free_pages = 0;
+  pager->free_pages_loaded = false;
+  pager->stream_file = false;
+  pager->latching = false;
+  pager->frame_sharers = 0;
+  pthread_mutex_init(&pager->frame_lock, NULL);
+  pthread_rwlock_init(&pager->tree_latch, NULL);
+  pthread_mutex_init(&pager->tree_gate, NULL);
 
   return pager;
 }
 void *get_page(Pager *pager, uint32_t page_num)
 {
-  if (page_num > TABLE_MAX_PAGES)
+  if (page_num >= TABLE_MAX_PAGES)
   {
     printf("Tried to fetch page out of bounds. %d > %d\n", page_num,
            TABLE_MAX_PAGES);
     exit(EXIT_FAILURE);
   }
+  // A loaded frame stays put until the pager closes, so a hit needs no lock.
+  // Misses mutate the frame table; once latching is on or the pager is
+  // shared they are serialized and the frame is published only after it has
+  // been read. Latches on the frame contents are taken by the caller.
+  void *page = __atomic_load_n(&pager->pages[page_num], __ATOMIC_ACQUIRE);
+  if (page != NULL)
+  {
+    PROFILE_COUNT(PROFILE_PAGE_HITS, 1);
+    return page;
+  }
+  bool serialize = pager->latching ||
+                   __atomic_load_n(&pager->frame_sharers, __ATOMIC_ACQUIRE) > 0;
+  if (serialize)
+  {
+    pthread_mutex_lock(&pager->frame_lock);
+  }
   if (pager->pages[page_num] == NULL)
-
   {
-    void *page = malloc(PAGE_SIZE);
+    PROFILE_COUNT(PROFILE_PAGE_READS, 1);
+    page = malloc(PAGE_SIZE);
     uint32_t num_pages = pager->file_length / PAGE_SIZE;
     if (pager->file_length % PAGE_SIZE)
     {
@@ -191,8 +243,9 @@ void *get_page(Pager *pager, uint32_t page_num)
     }
     if (page_num <= num_pages)
     {
-      lseek(pager->file_descriptor, page_num * PAGE_SIZE, SEEK_SET);
-      ssize_t bytes_read = read(pager->file_descriptor, page, PAGE_SIZE);
+      // pread, not lseek and read: the file offset is shared by every thread
+      ssize_t bytes_read = pread(pager->file_descriptor, page, PAGE_SIZE,
+                                 (off_t)page_num * PAGE_SIZE);
       if (bytes_read == -1)
       {
         printf("Error reading file: %d\n", errno);
@@ -200,14 +253,76 @@ void *get_page(Pager *pager, uint32_t page_num)
       }
     }
 
-    pager->pages[page_num] = page;
     if (page_num >= pager->num_pages)
     {
       pager->num_pages = page_num + 1;
     }
+    __atomic_store_n(&pager->pages[page_num], page, __ATOMIC_RELEASE);
+  }
+  else
+  {
+    // Another thread loaded it while this one waited
+    PROFILE_COUNT(PROFILE_PAGE_HITS, 1);
+  }
+  page = pager->pages[page_num];
+  if (serialize)
+  {
+    pthread_mutex_unlock(&pager->frame_lock);
+  }
+  return page;
+}
+// Collect the pages marked free, reading only their first byte from disk
+static void pager_load_free_pages(Pager *pager)
+{
+  pager->num_free_pages = 0;
+  for (uint32_t i = 0; i < pager->num_pages; i++)
+  {
+    uint8_t marker = 0;
+    if (pager->pages[i])
+    {
+      marker = *(uint8_t *)pager->pages[i];
+    }
+    else if ((uint64_t)i * PAGE_SIZE < pager->file_length)
+    {
+      lseek(pager->file_descriptor, i * PAGE_SIZE, SEEK_SET);
+      if (read(pager->file_descriptor, &marker, 1) != 1)
+      {
+        marker = 0;
+      }
+    }
+    if (marker == PAGE_FREE_MARKER)
+    {
+      pager->free_pages[pager->num_free_pages++] = i;
+    }
+  }
+  pager->free_pages_loaded = true;
+}
+
+uint32_t pager_allocate_page(Pager *pager)
+{
+  if (!pager->free_pages_loaded)
+  {
+    pager_load_free_pages(pager);
+  }
+  if (pager->num_free_pages > 0)
+  {
+    return pager->free_pages[--pager->num_free_pages];
   }
-  return pager->pages[page_num];
+  return pager->num_pages;
 }
+
+void pager_free_page(Pager *pager, uint32_t page_num)
+{
+  if (!pager->free_pages_loaded)
+  {
+    pager_load_free_pages(pager);
+  }
+  uint8_t *page = get_page(pager, page_num);
+  memset(page, 0, PAGE_SIZE);
+  *page = PAGE_FREE_MARKER;
+  pager->free_pages[pager->num_free_pages++] = page_num;
+}
+
 void pager_flush(Pager *pager, uint32_t page_num)
 {
   if (pager->pages[page_num] == NULL)
@@ -232,6 +347,8 @@ void pager_flush(Pager *pager, uint32_t page_num)
 void db_close(Table *table)
 {
   Pager *pager = table->pager;
+  bitmap_index_flush(table);
+  fulltext_index_flush(table);
   // uint32_t num_full_pages = table->num_rows / ROWS_PER_PAGE;
   for (uint32_t i = 0; i < pager->num_pages; i++)
   {
@@ -239,7 +356,10 @@ void db_close(Table *table)
     {
       continue;
     }
-    pager_flush(pager, i);
+    if (!pager->stream_file || pager->page_dirty[i])
+    {
+      pager_flush(pager, i);
+    }
     free(pager->pages[i]);
     pager->pages[i] = NULL;
   }
@@ -258,12 +378,95 @@ void db_close(Table *table)
       pager->pages[i] = NULL;
     }
   }
+  for (uint32_t i = 0; i < TABLE_MAX_PAGES; i++)
+  {
+    pthread_rwlock_destroy(&pager->frame_latches[i]);
+  }
+  pthread_mutex_destroy(&pager->frame_lock);
+  pthread_rwlock_destroy(&pager->tree_latch);
+  pthread_mutex_destroy(&pager->tree_gate);
   free(pager);
+  hot_index_disable(table);
+  bitmap_index_unload(table);
+  fulltext_index_unload(table);
+  index_predicate_unload(table);
   free(table);
 }
+
+void pager_enable_latching(Pager *pager)
+{
+  pager->latching = true;
+}
+
+void pager_share_frames(Pager *pager)
+{
+  __atomic_add_fetch(&pager->frame_sharers, 1, __ATOMIC_RELEASE);
+}
+
+void pager_unshare_frames(Pager *pager)
+{
+  __atomic_sub_fetch(&pager->frame_sharers, 1, __ATOMIC_RELEASE);
+}
+
+void pager_latch(Pager *pager, uint32_t page_num, LatchMode mode)
+{
+  if (!pager->latching || mode == LATCH_NONE)
+  {
+    return;
+  }
+  if (mode == LATCH_EXCLUSIVE)
+  {
+    pthread_rwlock_wrlock(&pager->frame_latches[page_num]);
+  }
+  else
+  {
+    pthread_rwlock_rdlock(&pager->frame_latches[page_num]);
+  }
+}
+
+void pager_unlatch(Pager *pager, uint32_t page_num)
+{
+  if (!pager->latching)
+  {
+    return;
+  }
+  pthread_rwlock_unlock(&pager->frame_latches[page_num]);
+}
+
+void pager_tree_latch(Pager *pager, LatchMode mode)
+{
+  if (!pager->latching || mode == LATCH_NONE)
+  {
+    return;
+  }
+  // New operations pass through the gate, so once a split is waiting for
+  // the exclusive latch only the operations already in flight can finish.
+  pthread_mutex_lock(&pager->tree_gate);
+  if (mode == LATCH_EXCLUSIVE)
+  {
+    pthread_rwlock_wrlock(&pager->tree_latch);
+  }
+  else
+  {
+    pthread_rwlock_rdlock(&pager->tree_latch);
+  }
+  pthread_mutex_unlock(&pager->tree_gate);
+}
+
+void pager_tree_unlatch(Pager *pager)
+{
+  if (!pager->latching)
+  {
+    return;
+  }
+  pthread_rwlock_unlock(&pager->tree_latch);
+}
+
 Cursor *table_start(Table *table)
 {
-  Cursor *cursor = table_find(table, 0);
+  uint8_t key[BTREE_MAX_KEY_SIZE];
+  key_min(&table->key, key);
+  Cursor *cursor = table_find_latched(table, key, LATCH_SHARED);
 
   void *node = get_page(table->pager, cursor->page_num);
   uint32_t num_cells = *leaf_node_num_cells(node);
@@ -283,6 +486,7 @@ void cursor_advance(Cursor *cursor)
 {
   uint32_t page_num = cursor->page_num;
   void *node = get_page(cursor->table->pager, page_num);
+  PROFILE_COUNT(PROFILE_CURSOR_ADVANCES, 1);
   cursor->cell_num += 1;
   if (cursor->cell_num >= *leaf_node_num_cells(node))
   {
@@ -295,12 +499,112 @@ void cursor_advance(Cursor *cursor)
     }
     else
     {
+      // Leaf-level crabbing: always left to right, so scans cannot deadlock
+      pager_latch(cursor->table->pager, next_page_num, cursor->latch);
+      if (cursor->latch != LATCH_NONE)
+      {
+        pager_unlatch(cursor->table->pager, page_num);
+      }
       cursor->page_num = next_page_num;
       cursor->cell_num = 0;
     }
   }
 }
 
+// Leaves only link forward, so the leaf before the one starting with
+// first_key is found from the root: remember the path down, climb to the
+// deepest ancestor where the path did not take the leftmost child, then
+// take the rightmost leaf of the sibling subtree to its left.
+static uint32_t leaf_predecessor(Table *table, const void *first_key, bool *found)
+{
+  Pager *pager = table->pager;
+  uint32_t path_pages[TABLE_MAX_PAGES];
+  uint32_t path_children[TABLE_MAX_PAGES];
+  uint32_t depth = 0;
+
+  uint32_t page_num = table->root_page_num;
+  void *node = get_page(pager, page_num);
+  while (get_node_type(node) == NODE_INTERNAL)
+  {
+    uint32_t child = internal_node_find_child(&table->key, node, first_key);
+    path_pages[depth] = page_num;
+    path_children[depth] = child;
+    depth++;
+    page_num = *internal_node_child(node, child);
+    node = get_page(pager, page_num);
+  }
+
+  while (depth > 0 && path_children[depth - 1] == 0)
+  {
+    depth--;
+  }
+  if (depth == 0)
+  {
+    *found = false;
+    return 0;
+  }
+
+  node = get_page(pager, path_pages[depth - 1]);
+  page_num = *internal_node_child(node, path_children[depth - 1] - 1);
+  node = get_page(pager, page_num);
+  while (get_node_type(node) == NODE_INTERNAL)
+  {
+    page_num = *internal_node_right_child(node);
+    node = get_page(pager, page_num);
+  }
+  *found = true;
+  return page_num;
+}
+
+void cursor_retreat(Cursor *cursor)
+{
+  if (cursor->cell_num > 0)
+  {
+    cursor->cell_num -= 1;
+    return;
+  }
+
+  Pager *pager = cursor->table->pager;
+  void *node = get_page(pager, cursor->page_num);
+  bool found = false;
+  uint32_t prev_page_num = 0;
+  if (*leaf_node_num_cells(node) > 0)
+  {
+    prev_page_num = leaf_predecessor(cursor->table, leaf_node_key(node, 0),
+                                     &found);
+  }
+  if (!found)
+  {
+    cursor->end_of_table = true;
+    return;
+  }
+
+  // Moving right to left would invert the latch order scans use, so the
+  // current leaf is released before the previous one is taken. The shared
+  // tree latch the cursor holds keeps the leaf chain from being split.
+  if (cursor->latch != LATCH_NONE)
+  {
+    pager_unlatch(pager, cursor->page_num);
+  }
+  pager_latch(pager, prev_page_num, cursor->latch);
+  cursor->page_num = prev_page_num;
+  cursor->cell_num = *leaf_node_num_cells(get_page(pager, prev_page_num)) - 1;
+}
+
+void cursor_close(Cursor *cursor)
+{
+  if (!cursor)
+  {
+    return;
+  }
+  if (cursor->latch != LATCH_NONE)
+  {
+    pager_unlatch(cursor->table->pager, cursor->page_num);
+    pager_tree_unlatch(cursor->table->pager);
+  }
+  free(cursor);
+}
+
 void dynamic_row_init(DynamicRow* row, TableDef* table_def) {
     // Calculate the total size needed for the row
     uint32_t size = 0;
@@ -331,6 +635,7 @@ void dynamic_row_init(DynamicRow* row, TableDef* table_def) {
             case COLUMN_TYPE_TIME:
                 size += sizeof(int32_t);
                 break;
+            case COLUMN_TYPE_BIGINT:
             case COLUMN_TYPE_TIMESTAMP:
                 size += sizeof(int64_t);
                 break;
@@ -437,6 +742,7 @@ uint32_t get_column_offset(TableDef* table_def, uint32_t col_idx) {
             case COLUMN_TYPE_TIME:
                 offset += sizeof(int32_t);
                 break;
+            case COLUMN_TYPE_BIGINT:
             case COLUMN_TYPE_TIMESTAMP:
                 offset += sizeof(int64_t);
                 break;
@@ -542,6 +848,16 @@ void dynamic_row_set_timestamp(DynamicRow* row, TableDef* table_def, uint32_t co
     #endif
 }
 
+void dynamic_row_set_bigint(DynamicRow* row, TableDef* table_def, uint32_t col_idx, int64_t value) {
+    if (col_idx >= table_def->num_columns || table_def->columns[col_idx].type != COLUMN_TYPE_BIGINT) {
+        fprintf(stderr, "ERROR: Cannot set bigint value for column %u\n", col_idx);
+        return;
+    }
+
+    uint32_t offset = get_column_offset(table_def, col_idx);
+    memcpy((uint8_t*)row->data + offset, &value, sizeof(int64_t));
+}
+
 char* dynamic_row_get_string(DynamicRow* row, TableDef* table_def, uint32_t col_idx) {
     if (col_idx >= table_def->num_columns) {
         fprintf(stderr, "ERROR: Invalid get_string call: idx=%d, num_cols=%d\n", 
@@ -684,6 +1000,18 @@ int64_t dynamic_row_get_timestamp(DynamicRow* row, TableDef* table_def, uint32_t
     return value;
 }
 
+int64_t dynamic_row_get_bigint(DynamicRow* row, TableDef* table_def, uint32_t col_idx) {
+    if (col_idx >= table_def->num_columns || table_def->columns[col_idx].type != COLUMN_TYPE_BIGINT) {
+        fprintf(stderr, "ERROR: Cannot get bigint value from column %u\n", col_idx);
+        return 0;
+    }
+    
+    uint32_t offset = get_column_offset(table_def, col_idx);
+    int64_t value;
+    memcpy(&value, (uint8_t*)row->data + offset, sizeof(int64_t));
+    return value;
+}
+
 void* dynamic_row_get_blob(DynamicRow* row, TableDef* table_def, uint32_t col_idx, uint32_t* size) {
     if (col_idx >= table_def->num_columns || table_def->columns[col_idx].type != COLUMN_TYPE_BLOB) {
         if (size) *size = 0;
@@ -748,6 +1076,7 @@ void deserialize_dynamic_row(void *source, TableDef *table_def, DynamicRow *dest
             case COLUMN_TYPE_TIME:
                 size += sizeof(int32_t);
                 break;
+            case COLUMN_TYPE_BIGINT:
             case COLUMN_TYPE_TIMESTAMP:
                 size += sizeof(int64_t);
                 break;
@@ -768,6 +1097,8 @@ void deserialize_dynamic_row(void *source, TableDef *table_def, DynamicRow *dest
     }
     
     destination->data_size = size;
+    PROFILE_COUNT(PROFILE_ROWS_DESERIALIZED, 1);
+    PROFILE_COUNT(PROFILE_BYTES_DESERIALIZED, size);
     
     // Copy data from source to destination
     memcpy(destination->data, source, size);
@@ -803,6 +1134,9 @@ void print_dynamic_row(DynamicRow* row, TableDef* table_def) {
             case COLUMN_TYPE_TIMESTAMP:
                 printf("TIMESTAMP(%lld)", (long long)dynamic_row_get_timestamp(row, table_def, i));
                 break;
+            case COLUMN_TYPE_BIGINT:
+                printf("%lld", (long long)dynamic_row_get_bigint(row, table_def, i));
+                break;
             case COLUMN_TYPE_STRING: {
                 char* str = dynamic_row_get_string(row, table_def, i);
                 if (str) {
@@ -855,6 +1189,9 @@ void print_dynamic_column(DynamicRow* row, TableDef* table_def, uint32_t col_idx
         case COLUMN_TYPE_TIMESTAMP:
             printf("%ld", dynamic_row_get_timestamp(row, table_def, col_idx));
             break;
+        case COLUMN_TYPE_BIGINT:
+            printf("%lld", (long long)dynamic_row_get_bigint(row, table_def, col_idx));
+            break;
         case COLUMN_TYPE_BLOB:
             printf("[BLOB]");
             break;
@@ -0,0 +1,144 @@
+#include "../include/table_cache.h"
+#include <stdio.h>
+#include <string.h>
+
+// One cache for the process, so the page budget covers every open file
+static TableCache cache = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+static uint32_t resident_pages(const Table *table)
+{
+  uint32_t pages = 0;
+  for (uint32_t i = 0; i < TABLE_MAX_PAGES; i++)
+  {
+    // An online index build may be loading pages of this table meanwhile
+    if (__atomic_load_n(&table->pager->pages[i], __ATOMIC_ACQUIRE))
+    {
+      pages++;
+    }
+  }
+  return pages;
+}
+
+static uint32_t total_resident_pages(void)
+{
+  uint32_t pages = 0;
+  for (uint32_t i = 0; i < cache.num_handles; i++)
+  {
+    pages += resident_pages(cache.handles[i].table);
+  }
+  return pages;
+}
+
+static void close_handle(uint32_t slot)
+{
+  db_close(cache.handles[slot].table);
+  cache.handles[slot] = cache.handles[--cache.num_handles];
+}
+
+// Close the least recently used handle nobody holds. False if every
+// handle is in use.
+static bool evict_one(void)
+{
+  int victim = -1;
+  for (uint32_t i = 0; i < cache.num_handles; i++)
+  {
+    TableHandle *handle = &cache.handles[i];
+    if (handle->refcount == 0 &&
+        (victim == -1 || handle->last_used < cache.handles[victim].last_used))
+    {
+      victim = i;
+    }
+  }
+  if (victim == -1)
+  {
+    return false;
+  }
+  close_handle(victim);
+  cache.evictions++;
+  return true;
+}
+
+Table *table_cache_acquire(const char *filename)
+{
+  pthread_mutex_lock(&cache.lock);
+  cache.clock++;
+  for (uint32_t i = 0; i < cache.num_handles; i++)
+  {
+    TableHandle *handle = &cache.handles[i];
+    if (strcmp(handle->filename, filename) == 0)
+    {
+      handle->refcount++;
+      handle->last_used = cache.clock;
+      cache.hits++;
+      pthread_mutex_unlock(&cache.lock);
+      return handle->table;
+    }
+  }
+
+  cache.misses++;
+  while ((cache.num_handles == TABLE_CACHE_CAPACITY ||
+          total_resident_pages() > TABLE_CACHE_MAX_PAGES) &&
+         evict_one())
+  {
+  }
+
+  Table *table = db_open(filename);
+  if (cache.num_handles < TABLE_CACHE_CAPACITY &&
+      strlen(filename) < sizeof(cache.handles[0].filename))
+  {
+    TableHandle *handle = &cache.handles[cache.num_handles++];
+    strcpy(handle->filename, filename);
+    handle->table = table;
+    handle->refcount = 1;
+    handle->last_used = cache.clock;
+  }
+  pthread_mutex_unlock(&cache.lock);
+  return table;
+}
+
+void table_cache_release(Table *table)
+{
+  pthread_mutex_lock(&cache.lock);
+  for (uint32_t i = 0; i < cache.num_handles; i++)
+  {
+    if (cache.handles[i].table == table)
+    {
+      cache.handles[i].refcount--;
+      pthread_mutex_unlock(&cache.lock);
+      return;
+    }
+  }
+  pthread_mutex_unlock(&cache.lock);
+  db_close(table);
+}
+
+void table_cache_close_all(void)
+{
+  pthread_mutex_lock(&cache.lock);
+  for (uint32_t i = cache.num_handles; i-- > 0;)
+  {
+    if (cache.handles[i].refcount == 0)
+    {
+      close_handle(i);
+    }
+  }
+  pthread_mutex_unlock(&cache.lock);
+}
+
+void table_cache_print(void)
+{
+  pthread_mutex_lock(&cache.lock);
+  printf("Open tables: %u of %d, %u of %d pages in memory\n",
+         cache.num_handles, TABLE_CACHE_CAPACITY, total_resident_pages(),
+         TABLE_CACHE_MAX_PAGES);
+  for (uint32_t i = 0; i < cache.num_handles; i++)
+  {
+    TableHandle *handle = &cache.handles[i];
+    printf("  %-48s refs=%u pages=%u\n", handle->filename, handle->refcount,
+           resident_pages(handle->table));
+  }
+  printf("Hits: %llu, misses: %llu, closed for room: %llu\n",
+         (unsigned long long)cache.hits, (unsigned long long)cache.misses,
+         (unsigned long long)cache.evictions);
+  pthread_mutex_unlock(&cache.lock);
+}
@@ -0,0 +1,310 @@
+#include "../include/table_stats.h"
+#include "../include/btree.h"
+#include "../include/parallel_scan.h"
+#include "../include/schema.h"
+#include "../include/table.h"
+#include <ctype.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+void hll_init(HyperLogLog *hll)
+{
+  memset(hll->registers, 0, sizeof(hll->registers));
+}
+
+void hll_add(HyperLogLog *hll, uint64_t hash)
+{
+  // The top bits pick a register, the rest contribute their leading zeros
+  uint32_t index = hash >> (64 - HLL_PRECISION);
+  uint64_t rest = hash << HLL_PRECISION;
+  uint8_t rank = rest ? __builtin_clzll(rest) + 1 : 64 - HLL_PRECISION + 1;
+  if (rank > hll->registers[index])
+  {
+    hll->registers[index] = rank;
+  }
+}
+
+double hll_estimate(const HyperLogLog *hll)
+{
+  double m = HLL_REGISTERS;
+  double sum = 0;
+  uint32_t zeros = 0;
+  for (uint32_t i = 0; i < HLL_REGISTERS; i++)
+  {
+    sum += ldexp(1.0, -hll->registers[i]);
+    zeros += hll->registers[i] == 0;
+  }
+
+  double alpha = 0.7213 / (1.0 + 1.079 / m);
+  double estimate = alpha * m * m / sum;
+  // Small cardinalities are better served by linear counting
+  if (estimate <= 2.5 * m && zeros > 0)
+  {
+    estimate = m * log(m / zeros);
+  }
+  return estimate;
+}
+
+// FNV-1a followed by a 64-bit finalizer so every bit is usable by the sketch
+static uint64_t hash_bytes(const uint8_t *bytes, uint32_t length, bool fold_case)
+{
+  uint64_t hash = 14695981039346656037ULL;
+  for (uint32_t i = 0; i < length; i++)
+  {
+    uint8_t c = fold_case ? (uint8_t)tolower(bytes[i]) : bytes[i];
+    hash = (hash ^ c) * 1099511628211ULL;
+  }
+  hash ^= hash >> 33;
+  hash *= 0xff51afd7ed558ccdULL;
+  hash ^= hash >> 33;
+  hash *= 0xc4ceb9fe1a85ec53ULL;
+  hash ^= hash >> 33;
+  return hash;
+}
+
+static bool column_is_numeric(ColumnType type)
+{
+  return type != COLUMN_TYPE_STRING && type != COLUMN_TYPE_BLOB;
+}
+
+static double read_numeric(const uint8_t *value, ColumnType type)
+{
+  switch (type)
+  {
+  case COLUMN_TYPE_FLOAT:
+  {
+    float f;
+    memcpy(&f, value, sizeof(f));
+    return f;
+  }
+  case COLUMN_TYPE_BOOLEAN:
+    return value[0];
+  case COLUMN_TYPE_BIGINT:
+  case COLUMN_TYPE_TIMESTAMP:
+  {
+    int64_t i;
+    memcpy(&i, value, sizeof(i));
+    return (double)i;
+  }
+  default:
+  {
+    int32_t i;
+    memcpy(&i, value, sizeof(i));
+    return i;
+  }
+  }
+}
+
+static uint32_t column_width(ColumnDef *column)
+{
+  switch (column->type)
+  {
+  case COLUMN_TYPE_STRING:
+    return column->size + 1;
+  case COLUMN_TYPE_FLOAT:
+    return sizeof(float);
+  case COLUMN_TYPE_BOOLEAN:
+    return sizeof(uint8_t);
+  case COLUMN_TYPE_BIGINT:
+  case COLUMN_TYPE_TIMESTAMP:
+    return sizeof(int64_t);
+  case COLUMN_TYPE_BLOB:
+    return column->size;
+  default:
+    return sizeof(int32_t);
+  }
+}
+
+static int compare_doubles(const void *a, const void *b)
+{
+  double x = *(const double *)a;
+  double y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+static void build_histogram(ColumnStats *column, double *values, uint32_t count)
+{
+  if (count == 0)
+  {
+    return;
+  }
+  qsort(values, count, sizeof(double), compare_doubles);
+  column->has_range = true;
+  column->min_value = values[0];
+  column->max_value = values[count - 1];
+  column->num_buckets = count < STATS_HISTOGRAM_BUCKETS ? count
+                                                         : STATS_HISTOGRAM_BUCKETS;
+  for (uint32_t b = 0; b < column->num_buckets; b++)
+  {
+    uint64_t last = (uint64_t)(b + 1) * count / column->num_buckets - 1;
+    column->bucket_bounds[b] = values[last];
+  }
+}
+
+static uint32_t tree_depth(Pager *pager, uint32_t page_num)
+{
+  uint32_t depth = 1;
+  void *node = get_page(pager, page_num);
+  while (get_node_type(node) == NODE_INTERNAL)
+  {
+    node = get_page(pager, *internal_node_child(node, 0));
+    depth++;
+  }
+  return depth;
+}
+
+void table_stats_collect(Table *table, TableDef *table_def, TableStats *stats)
+{
+  memset(stats, 0, sizeof(TableStats));
+  stats->depth = tree_depth(table->pager, table->root_page_num);
+
+  uint32_t num_leaves;
+  uint32_t *leaves = scan_collect_leaves(table, &num_leaves);
+  stats->leaf_pages = num_leaves;
+
+  uint32_t num_columns = table_def->num_columns;
+  HyperLogLog *sketches = malloc(num_columns * sizeof(HyperLogLog));
+  double *values[MAX_COLUMNS] = {0};
+  uint32_t offsets[MAX_COLUMNS];
+  uint32_t capacity = 0;
+  for (uint32_t c = 0; c < num_columns; c++)
+  {
+    hll_init(&sketches[c]);
+    offsets[c] = get_column_offset(table_def, c);
+  }
+
+  for (uint32_t l = 0; l < num_leaves; l++)
+  {
+    void *node = get_page(table->pager, leaves[l]);
+    uint32_t num_cells = *leaf_node_num_cells(node);
+    for (uint32_t cell = 0; cell < num_cells; cell++)
+    {
+      const uint8_t *row = leaf_node_value(node, cell);
+      if (stats->row_count == capacity)
+      {
+        capacity = capacity ? capacity * 2 : 256;
+        for (uint32_t c = 0; c < num_columns; c++)
+        {
+          if (column_is_numeric(table_def->columns[c].type))
+          {
+            values[c] = realloc(values[c], capacity * sizeof(double));
+          }
+        }
+      }
+
+      for (uint32_t c = 0; c < num_columns; c++)
+      {
+        ColumnDef *column = &table_def->columns[c];
+        const uint8_t *value = row + offsets[c];
+        if (column->type == COLUMN_TYPE_STRING)
+        {
+          // Distinct the way equality sees it: up to the NUL, ignoring case
+          uint32_t length = strnlen((const char *)value, column->size + 1);
+          hll_add(&sketches[c], hash_bytes(value, length, true));
+          continue;
+        }
+        hll_add(&sketches[c], hash_bytes(value, column_width(column), false));
+        if (values[c])
+        {
+          values[c][stats->row_count] = read_numeric(value, column->type);
+        }
+      }
+      stats->row_count++;
+    }
+  }
+
+  for (uint32_t c = 0; c < num_columns; c++)
+  {
+    ColumnStats *column = &stats->columns[c];
+    column->distinct = stats->row_count ? hll_estimate(&sketches[c]) : 0;
+    // The sketch can overshoot on small tables
+    if (column->distinct > stats->row_count)
+    {
+      column->distinct = stats->row_count;
+    }
+    if (values[c])
+    {
+      build_histogram(column, values[c], stats->row_count);
+      free(values[c]);
+    }
+  }
+
+  stats->analyzed = true;
+  free(sketches);
+  free(leaves);
+}
+
+void table_stats_print(const TableStats *stats, TableDef *table_def)
+{
+  printf("Analyzed table '%s': %u rows in %u leaf pages, depth %u.\n",
+         table_def->name, stats->row_count, stats->leaf_pages, stats->depth);
+  for (uint32_t c = 0; c < table_def->num_columns; c++)
+  {
+    const ColumnStats *column = &stats->columns[c];
+    printf("  %s: ~%.0f distinct", table_def->columns[c].name,
+           column->distinct);
+    if (column->has_range)
+    {
+      printf(", min %g, max %g", column->min_value, column->max_value);
+    }
+    printf("\n");
+  }
+}
+
+double stats_eq_selectivity(const TableStats *stats, uint32_t column_idx)
+{
+  if (!stats->analyzed || stats->row_count == 0)
+  {
+    return STATS_DEFAULT_EQ_SELECTIVITY;
+  }
+  double distinct = stats->columns[column_idx].distinct;
+  return distinct >= 1 ? 1.0 / distinct : 1.0;
+}
+
+double stats_less_selectivity(const TableStats *stats, uint32_t column_idx,
+                              double value, bool inclusive)
+{
+  const ColumnStats *column = &stats->columns[column_idx];
+  if (!stats->analyzed || !column->has_range)
+  {
+    return STATS_DEFAULT_RANGE_SELECTIVITY;
+  }
+  if (value < column->min_value || (!inclusive && value == column->min_value))
+  {
+    return 0;
+  }
+  if (value >= column->max_value)
+  {
+    return inclusive || value > column->max_value
+               ? 1.0
+               : 1.0 - stats_eq_selectivity(stats, column_idx);
+  }
+
+  // Whole buckets below the value, plus a linear share of the one it is in
+  double fraction = 0;
+  double lower = column->min_value;
+  for (uint32_t b = 0; b < column->num_buckets; b++)
+  {
+    double upper = column->bucket_bounds[b];
+    if (value >= upper)
+    {
+      fraction += 1.0;
+      lower = upper;
+      continue;
+    }
+    if (upper > lower)
+    {
+      fraction += (value - lower) / (upper - lower);
+    }
+    break;
+  }
+  fraction /= column->num_buckets;
+
+  if (!inclusive)
+  {
+    fraction -= stats_eq_selectivity(stats, column_idx);
+  }
+  return fraction < 0 ? 0 : fraction > 1 ? 1 : fraction;
+}
@@ -0,0 +1,304 @@
+#include "../include/vector_filter.h"
+#include "../include/btree.h"
+#include <ctype.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define VECTOR_FILTER_X86 1
+#include <immintrin.h>
+#endif
+
+// Kernels set bit i of the selection when column[i] matches
+typedef void (*Int32EqKernel)(const int32_t *column, uint32_t n, int32_t value,
+                              uint64_t *words);
+typedef void (*FloatEqKernel)(const float *column, uint32_t n, float value,
+                              uint64_t *words);
+
+// Same tolerance the row-at-a-time float comparison used
+#define FLOAT_EQ_EPSILON 0.0001f
+
+// Scalar loops over rows [start, n), used directly and for SIMD tails
+static void int32_eq_range(const int32_t *column, uint32_t start, uint32_t n,
+                           int32_t value, uint64_t *words)
+{
+  for (uint32_t i = start; i < n; i++)
+  {
+    words[i / 64] |= (uint64_t)(column[i] == value) << (i % 64);
+  }
+}
+
+static void float_eq_range(const float *column, uint32_t start, uint32_t n,
+                           float value, uint64_t *words)
+{
+  for (uint32_t i = start; i < n; i++)
+  {
+    float diff = column[i] - value;
+    bool match = (diff < FLOAT_EQ_EPSILON) & (diff > -FLOAT_EQ_EPSILON);
+    words[i / 64] |= (uint64_t)match << (i % 64);
+  }
+}
+
+static void int32_eq_scalar(const int32_t *column, uint32_t n, int32_t value,
+                            uint64_t *words)
+{
+  int32_eq_range(column, 0, n, value, words);
+}
+
+static void float_eq_scalar(const float *column, uint32_t n, float value,
+                            uint64_t *words)
+{
+  float_eq_range(column, 0, n, value, words);
+}
+
+#ifdef VECTOR_FILTER_X86
+// Batches are processed in strides of 4 (SSE2) or 8 (AVX2) rows starting at
+// a multiple of the stride, so a stride's mask never straddles two words.
+
+__attribute__((target("sse2"))) static void
+int32_eq_sse2(const int32_t *column, uint32_t n, int32_t value, uint64_t *words)
+{
+  __m128i needle = _mm_set1_epi32(value);
+  uint32_t i = 0;
+  for (; i + 4 <= n; i += 4)
+  {
+    __m128i lanes = _mm_loadu_si128((const __m128i *)(column + i));
+    uint32_t mask = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(lanes, needle)));
+    words[i / 64] |= (uint64_t)mask << (i % 64);
+  }
+  int32_eq_range(column, i, n, value, words);
+}
+
+__attribute__((target("sse2"))) static void
+float_eq_sse2(const float *column, uint32_t n, float value, uint64_t *words)
+{
+  __m128 needle = _mm_set1_ps(value);
+  __m128 epsilon = _mm_set1_ps(FLOAT_EQ_EPSILON);
+  __m128 sign_mask = _mm_set1_ps(-0.0f);
+  uint32_t i = 0;
+  for (; i + 4 <= n; i += 4)
+  {
+    __m128 diff = _mm_sub_ps(_mm_loadu_ps(column + i), needle);
+    __m128 abs_diff = _mm_andnot_ps(sign_mask, diff);
+    uint32_t mask = _mm_movemask_ps(_mm_cmplt_ps(abs_diff, epsilon));
+    words[i / 64] |= (uint64_t)mask << (i % 64);
+  }
+  float_eq_range(column, i, n, value, words);
+}
+
+__attribute__((target("avx2"))) static void
+int32_eq_avx2(const int32_t *column, uint32_t n, int32_t value, uint64_t *words)
+{
+  __m256i needle = _mm256_set1_epi32(value);
+  uint32_t i = 0;
+  for (; i + 8 <= n; i += 8)
+  {
+    __m256i lanes = _mm256_loadu_si256((const __m256i *)(column + i));
+    uint32_t mask = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(lanes, needle)));
+    words[i / 64] |= (uint64_t)mask << (i % 64);
+  }
+  int32_eq_range(column, i, n, value, words);
+}
+
+__attribute__((target("avx2"))) static void
+float_eq_avx2(const float *column, uint32_t n, float value, uint64_t *words)
+{
+  __m256 needle = _mm256_set1_ps(value);
+  __m256 epsilon = _mm256_set1_ps(FLOAT_EQ_EPSILON);
+  __m256 sign_mask = _mm256_set1_ps(-0.0f);
+  uint32_t i = 0;
+  for (; i + 8 <= n; i += 8)
+  {
+    __m256 diff = _mm256_sub_ps(_mm256_loadu_ps(column + i), needle);
+    __m256 abs_diff = _mm256_andnot_ps(sign_mask, diff);
+    uint32_t mask = _mm256_movemask_ps(_mm256_cmp_ps(abs_diff, epsilon, _CMP_LT_OQ));
+    words[i / 64] |= (uint64_t)mask << (i % 64);
+  }
+  float_eq_range(column, i, n, value, words);
+}
+#endif
+
+static Int32EqKernel int32_eq_kernel = int32_eq_scalar;
+static FloatEqKernel float_eq_kernel = float_eq_scalar;
+static const char *kernel_isa = "scalar";
+static pthread_once_t kernel_once = PTHREAD_ONCE_INIT;
+
+static void select_kernels()
+{
+#ifdef VECTOR_FILTER_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+  {
+    int32_eq_kernel = int32_eq_avx2;
+    float_eq_kernel = float_eq_avx2;
+    kernel_isa = "avx2";
+  }
+  else if (__builtin_cpu_supports("sse2"))
+  {
+    int32_eq_kernel = int32_eq_sse2;
+    float_eq_kernel = float_eq_sse2;
+    kernel_isa = "sse2";
+  }
+#endif
+}
+
+const char *vector_filter_isa()
+{
+  pthread_once(&kernel_once, select_kernels);
+  return kernel_isa;
+}
+
+bool vector_filter_use_isa(const char *isa)
+{
+  pthread_once(&kernel_once, select_kernels);
+  if (strcmp(isa, "scalar") == 0)
+  {
+    int32_eq_kernel = int32_eq_scalar;
+    float_eq_kernel = float_eq_scalar;
+    kernel_isa = "scalar";
+    return true;
+  }
+#ifdef VECTOR_FILTER_X86
+  if (strcmp(isa, "sse2") == 0 && __builtin_cpu_supports("sse2"))
+  {
+    int32_eq_kernel = int32_eq_sse2;
+    float_eq_kernel = float_eq_sse2;
+    kernel_isa = "sse2";
+    return true;
+  }
+  if (strcmp(isa, "avx2") == 0 && __builtin_cpu_supports("avx2"))
+  {
+    int32_eq_kernel = int32_eq_avx2;
+    float_eq_kernel = float_eq_avx2;
+    kernel_isa = "avx2";
+    return true;
+  }
+#endif
+  return false;
+}
+
+void predicate_compile(TableDef *table_def, uint32_t column_idx,
+                       const char *literal, CompiledPredicate *predicate)
+{
+  pthread_once(&kernel_once, select_kernels);
+
+  memset(predicate, 0, sizeof(CompiledPredicate));
+  predicate->type = table_def->columns[column_idx].type;
+  predicate->column_offset = get_column_offset(table_def, column_idx);
+
+  switch (predicate->type)
+  {
+    case COLUMN_TYPE_INT:
+      predicate->int_value = atoi(literal);
+      break;
+    case COLUMN_TYPE_FLOAT:
+      predicate->float_value = atof(literal);
+      break;
+    case COLUMN_TYPE_BOOLEAN:
+      predicate->bool_value = (strcasecmp(literal, "true") == 0 ||
+                               strcmp(literal, "1") == 0);
+      break;
+    case COLUMN_TYPE_STRING:
+    {
+      uint32_t length = 0;
+      while (literal[length] && length < COLUMN_EMAIL_SIZE)
+      {
+        predicate->string_value[length] = tolower((unsigned char)literal[length]);
+        length++;
+      }
+      predicate->string_value[length] = '\0';
+      predicate->string_length = length;
+      break;
+    }
+    default:
+      predicate->never_matches = true;
+      break;
+  }
+}
+
+// Case-insensitive equality against the pre-lowered literal
+static bool string_equals_lowered(const char *value, const char *lowered,
+                                  uint32_t length)
+{
+  for (uint32_t i = 0; i < length; i++)
+  {
+    if (tolower((unsigned char)value[i]) != (unsigned char)lowered[i])
+    {
+      return false;
+    }
+  }
+  return value[length] == '\0';
+}
+
+uint32_t predicate_eval_leaf(void *node, const CompiledPredicate *predicate,
+                             void **values, SelectionBitmap *selection)
+{
+  memset(selection, 0, sizeof(SelectionBitmap));
+
+  uint32_t num_cells = *leaf_node_num_cells(node);
+  uint8_t *cell = (uint8_t *)leaf_node_cell(node, 0);
+  uint32_t key_size = node_key_size(node);
+  uint32_t header_size = leaf_node_cell_header_size(node);
+  for (uint32_t c = 0; c < num_cells; c++)
+  {
+    values[c] = cell + header_size;
+    cell += header_size + *(uint32_t *)(cell + key_size);
+  }
+
+  if (predicate->never_matches)
+  {
+    return num_cells;
+  }
+
+  uint32_t offset = predicate->column_offset;
+  switch (predicate->type)
+  {
+    case COLUMN_TYPE_INT:
+    {
+      // Gather the column into a contiguous array for the kernel
+      int32_t column[VECTOR_BATCH_MAX];
+      for (uint32_t c = 0; c < num_cells; c++)
+      {
+        memcpy(&column[c], (uint8_t *)values[c] + offset, sizeof(int32_t));
+      }
+      int32_eq_kernel(column, num_cells, predicate->int_value, selection->words);
+      break;
+    }
+    case COLUMN_TYPE_FLOAT:
+    {
+      float column[VECTOR_BATCH_MAX];
+      for (uint32_t c = 0; c < num_cells; c++)
+      {
+        memcpy(&column[c], (uint8_t *)values[c] + offset, sizeof(float));
+      }
+      float_eq_kernel(column, num_cells, predicate->float_value, selection->words);
+      break;
+    }
+    case COLUMN_TYPE_BOOLEAN:
+    {
+      for (uint32_t c = 0; c < num_cells; c++)
+      {
+        bool match = (((uint8_t *)values[c])[offset] != 0) == predicate->bool_value;
+        selection->words[c / 64] |= (uint64_t)match << (c % 64);
+      }
+      break;
+    }
+    case COLUMN_TYPE_STRING:
+    {
+      for (uint32_t c = 0; c < num_cells; c++)
+      {
+        bool match = string_equals_lowered((char *)values[c] + offset,
+                                           predicate->string_value,
+                                           predicate->string_length);
+        selection->words[c / 64] |= (uint64_t)match << (c % 64);
+      }
+      break;
+    }
+    default:
+      break;
+  }
+
+  return num_cells;
+}
@@ -0,0 +1,654 @@
+// Multi-threaded stress test and scalability benchmark for the latched B-tree.
+//
+//   ./bin/btree-stress          run the stress test (writers + readers),
+//                               then check the compiled scan filters
+//   ./bin/btree-stress --bench  lookup/insert throughput at 1-32 threads,
+//                               then in-node key search at 16-512 keys
+
+#include "../include/btree.h"
+#include "../include/btree_key.h"
+#include "../include/cursor.h"
+#include "../include/parallel_scan.h"
+#include "../include/pager.h"
+#include "../include/table.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+
+// Kept well inside TABLE_MAX_PAGES for the small fan-out of internal nodes
+#define STRESS_KEYS 300
+#define STRESS_WRITERS 4
+#define STRESS_READERS 4
+#define BENCH_LOOKUPS 400000
+#define BENCH_SCANS 2000
+#define BENCH_SEARCH_PROBES 4096
+#define BENCH_SEARCH_ROUNDS 200
+
+typedef struct
+{
+  Table *table;
+  TableDef *table_def;
+  uint32_t thread_id;
+  uint32_t num_threads;
+  uint32_t num_keys;
+  uint32_t iterations;
+  uint32_t *keys;
+  volatile int *done;
+  uint32_t errors;
+} WorkerArgs;
+
+static void make_table_def(TableDef *table_def)
+{
+  memset(table_def, 0, sizeof(TableDef));
+  strcpy(table_def->name, "stress");
+  table_def->num_columns = 2;
+  strcpy(table_def->columns[0].name, "id");
+  table_def->columns[0].type = COLUMN_TYPE_INT;
+  table_def->columns[0].size = sizeof(int32_t);
+  strcpy(table_def->columns[1].name, "name");
+  table_def->columns[1].type = COLUMN_TYPE_STRING;
+  table_def->columns[1].size = 16;
+}
+
+static Table *open_fresh_table(const char *path)
+{
+  unlink(path);
+  Table *table = db_open(path);
+  pager_enable_latching(table->pager);
+  return table;
+}
+
+static void shuffle(uint32_t *keys, uint32_t n, unsigned int *seed)
+{
+  for (uint32_t i = n - 1; i > 0; i--)
+  {
+    uint32_t j = rand_r(seed) % (i + 1);
+    uint32_t tmp = keys[i];
+    keys[i] = keys[j];
+    keys[j] = tmp;
+  }
+}
+
+static bool insert_key(Table *table, TableDef *table_def, uint32_t key)
+{
+  DynamicRow row;
+  dynamic_row_init(&row, table_def);
+  char name[16];
+  snprintf(name, sizeof(name), "user%u", key);
+  dynamic_row_set_int(&row, table_def, 0, (int32_t)key);
+  dynamic_row_set_string(&row, table_def, 1, name);
+  BtreeInsertResult result = table_insert(table, key, &row, table_def);
+  dynamic_row_free(&row);
+  return result == BTREE_INSERT_SUCCESS;
+}
+
+// Returns 1 if found and consistent, 0 if absent, -1 if the row is corrupt
+static int lookup_key(Table *table, TableDef *table_def, uint32_t key)
+{
+  Cursor *cursor = table_find(table, key);
+  void *node = get_page(table->pager, cursor->page_num);
+  int found = 0;
+  if (cursor->cell_num < *leaf_node_num_cells(node) &&
+      *leaf_node_key(node, cursor->cell_num) == key)
+  {
+    DynamicRow row;
+    deserialize_dynamic_row(cursor_value(cursor), table_def, &row);
+    found = (uint32_t)dynamic_row_get_int(&row, table_def, 0) == key ? 1 : -1;
+    dynamic_row_free(&row);
+  }
+  cursor_close(cursor);
+  return found;
+}
+
+static void *writer_thread(void *arg)
+{
+  WorkerArgs *args = arg;
+  for (uint32_t i = args->thread_id; i < args->num_keys; i += args->num_threads)
+  {
+    if (!insert_key(args->table, args->table_def, args->keys[i]))
+    {
+      args->errors++;
+    }
+  }
+  return NULL;
+}
+
+static void *reader_thread(void *arg)
+{
+  WorkerArgs *args = arg;
+  unsigned int seed = args->thread_id * 7919u + 1;
+  while (!__atomic_load_n(args->done, __ATOMIC_ACQUIRE))
+  {
+    uint32_t key = args->keys[rand_r(&seed) % args->num_keys];
+    if (lookup_key(args->table, args->table_def, key) < 0)
+    {
+      args->errors++;
+    }
+  }
+  return NULL;
+}
+
+static void *lookup_thread(void *arg)
+{
+  WorkerArgs *args = arg;
+  unsigned int seed = args->thread_id * 104729u + 3;
+  for (uint32_t i = 0; i < args->iterations; i++)
+  {
+    uint32_t key = args->keys[rand_r(&seed) % args->num_keys];
+    if (lookup_key(args->table, args->table_def, key) != 1)
+    {
+      args->errors++;
+    }
+  }
+  return NULL;
+}
+
+static double now_seconds()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int run_stress(const char *path)
+{
+  TableDef table_def;
+  make_table_def(&table_def);
+  Table *table = open_fresh_table(path);
+
+  uint32_t keys[STRESS_KEYS];
+  for (uint32_t i = 0; i < STRESS_KEYS; i++)
+  {
+    keys[i] = i + 1;
+  }
+  unsigned int seed = 42;
+  shuffle(keys, STRESS_KEYS, &seed);
+
+  volatile int done = 0;
+  pthread_t threads[STRESS_WRITERS + STRESS_READERS];
+  WorkerArgs args[STRESS_WRITERS + STRESS_READERS];
+
+  for (uint32_t t = 0; t < STRESS_WRITERS + STRESS_READERS; t++)
+  {
+    args[t] = (WorkerArgs){table, &table_def, t, STRESS_WRITERS, STRESS_KEYS, 0,
+                           keys, &done, 0};
+    pthread_create(&threads[t], NULL,
+                   t < STRESS_WRITERS ? writer_thread : reader_thread, &args[t]);
+  }
+  for (uint32_t t = 0; t < STRESS_WRITERS; t++)
+  {
+    pthread_join(threads[t], NULL);
+  }
+  __atomic_store_n(&done, 1, __ATOMIC_RELEASE);
+  for (uint32_t t = STRESS_WRITERS; t < STRESS_WRITERS + STRESS_READERS; t++)
+  {
+    pthread_join(threads[t], NULL);
+  }
+
+  uint32_t errors = 0;
+  for (uint32_t t = 0; t < STRESS_WRITERS + STRESS_READERS; t++)
+  {
+    errors += args[t].errors;
+  }
+
+  // Every key must be reachable by point lookup...
+  for (uint32_t i = 0; i < STRESS_KEYS; i++)
+  {
+    if (lookup_key(table, &table_def, keys[i]) != 1)
+    {
+      printf("missing key %u\n", keys[i]);
+      errors++;
+    }
+  }
+
+  // ...and a scan must see them all in strictly increasing order
+  Cursor *cursor = table_start(table);
+  uint32_t count = 0;
+  uint32_t previous = 0;
+  while (!cursor->end_of_table)
+  {
+    void *node = get_page(table->pager, cursor->page_num);
+    uint32_t key = *leaf_node_key(node, cursor->cell_num);
+    if (key <= previous)
+    {
+      printf("scan out of order: %u after %u\n", key, previous);
+      errors++;
+    }
+    previous = key;
+    count++;
+    cursor_advance(cursor);
+  }
+  cursor_close(cursor);
+  if (count != STRESS_KEYS)
+  {
+    printf("scan returned %u rows, expected %u\n", count, STRESS_KEYS);
+    errors++;
+  }
+
+  // Parallel scans must return the same rows in the same order at any
+  // thread count
+  for (uint32_t num_threads = 1; num_threads <= 8; num_threads *= 2)
+  {
+    ScanResult result;
+    parallel_scan(table, &table_def, NULL, NULL, num_threads, &result);
+    if (result.num_rows != STRESS_KEYS)
+    {
+      printf("parallel scan (%u threads) returned %u rows, expected %u\n",
+             num_threads, result.num_rows, STRESS_KEYS);
+      errors++;
+    }
+    for (uint32_t i = 0; i < result.num_rows; i++)
+    {
+      if ((uint32_t)dynamic_row_get_int(&result.rows[i], &table_def, 0) != i + 1)
+      {
+        printf("parallel scan (%u threads) out of order at row %u\n",
+               num_threads, i);
+        errors++;
+        break;
+      }
+    }
+    scan_result_free(&result);
+  }
+
+  db_close(table);
+  unlink(path);
+
+  printf("stress: %u writers, %u readers, %u keys: %s (%u errors)\n",
+         STRESS_WRITERS, STRESS_READERS, STRESS_KEYS, errors ? "FAILED" : "OK", errors);
+  return errors ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+// Row-at-a-time equivalent of a compiled "name = literal" predicate
+static bool name_equals(DynamicRow *row, TableDef *table_def, void *ctx)
+{
+  return strcasecmp(dynamic_row_get_string(row, table_def, 1), ctx) == 0;
+}
+
+// The filter check's table: every column type the compiled predicates
+// handle
+static void make_filter_table_def(TableDef *table_def)
+{
+  static const struct
+  {
+    const char *name;
+    ColumnType type;
+    uint32_t size;
+  } columns[] = {{"id", COLUMN_TYPE_INT, sizeof(int32_t)},
+                 {"n", COLUMN_TYPE_INT, sizeof(int32_t)},
+                 {"f", COLUMN_TYPE_FLOAT, sizeof(float)},
+                 {"b", COLUMN_TYPE_BOOLEAN, sizeof(uint8_t)},
+                 {"s", COLUMN_TYPE_STRING, 16}};
+  memset(table_def, 0, sizeof(TableDef));
+  strcpy(table_def->name, "filter");
+  table_def->num_columns = sizeof(columns) / sizeof(columns[0]);
+  for (uint32_t i = 0; i < table_def->num_columns; i++)
+  {
+    strcpy(table_def->columns[i].name, columns[i].name);
+    table_def->columns[i].type = columns[i].type;
+    table_def->columns[i].size = columns[i].size;
+  }
+}
+
+static void insert_filter_row(Table *table, TableDef *table_def, uint32_t key)
+{
+  static const char *const spellings[] = {"Alpha", "ALPHA", "alphabet", "alph"};
+  DynamicRow row;
+  dynamic_row_init(&row, table_def);
+  dynamic_row_set_int(&row, table_def, 0, (int32_t)key);
+  dynamic_row_set_int(&row, table_def, 1, (int32_t)(key % 7) - 3);
+  // 0.5, 0.50004 and 0.50008 among others, around the float tolerance
+  dynamic_row_set_float(&row, table_def, 2, (key % 5) * 0.25f + (key % 3) * 0.00004f);
+  dynamic_row_set_boolean(&row, table_def, 3, key % 3 == 0);
+  dynamic_row_set_string(&row, table_def, 4, spellings[key % 4]);
+  table_insert(table, key, &row, table_def);
+  dynamic_row_free(&row);
+}
+
+// A "column = literal" filter, and its row-at-a-time meaning
+typedef struct
+{
+  uint32_t column;
+  const char *literal;
+} FilterCase;
+
+static bool column_equals(DynamicRow *row, TableDef *table_def, void *ctx)
+{
+  const FilterCase *filter = ctx;
+  const char *literal = filter->literal;
+  switch (table_def->columns[filter->column].type)
+  {
+  case COLUMN_TYPE_INT:
+    return dynamic_row_get_int(row, table_def, filter->column) == atoi(literal);
+  case COLUMN_TYPE_FLOAT:
+  {
+    float diff = dynamic_row_get_float(row, table_def, filter->column) -
+                 (float)atof(literal);
+    return diff < 0.0001f && diff > -0.0001f;
+  }
+  case COLUMN_TYPE_BOOLEAN:
+    return dynamic_row_get_boolean(row, table_def, filter->column) ==
+           (strcasecmp(literal, "true") == 0 || strcmp(literal, "1") == 0);
+  default:
+    return strcasecmp(dynamic_row_get_string(row, table_def, filter->column),
+                      literal) == 0;
+  }
+}
+
+// The compiled filters, with each kernel the CPU has, must select the rows
+// the row predicates do. The tables are sized so that leaves end in ragged
+// tails, not whole vectors.
+static uint32_t run_filter_check(const char *path)
+{
+  static const FilterCase cases[] = {
+      {1, "3"},      {1, "-1"},     {2, "0.5"},   {2, "0.50012"},
+      {2, "0.5002"}, {3, "true"},   {3, "0"},     {4, "aLpHa"},
+      {4, "alph"},   {4, "nothing"}};
+  static const uint32_t table_rows[] = {1, 13, 300};
+  static const char *const isas[] = {"scalar", "sse2", "avx2"};
+  const char *chosen = vector_filter_isa();
+  TableDef table_def;
+  make_filter_table_def(&table_def);
+
+  uint32_t errors = 0, kernels = 0, ragged_leaves = 0;
+  for (size_t t = 0; t < sizeof(table_rows) / sizeof(table_rows[0]); t++)
+  {
+    Table *table = open_fresh_table(path);
+    for (uint32_t key = 1; key <= table_rows[t]; key++)
+    {
+      insert_filter_row(table, &table_def, key);
+    }
+    uint32_t num_leaves;
+    uint32_t *leaves = scan_collect_leaves(table, &num_leaves);
+    for (uint32_t i = 0; i < num_leaves; i++)
+    {
+      ragged_leaves += *leaf_node_num_cells(get_page(table->pager, leaves[i])) % 8 != 0;
+    }
+    free(leaves);
+
+    kernels = 0;
+    for (size_t k = 0; k < sizeof(isas) / sizeof(isas[0]); k++)
+    {
+      if (!vector_filter_use_isa(isas[k]))
+      {
+        continue;
+      }
+      kernels++;
+      for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); c++)
+      {
+        CompiledPredicate predicate;
+        ScanResult by_row, by_batch;
+        predicate_compile(&table_def, cases[c].column, cases[c].literal, &predicate);
+        parallel_scan(table, &table_def, column_equals, (void *)&cases[c], 2, &by_row);
+        parallel_scan_compiled(table, &table_def, &predicate, 2, &by_batch);
+        bool same = by_row.num_rows == by_batch.num_rows;
+        for (uint32_t i = 0; same && i < by_row.num_rows; i++)
+        {
+          same = dynamic_row_get_int(&by_row.rows[i], &table_def, 0) ==
+                 dynamic_row_get_int(&by_batch.rows[i], &table_def, 0);
+        }
+        if (!same)
+        {
+          printf("filter %s = '%s' (%s, %u rows): %u rows by row, %u by batch\n",
+                 table_def.columns[cases[c].column].name, cases[c].literal,
+                 isas[k], table_rows[t], by_row.num_rows, by_batch.num_rows);
+          errors++;
+        }
+        scan_result_free(&by_row);
+        scan_result_free(&by_batch);
+      }
+    }
+    db_close(table);
+    unlink(path);
+  }
+  vector_filter_use_isa(chosen);
+  if (ragged_leaves == 0)
+  {
+    printf("filter check: no leaf ended in a ragged tail\n");
+    errors++;
+  }
+
+  printf("filter: %u kernels, %zu tables: %s (%u errors)\n", kernels,
+         sizeof(table_rows) / sizeof(table_rows[0]), errors ? "FAILED" : "OK",
+         errors);
+  return errors;
+}
+
+static void run_scan_bench(const char *path)
+{
+  TableDef table_def;
+  make_table_def(&table_def);
+  Table *table = open_fresh_table(path);
+  for (uint32_t key = 1; key <= STRESS_KEYS; key++)
+  {
+    insert_key(table, &table_def, key);
+  }
+
+  CompiledPredicate predicate;
+  predicate_compile(&table_def, 1, "user150", &predicate);
+
+  printf("\nfiltered scan (%s kernels)\n", vector_filter_isa());
+  printf("%8s | %16s | %16s\n", "threads", "row rows/sec", "batch rows/sec");
+  printf("---------|------------------|-----------------\n");
+  for (uint32_t num_threads = 1; num_threads <= 8; num_threads *= 2)
+  {
+    ScanResult result;
+    double start = now_seconds();
+    for (uint32_t i = 0; i < BENCH_SCANS; i++)
+    {
+      parallel_scan(table, &table_def, name_equals, "user150", num_threads, &result);
+      scan_result_free(&result);
+    }
+    double row_rate = (double)STRESS_KEYS * BENCH_SCANS / (now_seconds() - start);
+
+    start = now_seconds();
+    for (uint32_t i = 0; i < BENCH_SCANS; i++)
+    {
+      parallel_scan_compiled(table, &table_def, &predicate, num_threads, &result);
+      scan_result_free(&result);
+    }
+    double batch_rate = (double)STRESS_KEYS * BENCH_SCANS / (now_seconds() - start);
+    printf("%8u | %16.0f | %16.0f\n", num_threads, row_rate, batch_rate);
+  }
+
+  db_close(table);
+  unlink(path);
+}
+
+// The plain binary search the node search replaced, as the baseline
+static uint32_t branchy_search(const uint32_t *keys, uint32_t n, uint32_t key)
+{
+  uint32_t low = 0, high = n;
+  while (low < high)
+  {
+    uint32_t mid = (low + high) / 2;
+    if (keys[mid] < key)
+    {
+      low = mid + 1;
+    }
+    else
+    {
+      high = mid;
+    }
+  }
+  return low;
+}
+
+// Branch-free binary search all the way down, without the SIMD window
+static uint32_t branch_free_search(const uint32_t *keys, uint32_t n,
+                                   uint32_t key)
+{
+  uint32_t base = 0;
+  while (n > 1)
+  {
+    uint32_t half = n / 2;
+    base = keys[base + half] < key ? base + half : base;
+    n -= half;
+  }
+  return base + (keys[base] < key);
+}
+
+// Nanoseconds per search of the probes over one node's keys; adds any
+// answer that disagrees with the baseline to errors
+static double time_search(uint32_t (*search)(const uint32_t *, uint32_t, uint32_t),
+                          const uint32_t *keys, uint32_t n,
+                          const uint32_t *probes, uint32_t *errors)
+{
+  volatile uint32_t sink = 0;
+  double start = now_seconds();
+  for (uint32_t round = 0; round < BENCH_SEARCH_ROUNDS; round++)
+  {
+    for (uint32_t i = 0; i < BENCH_SEARCH_PROBES; i++)
+    {
+      sink += search(keys, n, probes[i]);
+    }
+  }
+  double elapsed = now_seconds() - start;
+  (void)sink;
+  for (uint32_t i = 0; i < BENCH_SEARCH_PROBES; i++)
+  {
+    *errors += search(keys, n, probes[i]) != branchy_search(keys, n, probes[i]);
+  }
+  return elapsed * 1e9 / ((double)BENCH_SEARCH_ROUNDS * BENCH_SEARCH_PROBES);
+}
+
+static uint32_t run_search_bench()
+{
+  static uint32_t keys[512];
+  static int64_t wide_keys[512];
+  static uint32_t probes[BENCH_SEARCH_PROBES];
+  static int64_t wide_probes[BENCH_SEARCH_PROBES];
+  uint32_t errors = 0;
+
+  printf("\nin-node key search, ns/search (%s window of %d keys)\n",
+         key_search_isa(), KEY_SEARCH_WINDOW);
+  printf("%8s | %10s | %11s | %10s | %10s\n", "keys", "branchy",
+         "branch-free", "hybrid u32", "hybrid i64");
+  printf("---------|------------|-------------|------------|-----------\n");
+  for (uint32_t n = 16; n <= 512; n *= 2)
+  {
+    // Keys 3 apart, probed at random both on and between them
+    unsigned int seed = n;
+    for (uint32_t i = 0; i < n; i++)
+    {
+      keys[i] = 3 * i + 1;
+      wide_keys[i] = ((int64_t)keys[i] - 3 * (int64_t)n / 2) * 1000000007;
+    }
+    for (uint32_t i = 0; i < BENCH_SEARCH_PROBES; i++)
+    {
+      probes[i] = rand_r(&seed) % (3 * n + 2);
+      wide_probes[i] = ((int64_t)probes[i] - 3 * (int64_t)n / 2) * 1000000007;
+    }
+
+    double branchy = time_search(branchy_search, keys, n, probes, &errors);
+    double branch_free = time_search(branch_free_search, keys, n, probes, &errors);
+    double hybrid = time_search(key_search_u32, keys, n, probes, &errors);
+
+    volatile uint32_t sink = 0;
+    double start = now_seconds();
+    for (uint32_t round = 0; round < BENCH_SEARCH_ROUNDS; round++)
+    {
+      for (uint32_t i = 0; i < BENCH_SEARCH_PROBES; i++)
+      {
+        sink += key_search_i64(wide_keys, n, wide_probes[i]);
+      }
+    }
+    double wide = (now_seconds() - start) * 1e9 /
+                  ((double)BENCH_SEARCH_ROUNDS * BENCH_SEARCH_PROBES);
+    (void)sink;
+    for (uint32_t i = 0; i < BENCH_SEARCH_PROBES; i++)
+    {
+      errors += key_search_i64(wide_keys, n, wide_probes[i]) !=
+                branchy_search(keys, n, probes[i]);
+    }
+    printf("%8u | %10.2f | %11.2f | %10.2f | %10.2f\n", n, branchy,
+           branch_free, hybrid, wide);
+  }
+  return errors;
+}
+
+static int run_bench(const char *path)
+{
+  static const uint32_t thread_counts[] = {1, 2, 4, 8, 16, 32};
+  TableDef table_def;
+  make_table_def(&table_def);
+
+  uint32_t keys[STRESS_KEYS];
+  for (uint32_t i = 0; i < STRESS_KEYS; i++)
+  {
+    keys[i] = i + 1;
+  }
+  unsigned int seed = 7;
+  shuffle(keys, STRESS_KEYS, &seed);
+
+  printf("%8s | %16s | %16s\n", "threads", "lookups/sec", "inserts/sec");
+  printf("---------|------------------|-----------------\n");
+
+  uint32_t errors = 0;
+  for (size_t c = 0; c < sizeof(thread_counts) / sizeof(thread_counts[0]); c++)
+  {
+    uint32_t num_threads = thread_counts[c];
+    pthread_t threads[32];
+    WorkerArgs args[32];
+
+    // Insert throughput into a fresh tree
+    Table *table = open_fresh_table(path);
+    double start = now_seconds();
+    for (uint32_t t = 0; t < num_threads; t++)
+    {
+      args[t] = (WorkerArgs){table, &table_def, t, num_threads, STRESS_KEYS, 0,
+                             keys, NULL, 0};
+      pthread_create(&threads[t], NULL, writer_thread, &args[t]);
+    }
+    for (uint32_t t = 0; t < num_threads; t++)
+    {
+      pthread_join(threads[t], NULL);
+      errors += args[t].errors;
+    }
+    double insert_rate = STRESS_KEYS / (now_seconds() - start);
+
+    // Point lookup throughput against the populated tree
+    start = now_seconds();
+    for (uint32_t t = 0; t < num_threads; t++)
+    {
+      args[t] = (WorkerArgs){table, &table_def, t, num_threads, STRESS_KEYS,
+                             BENCH_LOOKUPS / num_threads, keys, NULL, 0};
+      pthread_create(&threads[t], NULL, lookup_thread, &args[t]);
+    }
+    for (uint32_t t = 0; t < num_threads; t++)
+    {
+      pthread_join(threads[t], NULL);
+      errors += args[t].errors;
+    }
+    double lookup_rate = (BENCH_LOOKUPS / num_threads) * num_threads / (now_seconds() - start);
+
+    db_close(table);
+    printf("%8u | %16.0f | %16.0f\n", num_threads, lookup_rate, insert_rate);
+  }
+  unlink(path);
+  run_scan_bench(path);
+  errors += run_search_bench();
+
+  if (errors)
+  {
+    printf("bench: %u errors\n", errors);
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
+
+int main(int argc, char *argv[])
+{
+  char path[64];
+  snprintf(path, sizeof(path), "btree_stress_%d.tbl", (int)getpid());
+
+  if (argc > 1 && strcmp(argv[1], "--bench") == 0)
+  {
+    return run_bench(path);
+  }
+  int status = run_stress(path);
+  return run_filter_check(path) ? EXIT_FAILURE : status;
+}
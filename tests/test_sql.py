@@ -0,0 +1,815 @@
+import os
+import random
+import re
+import subprocess
+
+import pytest
+
+BINARY = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "bin",
+                      "db-project")
+
+# The shell prompts "db > " before login and "<database>:<user>> " after
+PROMPT = re.compile(r"db > |\w+:\w+> ")
+
+
+class TestSql:
+
+    @pytest.fixture(autouse=True)
+    def workdir(self, tmp_path):
+        # Every test gets its own Database directory with a database 'test'
+        self.dir = tmp_path
+        self.run_sql(["create database test"], use=False)
+
+    def run_sql(self, commands, use=True):
+        """Run commands in one session; returns each one's output lines."""
+        script = ["login admin jhaz"]
+        if use:
+            script.append("use database test")
+        script += commands + [".exit"]
+        process = subprocess.run([BINARY], input="\n".join(script) + "\n",
+                                 stdout=subprocess.PIPE, stderr=subprocess.STDOUT,
+                                 text=True, cwd=self.dir, timeout=60)
+        outputs = PROMPT.split(process.stdout)[len(script) - len(commands):]
+        return [[line for line in output.split("\n")
+                 if line and not line.startswith("Debug:")]
+                for output in outputs[:len(commands)]]
+
+    def table(self, name, columns):
+        return ["create table %s (%s)" % (name, columns), "use table %s" % name]
+
+    def rows(self, output):
+        """The rows of a result table, as tuples of column texts."""
+        lines = [line for line in output if line.startswith("| ")]
+        return [tuple(cell.strip() for cell in line.strip().strip("|").split("|"))
+                for line in lines[1:]]
+
+    def plan(self, output):
+        return [line for line in output if line.startswith("QUERY PLAN")]
+
+    def test_prepared_statements_run_from_the_plan_cache(self):
+        out = self.run_sql(self.table("t", "id INT, name STRING, age INT") + [
+            "insert into t values (1, 'ann', 30)",
+            "insert into t values (2, 'bob', 25)",
+            "prepare by_id as select name from t where id = ?",
+            "execute by_id(2)",
+            "execute by_id(1)",
+            "prepare add as insert into t values (?, ?, ?)",
+            "execute add(3, 'cy', 40)",
+            "select * from t",
+            "select * frm t",
+            "deallocate by_id",
+            "execute by_id(1)",
+        ])
+        assert self.rows(out[5]) == [("bob",)]
+        assert self.rows(out[6]) == [("ann",)]
+        assert self.rows(out[9]) == [("1", "ann", "30"), ("2", "bob", "25"),
+                                     ("3", "cy", "40")]
+        assert out[10][0] == "Parse error: expected FROM near 'frm'"
+        assert out[12] == ["Error: Prepared statement 'by_id' not found."]
+
+    def test_prepared_statement_reuses_its_access_path_until_the_catalog_changes(self):
+        orders = {i: (i % 9, "open" if i % 4 == 0 else "done") for i in range(1, 201)}
+        out = self.run_sql(
+            self.table("t", "id INT, cust INT, status STRING(8)") +
+            ["insert into t values (%d, %d, '%s')" % ((i,) + row)
+             for i, row in orders.items()] + [
+                "create index t_open on t (cust) where status = 'open'",
+                "prepare p as select id from t where cust = ? and status = ?",
+                "execute p(3, 'open')",
+                # The partial index lacks these rows, so this one is planned
+                # afresh, and the scan it picks is what the next one reuses
+                "execute p(3, 'done')",
+                "execute p(5, 'open')",
+                "create table u (x INT)",
+                "execute p(5, 'open')",
+            ])
+
+        def ids(cust, status):
+            return [(str(i),) for i, row in orders.items() if row == (cust, status)]
+        partial = ("QUERY PLAN: Using secondary index 't_open' on column 'cust' "
+                   "for rows where status = 'open'")
+        assert out[-5][0] == partial
+        assert self.rows(out[-5]) == ids(3, "open")
+        assert self.plan(out[-4]) == []
+        assert self.rows(out[-4]) == ids(3, "done")
+        assert self.plan(out[-3]) == []
+        assert self.rows(out[-3]) == ids(5, "open")
+        # Any DDL saves the catalog, so the path is searched for again
+        assert out[-1][0] == partial
+        assert self.rows(out[-1]) == ids(5, "open")
+
+    def test_compound_where_and_index_kept_current_by_writes(self):
+        people = [(1, "ann", 30), (2, "bob", 25), (3, "carol", 41),
+                  (4, "dave", 25), (5, "erin", 30)]
+        out = self.run_sql(self.table("t", "id INT, name STRING, age INT") + [
+            "insert into t values (%d, '%s', %d)" % row for row in people
+        ] + [
+            "select id from t where age >= 30 and (name like 'a%' or id > 4)",
+            "select id from t where age <> 25 and not_a_column = 1",
+            "select id from t where name like '%r%' or age < 26",
+            "create index t_age on t (age)",
+            "insert into t values (6, 'fay', 25)",
+            "update t set age = 41 where id = 2",
+            "delete from t where id = 4",
+            "select id, name from t where age = 25",
+            "select id, name from t where age = 41",
+        ])
+        assert self.rows(out[7]) == [("1",), ("5",)]
+        assert out[8][0].startswith("Error")
+        assert self.rows(out[9]) == [("2",), ("3",), ("4",), ("5",)]
+        # Rows written after CREATE INDEX come back through the index
+        assert self.plan(out[14]) == [
+            "QUERY PLAN: Using secondary index 't_age' on column 'age'"]
+        assert self.rows(out[14]) == [("6", "fay")]
+        assert self.rows(out[15]) == [("2", "bob"), ("3", "carol")]
+
+    def test_analyze_statistics_drive_the_plan(self):
+        out = self.run_sql(self.table("t", "id INT, name STRING, age INT") + [
+            "insert into t values (%d, 'n%d', %d)" % (i, i, 1 if i <= 55 else i)
+            for i in range(1, 61)
+        ] + [
+            "create index t_age on t (age)",
+            "explain select name from t where age = 1",
+            "analyze t",
+            "explain select name from t where age = 1",
+            "select name from t where age = 57",
+            "explain select name from t where id = 7",
+        ])
+        # Without statistics equality looks selective, so the index wins
+        assert out[63][1].startswith("  Secondary index probe on t using t_age")
+        assert out[64][0] == "Analyzed table 't': 60 rows in 7 leaf pages, depth 3."
+        assert "  age: ~6 distinct, min 1, max 60" in out[64]
+        # Knowing ~10 rows per value, reading every leaf is cheaper
+        assert out[65][1].startswith("  Full table scan on t")
+        assert self.rows(out[66]) == [("n57",)]
+        assert out[67][1].startswith("  Primary key lookup on t")
+
+    def test_explain_analyze_counts_rows_through_each_operator(self):
+        out = self.run_sql(self.table("t", "id INT, name STRING, age INT") + [
+            "insert into t values (%d, 'n%d', %d)" % (i, i, i % 3)
+            for i in range(1, 31)
+        ] + [
+            "explain analyze select name from t where age = 1",
+            "explain analyze select age, count(*) from t group by age",
+        ])
+
+        def operators(output):
+            # Operator name -> (rows in, rows out)
+            start = next(i for i, line in enumerate(output)
+                         if line.startswith("Operator "))
+            counts = {}
+            for line in output[start + 1:]:
+                if line.startswith("Total:"):
+                    break
+                fields = re.split(r"\s{2,}", line.strip())
+                counts[fields[0]] = (int(fields[1]), int(fields[2]))
+            return counts
+
+        # The query still returns its rows
+        assert self.rows(out[32]) == [("n%d" % i,) for i in range(1, 31, 3)]
+        assert operators(out[32]) == {"Full table scan": (30, 10),
+                                      "Output": (10, 10)}
+        assert operators(out[33]) == {"Full table scan": (30, 30),
+                                      "Hash aggregate": (30, 3),
+                                      "Output": (3, 3)}
+        assert out[33][-2].startswith("Total: ")
+
+    def shuffled_rows(self, count, seed):
+        """INSERTs of rows (i, 'n<i>', i * 37 % 101) for i in 1..count, in a
+        random order so the B-tree splits everywhere."""
+        ids = list(range(1, count + 1))
+        random.Random(seed).shuffle(ids)
+        return ["insert into t values (%d, 'n%d', %d)" % (i, i, i * 37 % 101)
+                for i in ids]
+
+    def test_primary_key_ranges_scan_the_btree(self):
+        out = self.run_sql(self.table("t", "id INT, name STRING, score INT") +
+                           self.shuffled_rows(300, 3) + [
+            "select id from t where id between 40 and 45",
+            "select id from t where id > 295 order by id desc",
+            "select id, name from t where id < 4 and id >= 2",
+            "select id from t where id between 45 and 40",
+            "explain select id from t where id between 40 and 45",
+            "select id from t where id >= 290 and score > 50 order by id desc",
+        ])
+        assert self.rows(out[302]) == [(str(i),) for i in range(40, 46)]
+        assert self.rows(out[303]) == [(str(i),) for i in range(300, 295, -1)]
+        assert self.rows(out[304]) == [("2", "n2"), ("3", "n3")]
+        assert self.rows(out[305]) == []
+        assert out[306][1].startswith(
+            "  Primary key range scan on t (40 <= id <= 45)")
+        assert self.rows(out[307]) == [(str(i),) for i in range(300, 289, -1)
+                                       if i * 37 % 101 > 50]
+
+    def test_order_by_spills_sorted_runs_and_keeps_a_top_n_heap(self):
+        out = self.run_sql(self.table("t", "id INT, name STRING, score INT") +
+                           self.shuffled_rows(300, 4) + [
+            ".workmem 4",
+            "explain analyze select id, score from t order by score desc, id",
+            "explain analyze select name from t order by score, id desc limit 4",
+        ])
+        expected = sorted(((i, i * 37 % 101) for i in range(1, 301)),
+                          key=lambda row: (-row[1], row[0]))
+        assert self.rows(out[303]) == [(str(i), str(s)) for i, s in expected]
+        # 300 rows do not fit 4 KB, so the sort merged runs from disk
+        assert any(re.match(r"External sort \(\d+ runs\)\s+300\s+300", line)
+                   for line in out[303])
+        top = sorted(range(1, 301), key=lambda i: (i * 37 % 101, -i))[:4]
+        assert self.rows(out[304]) == [("n%d" % i,) for i in top]
+        assert any(re.match(r"Top-N sort\s+300\s+4\s", line) for line in out[304])
+
+    def test_limit_and_offset_stop_the_scan_early(self):
+        out = self.run_sql(self.table("t", "id INT, name STRING, score INT") +
+                           self.shuffled_rows(300, 5) + [
+            "select id from t order by id limit 3 offset 5",
+            "explain analyze select id from t limit 2 offset 3",
+            "select id from t where score > 90 limit 3 offset 1",
+            "select id from t where id > 298 limit 5 offset 1",
+            "select id from t limit 0",
+        ])
+        assert self.rows(out[302]) == [("6",), ("7",), ("8",)]
+        assert self.rows(out[303]) == [("4",), ("5",)]
+        # Only the rows returned are read, not all 300
+        assert any(re.match(r"Full table scan\s+2\s+2\s", line)
+                   for line in out[303])
+        assert "Total: " in out[303][-2] and "2 rows deserialized" in out[303][-2]
+        high = [i for i in range(1, 301) if i * 37 % 101 > 90]
+        assert self.rows(out[304]) == [(str(i),) for i in high[1:4]]
+        assert self.rows(out[305]) == [("300",)]
+        assert self.rows(out[306]) == []
+
+    def test_hash_aggregation_spills_partitions_and_keeps_every_group(self):
+        out = self.run_sql(self.table("t", "id INT, name STRING, score INT, gpa FLOAT") + [
+            # Each name is written in two cases, which are one group, as
+            # WHERE name = ... finds both
+            "insert into t values (%d, '%s%d', %d, %d.5)"
+            % (i, "N" if i // 150 % 2 else "n", i % 150, i % 7, i % 4)
+            for i in range(1, 301)
+        ] + [
+            ".workmem 4",
+            "explain analyze select name, count(*), sum(score), min(id), max(id) "
+            "from t group by name",
+            "select count(*), sum(score), avg(score), min(gpa), max(gpa) from t "
+            "where id > 100",
+            "select score, count(*), avg(gpa) from t group by score",
+        ])
+        groups = {}
+        for i in range(1, 301):
+            groups.setdefault("n%d" % (i % 150), []).append(i)
+        expected = sorted(
+            (name, str(len(ids)), str(sum(i % 7 for i in ids)), str(min(ids)),
+             str(max(ids)))
+            for name, ids in groups.items())
+        assert sorted((row[0].lower(),) + row[1:] for row in self.rows(out[303])) == expected
+        # 150 groups do not fit 4 KB; the spilled ones still come out
+        assert any(re.match(r"Hash aggregate \(\d+ partitions\)\s+300\s+150\s", line)
+                   for line in out[303])
+        scores = [i % 7 for i in range(101, 301)]
+        assert self.rows(out[304]) == [("200", str(sum(scores)),
+                                        "%.2f" % (sum(scores) / 200), "0.50", "3.50")]
+        by_score = {}
+        for i in range(1, 301):
+            by_score.setdefault(i % 7, []).append(i % 4 + 0.5)
+        assert sorted(self.rows(out[305])) == sorted(
+            (str(s), str(len(g)), "%.2f" % (sum(g) / len(g)))
+            for s, g in by_score.items())
+
+    def test_hash_grace_and_index_nested_loop_joins(self):
+        customers = [(i, "c%d" % i, i % 5) for i in range(1, 41)]
+        orders = [(i, i % 45 + 1, i * 3 % 17) for i in range(1, 201)]
+        out = self.run_sql(
+            self.table("c", "id INT, name STRING, city INT") +
+            ["insert into c values (%d, '%s', %d)" % row for row in customers] +
+            self.table("o", "id INT, cust INT, amount INT") +
+            ["insert into o values (%d, %d, %d)" % row for row in orders] + [
+                "explain analyze select c.name, o.id from o join c on o.cust = c.id "
+                "where o.amount > 12",
+                ".workmem 4",
+                "explain analyze select c.name, o.id from c join o on c.city = o.amount",
+                "create index o_cust on o (cust)",
+                "insert into o values (201, 3, 99)",
+                "explain analyze select c.name, o.amount from c join o "
+                "on c.id = o.cust where c.id = 3",
+            ])
+        assert any(line.startswith("  Hash join on o.cust = c.id")
+                   for line in out[244])
+        assert sorted(self.rows(out[244])) == sorted(
+            (c[1], str(o[0])) for o in orders for c in customers
+            if o[1] == c[0] and o[2] > 12)
+        # The build side does not fit 4 KB, so it is partitioned on disk
+        assert any(line.startswith("Grace join") for line in out[246])
+        assert sorted(self.rows(out[246])) == sorted(
+            (c[1], str(o[0])) for c in customers for o in orders if c[2] == o[2])
+        # The order inserted after CREATE INDEX is found through the index
+        assert "    Inner: o through index o_cust" in out[249]
+        assert sorted(self.rows(out[249])) == sorted(
+            [("c3", str(o[2])) for o in orders if o[1] == 3] + [("c3", "99")])
+
+    def test_table_cache_evicts_and_reopens_tables_without_losing_writes(self):
+        commands = []
+        for k in range(18):
+            commands += self.table("t%d" % k, "id INT, v INT")
+            commands += ["insert into t%d values (%d, %d)" % (k, i, k * 10 + i)
+                         for i in range(1, 4)]
+        commands += ["use table t0", "update t0 set v = 7 where id = 2"]
+        commands += ["select v from t%d where id = 2" % k for k in range(18)]
+        commands += [".tablecache"]
+        out = self.run_sql(commands)
+        reads = out[-19:-1]
+        assert [self.rows(output) for output in reads] == (
+            [[("7",)]] + [[(str(k * 10 + 2),)] for k in range(1, 18)])
+        # 18 tables do not fit the 16 handles
+        assert out[-1][0].startswith("Open tables: 16 of 16")
+        assert re.match(r"Hits: \d+, misses: \d+, closed for room: [1-9]", out[-1][-1])
+
+        # Closed handles were flushed, so a new session sees every write
+        out = self.run_sql(["select v from t%d where id = 2" % k for k in range(18)])
+        assert [self.rows(output) for output in out] == (
+            [[("7",)]] + [[(str(k * 10 + 2),)] for k in range(1, 18)])
+
+    def test_update_rewrites_rows_in_place_and_when_they_grow(self):
+        out = self.run_sql(
+            self.table("t", "id INT, name STRING, gpa FLOAT, active BOOLEAN, age INT") +
+            ["insert into t values (%d, 'n%d', 1.5, false, %d)" % (i, i, i % 10)
+             for i in range(1, 121)] + [
+                "update t set active = true, gpa = 3.25 where age = 3",
+                # Every row grows past what its leaf has room for
+                "update t set name = '%s' where id > 0" % ("x" * 200),
+                "update t set name = 'short', age = 99 where id between 50 and 52",
+                "update t set id = 500 where id = 1",
+                "update t set nope = 1",
+                "select * from t",
+                "select count(*) from t where name = '%s'" % ("x" * 200),
+            ])
+        assert out[122] == ["12 row(s) updated.", "Executed."]
+        assert out[123][0] == "120 row(s) updated."
+        assert out[124][0] == "3 row(s) updated."
+        assert out[125][0] == "Error: cannot update the primary key column 'id'"
+        assert out[126][0] == "Error: unknown column 'nope'"
+        expected = []
+        for i in range(1, 121):
+            name, age = ("short", 99) if 50 <= i <= 52 else ("x" * 200, i % 10)
+            flagged = i % 10 == 3
+            expected.append((str(i), name, "3.25" if flagged else "1.50",
+                             "true" if flagged else "false", str(age)))
+        assert self.rows(out[127]) == expected
+        assert self.rows(out[128]) == [("117",)]
+
+    def test_delete_merges_leaves_and_reuses_their_pages(self):
+        path = os.path.join(self.dir, "Database", "test", "Tables", "t.tbl")
+        out = self.run_sql(self.table("t", "id INT, name STRING, score INT") +
+                           self.shuffled_rows(300, 6) + [".btree"])
+        full_leaves = [line for line in out[-1] if "- leaf" in line]
+        full_size = os.path.getsize(path)
+        out = self.run_sql([
+            "use table t",
+            "delete from t where score > 30",
+            "delete from t where id between 100 and 250",
+            "delete from t where id = 100000",
+            "select id from t",
+            ".btree",
+        ])
+        kept = [i for i in range(1, 301) if i * 37 % 101 <= 30 and not 100 <= i <= 250]
+        assert out[1][0] == "%d row(s) deleted." % sum(
+            1 for i in range(1, 301) if i * 37 % 101 > 30)
+        assert out[3][0] == "0 row(s) deleted."
+        assert self.rows(out[4]) == [(str(i),) for i in kept]
+        # 44 rows are left; their half-empty leaves were merged together
+        leaves = [line for line in out[5] if "- leaf" in line]
+        assert len(leaves) * 4 < len(full_leaves)
+
+        # New rows go into the released pages before the file grows
+        out = self.run_sql(["use table t"] + [
+            "insert into t values (%d, 'n%d', 0)" % (i, i) for i in range(301, 401)
+        ] + ["select count(*) from t"])
+        assert self.rows(out[-1]) == [(str(len(kept) + 100),)]
+        assert os.path.getsize(path) <= full_size
+
+    def test_composite_and_64_bit_keys(self):
+        out = self.run_sql(self.table(
+            "events", "user_id INT, at TIMESTAMP, kind STRING(16), "
+                      "PRIMARY KEY (user_id, at)") + [
+            "insert into events values (2, '2024-03-01 17:30:00', 'logout')",
+            "insert into events values (1, '2024-03-01 09:00:00', 'login')",
+            "insert into events values (2, '2024-03-01 09:00:00', 'login')",
+            "insert into events values (1, '2024-03-02', 'login')",
+            "insert into events values (1, 1709283600, 'again')",
+            "insert into events values (3, 'yesterday', 'login')",
+            "select * from events",
+            "select kind from events where at >= '2024-03-01 12:00:00'",
+        ])
+        # Rows are kept in (user_id, at) order; the same user at the same
+        # second is a duplicate however the timestamp is written
+        for line in out[2:6]:
+            assert line[0].startswith("Row successfully inserted with key: (")
+        assert out[6][0].startswith("Error: Duplicate key")
+        assert out[7] == ["Error: Invalid value 'yesterday' for column 'at'."]
+        assert self.rows(out[8]) == [
+            ("1", "1709283600", "login"), ("1", "1709337600", "login"),
+            ("2", "1709283600", "login"), ("2", "1709314200", "logout")]
+        assert self.rows(out[9]) == [("login",), ("logout",)]
+
+        big = 5000000000
+        out = self.run_sql(self.table("b", "id BIGINT, name STRING") + [
+            "insert into b values (%d, 'n%d')" % (big + i, i)
+            for i in range(200, 0, -1)] + [
+            "insert into b values (%d, 'again')" % (big + 7),
+            "insert into b values ('12x', 'bad')",
+            "select name from b where id = %d" % (big + 7),
+            "select count(*) from b where id > %d" % (big + 150),
+            "select name from b where id between %d and %d" % (big + 1, big + 3),
+            "explain select name from b where id between %d and %d" % (big + 1, big + 3),
+        ])
+        assert out[-6][0].startswith("Error: Duplicate key")
+        assert out[-5] == ["Error: Invalid value '12x' for column 'id'."]
+        assert self.rows(out[-4]) == [("n7",)]
+        assert self.rows(out[-3]) == [("50",)]
+        assert self.rows(out[-2]) == [("n1",), ("n2",), ("n3",)]
+        assert out[-1][1].startswith("  Primary key range scan on b (%d <= id <= %d)"
+                                     % (big + 1, big + 3))
+
+        # A key that is not the first column: an index on the first one
+        # still probes, and the key still looks rows up
+        out = self.run_sql(self.table(
+            "k", "age INT, id INT, name STRING(16), PRIMARY KEY (id)") + [
+            "insert into k values (%d, %d, 'n%d')" % (30 + i % 3, i, i)
+            for i in range(1, 61)] + [
+            "create index k_age on k (age)",
+            "select id from k where age = 31",
+            "explain select id from k where age = 31",
+            "explain select age from k where id = 31",
+        ])
+        assert sorted(int(row[0]) for row in self.rows(out[-3])) == list(range(1, 61, 3))
+        assert out[-2][1].startswith("  Index-only probe on k using k_age (age = 31)")
+        assert out[-1][1].startswith("  Primary key lookup on k (id = 31)")
+
+    def hot_index_counts(self, output):
+        """The (keys, hits, misses, builds) .hotindex reports."""
+        keys = int(re.search(r"(\d+) keys", output[0]).group(1))
+        counts = re.findall(r"(\w+): (\d+)", output[1])
+        return (keys,) + tuple(int(count) for _, count in counts)
+
+    def test_hot_index_answers_point_lookups_through_splits_and_merges(self):
+        inserts = self.shuffled_rows(300, 43)
+        first = int(re.search(r"\((\d+),", inserts[0]).group(1))
+        lookups = ["select name from t where id = %d" % i for i in range(1, 301, 7)]
+        out = self.run_sql(self.table("t", "id INT, name STRING, score INT") +
+                           inserts[:100] + [
+            ".hotindex on",
+            "select name from t where id = %d" % first,
+            ".hotindex",
+        ] + inserts[100:] + lookups + [
+            ".hotindex",
+            "update t set name = '%s' where id = 8" % ("x" * 200),
+            "delete from t where id > 20 and id < 280",
+            "select name from t where id = 8",
+            "select name from t where id = 150",
+            "select name from t where id = 290",
+            ".hotindex",
+            ".hotindex off",
+            ".hotindex",
+        ])
+        at = 102
+        # Built from the leaves by the first lookup
+        assert self.rows(out[at + 1]) == [("n%d" % first,)]
+        assert self.hot_index_counts(out[at + 2]) == (100, 1, 0, 1)
+
+        # Splits re-register the cells they move, so every lookup hits
+        at += 3 + 200
+        for i, output in zip(range(1, 301, 7), out[at:]):
+            assert self.rows(output) == [("n%d" % i,)]
+        at += len(lookups)
+        keys, hits, misses, builds = self.hot_index_counts(out[at])
+        assert (keys, misses, builds) == (300, 0, 1)
+        assert hits == 1 + len(lookups)
+
+        # A row that moved, and one that is gone, are found by the descent
+        assert self.rows(out[at + 3]) == [("x" * 200,)]
+        assert self.rows(out[at + 4]) == []
+        assert self.rows(out[at + 5]) == [("n290",)]
+        assert self.hot_index_counts(out[at + 6])[3] == 1
+        assert out[at + 8] == ["Hot index is off for 't'"]
+
+    def test_hash_index_probes_and_is_kept_current_by_writes(self):
+        out = self.run_sql(self.table("t", "id INT, name STRING(16), score INT") +
+                           self.shuffled_rows(200, 44) + [
+            "create index t_score on t (score) using hash include (name)",
+            "show indexes from t",
+        ])
+        assert any("t_score" in line and "HASH" in line for line in out[-1])
+        path = os.path.join(self.dir, "Database", "test", "Tables", "t_t_score.idx")
+        created_size = os.path.getsize(path)
+
+        # Enough new entries that buckets split while the index is open
+        names = {i: ("n%d" % i, i * 37 % 101) for i in range(1, 201)}
+        writes = ["insert into t values (%d, 'm%d', %d)" % (i, i, i % 13)
+                  for i in range(201, 451)]
+        names.update((i, ("m%d" % i, i % 13)) for i in range(201, 451))
+        writes += ["update t set score = 7 where id < 20",
+                   "update t set name = 'renamed' where id = 7",
+                   "delete from t where id > 400"]
+        names.update((i, (names[i][0], 7)) for i in range(1, 20))
+        names[7] = ("renamed", 7)
+        for i in range(401, 451):
+            del names[i]
+        self.run_sql(["use table t"] + writes)
+        assert os.path.getsize(path) > created_size
+
+        scores = (7, 12, 50, 102)
+        out = self.run_sql(["use table t"] + [
+            "select id, name from t where score = %d" % score for score in scores
+        ] + ["explain select id, name from t where score = 7"])
+        for score, output in zip(scores, out[1:5]):
+            expected = sorted((str(i), name) for i, (name, s) in names.items()
+                              if s == score)
+            assert sorted(self.rows(output)) == expected
+        assert out[5][1].startswith(
+            "  Index-only probe on t using hash index t_score (score = 7)")
+
+    def test_bitmap_indexes_combine_conditions_and_are_kept_current_by_writes(self):
+        rows = {i: ("abc"[i % 3], i % 2 == 0) for i in range(1, 301)}
+        out = self.run_sql(
+            self.table("t", "id INT, grade STRING(4), active BOOLEAN") +
+            ["insert into t values (%d, '%s', %s)" % (i, grade, str(active).lower())
+             for i, (grade, active) in rows.items()] + [
+                "create index t_grade on t (grade) using bitmap",
+                "create index t_active on t (active) using bitmap",
+                "update t set grade = 'd' where id < 30",
+                "delete from t where id > 280",
+                "insert into t values (500, 'D', true)",
+                "select count(*) from t where grade = 'd' or (grade = 'a' and active != true)",
+                "explain select id from t where grade = 'd' or (grade = 'a' and active != true)",
+            ])
+        rows.update((i, ("d", rows[i][1])) for i in range(1, 30))
+        for i in range(281, 301):
+            del rows[i]
+        rows[500] = ("d", True)
+
+        def expected():
+            return sum(1 for grade, active in rows.values()
+                       if grade == "d" or (grade == "a" and not active))
+        assert self.rows(out[-2]) == [(str(expected()),)]
+        assert out[-1][1].startswith(
+            "  Bitmap index scan on t (grade = d OR grade = a AND active != true)")
+
+        # The bitmaps are saved when their handles close: on .exit here, and
+        # when the table cache needs the room in the next session
+        commands = ["use table t", "update t set active = false where grade = 'b'"]
+        for k in range(16):
+            commands += self.table("other%d" % k, "id INT") + [
+                "insert into other%d values (1)" % k]
+        commands += ["use table t",
+                     "select id from t where grade = 'b' and active = true",
+                     "select count(*) from t where grade = 'd' or (grade = 'a' and active != true)",
+                     ".tablecache"]
+        out = self.run_sql(commands)
+        rows.update((i, ("b", False)) for i, (grade, _) in rows.items() if grade == "b")
+        assert self.rows(out[-3]) == []
+        assert self.rows(out[-2]) == [(str(expected()),)]
+        assert re.match(r"Hits: \d+, misses: \d+, closed for room: [1-9]", out[-1][-1])
+
+        out = self.run_sql(["use table t",
+                            "select count(*) from t where active = false and grade != 'c'"])
+        assert self.rows(out[1]) == [(str(sum(
+            1 for grade, active in rows.values() if not active and grade != "c")),)]
+
+    def test_covering_index_answers_from_its_entries_after_writes(self):
+        rows = {i: ("n%d" % i, i % 5, float(i % 7)) for i in range(1, 121)}
+        out = self.run_sql(
+            self.table("t", "id INT, name STRING(16), year INT, gpa FLOAT") +
+            ["insert into t values (%d, '%s', %d, %.1f)" % ((i,) + row)
+             for i, row in rows.items()] + [
+                "create index t_year on t (year) include (name, gpa)",
+                "insert into t values (500, 'late', 2, 9.5)",
+                "update t set gpa = 8.0 where id = 7",
+                "update t set year = 2, name = 'moved' where id = 11",
+                "update t set year = 4 where id = 12",
+                "delete from t where id > 100 and id < 120",
+                "select name, gpa from t where year = 2 order by gpa desc, name",
+                "explain select name, gpa from t where year = 2",
+                "explain select name, gpa, id from t where year = 2",
+                "explain select * from t where year = 2",
+            ])
+        rows[500] = ("late", 2, 9.5)
+        rows[7] = ("n7", 2, 8.0)
+        rows[11] = ("moved", 2, rows[11][2])
+        rows[12] = ("n12", 4, rows[12][2])
+        for i in range(101, 120):
+            del rows[i]
+        expected = sorted(((name, "%.2f" % gpa) for name, year, gpa in rows.values()
+                           if year == 2), key=lambda r: (-float(r[1]), r[0]))
+        assert self.rows(out[-4]) == expected
+        assert out[-3][1].startswith("  Index-only probe on t using t_year (year = 2)")
+        # The primary key is in every entry too
+        assert out[-2][1].startswith("  Index-only probe on t using t_year (year = 2)")
+        # Columns outside the index go back to the table
+        assert out[-1][1].startswith(
+            "  Secondary index probe on t using t_year (year = 2)")
+
+    def test_online_index_build_keeps_up_with_writes_made_meanwhile(self):
+        scores = {i: i % 13 for i in range(1, 451)}
+        commands = self.table("t", "id INT, name STRING(16), score INT") + [
+            "insert into t values (%d, 'n%d', %d)" % (i, i, s) for i, s in scores.items()
+        ] + [".hotindex on", "create index t_score on t (score) online"]
+        names = {i: "n%d" % i for i in scores}
+        lookups = {}
+        for k in range(1, 31):
+            commands += ["update t set score = 5 where id = %d" % (k * 7),
+                         "delete from t where id = %d" % (k * 11),
+                         "insert into t values (%d, 'm%d', 5)" % (1000 + k, k),
+                         # A point lookup through the hot index while the
+                         # builder scans the same table
+                         "select name from t where id = %d" % (k * 13)]
+            if k * 7 in scores:
+                scores[k * 7] = 5
+            scores.pop(k * 11, None)
+            scores[1000 + k] = 5
+            lookups[len(commands) - 1] = (
+                [(names[k * 13],)] if k * 13 in scores else [])
+        out = self.run_sql(commands)
+        for at, expected in lookups.items():
+            assert self.rows(out[at]) == expected
+
+        # .exit waited for the build; the next session finds it published
+        out = self.run_sql(["use table t", "show indexes from t",
+                            "select id from t where score = 5",
+                            "explain select id from t where score = 5"])
+        assert any("t_score" in line and "BTREE" in line for line in out[1])
+        assert sorted(int(row[0]) for row in self.rows(out[2])) == sorted(
+            i for i, s in scores.items() if s == 5)
+        assert out[3][1].startswith("  Index-only probe on t using t_score (score = 5)")
+
+    def test_online_index_build_shares_the_table_with_selects(self):
+        self.run_sql(self.table("t", "id INT, name STRING(16), score INT") + [
+            "insert into t values (%d, 'n%d', %d)" % (i, i, i % 13)
+            for i in range(1, 451)])
+
+        # A new session: the table's leaves are read from disk by the
+        # builder and by these scans at the same time
+        commands = ["use table t", "create index t_score on t (score) online"]
+        expected = {}
+        for k in range(1, 31):
+            commands += ["select id from t where name = 'n%d'" % (k * 15),
+                         "select name from t where id = %d" % (k * 13 + 60)]
+            expected[len(commands) - 2] = [(str(k * 15),)]
+            expected[len(commands) - 1] = [("n%d" % (k * 13 + 60),)]
+        commands.append("select id from t where score = 12")
+        out = self.run_sql(commands)
+        for at, rows in expected.items():
+            assert self.rows(out[at]) == rows
+        assert sorted(int(row[0]) for row in self.rows(out[-1])) == [
+            i for i in range(1, 451) if i % 13 == 12]
+
+        out = self.run_sql(["use table t", "select id from t where score = 12",
+                            "explain select id from t where score = 12"])
+        assert sorted(int(row[0]) for row in self.rows(out[1])) == [
+            i for i in range(1, 451) if i % 13 == 12]
+        assert out[2][1].startswith("  Index-only probe on t using t_score (score = 12)")
+
+    def test_partial_index_holds_only_rows_meeting_its_condition(self):
+        orders = {i: (i % 9, "open" if i % 4 == 0 else "done") for i in range(1, 201)}
+        out = self.run_sql(
+            self.table("t", "id INT, cust INT, status STRING(8)") +
+            ["insert into t values (%d, %d, '%s')" % ((i,) + row)
+             for i, row in orders.items()] + [
+                "create index t_open on t (cust) where status = 'open'",
+                "create index t_bad on t (cust) where nope = 1",
+                # Into the condition, out of it, and moved within it
+                "update t set status = 'open' where id = 3",
+                "update t set status = 'done' where id = 12",
+                "update t set cust = 3 where id = 16",
+                "insert into t values (500, 3, 'open')",
+                "insert into t values (501, 3, 'done')",
+                "delete from t where id = 24",
+                "select id from t where cust = 3 and status = 'open'",
+                "explain select id from t where cust = 3 and status = 'open'",
+                "explain select id from t where cust = 3",
+                "explain select id from t where cust = 3 and status = 'done'",
+            ])
+        assert out[-11] == ["Error: Invalid index condition: "
+                            "Column 'nope' not found in table.",
+                            "Unrecognized statement at "
+                            "'create index t_bad on t (cust) where nope = 1'."]
+        orders[3] = (orders[3][0], "open")
+        orders[12] = (orders[12][0], "done")
+        orders[16] = (3, orders[16][1])
+        orders[500] = (3, "open")
+        orders[501] = (3, "done")
+        del orders[24]
+        open_for_3 = sorted(i for i, (cust, status) in orders.items()
+                            if cust == 3 and status == "open")
+        assert sorted(int(row[0]) for row in self.rows(out[-4])) == open_for_3
+        assert out[-3][1].startswith("  Secondary index probe on t using t_open (cust = 3)")
+        # The index misses the rows outside its condition
+        assert out[-2][1].startswith("  Full table scan on t")
+        assert out[-1][1].startswith("  Full table scan on t")
+
+        # A condition that no longer compiles is reported once, and the
+        # index is neither kept current nor planned
+        catalog = os.path.join(self.dir, "Database", "test", "test.catalog")
+        with open(catalog, "rb") as f:
+            data = f.read()
+        with open(catalog, "wb") as f:
+            f.write(data.replace(b"status = 'open'", b"stotus = 'open'"))
+        out = self.run_sql(["use table t", "insert into t values (502, 3, 'open')",
+                            "select id from t where cust = 3 and status = 'open'",
+                            "explain select id from t where cust = 3 and status = 'open'"])
+        assert out[0][0] == ("Error: Condition of index 't_open' no longer compiles: "
+                             "Column 'stotus' not found in table. The index is not used.")
+        assert sum(line.startswith("Error:") for lines in out for line in lines) == 1
+        assert sorted(int(row[0]) for row in self.rows(out[2])) == open_for_3 + [502]
+        assert out[3][1].startswith("  Full table scan on t")
+
+    def test_expression_indexes_match_the_same_expression_in_queries(self):
+        day = 19783 * 86400  # 2024-03-01
+        users = {i: ("User%d@Mail.org" % (i % 40) if i % 2 else "u%d@mail.org" % (i % 40),
+                     day + (i % 6) * 86400 + (i * 3607) % 86400, (i % 50) / 10.0)
+                 for i in range(1, 151)}
+        commands = self.table(
+            "t", "id INT, email STRING(24), created TIMESTAMP, score FLOAT") + [
+            "insert into t values (%d, '%s', %d, %.1f)" % ((i,) + row)
+            for i, row in users.items()] + [
+                "create index t_mail on t (lower(email)) using hash",
+                "create index t_day on t (date(created))",
+                "create index t_pre on t (substr(email, 1, 5))",
+                "create index t_int on t (cast(score AS INT))",
+                "create index t_bad on t (lower(score))",
+                "insert into t values (500, 'USER7@MAIL.ORG', '2024-03-03 23:59:59', 3.9)",
+                "update t set email = 'moved@mail.org', score = 0.5 where id = 7",
+                "update t set created = %d where id = 8" % (day + 5 * 86400),
+                "delete from t where id = 47",
+            ]
+        users[500] = ("USER7@MAIL.ORG", day + 2 * 86400 + 86399, 3.9)
+        users[7] = ("moved@mail.org", users[7][1], 0.5)
+        users[8] = (users[8][0], day + 5 * 86400, users[8][2])
+        del users[47]
+        queries = [
+            ("lower(email) = 'user7@mail.org'", "hash index t_mail",
+             lambda email, created, score: email.lower() == "user7@mail.org"),
+            ("date(created) = 19785", "t_day",
+             lambda email, created, score: created // 86400 == 19785),
+            ("substr(email, 1, 5) = 'user1'", "t_pre",
+             lambda email, created, score: email[:5].lower() == "user1"),
+            ("cast(score AS INT) = 3", "t_int",
+             lambda email, created, score: int(score) == 3),
+        ]
+        for where, _, _ in queries:
+            commands += ["select id from t where " + where,
+                         "explain select id from t where " + where]
+        out = self.run_sql(commands)
+        assert out[commands.index("create index t_bad on t (lower(score))")] == [
+            "Error: Cannot index lower(score): the function does not apply "
+            "to the column's type.",
+            "Unrecognized statement at 'create index t_bad on t (lower(score))'."]
+        for n, (where, index, holds) in enumerate(queries):
+            result, plan = out[len(out) - 2 * len(queries) + 2 * n:][:2]
+            assert sorted(int(row[0]) for row in self.rows(result)) == sorted(
+                i for i, row in users.items() if holds(*row)), where
+            assert plan[1].startswith("  Secondary index probe on t using " + index), where
+
+    def test_fulltext_index_matches_words_and_is_kept_current_by_writes(self):
+        rng = random.Random(50)
+        vocabulary = ["disk", "cache", "buffer", "page", "Tree", "latch", "row%d" % 1]
+        posts = {i: " ".join(rng.choice(vocabulary) + rng.choice(["", ",", "-x"])
+                             for _ in range(rng.randint(1, 8)))
+                 for i in range(1, 151)}
+        commands = self.table("t", "id INT, tag INT, body STRING(120)") + [
+            "insert into t values (%d, %d, '%s')" % (i, i % 3, body)
+            for i, body in posts.items()] + [
+                "create index t_body on t (body) using fulltext",
+                "insert into t values (500, 0, 'quokka Quokka quokka')",
+                "insert into t values (501, 0, 'a quokka among many other words here')",
+                "update t set body = 'cache zebra' where id = 7",
+                "update t set tag = 2 where id = 8",
+                "delete from t where id = 9 or id = 10",
+            ]
+        posts.update({500: "quokka Quokka quokka",
+                      501: "a quokka among many other words here", 7: "cache zebra"})
+        del posts[9], posts[10]
+
+        def words(body):
+            return set(re.findall(r"[a-z0-9]+", body.lower()))
+        queries = [
+            ("zebra", lambda w: "zebra" in w),
+            ("disk AND (cache OR buffer)",
+             lambda w: "disk" in w and ("cache" in w or "buffer" in w)),
+            ("latch tree", lambda w: "latch" in w and "tree" in w),
+            ("row1 OR x", lambda w: "row1" in w or "x" in w),
+        ]
+        reads = ["select id from t where body match '%s'" % match for match, _ in queries]
+        reads += ["select id from t where body match 'quokka' limit 1",
+                  "explain select id from t where body match 'quokka'"]
+        out = self.run_sql(commands + reads)
+        for (match, holds), result in zip(queries, out[-len(reads):]):
+            assert sorted(int(row[0]) for row in self.rows(result)) == sorted(
+                i for i, body in posts.items() if holds(words(body))), match
+        # Three times in a short row beats once in a long one
+        assert self.rows(out[-2]) == [("500",)]
+        assert out[-1][1].startswith(
+            "  Full-text index search on t using t_body (body MATCH 'quokka')")
+
+        # The changes were saved when the file closed
+        out = self.run_sql(["use table t"] + reads[:len(queries)])
+        for (match, holds), result in zip(queries, out[1:]):
+            assert sorted(int(row[0]) for row in self.rows(result)) == sorted(
+                i for i, body in posts.items() if holds(words(body))), match